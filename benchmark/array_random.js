@@ -0,0 +1,4 @@
+var a = [];
+for (var i=0;i<1000;i++) a.push(i);
+var s = 0, j = 0;
+for (var i=0;i<5000;i++) { j = (j*17+11)%1000; s += a[j]; }
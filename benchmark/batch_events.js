@@ -0,0 +1,24 @@
+// Time handling 100Hz-style sensor events one at a time vs with E.batchEvents
+// (the batched handler uses E.sum, as handlers for batches should use native functions on the arrays)
+var SAMPLES = 20000, PER_TICK = 500;
+
+function run(batch, done) {
+  var o = {}, sum = 0, sent = 0;
+  if (batch) {
+    E.batchEvents(o, "accel", {count:25});
+    o.on("accel", function(a) { sum += E.sum(a.x); });
+  } else {
+    o.on("accel", function(a) { sum += a.x; });
+  }
+  var t = getTime();
+  function tick() {
+    for (var i=0;i<PER_TICK;i++,sent++) o.emit("accel", {x:sent, y:1, z:2});
+    if (sent < SAMPLES) setTimeout(tick, 0);
+    else setTimeout(function() {
+      print(batch ? "batched  " : "unbatched", ((getTime()-t)*1000).toFixed(0), "ms", sum);
+      done();
+    }, 0);
+  }
+  tick();
+}
+run(false, function() { run(true, function() {}); });
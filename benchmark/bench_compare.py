@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+
+# This file is part of Espruino, a JavaScript interpreter for Microcontrollers
+#
+# Copyright (C) 2013 Gordon Williams <gw@pur3.co.uk>
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# ----------------------------------------------------------------------------------------
+# Compare the JSON output of two './espruino --bench' runs (eg. before and after a
+# change) and flag any benchmark that got slower or used more memory.
+#
+#   ./espruino --bench > before.json
+#   (make changes, rebuild)
+#   ./espruino --bench > after.json
+#   benchmark/bench_compare.py before.json after.json
+#
+# Exits with 1 if anything regressed by more than the threshold, so it can be used in CI
+# ----------------------------------------------------------------------------------------
+
+import sys
+import json
+import argparse
+
+# Counts should be the same every run, so any change is real. Time is noisy, so
+# we compare the fastest run and allow more slack.
+COUNTERS = ["allocs", "locks", "gcRuns", "peakVars"]
+
+def load(filename):
+  with open(filename) as f:
+    results = json.load(f)
+  return { b["name"] : b for b in results["benchmarks"] }
+
+def change(old, new):
+  if old == new: return 0
+  if not old: return float("inf")
+  return (new - old) * 100.0 / old
+
+parser = argparse.ArgumentParser(description="Compare two sets of './espruino --bench' results")
+parser.add_argument("before", help="JSON results from the old build")
+parser.add_argument("after", help="JSON results from the new build")
+parser.add_argument("--time", type=float, default=10, help="%% increase in time that counts as a regression (default 10)")
+parser.add_argument("--count", type=float, default=1, help="%% increase in a counter that counts as a regression (default 1)")
+args = parser.parse_args()
+
+before = load(args.before)
+after = load(args.after)
+regressions = []
+
+print("%-24s %-10s %12s %12s %8s" % ("benchmark", "", "before", "after", "change"))
+for name in sorted(set(before) | set(after)):
+  if name not in after:
+    print("%-24s removed" % name)
+    continue
+  if name not in before:
+    print("%-24s new" % name)
+    continue
+  b = before[name]
+  a = after[name]
+  if not a["ok"]:
+    print("%-24s FAILED%s" % (name, " (crashed)" if a.get("crashed") else ""))
+    if b["ok"]:
+      regressions.append(name + " failed")
+    continue
+  if not b["ok"]:
+    print("%-24s fixed" % name)
+    continue
+  rows = [("timeMin", args.time)] + [(c, args.count) for c in COUNTERS if c in a and c in b]
+  for key, threshold in rows:
+    pc = change(b[key], a[key])
+    flag = ""
+    if pc > threshold:
+      flag = " <-- REGRESSION"
+      regressions.append("%s %s +%.1f%%" % (name, key, pc))
+    elif pc < -threshold:
+      flag = " (better)"
+    label = name if key == "timeMin" else ""
+    print("%-24s %-10s %12s %12s %+7.1f%%%s" % (label, key, b[key], a[key], pc, flag))
+
+if regressions:
+  print("")
+  print("%d regression(s):" % len(regressions))
+  for r in regressions:
+    print("  " + r)
+  sys.exit(1)
+print("")
+print("No regressions")
@@ -0,0 +1,14 @@
+// Defragment a heap where ArrayBuffers are interleaved with freed ones
+var keep = [], junk = [];
+for (var i=0;i<3000;i++) {
+  keep.push({ n : i, a : new Uint8Array(30) });
+  junk.push(new Uint8Array(60), { x : i });
+}
+setTimeout(function() {
+  junk = undefined;
+  process.memory(); // GC
+  var t = getTime();
+  E.defrag();
+  print("defrag", ((getTime()-t)*1000).toFixed(1), "ms");
+  E.dumpFragmentation();
+}, 10);
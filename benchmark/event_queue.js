@@ -0,0 +1,18 @@
+// Time dispatching queued events (obj.emit), and how many variables a burst of them uses while queued
+var o = {}, n = 0;
+o.on("data", function(a, b) { n++; });
+
+var m0 = process.memory(false).usage;
+for (var i=0;i<32;i++) o.emit("data", i, "x");
+print("vars used by 32 queued events:", process.memory(false).usage - m0);
+
+var BURSTS = 1000;
+var bursts = 0, t = getTime();
+function burst() {
+  for (var i=0;i<32;i++) o.emit("data", i, "x");
+  if (++bursts < BURSTS) setTimeout(burst, 0);
+  else setTimeout(function() {
+    print(n-32, "events in", ((getTime()-t)*1000).toFixed(0), "ms");
+  }, 0);
+}
+setTimeout(burst, 0);
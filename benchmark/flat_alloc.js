@@ -0,0 +1,16 @@
+// Allocate ArrayBuffers when the free list is full of small gaps
+var keep = [], junk = [];
+for (var i=0;i<5000;i++) {
+  keep.push({ n : i });
+  junk.push({ x : i }, "junk"+i);
+}
+setTimeout(function() {
+  junk = undefined;
+  process.memory(); // GC
+  var t = getTime(), bufs = [];
+  for (var j=0;j<5000;j++) {
+    bufs.push(new Uint8Array(64+(j&255)));
+    if (bufs.length>8) bufs.shift();
+  }
+  print("alloc", ((getTime()-t)*1000).toFixed(1), "ms");
+}, 10);
@@ -0,0 +1,21 @@
+// Worst-case pause while making cyclic garbage with a big live heap.
+// Set SLICE=0 to compare against stopping for a full GC (ESPR_GC_INCREMENTAL builds only)
+var SLICE = 2;
+if (E.getFlags().gcSliceTime!==undefined) E.setFlags({gcSliceTime:SLICE});
+var live = [];
+for (var i=0;i<20000;i++) live[i%200] = { a : i, b : "item "+i, c : [i,i+1], next : live[i%200] };
+function mk() { var a={}, b={a:a}; a.b=b; } // only the GC can free this
+var worstGap = 0, worstFrame = 0, frames = 0, last = getTime();
+var iv = setInterval(function() {
+  var t = getTime();
+  worstGap = Math.max(worstGap, t-last);
+  for (var i=0;i<100;i++) mk();
+  live[frames%200].a++;
+  frames++;
+  last = getTime();
+  worstFrame = Math.max(worstFrame, last-t);
+}, 5);
+setTimeout(function() {
+  clearInterval(iv);
+  print("frames", frames, "worst frame", (worstFrame*1000).toFixed(2), "ms", "worst gap", (worstGap*1000).toFixed(2), "ms");
+}, 3000);
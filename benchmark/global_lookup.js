@@ -0,0 +1,3 @@
+for (var i=0;i<600;i++) global["g"+i] = i;
+var s = 0;
+for (var j=0;j<5000;j++) s += g599 + g300 + Math.abs(j);
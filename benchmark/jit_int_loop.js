@@ -0,0 +1,13 @@
+// Integer loop with local variables - with the JIT these stay as native ints
+function f() {
+  "jit";
+  var s = 0;
+  for (var i=0;i<100000;i++) {
+    if (i&1) s += i>>2;
+    else s -= 3;
+  }
+  return s;
+}
+var t = getTime();
+f();
+print(f(), (getTime()-t)*1000, "ms");
@@ -0,0 +1,26 @@
+// Time JSON.parse and Storage.readJSON of a ~6kB settings-style file
+var settings = { ble:true, blerepl:true, log:false, timeout:10, vibrate:true, beep:"vib",
+  quiet:0, clock:"anton.app.js", "12hour":false, firstDayOfWeek:1, brightness:0.8,
+  options:{ wakeOnBTN1:true, wakeOnTouch:false, twistThreshold:819.2, btnLoadTimeout:700 },
+  apps:[] };
+for (var i=0;i<40;i++) settings.apps.push({ id:"app"+i, name:"Application number "+i,
+  version:"0."+i, files:"app"+i+".info,app"+i+".app.js,app"+i+".img", tags:"tool,clock",
+  size:[i*100, i*7.5], enabled:!(i&1) });
+var json = JSON.stringify(settings, null, 1);
+print("JSON length", json.length);
+
+var t = getTime();
+for (var j=0;j<20;j++) JSON.parse(json);
+print("JSON.parse x20", ((getTime()-t)*1000).toFixed(1), "ms");
+
+var flat = E.toString(json);
+t = getTime();
+for (var j=0;j<20;j++) JSON.parse(flat);
+print("JSON.parse flat x20", ((getTime()-t)*1000).toFixed(1), "ms");
+
+var s = require("Storage");
+s.write("settings.json", json);
+t = getTime();
+for (var j=0;j<20;j++) s.readJSON("settings.json");
+print("Storage.readJSON x20", ((getTime()-t)*1000).toFixed(1), "ms");
+s.erase("settings.json");
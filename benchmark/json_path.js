@@ -0,0 +1,22 @@
+// Time reading one value from a big JSON file in Storage with readJSON(file, path), against reading it all
+var apps = [];
+for (var i=0;i<200;i++) apps.push({ id:"app"+i, name:"Application number "+i, version:"0."+i,
+  files:"app"+i+".info,app"+i+".app.js,app"+i+".img", tags:"tool,clock", size:[i*100, i*7.5] });
+var s = require("Storage");
+s.write("apps.json", JSON.stringify({apps:apps})); // not writeJSON, as on Linux that makes a journal, which is read into RAM
+apps = undefined;
+print("File length", s.read("apps.json").length);
+
+var base = process.memory().usage;
+var t = getTime(), v;
+for (var j=0;j<10;j++) v = s.readJSON("apps.json").apps[150].name;
+print("readJSON(file).apps[150].name x10", ((getTime()-t)*1000).toFixed(1), "ms");
+v = s.readJSON("apps.json");
+print("Vars used reading it all", process.memory().usage - base);
+v = undefined;
+
+t = getTime();
+for (var j=0;j<10;j++) v = s.readJSON("apps.json", ["apps",150,"name"]);
+print("readJSON(file, ['apps',150,'name']) x10", ((getTime()-t)*1000).toFixed(1), "ms");
+print("Vars used by path", process.memory().usage - base);
+s.erase("apps.json");
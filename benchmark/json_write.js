@@ -0,0 +1,30 @@
+// Time writing a ~120kB state dump to Storage, and to a stream
+var state = [];
+var desc = "A description that's shared between all the entries, so the JSON is much bigger than the data";
+for (var i=0;i<800;i++) state.push({ id:i, t:1700000000+i*60, desc:desc, v:[i, i/4] });
+var s = require("Storage");
+s.eraseAll();
+print("Memory used by data", process.memory().usage);
+
+var t = getTime();
+s.writeJSON("state.json", state);
+print("Storage.writeJSON", ((getTime()-t)*1000).toFixed(1), "ms, length", s.read("state.json").length);
+t = getTime();
+s.writeJSON("state.json", state); // unchanged
+print("Storage.writeJSON unchanged", ((getTime()-t)*1000).toFixed(1), "ms");
+
+function writeJSON(out) {
+  if (E.writeJSON) E.writeJSON(out, state);
+  else out.write(JSON.stringify(state));
+}
+var len = 0;
+t = getTime();
+writeJSON({ write : function(d) { len += d.length; } });
+print("Write JSON to a stream", ((getTime()-t)*1000).toFixed(1), "ms, length", len);
+// Extra memory used while the JSON is written (process.memory is slow, so only check every few chunks)
+var base = process.memory(false).usage, peak = 0, chunks = 0;
+writeJSON({ write : function(d) {
+  if (!(chunks++ & 31)) peak = Math.max(peak, process.memory(false).usage - base);
+} });
+print("Peak extra vars used writing JSON to a stream", peak);
+s.eraseAll();
@@ -0,0 +1,5 @@
+function P() {}
+P.prototype.get = function() { return 1; };
+var p = new P();
+var s = 0;
+for (var j=0;j<20000;j++) s += Math.sin(j) + p.get();
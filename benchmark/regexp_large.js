@@ -0,0 +1,28 @@
+// Time RegExp replace/split/match on a ~10kB string, and Storage.list(regex)
+var str = "";
+for (var i=0;i<1000;i++) str += "item"+i+"=" + (i*7) + ";";
+
+var t = getTime();
+for (var j=0;j<5;j++) str.replace(/\d+/g, "#");
+print("replace x5", ((getTime()-t)*1000).toFixed(1), "ms");
+
+t = getTime();
+for (var j=0;j<5;j++) str.split(/;/);
+print("split x5", ((getTime()-t)*1000).toFixed(1), "ms");
+
+t = getTime();
+for (var j=0;j<5;j++) str.match(/item99\d=(\d+)/);
+print("match x5", ((getTime()-t)*1000).toFixed(1), "ms");
+
+t = getTime();
+var re = /missing=\d+/;
+for (var j=0;j<20;j++) re.test(str);
+print("no match x20", ((getTime()-t)*1000).toFixed(1), "ms");
+
+var s = require("Storage");
+s.eraseAll();
+for (var i=0;i<100;i++) s.write((i&1 ? "app" : "data")+i+".json", "{}");
+t = getTime();
+for (var j=0;j<20;j++) s.list(/^app.*\.json$/);
+print("Storage.list x20", ((getTime()-t)*1000).toFixed(1), "ms");
+s.eraseAll();
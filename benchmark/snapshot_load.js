@@ -0,0 +1,36 @@
+// Time save() and load() of the variable image, compressed vs uncompressed snapshot
+// Needs an ESPR_VARIMAGE_SNAPSHOT build. Progress is kept in Storage as load() replaces all variables
+var S = require("Storage");
+var data = [];
+for (var i=0;i<500;i++) data.push({ n : i, s : "item"+i });
+
+function onInit() {
+  var st = S.readJSON("snapbench.json",1);
+  if (!st) return;
+  var t = getTime() - st.t;
+  if (st.stage=="save") {
+    st.stage = "load";
+    st.save = t;
+    setTimeout(function() {
+      st.t = getTime();
+      S.writeJSON("snapbench.json", st);
+      load();
+    }, 1);
+  } else {
+    print(st.compress ? "compressed" : "snapshot  ",
+          "save", (st.save*1000).toFixed(1), "ms,",
+          "load", (t*1000).toFixed(1), "ms");
+    if (st.compress) {
+      S.erase("snapbench.json");
+      E.setFlags({compressSave:0});
+    } else setTimeout(next, 1, true);
+  }
+}
+
+function next(compress) {
+  E.setFlags({compressSave:compress});
+  S.writeJSON("snapbench.json", { stage : "save", compress : compress, t : getTime() });
+  save();
+}
+
+setTimeout(function() { next(false); }, 10);
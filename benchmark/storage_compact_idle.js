@@ -0,0 +1,42 @@
+// How long does Storage freeze for when it has to be compacted?
+// Fills Storage, erases 3/4 of it, then writes a file that needs the space:
+// - straight away (so compaction has to happen inside the write)
+// - after idling (on ESPR_STORAGE_COMPACT_IDLE builds), timing the longest gap between 20ms timer ticks
+var s = require("Storage");
+var data = "";
+for (var i=0;i<100;i++) data += "0123456789";
+var big = "";
+while (big.length<60000) big += data;
+
+function fill() {
+  s.eraseAll();
+  for (var i=0;s.getStats().freeBytes>2000;i++) s.write("f"+i, data);
+  for (var j=0;j<i;j++) if (j%4) s.erase("f"+j);
+}
+function writeBig() {
+  var t = getTime();
+  s.write("big", big);
+  return ((getTime()-t)*1000).toFixed(1);
+}
+
+fill();
+print("write needing compaction:", writeBig(), "ms");
+if (E.getFlags().compactSliceTime===undefined) {
+  s.eraseAll();
+} else {
+  fill();
+  var last = getTime(), start = last, maxGap = 0, ticks = 0;
+  var iv = setInterval(function() {
+    var t = getTime();
+    if (t-last > maxGap) maxGap = t-last;
+    last = t;
+    if (++ticks % 5) return; // getStats scans Storage, so don't do it every time
+    var st = s.getStats();
+    if (st.trashBytes < st.freeBytes) {
+      clearInterval(iv);
+      print("compacted when idle in", ((t-start)*1000).toFixed(0), "ms, longest gap between 20ms ticks", (maxGap*1000).toFixed(1), "ms");
+      print("write after idle compaction:", writeBig(), "ms");
+      s.eraseAll();
+    }
+  }, 20);
+}
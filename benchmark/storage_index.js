@@ -0,0 +1,19 @@
+// Time reading and listing files on a Storage with 200 files
+var s = require("Storage");
+s.eraseAll();
+for (var i=0;i<200;i++) s.write("file"+i+".json", '{"n":'+i+'}');
+
+var t = getTime();
+for (var j=0;j<10;j++)
+  for (var i=0;i<200;i++) s.read("file"+i+".json");
+print("read x2000", ((getTime()-t)*1000).toFixed(1), "ms");
+
+t = getTime();
+for (var i=0;i<2000;i++) s.read("missing.json");
+print("missing x2000", ((getTime()-t)*1000).toFixed(1), "ms");
+
+t = getTime();
+for (var i=0;i<100;i++) s.list();
+print("list x100", ((getTime()-t)*1000).toFixed(1), "ms");
+
+s.eraseAll();
@@ -0,0 +1,26 @@
+// Update one field of a settings file 1000 times with Storage.writeJSON
+// Prints the time taken, flash used by the writes and how many times Storage had to be compacted
+var s = require("Storage");
+s.eraseAll();
+var settings = { ble:true, blerepl:true, log:false, timeout:10, vibrate:true, beep:"vib",
+                 timezone:0, HID:false, clock:"anaclock.app.js", "12hour":false, brightness:1,
+                 options:{wakeOnBTN1:true, wakeOnBTN2:true, wakeOnBTN3:true, wakeOnFaceUp:false,
+                          wakeOnTouch:false, wakeOnTwist:true, twistThreshold:819.2, twistMaxY:-800,
+                          twistTimeout:1000 }, widgets:["bat","bluetooth","messages","clkinfo"] };
+s.writeJSON("setting.json", settings);
+function used() { var st = s.getStats(); return st.fileBytes + st.trashBytes; }
+var written = 0, compactions = 0, last = used();
+var t = getTime();
+for (var i=0;i<1000;i++) {
+  settings.timeout = i;
+  s.writeJSON("setting.json", settings);
+  var u = used();
+  if (u<last) compactions++;
+  else written += u-last;
+  last = u;
+}
+t = getTime()-t;
+if (s.readJSON("setting.json").timeout!=999) print("ERROR: wrong contents");
+print("1000 updates of", JSON.stringify(settings).length, "byte file:", (t*1000).toFixed(0), "ms,",
+      written, "bytes of flash used,", compactions, "compactions");
+s.eraseAll();
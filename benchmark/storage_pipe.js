@@ -0,0 +1,25 @@
+// Read a 40kB StorageFile in 64 byte chunks, keep it all in 256 byte chunks, and pipe it to a Serial device (LoopbackA)
+var s = require("Storage");
+s.eraseAll();
+var f = s.open("log","w");
+for (var i=0;i<1000;i++) f.write("line "+i+" of the log file...............\n");
+var len = 0, d;
+var r = s.open("log","r");
+var t = getTime();
+while ((d = r.read(64))!==undefined) len += d.length;
+print("read", len, "bytes in 64 byte chunks:", ((getTime()-t)*1000).toFixed(1), "ms");
+var chunks = [], used = process.memory().usage;
+r = s.open("log","r");
+while ((d = r.read(256))!==undefined) chunks.push(d);
+print("JsVars used to keep", chunks.length, "x 256 byte chunks:", process.memory().usage-used);
+chunks = undefined;
+var received = 0;
+LoopbackB.on('data', function(d) { received += d.length; });
+t = getTime();
+s.open("log","r").pipe(LoopbackA, {chunkSize:64, complete:function() {
+  print("pipe to LoopbackA:", ((getTime()-t)*1000).toFixed(1), "ms");
+  setTimeout(function() {
+    if (received!=len) print("ERROR: received", received);
+    s.eraseAll();
+  }, 100);
+}});
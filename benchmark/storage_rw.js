@@ -0,0 +1,17 @@
+// Raw Storage write/read/compact speed - on Linux this is mostly the cost of accessing the fake flash file
+var s = require("Storage");
+s.eraseAll();
+var data = "";
+for (var i=0;i<100;i++) data += "0123456789";
+var t = getTime();
+for (var i=0;i<100;i++) s.write("f"+i, data);
+print("write 100 x 1kB", ((getTime()-t)*1000).toFixed(1), "ms");
+t = getTime();
+var l = 0;
+for (var i=0;i<2000;i++) l += s.read("f"+(i%100)).length;
+print("read 2000 x 1kB", ((getTime()-t)*1000).toFixed(1), "ms");
+for (var i=0;i<100;i+=2) s.erase("f"+i);
+t = getTime();
+s.compact();
+print("compact", ((getTime()-t)*1000).toFixed(1), "ms");
+s.eraseAll();
@@ -0,0 +1,30 @@
+// Time building up big strings with +=, template literals and Array.join
+function time(name, fn) {
+  var t = getTime();
+  var s = fn();
+  print(name, s.length, "chars", ((getTime()-t)*1000).toFixed(1), "ms");
+}
+
+time("+= 'X' x20000", function() {
+  var s = "";
+  for (var i=0;i<20000;i++) s += "X";
+  return s;
+});
+time("+= line x4000", function() {
+  var s = "";
+  for (var i=0;i<4000;i++) s += "Hello World "+i+"\n";
+  return s;
+});
+var arr = [];
+for (var i=0;i<2000;i++) arr.push("item number "+i);
+time("join x10", function() {
+  var s;
+  for (var j=0;j<10;j++) s = arr.join(", ");
+  return s;
+});
+var long = "abcdefghij".repeat(50);
+time("template x2000", function() {
+  var s;
+  for (var j=0;j<2000;j++) s = `<div class="x">${long}</div><p>${j}</p>`;
+  return s;
+});
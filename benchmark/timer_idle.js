@@ -0,0 +1,10 @@
+// How fast can a chain of setTimeout(..,0) run when lots of other timers are waiting?
+var timers = [];
+for (var i=0;i<1000;i++) timers.push(setInterval(function(){}, 3600000+i));
+var n = 0, t = getTime();
+function tick() {
+  if (++n < 5000) return setTimeout(tick, 0);
+  print("tick", ((getTime()-t)*1000000/n).toFixed(1), "us");
+  timers.forEach(clearInterval);
+}
+setTimeout(tick, 0);
@@ -34,6 +34,19 @@ info = {
 #     'CFLAGS+=-m32', 'LDFLAGS+=-m32', 'DEFINES+=-DUSE_CALLFUNCTION_HACK', # For testing 32 bit builds
      'DEFINES+=-DESPR_UNICODE_SUPPORT=1',
      'DEFINES+=-DUSE_FONT_6X8 -DGRAPHICS_PALETTED_IMAGES -DGRAPHICS_ANTIALIAS -DESPR_PBF_FONTS',
+     'DEFINES+=-DESPR_OBJECT_INDEX', # Hash index for objects with lots of keys
+     'DEFINES+=-DESPR_INLINE_CACHE', # Cache prototype/built-in member lookups
+     'DEFINES+=-DESPR_GC_INCREMENTAL', # Garbage collect in small slices from idle
+     'DEFINES+=-DESPR_FREE_RUN_INDEX', # Index of free runs so flat strings don't search the free list
+     'DEFINES+=-DESPR_VARIMAGE_SNAPSHOT', # save() writes an uncompressed snapshot of variables that loads with a bulk copy
+     'DEFINES+=-DESPR_TIMER_HEAP', # Keep timers in a heap so idle doesn't update and scan every timer
+     'DEFINES+=-DESPR_EVENT_QUEUE', # Queue events in a fixed ring buffer rather than allocating a JS object for each
+     'DEFINES+=-DESPR_STORAGE_INDEX=512', # Keep an index of all Storage files in RAM so finding/listing files doesn't scan flash
+     'DEFINES+=-DESPR_STORAGE_JOURNAL', # Storage.writeJSON appends just what changed to a journal file
+     'DEFINES+=-DESPR_STORAGE_COMPACT_IDLE', # Compact Storage a few ms at a time when idle rather than all at once when full
+     'DEFINES+=-DESPR_JSVAR_STATS', # Count allocations, locks and GCs for --bench
+     'DEFINES+=-DESPR_PROFILE=1024', # E.profileStart/profileStop sampling profiler, counting samples at up to 1024 places in the code
+     'DEFINES+=-DESPR_STRING_TAIL_CACHE', # Remember where the last string appended to ends, so += doesn't walk the whole string
      'DEFINES+=-DSPIFLASH_BASE=0 -DSPIFLASH_LENGTH=FLASH_SAVED_CODE_LENGTH', # For Testing Flash Strings
      'LINUX=1',
    ]
@@ -4209,10 +4209,18 @@ bool jswrap_banglejs_idle() {
     if (bangleTasks & JSBT_ACCEL_INTERVAL_DEFAULT) jswrap_banglejs_setPollInterval_internal(DEFAULT_ACCEL_POLL_INTERVAL);
     if (bangleTasks & JSBT_ACCEL_INTERVAL_POWERSAVE) jswrap_banglejs_setPollInterval_internal(POWER_SAVE_ACCEL_POLL_INTERVAL);
     if (bangleTasks & JSBT_ACCEL_DATA) {
-      JsVar *o = jswrap_banglejs_getAccel();
-      if (o) {
-        jsiQueueObjectCallbacks(bangle, JS_EVENT_PREFIX"accel", &o, 1);
-        jsvUnLock(o);
+#ifndef SAVE_ON_FLASH
+      // If E.batchEvents is used, add straight to the batch without making an object
+      const char *names[] = {"x","y","z","mag","diff"};
+      JsVarFloat values[] = {acc.x/8192.0, acc.y/8192.0, acc.z/8192.0, sqrt(accMagSquared)/8192.0, accDiff/8192.0};
+      if (!jsiBatchEventsAddFloats(bangle, JS_EVENT_PREFIX"accel", names, values, 5))
+#endif
+      {
+        JsVar *o = jswrap_banglejs_getAccel();
+        if (o) {
+          jsiQueueObjectCallbacks(bangle, JS_EVENT_PREFIX"accel", &o, 1);
+          jsvUnLock(o);
+        }
       }
     }
     if (bangleTasks & JSBT_ACCEL_TAPPED) {
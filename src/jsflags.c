@@ -12,6 +12,9 @@
  * ----------------------------------------------------------------------------
  */
 #include "jsflags.h"
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+#include "jsflash.h"
+#endif
 
 volatile JsFlags jsFlags;
 const char *jsFlagNames = JSFLAG_NAMES;
@@ -41,6 +44,12 @@ JsVar *jsfGetFlags() {
    p += strlen(p)+1;
    flag<<=1;
  }
+#ifdef ESPR_GC_INCREMENTAL
+ jsvObjectSetChildAndUnLock(o, "gcSliceTime", jsvNewFromFloat(jsvGCSliceTime));
+#endif
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+ jsvObjectSetChildAndUnLock(o, "compactSliceTime", jsvNewFromFloat(jsfCompactSliceTime));
+#endif
  return o;
 }
 
@@ -55,4 +64,18 @@ void jsfSetFlags(JsVar *flags) {
     p += strlen(p)+1;
     flag<<=1;
   }
+#ifdef ESPR_GC_INCREMENTAL
+  JsVar *v = jsvObjectGetChildIfExists(flags, "gcSliceTime");
+  if (v) {
+    JsVarFloat t = jsvGetFloatAndUnLock(v);
+    jsvGCSliceTime = (t>0) ? t : 0; // 0 (or NaN) disables incremental GC
+  }
+#endif
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+  JsVar *ct = jsvObjectGetChildIfExists(flags, "compactSliceTime");
+  if (ct) {
+    JsVarFloat t = jsvGetFloatAndUnLock(ct);
+    jsfCompactSliceTime = (t>0) ? t : 0; // 0 (or NaN) disables compaction when idle
+  }
+#endif
 }
@@ -27,10 +27,13 @@ typedef enum {
 #ifdef ESPR_JIT
   JSF_JIT_DEBUG           = 1<<4, ///< When JIT enabled,
 #endif
+#ifdef ESPR_VARIMAGE_SNAPSHOT
+  JSF_COMPRESS_SAVE       = 1<<5, ///< When saving, write a compressed image of variables rather than an uncompressed snapshot
+#endif
 } PACKED_FLAGS JsFlags;
 
 
-#define JSFLAG_NAMES "deepSleep\0unsafeFlash\0unsyncFiles\0pretokenise\0jitDebug\0"
+#define JSFLAG_NAMES "deepSleep\0unsafeFlash\0unsyncFiles\0pretokenise\0jitDebug\0compressSave\0"
 // NOTE: \0 also added by compiler - two \0's are required!
 
 extern volatile JsFlags jsFlags;
@@ -17,6 +17,7 @@
 #include "jsinteractive.h"
 #include "jswrap_string.h" //jswrap_string_match
 #include "jswrap_espruino.h" //jswrap_espruino_CRC
+#include "jsflags.h"
 
 #define SAVED_CODE_BOOTCODE_RESET ".bootrst" // bootcode that runs even after reset
 #define SAVED_CODE_BOOTCODE ".bootcde" // bootcode that doesn't run after reset
@@ -57,6 +58,17 @@ uint32_t jsfFilenameTableBank1Addr = 0; // address of DATA in the table, NOT THE
 uint32_t jsfFilenameTableBank1Size = 0; // size of table in bytes
 #endif
 
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+#ifndef ESPR_STORAGE_COMPACT_SLICE_TIME
+#define ESPR_STORAGE_COMPACT_SLICE_TIME 5 ///< Default maximum time in milliseconds for each slice of compaction when idle
+#endif
+#define JSF_COMPACT_MARKER_FLAGS 0xFFu // flags in the erased file header that marks where paused compaction got to
+#define JSF_COMPACT_PAUSE_WASTE 4 // only pause compaction part way through a page if less than 1/this of it is left
+JsVarFloat jsfCompactSliceTime = ESPR_STORAGE_COMPACT_SLICE_TIME;
+static uint32_t jsfCompactResumeAddr = 0; ///< If compaction is paused, the address of the header marking where we got to
+static bool jsfCompactCheckIdle = false; ///< Set when files are erased, so we check whether to compact when idle
+#endif
+
 #if ESPR_USE_STORAGE_CACHE
 /* Filename lookups can take over 1ms per file even on a reasonably empty SPI Flash memory,
 so we can have a cache of the most used file *addresses* in RAM. The data is still in
@@ -129,6 +141,120 @@ static uint32_t jsfCacheFind(JsfFileName name, JsfFileHeader *header) { return J
 static void jsfCachePut(JsfFileHeader *header, uint32_t addr) { }
 #endif
 
+#ifdef ESPR_STORAGE_INDEX
+/* A RAM index of every file in Storage (the address and header), built by one scan of
+Storage the first time it's needed and then kept up to date as files are created,
+erased and moved by compaction. Finding a file is then a hash lookup and listing files
+doesn't have to walk flash at all.
+
+To use this, add '-DESPR_STORAGE_INDEX=512' or another power of 2 to the BOARD.py file. It
+uses 36 bytes of RAM per entry, and the index is only used while it's no more than 3/4 full
+- if there are more files than that we go back to scanning flash until Storage is compacted
+or erased.
+*/
+#if ESPR_STORAGE_INDEX & (ESPR_STORAGE_INDEX-1)
+#error ESPR_STORAGE_INDEX must be a power of 2
+#endif
+#define JSF_INDEX_MASK (ESPR_STORAGE_INDEX-1)
+#define JSF_INDEX_MAX_FILES (ESPR_STORAGE_INDEX*3/4)
+
+typedef enum {
+  JSFI_UNBUILT,  ///< We need to scan Storage before we can use the index
+  JSFI_VALID,    ///< The index contains every file in Storage
+  JSFI_OVERFLOW, ///< Too many files for the index - scan Storage instead
+} JsfIndexState;
+
+typedef struct {
+  uint32_t addr; ///< Address as returned by jsfFindFile, or 0 if the slot is empty
+  JsfFileHeader header; ///< The file header
+} JsfIndexEntry;
+
+static JsfIndexEntry jsfIndex[ESPR_STORAGE_INDEX]; // open addressing with linear probing
+static uint16_t jsfIndexCount = 0;
+static JsfIndexState jsfIndexState = JSFI_UNBUILT;
+
+static unsigned int jsfIndexHash(JsfFileName *name) {
+  uint32_t hash = 2166136261u; // FNV-1a
+  for (unsigned int i=0;i<sizeof(JsfFileName) && name->c[i];i++)
+    hash = (hash ^ (unsigned char)name->c[i]) * 16777619u;
+  return hash & JSF_INDEX_MASK;
+}
+
+/// Forget the index - it'll be rebuilt from Storage next time it's needed
+static void jsfIndexClear() {
+  jsfIndexState = JSFI_UNBUILT;
+}
+
+/// Add a file to the index (addr=address of data, NOT header)
+static void jsfIndexPut(uint32_t addr, JsfFileHeader *header) {
+  if (jsfIndexState!=JSFI_VALID) return;
+  if (jsfIndexCount >= JSF_INDEX_MAX_FILES) {
+    jsfIndexState = JSFI_OVERFLOW;
+    return;
+  }
+  unsigned int i = jsfIndexHash(&header->name);
+  while (jsfIndex[i].addr) i = (i+1)&JSF_INDEX_MASK;
+  jsfIndex[i].addr = addr;
+  jsfIndex[i].header = *header;
+  jsfIndexCount++;
+}
+
+/// Find the slot for the file with this name at this address, or -1
+static int jsfIndexFindSlot(JsfFileName *name, uint32_t addr) {
+  unsigned int i = jsfIndexHash(name);
+  while (jsfIndex[i].addr) {
+    if (jsfIndex[i].addr==addr && jsfIsNameEqual(jsfIndex[i].header.name, *name))
+      return (int)i;
+    i = (i+1)&JSF_INDEX_MASK;
+  }
+  return -1;
+}
+
+/// Remove a file from the index (addr=address of data, NOT header)
+static void jsfIndexRemove(uint32_t addr, JsfFileHeader *header) {
+  if (jsfIndexState!=JSFI_VALID) return;
+  int slot = jsfIndexFindSlot(&header->name, addr);
+  if (slot<0) return;
+  unsigned int i = (unsigned int)slot, j = i;
+  jsfIndex[i].addr = 0;
+  jsfIndexCount--;
+  /* Now move back any entries after this one that wouldn't be found any more
+  because they were pushed past the slot we just emptied */
+  while (jsfIndex[j = (j+1)&JSF_INDEX_MASK].addr) {
+    unsigned int k = jsfIndexHash(&jsfIndex[j].header.name);
+    if ((j>i) ? (i<k && k<=j) : (i<k || k<=j)) continue; // it's still reachable
+    jsfIndex[i] = jsfIndex[j];
+    jsfIndex[j].addr = 0;
+    i = j;
+  }
+}
+
+/// A file has been moved (by compaction) - update its address
+static void jsfIndexMove(JsfFileHeader *header, uint32_t oldAddr, uint32_t newAddr) {
+  if (jsfIndexState!=JSFI_VALID) return;
+  int slot = jsfIndexFindSlot(&header->name, oldAddr);
+  if (slot>=0) jsfIndex[slot].addr = newAddr;
+  else jsfIndexClear(); // shouldn't happen, but if we weren't tracking it properly just rebuild
+}
+
+/// Find the file with the lowest address in the given bank, return the address of data or 0
+static uint32_t jsfIndexFind(JsfFileName name, uint32_t bankAddress, uint32_t bankEndAddress, JsfFileHeader *returnedHeader) {
+  JsfIndexEntry *found = 0;
+  unsigned int i = jsfIndexHash(&name);
+  while (jsfIndex[i].addr) {
+    JsfIndexEntry *e = &jsfIndex[i];
+    if (e->addr>=bankAddress && e->addr<bankEndAddress &&
+        (!found || e->addr<found->addr) &&
+        jsfIsNameEqual(e->header.name, name))
+      found = e;
+    i = (i+1)&JSF_INDEX_MASK;
+  }
+  if (!found) return 0;
+  if (returnedHeader) *returnedHeader = found->header;
+  return found->addr;
+}
+#endif
+
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------ Flash Storage Functionality
@@ -139,6 +265,24 @@ static uint32_t jsfCreateFile(JsfFileName name, uint32_t size, JsfFileFlags flag
 #ifdef ESPR_STORAGE_FILENAME_TABLE
 static uint32_t jsfBankCreateFileTable(uint32_t startAddr);
 #endif
+#ifdef ESPR_STORAGE_INDEX
+static bool jsfIndexReady();
+#endif
+#ifdef ESPR_STORAGE_JOURNAL
+/* A journal file (JSFF_JOURNAL) is a list of these records, each one followed by its new data and
+padded to JSF_ALIGNMENT. Each record makes new contents from the start and end of the previous contents
+with the new data in between, so rewriting a file that has only changed a little writes very little to
+flash. The file ends at the first record that hasn't been written (all 0xFF). */
+typedef struct {
+  uint16_t keepStart; ///< Bytes to keep from the start of the previous contents
+  uint16_t keepEnd;   ///< Bytes to keep from the end of the previous contents
+  uint32_t length;    ///< Bytes of new data after this record
+} JsfJournalRecord;
+#define JSF_JOURNAL_SPACE 256 // bytes (plus half the file size) to leave free for changes when a journal is written
+#define JSF_JOURNAL_MAX_RECORDS 32 // after this many changes we write a new journal (so reading doesn't get slow)
+static JsVar *jsfJournalReplay(uint32_t addr, JsfFileHeader *header, uint32_t *length, uint32_t *endAddr, int *recordCount);
+static void jsfJournalCheckpointRead(JsVar *contents, uint32_t length, uint32_t offset, char *buf, uint32_t len);
+#endif
 
 /// Aligns a block, pushing it along in memory until it reaches the required alignment
 static uint32_t jsfAlignAddress(uint32_t addr) {
@@ -268,6 +412,12 @@ static bool jsfIsEqual(uint32_t addr, const unsigned char *data, uint32_t len) {
 bool jsfEraseAll() {
   jsDebug(DBG_INFO,"EraseAll\n");
   jsfCacheClear();
+#ifdef ESPR_STORAGE_INDEX
+  jsfIndexClear();
+#endif
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+  jsfCompactResumeAddr = 0;
+#endif
 #ifdef ESPR_STORAGE_FILENAME_TABLE
   jsfFilenameTableBank1Addr = 0;
   jsfFilenameTableBank1Size = 0;
@@ -281,14 +431,24 @@ bool jsfEraseAll() {
 /// When a file is found in memory, erase it (by setting first bytes of name to 0). addr=ptr to data, NOT header
 static void jsfEraseFileInternal(uint32_t addr, JsfFileHeader *header, bool createFilenameTable) {
   jsDebug(DBG_INFO,"EraseFile 0x%08x\n", addr);
+#ifdef ESPR_STORAGE_INDEX
+  jsfIndexRemove(addr, header);
+#endif
 
   addr -= (uint32_t)sizeof(JsfFileHeader);
   addr += (uint32_t)((char*)&header->name.firstChars - (char*)header);
   header->name.firstChars = 0;
   jshFlashWrite(&header->name.firstChars,addr,(uint32_t)sizeof(header->name.firstChars));
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+  jsfCompactCheckIdle = true;
+#endif
 
 #ifdef ESPR_STORAGE_FILENAME_TABLE
-  if (createFilenameTable && addr>=JSF_START_ADDRESS && addr<JSF_END_ADDRESS) { // if was erasing in Bank 1
+  if (createFilenameTable && addr>=JSF_START_ADDRESS && addr<JSF_END_ADDRESS // if was erasing in Bank 1
+#ifdef ESPR_STORAGE_INDEX
+      && jsfIndexState!=JSFI_VALID // no need for a table (or the scan to decide if we want one) if we have an index
+#endif
+      ) {
     // do a scan from the last FILENAME_TABLE to see how many files there are
     uint32_t scanAddr = 0;
     if (jsfFilenameTableBank1Addr)
@@ -391,6 +551,30 @@ static uint32_t jsfGetAddressOfNextStartPage(uint32_t addr) {
   return next;
 }
 
+#ifdef ESPR_STORAGE_INDEX
+static void jsfBankIndexBuild(uint32_t addr) {
+  JsfFileHeader header;
+  if (jsfGetFileHeader(addr, &header, true)) do {
+    if (header.name.firstChars != 0) // if not replaced
+      jsfIndexPut(addr+(uint32_t)sizeof(JsfFileHeader), &header);
+  } while (jsfIndexState==JSFI_VALID && jsfGetNextFileHeader(&addr, &header, GNFH_GET_ALL));
+}
+
+/// Build the index if needed, and return true if it can be used
+static bool jsfIndexReady() {
+  if (jsfIndexState==JSFI_UNBUILT) {
+    memset(jsfIndex, 0, sizeof(jsfIndex));
+    jsfIndexCount = 0;
+    jsfIndexState = JSFI_VALID;
+    jsfBankIndexBuild(JSF_START_ADDRESS);
+#ifdef JSF_BANK2_START_ADDRESS
+    jsfBankIndexBuild(JSF_BANK2_START_ADDRESS);
+#endif
+  }
+  return jsfIndexState==JSFI_VALID;
+}
+#endif
+
 /// Get info about the current filesystem
 JsfStorageStats jsfGetStorageStats(uint32_t addr, bool allPages) {
   if (!addr) addr=JSF_DEFAULT_START_ADDRESS;
@@ -480,17 +664,63 @@ static void jsfCompactWriteBuffer(uint32_t *writeAddress, uint32_t readAddress,
   }
 }
 
+/// Get the address JsVars use to point to flash (which may not be the flash address, eg. on Linux)
+static size_t jsfGetMemMapAddress(uint32_t addr) {
+  size_t mappedAddr = jshFlashGetMemMapAddress((size_t)addr);
+  return mappedAddr ? mappedAddr : (size_t)addr; // not memory-mapped (eg SPI flash) so flash strings use the address
+}
+
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+/** Can we pause compaction here? If so, return the address of the page that the header marking
+the gap up to readAddress will go at the start of. We need everything we've read to have been
+written, and that page must only contain data we've already read (so we can erase it now, and
+again when we resume). Compacted data is never on that page, so it never has to be erased again */
+static uint32_t jsfCompactCanPause(uint32_t writeAddress, uint32_t readAddress, uint32_t swapBufferUsed) {
+  uint32_t pageAddr, pageLen;
+  if (swapBufferUsed || !jshFlashGetPage(writeAddress, &pageAddr, &pageLen))
+    return 0;
+  if (pageAddr!=writeAddress) {
+    /* We've written to this page, so we need room for a header marking the rest of it as erased.
+    That space is wasted until Storage is next compacted, so only do it if there's not much left */
+    uint32_t pageEnd = pageAddr+pageLen;
+    if (writeAddress+(uint32_t)sizeof(JsfFileHeader) > pageEnd ||
+        pageEnd-writeAddress > pageLen/JSF_COMPACT_PAUSE_WASTE ||
+        !jshFlashGetPage(pageEnd, &pageAddr, &pageLen))
+      return 0;
+  }
+  if (readAddress < pageAddr+pageLen || pageAddr+pageLen > jsfGetBankEndAddress(writeAddress))
+    return 0;
+  return pageAddr;
+}
+
+/// Write a header for an erased file (that compaction knows to resume from) covering from addr up to endAddr
+static void jsfCompactWriteMarker(uint32_t addr, uint32_t endAddr) {
+  JsfFileHeader marker;
+  memset(&marker, 0, sizeof(JsfFileHeader));
+  marker.size = (endAddr - addr - (uint32_t)sizeof(JsfFileHeader)) | (JSF_COMPACT_MARKER_FLAGS<<24);
+  jshFlashWrite(&marker, addr, (uint32_t)sizeof(JsfFileHeader));
+}
+#endif
+
 /* Try and compact saved data so it'll fit in Flash again.
+ * If resumeAddr!=0, it's the address of the header written when compaction was paused, which
+ * is at the start of a page (and startAddress). If endTime!=0 we return early (after writing
+ * headers covering the gap between what's been written and what's left to read) when it is reached.
+ * Storage is only valid again once we return: until then the files end at writeAddress, and
+ * what's in swapBuffer is only in RAM. Nothing is journaled, so if power is lost while this is
+ * running (even for one slice) any files that haven't been copied yet are lost.
  */
-static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t swapBufferSize) {
+static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t swapBufferSize, uint32_t resumeAddr, JsSysTime endTime) {
   uint32_t writeAddress = startAddress;
   jsDebug(DBG_INFO,"Compacting from 0x%08x (%d byte buffer)\n", startAddress, swapBufferSize);
 
+  if (!endTime) {
 #ifdef JSF_BANK2_START_ADDRESS
-  jsiConsolePrintf("Compacting Bank %d... ", (startAddress>=JSF_BANK2_START_ADDRESS && startAddress<JSF_BANK2_END_ADDRESS)?2:1);
+    jsiConsolePrintf("Compacting Bank %d... ", (startAddress>=JSF_BANK2_START_ADDRESS && startAddress<JSF_BANK2_END_ADDRESS)?2:1);
 #else
-  jsiConsolePrintf("Compacting... ");
+    jsiConsolePrintf("Compacting... ");
 #endif
+  }
 
   uint32_t swapBufferHead = 0;
   uint32_t swapBufferTail = 0;
@@ -499,13 +729,42 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
   memset(&header,0,sizeof(JsfFileHeader));
   uint32_t addr = startAddress;
   uint32_t lastProgress = 0;
+  if (resumeAddr) {
+    /* The page resumeAddr is on only contains the header marking the gap (and data that was
+    already copied), so we just carry on reading from the end of the gap, and the page will be
+    erased when we first write to it */
+    assert(resumeAddr==startAddress);
+    addr = resumeAddr;
+  }
   if (jsfGetFileHeader(addr, &header, true)) do {
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+    uint32_t markerAddr;
+    if (endTime && jshGetSystemTime()>endTime &&
+        (markerAddr = jsfCompactCanPause(writeAddress, addr, swapBufferUsed))) {
+      /* Write headers for erased files that cover everything up to what we haven't read yet:
+      one for the rest of the page we're writing to (if we've started it), and one at the start
+      of the next page (which only contains data we've already copied) that we resume from.
+      If power is lost while paused, these are just erased files. The one at writeAddress goes
+      last, as until it's written the next page isn't reachable from the files before it */
+      jshFlashErasePage(markerAddr);
+      jsfCompactWriteMarker(markerAddr, addr);
+      if (writeAddress!=markerAddr)
+        jsfCompactWriteMarker(writeAddress, markerAddr);
+      jsDebug(DBG_INFO,"compact> paused at 0x%08x (read 0x%08x)\n", markerAddr, addr);
+      jsfCompactResumeAddr = markerAddr;
+      return true;
+    }
+#endif
     if (jsfIsRealFile(&header)) { // if not replaced or system file
       jsDebug(DBG_INFO,"compact> copying file at 0x%08x\n", addr);
       // Rewrite file position for any JsVars that used this file *if* the file changed position
       uint32_t newAddress = writeAddress+swapBufferUsed;
-      if (addr != newAddress)
-        jsvUpdateMemoryAddress(addr, sizeof(JsfFileHeader) + jsfGetFileSize(&header), newAddress);
+      if (addr != newAddress) {
+        jsvUpdateMemoryAddress(jsfGetMemMapAddress(addr), sizeof(JsfFileHeader) + jsfGetFileSize(&header), jsfGetMemMapAddress(newAddress));
+#ifdef ESPR_STORAGE_INDEX
+        jsfIndexMove(&header, addr+(uint32_t)sizeof(JsfFileHeader), newAddress+(uint32_t)sizeof(JsfFileHeader));
+#endif
+      }
       // Copy the file into the circular buffer, one bit at a time.
       // Write the header
       memcpy_circular(swapBuffer, &swapBufferHead, swapBufferSize, (char*)&header, sizeof(JsfFileHeader));
@@ -513,6 +772,21 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
       // Write the contents
       uint32_t alignedSize = jsfAlignAddress(jsfGetFileSize(&header));
       uint32_t alignedPtr = addr+(uint32_t)sizeof(JsfFileHeader);
+#ifdef ESPR_STORAGE_JOURNAL
+      /* If a journal has had changes written to it, checkpoint it while we copy it
+      so it just contains one record with all the data */
+      JsVar *journal = 0;
+      uint32_t journalLength = 0;
+      if (jsfGetFileFlags(&header)&JSFF_JOURNAL) {
+        uint32_t endAddr;
+        int recordCount;
+        journal = jsfJournalReplay(alignedPtr, &header, &journalLength, &endAddr, &recordCount);
+        if (journal && recordCount<=1) {
+          jsvUnLock(journal);
+          journal = 0;
+        }
+      }
+#endif
       jsfCompactWriteBuffer(&writeAddress, alignedPtr, swapBuffer, swapBufferSize, &swapBufferUsed, &swapBufferTail);
       while (alignedSize) {
         // How much space do we have available in our swapBuffer
@@ -523,10 +797,21 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
           s = swapBufferTail-swapBufferHead;
         if (s==0) {
           jsDebug(DBG_INFO,"compact> error - no space left!\n");
+#ifdef ESPR_STORAGE_INDEX
+          jsfIndexClear(); // some files may have moved
+#endif
+#ifdef ESPR_STORAGE_JOURNAL
+          jsvUnLock(journal);
+#endif
           return false;
         }
         if (s>alignedSize) s=alignedSize;
         jsDebug(DBG_INFO,"compact> read %d from 0x%08x => buf[%d]\n", s, alignedPtr, swapBufferHead);
+#ifdef ESPR_STORAGE_JOURNAL
+        if (journal)
+          jsfJournalCheckpointRead(journal, journalLength, alignedPtr-(addr+(uint32_t)sizeof(JsfFileHeader)), &swapBuffer[swapBufferHead], s);
+        else
+#endif
         jshFlashRead(&swapBuffer[swapBufferHead], alignedPtr, s);
         alignedSize -= s;
         alignedPtr += s;
@@ -535,12 +820,19 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
         // Is the buffer big enough to write?
         jsfCompactWriteBuffer(&writeAddress, alignedPtr, swapBuffer, swapBufferSize, &swapBufferUsed, &swapBufferTail);
       }
+#ifdef ESPR_STORAGE_JOURNAL
+      jsvUnLock(journal);
+#endif
       uint32_t progress = (addr-startAddress)>>14; // every 16k
-      if (progress!=lastProgress) {
+      if (progress!=lastProgress && !endTime) {
         jsiConsolePrintf("\x08%c", "/-\\|"[progress&3]);
         lastProgress = progress;
       }
     }
+#ifdef ESPR_STORAGE_INDEX
+    else if (header.name.firstChars != 0) // a system file that compaction drops
+      jsfIndexRemove(addr+(uint32_t)sizeof(JsfFileHeader), &header);
+#endif
     // kick watchdog to ensure we don't reboot
     jshKickWatchDog();
     jshKickSoftWatchDog();
@@ -559,12 +851,36 @@ static bool jsfCompactInternal(uint32_t startAddress, char *swapBuffer, uint32_t
     // addr is the address of the last area in flash
     jshFlashErasePages(writeAddress, addr-writeAddress);
   }
-  jsiConsolePrintf("\n");
+  if (!endTime) jsiConsolePrintf("\n");
   jsDebug(DBG_INFO,"Compaction Complete\n");
   return true;
 }
 #endif
 
+#ifndef SAVE_ON_FLASH
+/// Allocate a buffer and call jsfCompactInternal with it
+static bool jsfCompactWithBuffer(uint32_t startAddress, uint32_t swapBufferSize, uint32_t resumeAddr, JsSysTime endTime) {
+  // See if we have enough memory...
+  bool freedMemory = false;
+  if (swapBufferSize+256 < jsuGetFreeStack()) {
+    jsDebug(DBG_INFO,"Enough stack for %d byte buffer\n", swapBufferSize);
+    char *swapBuffer = alloca(swapBufferSize);
+    freedMemory = jsfCompactInternal(startAddress, swapBuffer, swapBufferSize, resumeAddr, endTime);
+  } else {
+    jsDebug(DBG_INFO,"Not enough stack for (%d bytes)\n", swapBufferSize);
+    JsVar *buf = jsvNewFlatStringOfLength(swapBufferSize);
+    if (buf) {
+      jsDebug(DBG_INFO,"Allocated data in JsVars\n");
+      char *swapBuffer = jsvGetFlatStringPointer(buf);
+      freedMemory = jsfCompactInternal(startAddress, swapBuffer, swapBufferSize, resumeAddr, endTime);
+      jsvUnLock(buf);
+    } else
+      jsDebug(DBG_INFO,"Not enough memory to compact anything\n");
+  }
+  return freedMemory;
+}
+#endif
+
 // Compacts one bank - return true if some free space was created
 bool jsfBankCompact(uint32_t startAddress, bool showMessage) {
 #ifndef SAVE_ON_FLASH
@@ -593,23 +909,10 @@ bool jsfBankCompact(uint32_t startAddress, bool showMessage) {
 
   uint32_t swapBufferSize = stats.fileBytes;
   if (swapBufferSize > maxRequired) swapBufferSize=maxRequired;
-  // See if we have enough memory...
-  bool freedMemory = false;
-  if (swapBufferSize+256 < jsuGetFreeStack()) {
-    jsDebug(DBG_INFO,"Enough stack for %d byte buffer\n", swapBufferSize);
-    char *swapBuffer = alloca(swapBufferSize);
-    freedMemory = jsfCompactInternal(stats.firstPageWithErasedFiles, swapBuffer, swapBufferSize);
-  } else {
-    jsDebug(DBG_INFO,"Not enough stack for (%d bytes)\n", swapBufferSize);
-    JsVar *buf = jsvNewFlatStringOfLength(swapBufferSize);
-    if (buf) {
-      jsDebug(DBG_INFO,"Allocated data in JsVars\n");
-      char *swapBuffer = jsvGetFlatStringPointer(buf);
-      freedMemory = jsfCompactInternal(stats.firstPageWithErasedFiles, swapBuffer, swapBufferSize);
-      jsvUnLock(buf);
-    } else
-      jsDebug(DBG_INFO,"Not enough memory to compact anything\n");
-  }
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+  jsfCompactResumeAddr = 0; // we're starting from the beginning, and any paused compaction is just an erased file
+#endif
+  bool freedMemory = jsfCompactWithBuffer(stats.firstPageWithErasedFiles, swapBufferSize, 0, 0);
 #if defined(BANGLEJS_Q3) || defined(DICKENS)
   // if we added the compact message, take it off
   jsvUnLock(jspEvaluate("Bangle.setLCDOverlay();g.flip();",true));
@@ -648,6 +951,56 @@ bool jsfCompact(bool showMessage) {
   return compacted;
 }
 
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+/* Do a slice of compaction (at most jsfCompactSliceTime ms) if compaction was paused, or
+if files have been erased and a bank has more space taken up by erased files than is free.
+Return true if there is more to do */
+bool jsfCompactIdle() {
+  if (!jsfCompactResumeAddr && !jsfCompactCheckIdle) return false;
+  uint32_t resumeAddr = jsfCompactResumeAddr;
+  jsfCompactResumeAddr = 0;
+  uint32_t startAddress = 0, swapBufferSize = 0, pageAddr, pageSize;
+  if (resumeAddr) {
+    // Check the header we left is still there, and where the page it's in starts
+    JsfFileHeader header;
+    if (jsfGetFileHeader(resumeAddr, &header, false) && header.name.firstChars==0 &&
+        jsfGetFileFlags(&header)==JSF_COMPACT_MARKER_FLAGS &&
+        jshFlashGetPage(resumeAddr, &pageAddr, &pageSize) && pageAddr==resumeAddr) {
+      startAddress = pageAddr;
+      swapBufferSize = pageSize + (uint32_t)sizeof(JsfFileHeader);
+    } else
+      resumeAddr = 0;
+  }
+  if (!resumeAddr) {
+    jsfCompactCheckIdle = false;
+    uint32_t banks[] = { JSF_START_ADDRESS
+#ifdef JSF_BANK2_START_ADDRESS
+        , JSF_BANK2_START_ADDRESS
+#endif
+    };
+    for (unsigned int i=0;i<sizeof(banks)/sizeof(banks[0]) && !startAddress;i++) {
+      if (!jshFlashGetPage(banks[i], &pageAddr, &pageSize)) continue;
+      JsfStorageStats stats = jsfGetStorageStats(banks[i], true);
+      if (stats.trashBytes >= pageSize && stats.trashBytes > stats.free) {
+        startAddress = stats.firstPageWithErasedFiles;
+        swapBufferSize = pageSize + (uint32_t)sizeof(JsfFileHeader);
+        if (swapBufferSize > stats.fileBytes) swapBufferSize = stats.fileBytes;
+      }
+    }
+    if (!startAddress) return false;
+  }
+  jsfCacheClear();
+#ifdef ESPR_STORAGE_FILENAME_TABLE
+  jsfFilenameTableBank1Addr = 0;
+  jsfFilenameTableBank1Size = 0;
+#endif
+  JsSysTime endTime = jshGetSystemTime() + jshGetTimeFromMilliseconds(jsfCompactSliceTime);
+  if (!endTime) endTime = 1;
+  jsfCompactWithBuffer(startAddress, swapBufferSize, resumeAddr, endTime);
+  return jsfCompactResumeAddr!=0;
+}
+#endif
+
 /* If we have a filename like "C:foo", take the 'C:' bit
  * off it and return the drive. If explicitOnly==false,
  * we also return the drive name if we think a file should
@@ -749,10 +1102,17 @@ static uint32_t jsfCreateFile(JsfFileName name, uint32_t size, JsfFileFlags flag
   if (returnedHeader) *returnedHeader = header;
   addr += (uint32_t)sizeof(JsfFileHeader); // address of actual file data
   jsfCachePut(&header, addr);
+#ifdef ESPR_STORAGE_INDEX
+  jsfIndexPut(addr, &header);
+#endif
   return addr;
 }
 
 static uint32_t jsfBankFindFile(uint32_t bankAddress, uint32_t bankEndAddress, JsfFileName name, JsfFileHeader *returnedHeader) {
+#ifdef ESPR_STORAGE_INDEX
+  if (jsfIndexReady())
+    return jsfIndexFind(name, bankAddress, bankEndAddress, returnedHeader);
+#endif
   uint32_t addr = bankAddress;
   JsfFileHeader header;
 #ifdef ESPR_STORAGE_FILENAME_TABLE
@@ -842,6 +1202,20 @@ uint32_t jsfFindFile(JsfFileName name, JsfFileHeader *returnedHeader) {
 }
 
 static uint32_t jsfBankFindFileFromAddr(uint32_t bankAddress, uint32_t bankEndAddress, uint32_t containsAddr, JsfFileHeader *returnedHeader) {
+#ifdef ESPR_STORAGE_INDEX
+  if (jsfIndexReady()) {
+    for (int i=0;i<ESPR_STORAGE_INDEX;i++) {
+      JsfIndexEntry *e = &jsfIndex[i];
+      if (e->addr>=bankAddress && e->addr<bankEndAddress &&
+          e->addr-(uint32_t)sizeof(JsfFileHeader)<=containsAddr && containsAddr<=e->addr+jsfGetFileSize(&e->header)) {
+        if (returnedHeader)
+          *returnedHeader = e->header;
+        return e->addr;
+      }
+    }
+    return 0;
+  }
+#endif
   uint32_t addr = bankAddress;
   JsfFileHeader header;
   memset(&header,0,sizeof(JsfFileHeader));
@@ -1003,10 +1377,130 @@ bool jsfIsStorageEmpty() {
   return true;
 }
 
+#ifdef ESPR_STORAGE_JOURNAL
+/* Replay the records in a journal file into a Flat String (addr=address of data, NOT header).
+The String may be longer than the contents, so the length is returned in 'length'.
+'endAddr' is set to where the next record should go and 'recordCount' to the number of records.
+Returns 0 if there isn't enough memory */
+static JsVar *jsfJournalReplay(uint32_t addr, JsfFileHeader *header, uint32_t *length, uint32_t *endAddr, int *recordCount) {
+  uint32_t fileEnd = addr + jsfGetFileSize(header);
+  // First scan records to see how big the contents gets
+  JsfJournalRecord record;
+  uint32_t recordAddr = addr, len = 0, maxLen = 1;
+  int count = 0;
+  while (recordAddr+sizeof(JsfJournalRecord) <= fileEnd) {
+    jshFlashRead(&record, recordAddr, sizeof(JsfJournalRecord));
+    uint32_t next = jsfAlignAddress(recordAddr + (uint32_t)sizeof(JsfJournalRecord) + record.length);
+    if (record.length==0xFFFFFFFF || // end of journal
+        (uint32_t)record.keepStart+record.keepEnd > len || // corrupt
+        next>jsfAlignAddress(fileEnd) || next<recordAddr) break;
+    len = record.keepStart + record.length + record.keepEnd;
+    if (len>maxLen) maxLen = len;
+    recordAddr = next;
+    count++;
+  }
+  JsVar *contents = jsvNewFlatStringOfLength(maxLen);
+  if (!contents) return 0;
+  *length = len;
+  *endAddr = recordAddr;
+  *recordCount = count;
+  // Now apply each record in turn
+  char *ptr = jsvGetFlatStringPointer(contents);
+  recordAddr = addr;
+  len = 0;
+  while (count--) {
+    jshFlashRead(&record, recordAddr, sizeof(JsfJournalRecord));
+    memmove(&ptr[record.keepStart + record.length], &ptr[len - record.keepEnd], record.keepEnd);
+    jshFlashRead(&ptr[record.keepStart], recordAddr + (uint32_t)sizeof(JsfJournalRecord), record.length);
+    len = record.keepStart + record.length + record.keepEnd;
+    recordAddr = jsfAlignAddress(recordAddr + (uint32_t)sizeof(JsfJournalRecord) + record.length);
+  }
+  return contents;
+}
+
+/// When compacting, get the data for a journal that's been checkpointed into one record
+static void jsfJournalCheckpointRead(JsVar *contents, uint32_t length, uint32_t offset, char *buf, uint32_t len) {
+  JsfJournalRecord record = { 0, 0, length };
+  char *ptr = jsvGetFlatStringPointer(contents);
+  for (uint32_t i=0;i<len;i++,offset++) {
+    if (offset<sizeof(record)) buf[i] = ((char*)&record)[offset];
+    else if (offset-sizeof(record)<length) buf[i] = ptr[offset-sizeof(record)];
+    else buf[i] = (char)0xFF;
+  }
+}
+
+/// Write a whole new journal file with one record containing all the data
+static bool jsfJournalCreate(JsfFileName name, const char *data, uint32_t len) {
+  // leave some space for changes
+  uint32_t size = (uint32_t)sizeof(JsfJournalRecord) + len + JSF_JOURNAL_SPACE + len/2;
+  uint32_t addr = jsfCreateFile(name, size, JSFF_JOURNAL, NULL);
+  if (!addr) return false;
+  JsfJournalRecord record = { 0, 0, len };
+  jshFlashWriteAligned((void*)data, addr + (uint32_t)sizeof(JsfJournalRecord), len);
+  jshFlashWrite(&record, addr, sizeof(JsfJournalRecord)); // header last, so it's only valid if the data got written
+  return true;
+}
+
+/** Write data to a journal file, appending just the bytes that changed if we can or writing
+a new journal if there's no space. Returns false if we couldn't (so a normal file should be written) */
+static bool jsfJournalWrite(JsfFileName name, const char *data, uint32_t len) {
+  JsfFileHeader header;
+  uint32_t addr = jsfFindFile(name, &header);
+  if (addr && (jsfGetFileFlags(&header)&JSFF_JOURNAL)) {
+    uint32_t oldLen, endAddr;
+    int recordCount;
+    JsVar *old = jsfJournalReplay(addr, &header, &oldLen, &endAddr, &recordCount);
+    if (old) {
+      // work out how much is the same at the start and end
+      const char *oldPtr = jsvGetFlatStringPointer(old);
+      uint32_t maxKeep = (len<oldLen) ? len : oldLen;
+      uint32_t keepStart = 0, keepEnd = 0;
+      while (keepStart<maxKeep && keepStart<0xFFFF && oldPtr[keepStart]==data[keepStart]) keepStart++;
+      while (keepStart+keepEnd<maxKeep && keepEnd<0xFFFF && oldPtr[oldLen-keepEnd-1]==data[len-keepEnd-1]) keepEnd++;
+      jsvUnLock(old);
+      if (keepStart==oldLen && keepStart==len) {
+        jsDebug(DBG_INFO,"jsfJournalWrite files Equal\n");
+        return true;
+      }
+      JsfJournalRecord record = { (uint16_t)keepStart, (uint16_t)keepEnd, len-(keepStart+keepEnd) };
+      uint32_t recordSize = jsfAlignAddress((uint32_t)sizeof(JsfJournalRecord) + record.length);
+      if (recordCount < JSF_JOURNAL_MAX_RECORDS &&
+          endAddr+recordSize <= jsfAlignAddress(addr+jsfGetFileSize(&header)) &&
+          jsfIsErased(endAddr, recordSize)) {
+        jsDebug(DBG_INFO,"jsfJournalWrite append %d bytes\n", record.length);
+        jshFlashWriteAligned((void*)&data[keepStart], endAddr + (uint32_t)sizeof(JsfJournalRecord), record.length);
+        jshFlashWrite(&record, endAddr, sizeof(JsfJournalRecord));
+        return true;
+      }
+    }
+  }
+  // No journal, or it's full - write a new one
+  if (addr) jsfEraseFileInternal(addr, &header, true);
+  return jsfJournalCreate(name, data, len);
+}
+#endif
+
 JsVar *jsfReadFile(JsfFileName name, int offset, int length) {
   JsfFileHeader header;
   uint32_t addr = jsfFindFile(name, &header);
   if (!addr) return 0;
+#ifdef ESPR_STORAGE_JOURNAL
+  if (jsfGetFileFlags(&header)&JSFF_JOURNAL) {
+    uint32_t fileLen, endAddr;
+    int recordCount;
+    JsVar *contents = jsfJournalReplay(addr, &header, &fileLen, &endAddr, &recordCount);
+    if (!contents) return 0;
+    if (offset<0) offset=0;
+    if (length<=0) length=(int)fileLen;
+    if (offset>(int)fileLen) offset=(int)fileLen;
+    if (offset+length>(int)fileLen) length=(int)fileLen-offset;
+    if (offset==0 && (uint32_t)length==jsvGetCharactersInVar(contents))
+      return contents;
+    JsVar *v = jsvNewFromStringVar(contents, (size_t)offset, (size_t)length);
+    jsvUnLock(contents);
+    return v;
+  }
+#endif
   // clip requested read lengths
   if (offset<0) offset=0;
   int fileLen = (int)jsfGetFileSize(&header);
@@ -1026,18 +1520,18 @@ JsVar* jsvAddressToVar(size_t addr, uint32_t length) {
   if (!mappedAddr) {
     return jsvNewFlashString((char*)(size_t)addr, (size_t)length);
   }
+#elif defined(LINUX)
+  if (!mappedAddr) {
+    // linux fakes flash with a file, and if that couldn't be memory-mapped we can't just return a pointer to it!
+    uint32_t alignedSize = jsfAlignAddress((uint32_t)length);
+    char *d = (char*)malloc(alignedSize);
+    jshFlashRead(d, (size_t)addr, alignedSize);
+    JsVar *v = jsvNewStringOfLength((uint32_t)length, d);
+    free(d);
+    return v;
+  }
 #endif
-#ifdef LINUX
-  // linux fakes flash with a file, so we can't just return a pointer to it!
-  uint32_t alignedSize = jsfAlignAddress((uint32_t)length);
-  char *d = (char*)malloc(alignedSize);
-  jshFlashRead(d, (size_t)addr, alignedSize);
-  JsVar *v = jsvNewStringOfLength((uint32_t)length, d);
-  free(d);
-  return v;
-#else
   return jsvNewNativeString((char*)mappedAddr, length);
-#endif
 }
 
 bool jsfWriteFile(JsfFileName name, JsVar *data, JsfFileFlags flags, JsVarInt offset, JsVarInt _size) {
@@ -1054,9 +1548,23 @@ bool jsfWriteFile(JsfFileName name, JsVar *data, JsfFileFlags flags, JsVarInt of
     jsExceptionHere(JSET_ERROR, "Can't create zero length file");
     return false;
   }
+#ifdef ESPR_STORAGE_JOURNAL
+  if (flags & JSFF_JOURNAL) {
+    if (offset==0 && size==dLen && dLen<=JSF_JOURNAL_MAX_SIZE &&
+        jsfJournalWrite(name, dPtr, (uint32_t)dLen))
+      return true;
+    flags &= (JsfFileFlags)~JSFF_JOURNAL; // otherwise just write a normal file
+  }
+#endif
   // Lookup file
   JsfFileHeader header;
   uint32_t addr = jsfFindFile(name, &header);
+#ifdef ESPR_STORAGE_JOURNAL
+  if (addr && offset && (jsfGetFileFlags(&header)&JSFF_JOURNAL)) {
+    jsExceptionHere(JSET_ERROR, "Can't write within a journal file");
+    return false;
+  }
+#endif
 #ifdef JSF_BANK2_START_ADDRESS
   if (!addr && name.c[1]==':'){
     // if not found where it should be, try another bank to not end with two files
@@ -1145,6 +1653,30 @@ static void jsfBankListFilesHandleFile(JsVar *files, uint32_t addr, JsfFileHeade
 static void jsfBankListFiles(JsVar *files, uint32_t addr, JsVar *regex, JsfFileFlags containing, JsfFileFlags notContaining, uint32_t *hash) {
   JsfFileHeader header;
   memset(&header,0,sizeof(JsfFileHeader));
+#ifdef ESPR_STORAGE_INDEX
+  if (jsfIndexReady()) {
+    // Get the files in this bank, sorted by address so we list them in the same order as they're stored
+    uint32_t endAddr = jsfGetBankEndAddress(addr);
+    uint16_t *order = alloca(jsfIndexCount*sizeof(uint16_t));
+    int count = 0;
+    for (int i=0;i<ESPR_STORAGE_INDEX;i++) {
+      uint32_t a = jsfIndex[i].addr;
+      if (!a || a<addr || a>=endAddr) continue;
+      int j = count++;
+      while (j>0 && jsfIndex[order[j-1]].addr>a) {
+        order[j] = order[j-1];
+        j--;
+      }
+      order[j] = (uint16_t)i;
+    }
+    for (int i=0;i<count;i++) {
+      header = jsfIndex[order[i]].header; // copy, as jsfBankListFilesHandleFile may modify it
+      if (jsfIsRealFile(&header))
+        jsfBankListFilesHandleFile(files, jsfIndex[order[i]].addr-(uint32_t)sizeof(JsfFileHeader), &header, regex, containing, notContaining, hash);
+    }
+    return;
+  }
+#endif
 #ifdef ESPR_STORAGE_FILENAME_TABLE
   if (jsfFilenameTableBank1Addr && addr==JSF_START_ADDRESS) {
     //jsiConsolePrintf("jsfFilenameTable 0x%08x\n", jsfFilenameTableBank1Addr);
@@ -1268,20 +1800,177 @@ int jsfLoadFromFlash_readcb(uint32_t *cbdata) {
   return data->buffer[data->bufferCnt++];
 }
 
+#ifdef ESPR_VARIMAGE_SNAPSHOT
+/* An uncompressed snapshot of variable memory. JsVars refer to each other by
+ * index rather than by pointer, so this can be copied straight back into
+ * variable memory with no relocation. It is stored uncompressed (without
+ * JSFF_COMPRESSED) and the header is a multiple of 16 bytes, so the
+ * variables themselves stay aligned in flash. */
+typedef struct {
+  uint32_t hash;     ///< build hash, as for the compressed image
+  uint32_t magic;    ///< JSF_SNAPSHOT_MAGIC
+  uint32_t varCount; ///< number of JsVars in the image (trailing unused vars are not stored)
+  uint32_t varSize;  ///< sizeof(JsVar) in the build that wrote the image
+} JsfSnapshotHeader;
+#define JSF_SNAPSHOT_MAGIC 0x50414E53 // "SNAP"
+
+/// Write a block of snapshot data - anything aligned is written straight from RAM rather than via the buffer
+static void jsfSaveSnapshot_write(jsfcbData *data, unsigned char *ptr, uint32_t len) {
+  // fill up and flush anything left in the buffer
+  while (len && data->bufferCnt) {
+    jsfSaveToFlash_writecb(*(ptr++), (uint32_t*)data);
+    len--;
+  }
+  uint32_t bulkLen = len & ~(uint32_t)(JSF_ALIGNMENT-1);
+  if (bulkLen) {
+    jshFlashWrite(ptr, data->address, bulkLen);
+    data->address += bulkLen;
+    ptr += bulkLen;
+    len -= bulkLen;
+  }
+  while (len--)
+    jsfSaveToFlash_writecb(*(ptr++), (uint32_t*)data);
+}
+
+/// How many vars will be in the snapshot? jsvSoftKill has zeroed all unused vars, so we needn't store the ones at the end
+static unsigned int jsfGetSnapshotVarCount() {
+  unsigned int varCount = jsvGetMemoryTotal();
+  while (varCount) {
+    unsigned char *p = (unsigned char *)_jsvGetAddressOf((JsVarRef)varCount);
+    unsigned int i;
+    for (i=0;i<sizeof(JsVar) && !p[i];i++);
+    if (i<sizeof(JsVar)) break;
+    varCount--;
+  }
+  return varCount;
+}
+
+/// Will a file of 'size' bytes fit in Storage after the file 'name' is erased and Storage is compacted?
+static bool jsfWillFitAfterErase(JsfFileName name, uint32_t size) {
+  JsfStorageStats stats = jsfGetStorageStats(JSF_DEFAULT_START_ADDRESS, true);
+  uint32_t used = stats.fileBytes;
+  JsfFileHeader header;
+  if (jsfFindFile(name, &header))
+    used -= jsfAlignAddress(jsfGetFileSize(&header)) + (uint32_t)sizeof(JsfFileHeader);
+  return used + jsfAlignAddress(size) + (uint32_t)sizeof(JsfFileHeader) <= stats.total;
+}
+
+/// Save an uncompressed snapshot of variables, return false if there wasn't space
+static bool jsfSaveSnapshotToFlash(JsfFileName name) {
+  unsigned int varCount = jsfGetSnapshotVarCount();
+  uint32_t size = (uint32_t)sizeof(JsfSnapshotHeader) + varCount*(uint32_t)sizeof(JsVar);
+  uint32_t savedCodeAddr = jsfCreateFile(name, size, JSFF_NONE, NULL);
+  if (!savedCodeAddr) return false;
+  jsfcbData cbData;
+  memset(&cbData, 0, sizeof(cbData));
+  cbData.address = savedCodeAddr;
+  jsiConsolePrint("Writing..");
+  JsfSnapshotHeader header;
+  header.hash = getBuildHash();
+  header.magic = JSF_SNAPSHOT_MAGIC;
+  header.varCount = varCount;
+  header.varSize = (uint32_t)sizeof(JsVar);
+  jsfSaveSnapshot_write(&cbData, (unsigned char*)&header, sizeof(header));
+  JsVarRef ref = 1;
+  while (ref <= varCount) {
+    unsigned int count;
+    JsVar *v = jsvGetContiguousVars(ref, &count);
+    if (count > varCount+1-ref) count = varCount+1-ref;
+    jsfSaveSnapshot_write(&cbData, (unsigned char*)v, count*(uint32_t)sizeof(JsVar));
+    ref = (JsVarRef)(ref+count);
+  }
+  jsfSaveToFlash_finish(&cbData);
+  jsiConsolePrintf("\nSaved %d byte snapshot\n", size);
+  return true;
+}
+
+/// Load an uncompressed snapshot of variables written by jsfSaveSnapshotToFlash
+static void jsfLoadSnapshotFromFlash(uint32_t addr, uint32_t size) {
+  JsfSnapshotHeader header;
+  if (size < sizeof(header)) return;
+  jshFlashRead(&header, addr, sizeof(header));
+  if (header.hash != getBuildHash()) {
+    jsiConsolePrintf("Not loading saved code from different Espruino firmware.\n");
+    return;
+  }
+  if (header.magic != JSF_SNAPSHOT_MAGIC ||
+      header.varSize != sizeof(JsVar) ||
+      size < sizeof(header) + header.varCount*(uint32_t)sizeof(JsVar)) {
+    jsiConsolePrintf("Saved snapshot is invalid.\n");
+    return;
+  }
+#ifdef RESIZABLE_JSVARS
+  if (header.varCount > jsvGetMemoryTotal()) {
+    jsvSoftKill(); // free list must be empty to grow memory - it's all overwritten anyway
+    jsvSetMemoryTotal(header.varCount);
+  }
+#endif
+  if (header.varCount > jsvGetMemoryTotal()) {
+    jsiConsolePrintf("Saved snapshot is too big (%d vars).\n", header.varCount);
+    return;
+  }
+  jsiConsolePrintf("Loading %d bytes from flash...\n", size);
+  addr += (uint32_t)sizeof(header);
+  unsigned int varTotal = jsvGetMemoryTotal();
+  JsVarRef ref = 1;
+  while (ref <= varTotal) {
+    unsigned int count, loadCount = 0;
+    JsVar *v = jsvGetContiguousVars(ref, &count);
+    if (ref <= header.varCount) {
+      loadCount = header.varCount+1-ref;
+      if (loadCount > count) loadCount = count;
+      jshFlashRead(v, addr, loadCount*(uint32_t)sizeof(JsVar));
+      addr += loadCount*(uint32_t)sizeof(JsVar);
+    }
+    // vars after the end of the image were unused (and zeroed) when it was saved
+    memset((void*)&v[loadCount], 0, (count-loadCount)*sizeof(JsVar));
+    ref = (JsVarRef)(ref+count);
+  }
+}
+#endif
+
 /// Save the RAM image to flash (this is the actual interpreter state)
 void jsfSaveToFlash() {
 #ifdef ESPR_NO_VARIMAGE
   jsiConsolePrint("Not implemented in this build\n");
 #else
-  unsigned int varSize = jsvGetMemoryTotal() * (unsigned int)sizeof(JsVar);
-  unsigned char* varPtr = (unsigned char *)_jsvGetAddressOf(1);
-
-  jsiConsolePrint("Compacting Flash...\n");
   JsfFileName name = jsfNameFromString(SAVED_CODE_VARIMAGE);
+  unsigned int varCount;
+  unsigned char* varPtr = (unsigned char *)jsvGetContiguousVars(1, &varCount);
+  // COMPRESS needs one contiguous area (with RESIZABLE_JSVARS memory may have grown)
+  bool canCompress = varCount >= jsvGetMemoryTotal();
+  /* Check we can save before we erase what was saved before. If variables aren't
+  contiguous, the snapshot is all we can write so it has to fit */
+#ifdef ESPR_VARIMAGE_SNAPSHOT
+  bool snapshot = !jsfGetFlag(JSF_COMPRESS_SAVE);
+  if (snapshot && !canCompress &&
+      !jsfWillFitAfterErase(name, (uint32_t)sizeof(JsfSnapshotHeader) + jsfGetSnapshotVarCount()*(uint32_t)sizeof(JsVar))) {
+    jsiConsolePrint("Not enough space for a snapshot, and variables are not contiguous so can't be compressed.\n");
+    return;
+  }
+#else
+  bool snapshot = false;
+#endif
+  if (!snapshot && !canCompress) {
+    jsiConsolePrint("Variables are not contiguous, so can't be compressed.\n");
+    return;
+  }
+  jsiConsolePrint("Compacting Flash...\n");
   // Ensure we get rid of any saved code we had before
   jsfEraseFile(name);
   // Try and compact, just to ensure we get the maximum amount saved
   jsfCompact(true);
+#ifdef ESPR_VARIMAGE_SNAPSHOT
+  if (snapshot) {
+    if (jsfSaveSnapshotToFlash(name)) return;
+    jsiConsolePrint("Not enough space for a snapshot, compressing instead...\n");
+  }
+#endif
+  if (!canCompress) { // shouldn't happen - we checked the snapshot would fit
+    jsiConsolePrint("Variables are not contiguous, so can't be compressed.\n");
+    return;
+  }
+  unsigned int varSize = varCount * (unsigned int)sizeof(JsVar);
   jsiConsolePrint("Calculating Size...\n");
   // Work out how much data this'll take, plus 4 bytes for build hash
   uint32_t compressedSize = 4 + COMPRESS(varPtr, varSize, NULL, NULL);
@@ -1333,6 +2022,12 @@ void jsfLoadStateFromFlash() {
   if (!savedCode) {
     return;
   }
+#ifdef ESPR_VARIMAGE_SNAPSHOT
+  if (!(jsfGetFileFlags(&header) & JSFF_COMPRESSED)) {
+    jsfLoadSnapshotFromFlash(savedCode, jsfGetFileSize(&header));
+    return;
+  }
+#endif
 
   //  unsigned int dataSize = jsvGetMemoryTotal() * sizeof(JsVar);
   unsigned char* varPtr = (unsigned char *)_jsvGetAddressOf(1);
@@ -43,6 +43,9 @@ typedef struct {
 
 typedef enum {
   JSFF_NONE,              ///< A normal file
+#ifdef ESPR_STORAGE_JOURNAL
+  JSFF_JOURNAL = 16,      ///< A file containing JsfJournalRecords - each one is a change to the contents before it
+#endif
 #ifndef SAVE_ON_FLASH
   JSFF_FILENAME_TABLE = 32,        ///< A file that contains a list of JsfFileHeader structs with 'size' pointing to the file addresses at the time it was created
 #endif
@@ -50,6 +53,10 @@ typedef enum {
   JSFF_COMPRESSED = 128   ///< This file contains compressed data (used only for .varimg currently)
 } JsfFileFlags; // these are stored in the top 8 bits of JsfFileHeader.size
 
+#ifdef ESPR_STORAGE_JOURNAL
+#define JSF_JOURNAL_MAX_SIZE 0xFFFF // biggest file we'll write as a journal
+#endif
+
 
 // ------------------------------------------------------------------------ Flash Storage Functionality
 /// utility function for creating JsfFileName
@@ -82,6 +89,11 @@ bool jsfEraseFile(JsfFileName name);
 bool jsfEraseAll();
 /// Try and compact saved data so it'll fit in Flash again. Return true if some free space was created
 bool jsfCompact(bool showMessage);
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+extern JsVarFloat jsfCompactSliceTime; ///< Maximum milliseconds for each slice of compaction when idle (0 = don't compact when idle)
+/// Do a slice of compaction if there are enough erased files (call when idle). Return true if there is more to do
+bool jsfCompactIdle();
+#endif
 /** Return all files in flash as a JsVar array of names. If regex is supplied, it is used to filter the filenames using String.match(regexp)
  * If containing!=0, file flags must contain one of the 'containing' argument's bits.
  * Flags can't contain any bits in the 'notContaining' argument
@@ -25,6 +25,7 @@
 #include "jsflash.h" // load and save to flash
 #include "jswrap_interactive.h" // jswrap_interactive_setTimeout
 #include "jswrap_object.h" // jswrap_object_keys_or_property_names
+#include "jswrap_arraybuffer.h" // jswrap_typedarray_constructor
 #include "jsnative.h" // jsnSanityTest
 #ifdef BLUETOOTH
 #include "bluetooth.h"
@@ -433,6 +434,365 @@ void jsiSetSleep(JsiSleepType isSleep) {
 #endif
 }
 
+#ifdef ESPR_TIMER_HEAP
+/* Timers are kept in a binary min-heap ordered by the absolute time they
+ * next fire, so jsiIdle only looks at the top of the heap rather than
+ * rewriting and checking the "time" of every timer in timerArray. Each entry
+ * holds a lock on the timer's NAME in timerArray, so it can't move in a
+ * defrag and can be removed from timerArray without searching for it.
+ *
+ * Removing a timer doesn't search the heap either. Once its NAME is removed
+ * from timerArray it has no references, so its entry is 'stale' and is dropped
+ * when it reaches the top of the heap, or by jsiTimerHeapSweep in one pass
+ * once stale entries make up half the heap (eg. after clearTimeout()).
+ *
+ * While the heap exists it is the only accurate record of when timers fire -
+ * each timer's "time" child is only brought up to date by jsiTimerHeapSync
+ * when something needs it (dump, save). The heap is built from timerArray
+ * in jsiIdle, and if we can't allocate it we fall back to scanning. */
+typedef struct {
+  JsSysTime time; ///< Absolute system time at which the timer fires
+  uint32_t seq;   ///< Order entries were added in, so timers with the same time run in order
+  JsVarRef name;  ///< The (locked) NAME of the timer in timerArray
+} JsiTimerHeapEntry;
+
+static JsVar *jsiTimerHeapVar = 0; ///< Locked Flat String containing the heap, or 0 if we're scanning timerArray
+static JsiTimerHeapEntry *jsiTimerHeap; ///< Pointer to the entries in jsiTimerHeapVar
+static unsigned int jsiTimerHeapCount; ///< How many entries are in the heap
+static unsigned int jsiTimerHeapSize; ///< How many entries will fit in jsiTimerHeapVar
+static uint32_t jsiTimerHeapSeq; ///< Sequence number for the next entry
+static unsigned int jsiTimerHeapStale; ///< How many entries are for timers that have been removed
+static JsVarRef jsiTimerHeapCurrent = 0; ///< NAME of the timer that is executing (not in the heap), or 0 if it was removed
+static bool jsiTimerHeapFailed = false; ///< We couldn't allocate the heap - don't try again until a timer is removed
+
+static ALWAYS_INLINE bool jsiTimerHeapLess(JsiTimerHeapEntry *a, JsiTimerHeapEntry *b) {
+  return a->time < b->time || (a->time == b->time && (int32_t)(a->seq - b->seq) < 0);
+}
+
+static void jsiTimerHeapSwap(unsigned int a, unsigned int b) {
+  JsiTimerHeapEntry t = jsiTimerHeap[a];
+  jsiTimerHeap[a] = jsiTimerHeap[b];
+  jsiTimerHeap[b] = t;
+}
+
+static void jsiTimerHeapUp(unsigned int i) {
+  while (i && jsiTimerHeapLess(&jsiTimerHeap[i], &jsiTimerHeap[(i-1)>>1])) {
+    jsiTimerHeapSwap(i, (i-1)>>1);
+    i = (i-1)>>1;
+  }
+}
+
+static void jsiTimerHeapDown(unsigned int i) {
+  while (true) {
+    unsigned int min = i, c = i*2+1;
+    if (c<jsiTimerHeapCount && jsiTimerHeapLess(&jsiTimerHeap[c], &jsiTimerHeap[min])) min = c;
+    c++;
+    if (c<jsiTimerHeapCount && jsiTimerHeapLess(&jsiTimerHeap[c], &jsiTimerHeap[min])) min = c;
+    if (min==i) return;
+    jsiTimerHeapSwap(i, min);
+    i = min;
+  }
+}
+
+/// Add a timer's NAME to the heap (locking it), return false if we couldn't allocate space
+static bool jsiTimerHeapPush(JsVar *timerName, JsSysTime time) {
+  if (jsiTimerHeapCount >= jsiTimerHeapSize) {
+    unsigned int newSize = jsiTimerHeapSize ? jsiTimerHeapSize*2 : 16;
+    JsVar *newVar = jsvNewFlatStringOfLength(newSize*(unsigned int)sizeof(JsiTimerHeapEntry));
+    if (!newVar) return false;
+    JsiTimerHeapEntry *newHeap = (JsiTimerHeapEntry*)jsvGetFlatStringPointer(newVar);
+    if (jsiTimerHeapVar) {
+      memcpy(newHeap, jsiTimerHeap, jsiTimerHeapCount*sizeof(JsiTimerHeapEntry));
+      jsvUnLock(jsiTimerHeapVar); // nothing else references it, so it's freed
+    }
+    jsiTimerHeapVar = newVar; // keep locked
+    jsiTimerHeap = newHeap;
+    jsiTimerHeapSize = newSize;
+  }
+  JsiTimerHeapEntry *e = &jsiTimerHeap[jsiTimerHeapCount];
+  e->time = time;
+  e->seq = jsiTimerHeapSeq++;
+  e->name = jsvGetRef(jsvLockAgain(timerName));
+  jsiTimerHeapUp(jsiTimerHeapCount++);
+  return true;
+}
+
+/// Remove entry i from the heap (without unlocking its NAME)
+static void jsiTimerHeapRemoveAt(unsigned int i) {
+  jsiTimerHeapCount--;
+  if (i == jsiTimerHeapCount) return;
+  jsiTimerHeap[i] = jsiTimerHeap[jsiTimerHeapCount];
+  jsiTimerHeapUp(i);
+  jsiTimerHeapDown(i);
+}
+
+/// Has the timer for this heap entry been removed from timerArray?
+static ALWAYS_INLINE bool jsiTimerHeapIsStale(unsigned int i) {
+  return jsvGetRefs(_jsvGetAddressOf(jsiTimerHeap[i].name)) == 0;
+}
+
+/// Remove stale entries from the top of the heap, so jsiTimerHeap[0] is a timer that will fire
+static void jsiTimerHeapPopStale() {
+  while (jsiTimerHeapCount && jsiTimerHeapIsStale(0)) {
+    JsVarRef name = jsiTimerHeap[0].name;
+    jsiTimerHeapRemoveAt(0);
+    jsvUnLock(_jsvGetAddressOf(name)); // frees the NAME (and the timer, if nothing else uses it)
+    if (jsiTimerHeapStale) jsiTimerHeapStale--;
+  }
+}
+
+/// Remove all stale entries and rebuild the heap from what's left
+static void jsiTimerHeapSweep() {
+  unsigned int count = 0;
+  for (unsigned int i=0;i<jsiTimerHeapCount;i++) {
+    if (jsiTimerHeapIsStale(i))
+      jsvUnLock(_jsvGetAddressOf(jsiTimerHeap[i].name));
+    else
+      jsiTimerHeap[count++] = jsiTimerHeap[i];
+  }
+  jsiTimerHeapCount = count;
+  jsiTimerHeapStale = 0;
+  for (unsigned int i=count/2;i>0;i--)
+    jsiTimerHeapDown(i-1);
+}
+
+/// Sweep the heap if enough of it is stale - called when timers are added, or before they're checked
+static void jsiTimerHeapCheckStale() {
+  if (jsiTimerHeapStale && jsiTimerHeapStale*2 >= jsiTimerHeapCount)
+    jsiTimerHeapSweep();
+}
+
+/// Find the heap entry for a timer object, or return -1
+static int jsiTimerHeapFind(JsVar *timerPtr) {
+  JsVarRef ref = jsvGetRef(timerPtr);
+  for (unsigned int i=0;i<jsiTimerHeapCount;i++)
+    if (jsvGetFirstChild(_jsvGetAddressOf(jsiTimerHeap[i].name)) == ref && !jsiTimerHeapIsStale(i))
+      return (int)i;
+  return -1;
+}
+
+/// Write each timer's "time" (relative to jsiLastIdleTime) back into it
+static void jsiTimerHeapSync() {
+  for (unsigned int i=0;i<jsiTimerHeapCount;i++) {
+    if (jsiTimerHeapIsStale(i)) continue;
+    JsVar *timerPtr = jsvSkipName(_jsvGetAddressOf(jsiTimerHeap[i].name));
+    jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(jsiTimerHeap[i].time - jsiLastIdleTime));
+    jsvUnLock(timerPtr);
+  }
+}
+
+/// Sync timers' "time" and free the heap, so we go back to scanning timerArray
+static void jsiTimerHeapFree() {
+  if (!jsiTimerHeapVar) return;
+  jsiTimerHeapSync();
+  for (unsigned int i=0;i<jsiTimerHeapCount;i++)
+    jsvUnLock(_jsvGetAddressOf(jsiTimerHeap[i].name));
+  jsvUnLock(jsiTimerHeapVar);
+  jsiTimerHeapVar = 0;
+  jsiTimerHeap = 0;
+  jsiTimerHeapCount = 0;
+  jsiTimerHeapSize = 0;
+  jsiTimerHeapStale = 0;
+}
+
+/// Build the heap from the timers in timerArray, return false if we couldn't
+static bool jsiTimerHeapBuild() {
+  JsVar *timerArrayPtr = jsvLock(timerArray);
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, timerArrayPtr);
+  bool ok = true;
+  while (ok && jsvObjectIteratorHasValue(&it)) {
+    JsVar *timerName = jsvObjectIteratorGetKey(&it);
+    JsVar *timerPtr = jsvSkipName(timerName);
+    JsSysTime timerTime = (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time"));
+    ok = jsiTimerHeapPush(timerName, jsiLastIdleTime + timerTime);
+    jsvUnLock2(timerPtr, timerName);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  jsvUnLock(timerArrayPtr);
+  if (!ok) {
+    jsiTimerHeapFree(); // "time" is still correct for everything
+    jsiTimerHeapFailed = true;
+  }
+  return ok;
+}
+#endif
+
+/// Get the time until a timer fires, relative to jsiLastIdleTime
+JsSysTime jsiTimerGetTime(JsVar *timerPtr) {
+#ifdef ESPR_TIMER_HEAP
+  int i = jsiTimerHeapFind(timerPtr);
+  if (i>=0) return jsiTimerHeap[i].time - jsiLastIdleTime;
+#endif
+  return (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time"));
+}
+
+/// Set the time until a timer fires, relative to jsiLastIdleTime
+void jsiTimerSetTime(JsVar *timerPtr, JsSysTime time) {
+  jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(time));
+#ifdef ESPR_TIMER_HEAP
+  int i = jsiTimerHeapFind(timerPtr);
+  if (i>=0) {
+    jsiTimerHeap[i].time = jsiLastIdleTime + time;
+    jsiTimerHeapUp((unsigned int)i);
+    jsiTimerHeapDown((unsigned int)i);
+  }
+#endif
+}
+
+/// Call before removing a timer from timerArray
+void jsiTimerRemoved(JsVar *timerPtr) {
+#ifdef ESPR_TIMER_HEAP
+  // Its heap entry goes stale when it's removed from timerArray - we don't need to find it now
+  if (jsiTimerHeapCurrent && jsvGetFirstChild(_jsvGetAddressOf(jsiTimerHeapCurrent))==jsvGetRef(timerPtr))
+    jsiTimerHeapCurrent = 0;
+  else if (jsiTimerHeapVar)
+    jsiTimerHeapStale++;
+  jsiTimerHeapFailed = false; // there may be space for the heap now
+#else
+  NOT_USED(timerPtr);
+#endif
+}
+
+/// The time that timers are relative to has jumped by 'diff' (eg. setTime) - keep the time until they fire the same
+void jsiTimersTimeChanged(JsSysTime diff) {
+#ifdef ESPR_TIMER_HEAP
+  for (unsigned int i=0;i<jsiTimerHeapCount;i++)
+    jsiTimerHeap[i].time += diff; // same for all, so the order doesn't change
+#else
+  NOT_USED(diff);
+#endif
+}
+
+/// Create an object for the `events` array: { func, args, this }
+static JsVar *jsiNewEventObject(JsVar *object, JsVar *callback, JsVar **args, int argCount) {
+  JsVar *event = jsvNewObject();
+  if (event) {
+    jsvUnLock(jsvAddNamedChild(event, callback, "func"));
+    if (argCount) {
+      JsVar *arr = jsvNewArray(args, argCount);
+      if (arr)
+        jsvAddNamedChildAndUnLock(event, arr, "args");
+    }
+    if (object) jsvUnLock(jsvAddNamedChild(event, object, "this"));
+  }
+  return event;
+}
+
+#ifdef ESPR_EVENT_QUEUE
+/* Events queued with jsiQueueEvents go in a fixed-size ring buffer, so
+ * queueing and dispatching them doesn't allocate any variables (rather than
+ * an object with func/this/args for each event in the `events` array).
+ *
+ * The ring holds locks on each event's callback, `this` and args. Bursts of
+ * events often come from the same object (eg. `emit` in a loop), and there
+ * are only a few bits for locks, so when an event has the same callback or
+ * `this` as the one queued before it, the lock is handed on to the new event
+ * rather than adding another. Only the newest event in each run owns a lock.
+ *
+ * If the ring is full, an event has too many args, or one of its vars has
+ * too many locks for us to add another, it goes in the `events` array as
+ * before. Once anything is in `events`, new events go there too (until it
+ * is empty) so they are still executed in the order they were queued. */
+#ifndef ESPR_EVENT_QUEUE_SIZE
+#define ESPR_EVENT_QUEUE_SIZE 64
+#endif
+#define ESPR_EVENT_QUEUE_ARGS 4 ///< Max args an event can have to go in the ring
+typedef enum {
+  JSIEV_OWNS_FUNC = 1, ///< This event holds the lock on 'func' (otherwise a later event does)
+  JSIEV_OWNS_THIS = 2, ///< This event holds the lock on 'thisVar' (otherwise a later event does)
+} PACKED_FLAGS JsiQueuedEventFlags;
+
+typedef struct {
+  JsVarRef func;     ///< The callback (function, string, or array of them)
+  JsVarRef thisVar;  ///< `this` for the callback (or 0)
+  JsiQueuedEventFlags flags;
+  uint8_t argCount;
+  JsVarRef args[ESPR_EVENT_QUEUE_ARGS]; ///< Each arg (if not 0) is locked
+} JsiQueuedEvent;
+
+static JsiQueuedEvent jsiEventQueue[ESPR_EVENT_QUEUE_SIZE];
+static unsigned int jsiEventQueueFirst = 0; ///< Index of the next event to execute
+static unsigned int jsiEventQueueCount = 0; ///< How many events are in the ring
+unsigned int jsiEventsDropped = 0; ///< Events we couldn't queue at all (out of memory)
+
+/// Can we add another lock to this var while it's in the queue? (leaving some for normal use)
+static ALWAYS_INLINE bool jsiEventQueueCanLock(JsVar *v) {
+  return !v || jsvGetLocks(v) < JSV_LOCK_MAX/2;
+}
+
+/// Try and add an event to the ring, return false if it must go in `events`
+static bool jsiEventQueuePush(JsVar *object, JsVar *callback, JsVar **args, int argCount) {
+  if (jsiEventQueueCount>=ESPR_EVENT_QUEUE_SIZE ||
+      argCount>ESPR_EVENT_QUEUE_ARGS ||
+      !jsvArrayIsEmpty(events))
+    return false;
+  JsVarRef funcRef = jsvGetRef(callback);
+  JsVarRef thisRef = object ? jsvGetRef(object) : 0;
+  JsiQueuedEvent *last = jsiEventQueueCount ? &jsiEventQueue[(jsiEventQueueFirst+jsiEventQueueCount-1) % ESPR_EVENT_QUEUE_SIZE] : 0;
+  // the last event always owns the locks on its vars
+  bool shareFunc = last && last->func==funcRef;
+  bool shareThis = last && thisRef && last->thisVar==thisRef;
+  if ((!shareFunc && !jsiEventQueueCanLock(callback)) ||
+      (!shareThis && !jsiEventQueueCanLock(object)))
+    return false;
+  for (int i=0;i<argCount;i++)
+    if (!jsiEventQueueCanLock(args[i])) return false;
+  if (shareFunc) last->flags &= (JsiQueuedEventFlags)~JSIEV_OWNS_FUNC;
+  else jsvLockAgain(callback);
+  if (shareThis) last->flags &= (JsiQueuedEventFlags)~JSIEV_OWNS_THIS;
+  else if (object) jsvLockAgain(object);
+  JsiQueuedEvent *e = &jsiEventQueue[(jsiEventQueueFirst+jsiEventQueueCount) % ESPR_EVENT_QUEUE_SIZE];
+  e->func = funcRef;
+  e->thisVar = thisRef;
+  e->flags = JSIEV_OWNS_FUNC | (thisRef ? JSIEV_OWNS_THIS : 0);
+  e->argCount = (uint8_t)argCount;
+  for (int i=0;i<argCount;i++)
+    e->args[i] = args[i] ? jsvGetRef(jsvLockAgain(args[i])) : 0;
+  jsiEventQueueCount++;
+  return true;
+}
+
+/** Take the next event out of the ring, filling in locked vars for it. The
+ * callback may queue more events, so it must be out of the ring first */
+static void jsiEventQueuePop(JsVar **func, JsVar **thisVar, JsVar **args, unsigned int *argCount) {
+  JsiQueuedEvent *e = &jsiEventQueue[jsiEventQueueFirst];
+  // if we don't own the lock, a later event does so the var is still there
+  *func = (e->flags & JSIEV_OWNS_FUNC) ? _jsvGetAddressOf(e->func) : jsvLock(e->func);
+  *thisVar = e->thisVar ? ((e->flags & JSIEV_OWNS_THIS) ? _jsvGetAddressOf(e->thisVar) : jsvLock(e->thisVar)) : 0;
+  *argCount = e->argCount;
+  for (unsigned int i=0;i<e->argCount;i++)
+    args[i] = e->args[i] ? _jsvGetAddressOf(e->args[i]) : 0;
+  jsiEventQueueFirst = (jsiEventQueueFirst+1) % ESPR_EVENT_QUEUE_SIZE;
+  jsiEventQueueCount--;
+}
+
+/// Empty the ring, moving its events to the start of `events` (so they're kept if we're saving)
+static void jsiEventQueueToArray() {
+  if (jsiEventQueueCount) {
+    JsVar *newEvents = jsvNewEmptyArray();
+    while (jsiEventQueueCount) {
+      JsVar *func, *thisVar, *args[ESPR_EVENT_QUEUE_ARGS];
+      unsigned int argCount;
+      jsiEventQueuePop(&func, &thisVar, args, &argCount);
+      JsVar *event = newEvents ? jsiNewEventObject(thisVar, func, args, (int)argCount) : 0;
+      if (event) jsvArrayPushAndUnLock(newEvents, event);
+      else jsiEventsDropped++;
+      jsvUnLockMany(argCount, args);
+      jsvUnLock2(func, thisVar);
+    }
+    if (newEvents) {
+      // anything already in `events` was queued after everything in the ring
+      jsvArrayPushAll(newEvents, events, false);
+      jsvUnLock(events);
+      events = newEvents;
+    }
+  }
+  jsiEventQueueFirst = 0;
+}
+#endif
+
 static JsVarRef _jsiInitNamedArray(const char *name) {
   JsVar *array = jsvObjectGetChild(execInfo.hiddenRoot, name, JSV_ARRAY);
   JsVarRef arrayRef = 0;
@@ -446,7 +806,10 @@ static JsVarRef _jsiInitNamedArray(const char *name) {
 void jsiSoftInit(bool hasBeenReset) {
   jsErrorFlags = 0;
   lastJsErrorFlags = 0;
-  events = jsvNewEmptyArray();
+  // if we were saving, events that were still queued were kept
+  events = jsvObjectGetChildIfExists(execInfo.hiddenRoot, JSI_EVENTS_NAME);
+  if (events) jsvObjectRemoveChild(execInfo.hiddenRoot, JSI_EVENTS_NAME);
+  else events = jsvNewEmptyArray();
   inputLine = jsvNewFromEmptyString();
   inputCursorPos = 0;
   jsiLineNumberOffset = 0;
@@ -534,6 +897,7 @@ void jsiDumpJSON(vcbprintf_callback user_callback, void *user_data, JsVar *data,
     // if it doesn't, print JSON
     jsfGetJSONWithCallback(data, NULL, JSON_SOME_NEWLINES | JSON_PRETTY | JSON_SHOW_DEVICES, 0, user_callback, user_data);
   }
+  jsvUnLock(name);
 }
 
 NO_INLINE static void jsiDumpEvent(vcbprintf_callback user_callback, void *user_data, JsVar *parentName, JsVar *eventKeyName, JsVar *eventFn) {
@@ -735,10 +1099,20 @@ void jsiSoftKill() {
   // Stop all active timer tasks
   jstReset();
   // Unref Watches/etc
+#ifdef ESPR_EVENT_QUEUE
+  jsiEventQueueToArray();
+#endif
   if (events) {
+    // keep any events that haven't run yet (if we're saving, they'll run after)
+    if (!jsvArrayIsEmpty(events))
+      jsvObjectSetChild(execInfo.hiddenRoot, JSI_EVENTS_NAME, events);
     jsvUnLock(events);
     events=0;
   }
+#ifdef ESPR_TIMER_HEAP
+  jsiTimerHeapFree(); // so timers' "time" is right when saved
+  jsiTimerHeapFailed = false;
+#endif
   if (timerArray) {
     jsvUnRefRef(timerArray);
     timerArray=0;
@@ -1673,19 +2047,297 @@ void jsiHandleChar(char ch) {
 /// Queue a function, string, or array (of funcs/strings) to be executed next time around the idle loop
 void jsiQueueEvents(JsVar *object, JsVar *callback, JsVar **args, int argCount) { // an array of functions, a string, or a single function
   assert(argCount<10);
-  JsVar *event = jsvNewObject();
-  if (event) { // Could be out of memory error!
-    jsvUnLock(jsvAddNamedChild(event, callback, "func"));
-    if (argCount) {
-      JsVar *arr = jsvNewArray(args, argCount);
-      if (arr)
-        jsvAddNamedChildAndUnLock(event, arr, "args");
-    }
-    if (object) jsvUnLock(jsvAddNamedChild(event, object, "this"));
+#ifdef ESPR_EVENT_QUEUE
+  if (jsiEventQueuePush(object, callback, args, argCount)) return;
+#endif
+  JsVar *event = jsiNewEventObject(object, callback, args, argCount);
+  if (event) // Could be out of memory error!
     jsvArrayPushAndUnLock(events, event);
+#ifdef ESPR_EVENT_QUEUE
+  else jsiEventsDropped++;
+#endif
+}
+
+
+#ifndef SAVE_ON_FLASH
+/* E.batchEvents - rather than queueing a callback for every event, the first
+ * argument of each event is added to a batch and one callback is queued with
+ * the whole batch when it has 'count' items or after 'maxDelay' ms. Numbers
+ * (and numeric fields of objects) are stored in Float32Arrays, so a batch of
+ * samples only uses a few vars however many there are.
+ *
+ * Batches are kept in the object itself as JSI_BATCH_NAME : { eventName : batch }
+ * where batch is { data, n, count, maxDelay, timer, obj, name, fields }. 'data' and
+ * 'n' are looked up for every event so they're first, and they're set to
+ * undefined rather than removed so they stay first. */
+#define JSI_BATCH_NAME JS_HIDDEN_CHAR_STR"bat"
+
+/// Create something to store a value like 'sample' in, with room for 'count' of them
+static JsVar *jsiBatchEventsNewData(JsVar *sample, int count) {
+  if (jsvIsNumeric(sample))
+    return jsvNewTypedArray(ARRAYBUFFERVIEW_FLOAT32, count);
+  if (jsvIsObject(sample))
+    return jsvNewObject(); // fields are added as they are found
+  return jsvNewEmptyArray();
+}
+
+/// Can 'sample' be stored in data (from jsiBatchEventsNewData)?
+static bool jsiBatchEventsCanStore(JsVar *data, JsVar *sample) {
+  if (jsvIsArrayBuffer(data)) return jsvIsNumeric(sample);
+  if (jsvIsArray(data)) return !jsvIsNumeric(sample) && !jsvIsObject(sample);
+  return jsvIsObject(sample);
+}
+
+/// Store a number at index 'n' of a Float32Array
+static void jsiBatchEventsSetFloat(JsVar *arr, int n, JsVarFloat value) {
+  size_t len;
+  float *ptr = (float*)jsvGetDataPointer(arr, &len); // 'len' is in elements for a Float32Array
+  if (ptr && (size_t)n < len) {
+    ptr[n] = (float)value; // fast path for flat buffers
+  } else {
+    JsVar *v = jsvNewFromFloat(value);
+    if (v) jsvArrayBufferSet(arr, (size_t)n, v);
+    jsvUnLock(v);
+  }
+}
+
+/// Store 'sample' at index 'n' in data (from jsiBatchEventsNewData)
+static void jsiBatchEventsSet(JsVar *data, int n, JsVar *sample, int count) {
+  if (jsvIsArrayBuffer(data)) {
+    jsiBatchEventsSetFloat(data, n, jsvGetFloat(sample));
+  } else if (jsvIsArray(data)) {
+    jsvSetArrayItem(data, n, sample);
+  } else if (jsvIsObject(sample)) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, sample);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *key = jsvObjectIteratorGetKey(&it);
+      JsVar *value = jsvObjectIteratorGetValue(&it);
+      JsVar *field = jsvSkipNameAndUnLock(jsvFindChildFromVar(data, key, false));
+      if (!field) {
+        field = jsiBatchEventsNewData(value, count);
+        if (field) jsvObjectSetChildVar(data, key, field);
+      }
+      if (field && !jsvIsObject(field)) // don't go any deeper than one level of object
+        jsiBatchEventsSet(field, n, value, count);
+      jsvUnLock3(field, value, key);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
   }
 }
 
+/// Trim data to 'n' items - typed arrays that weren't filled become shorter views of the same buffer
+static JsVar *jsiBatchEventsTrim(JsVar *data, int n, int count) {
+  if (jsvIsArrayBuffer(data)) {
+    if (n>=count) return jsvLockAgain(data);
+    JsVar *buffer = jsvLock(jsvGetFirstChild(data));
+    JsVar *view = jswrap_typedarray_constructor(ARRAYBUFFERVIEW_FLOAT32, buffer, 0, n);
+    jsvUnLock(buffer);
+    return view;
+  }
+  if (jsvIsObject(data) && n<count) {
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, data);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *value = jsvObjectIteratorGetValue(&it);
+      JsVar *trimmed = jsiBatchEventsTrim(value, n, count);
+      jsvObjectIteratorSetValue(&it, trimmed);
+      jsvUnLock2(trimmed, value);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+  }
+  return jsvLockAgain(data);
+}
+
+/// Queue a callback with everything in the batch (and empty it)
+static void jsiBatchEventsFlush(JsVar *batch) {
+  JsVar *timer = jsvObjectGetChildIfExists(batch, "timer");
+  if (timer) {
+    JsVar *timerArgs = jsvNewArray(&timer, 1);
+    if (timerArgs) jswrap_interface_clearTimeout(timerArgs);
+    jsvUnLock2(timerArgs, timer);
+    jsvObjectSetChild(batch, "timer", 0);
+  }
+  JsVar *data = jsvObjectGetChildIfExists(batch, "data");
+  if (!data) return;
+  jsvObjectSetChild(batch, "data", 0);
+  int n = (int)jsvObjectGetIntegerChild(batch, "n");
+  int count = (int)jsvObjectGetIntegerChild(batch, "count");
+  JsVar *fields = jsvObjectGetChildIfExists(batch, "fields");
+  JsVar *result;
+  if (fields && jsvIsArrayBuffer(data)) { // from jsiBatchEventsAddFloats - split into columns
+    jsvObjectSetChild(batch, "fields", 0);
+    result = jsvNewObject();
+    JsVar *buffer = jsvLock(jsvGetFirstChild(data));
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, fields);
+    int i = 0;
+    while (result && jsvObjectIteratorHasValue(&it)) {
+      JsVar *name = jsvObjectIteratorGetValue(&it);
+      JsVar *column = jswrap_typedarray_constructor(ARRAYBUFFERVIEW_FLOAT32, buffer, (JsVarInt)(i*count*(int)sizeof(float)), n);
+      if (column) jsvObjectSetChildVar(result, name, column);
+      jsvUnLock2(column, name);
+      i++;
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvUnLock(buffer);
+  } else {
+    result = jsiBatchEventsTrim(data, n, count);
+  }
+  jsvUnLock2(fields, data);
+  JsVar *object = jsvObjectGetChildIfExists(batch, "obj");
+  JsVar *name = jsvObjectGetChildIfExists(batch, "name");
+  JsVar *callback = (object && name) ? jsvSkipNameAndUnLock(jsvFindChildFromVar(object, name, false)) : 0;
+  if (callback && result) jsiQueueEvents(object, callback, &result, 1);
+  jsvUnLock4(callback, name, object, result);
+}
+
+/// Called from a timeout when a batch has waited for 'maxDelay'
+static void jsiBatchEventsTimeout(JsVar *batch) {
+  jsvObjectSetChild(batch, "timer", 0); // the timeout is finished - don't try and clear it
+  jsiBatchEventsFlush(batch);
+}
+
+/// Start a new batch using 'data', starting the timeout for 'maxDelay' if needed
+static void jsiBatchEventsStart(JsVar *batch, JsVar *data) {
+  jsvObjectSetChild(batch, "data", data);
+  JsVarFloat maxDelay = jsvObjectGetFloatChild(batch, "maxDelay");
+  if (maxDelay>0) {
+    JsVar *fn = jsvNewNativeFunction((void (*)(void))jsiBatchEventsTimeout, JSWAT_VOID|JSWAT_THIS_ARG);
+    if (fn) {
+      jsvObjectSetChild(fn, JSPARSE_FUNCTION_THIS_NAME, batch); // bind 'this'
+      jsvObjectSetChildAndUnLock(batch, "timer", jswrap_interface_setTimeout(fn, maxDelay, 0));
+      jsvUnLock(fn);
+    }
+  }
+}
+
+/// We've just added item 'n' to the batch - send it if it's full
+static void jsiBatchEventsAdded(JsVar *batch, int n, int count) {
+  jsvObjectSetChildAndUnLock(batch, "n", jsvNewFromInteger(n+1));
+  if (n+1 >= count) jsiBatchEventsFlush(batch);
+}
+
+/// Add the first of 'args' to the batch, queueing a callback if it's full
+static void jsiBatchEventsAdd(JsVar *batch, JsVar **args, int argCount) {
+  JsVar *sample = argCount ? args[0] : 0;
+  int n = 0;
+  int count = (int)jsvObjectGetIntegerChild(batch, "count");
+  JsVar *data = jsvObjectGetChildIfExists(batch, "data");
+  JsVar *fields = data ? jsvObjectGetChildIfExists(batch, "fields") : 0;
+  if (data && (fields || !jsiBatchEventsCanStore(data, sample))) {
+    // the batch came from jsiBatchEventsAddFloats (or had a different type of sample) - send what we have
+    jsvUnLock(data);
+    jsiBatchEventsFlush(batch);
+    data = 0;
+  }
+  jsvUnLock(fields);
+  if (data) {
+    n = (int)jsvObjectGetIntegerChild(batch, "n");
+  } else {
+    data = jsiBatchEventsNewData(sample, count);
+    if (!data) return; // out of memory - we lose this sample
+    jsiBatchEventsStart(batch, data);
+  }
+  jsiBatchEventsSet(data, n, sample, count);
+  jsvUnLock(data);
+  jsiBatchEventsAdded(batch, n, count);
+}
+
+/// Get the batch for the given event name on an object (or 0 if it's not being batched)
+static JsVar *jsiBatchEventsGet(JsVar *object, JsVar *eventName, const char *eventNameStr) {
+  JsVar *batches = jsvObjectGetChildIfExists(object, JSI_BATCH_NAME);
+  if (!batches) return 0;
+  JsVar *batch = eventName ?
+      jsvSkipNameAndUnLock(jsvFindChildFromVar(batches, eventName, false)) :
+      jsvObjectGetChildIfExists(batches, eventNameStr);
+  jsvUnLock(batches);
+  return batch;
+}
+
+bool jsiBatchEventsAddFloats(JsVar *object, const char *callbackName, const char **names, const JsVarFloat *values, int valueCount) {
+  JsVar *batch = jsiBatchEventsGet(object, 0, callbackName);
+  if (!batch) return false;
+  int n = 0;
+  int count = (int)jsvObjectGetIntegerChild(batch, "count");
+  // views into the buffer have a 16 bit byte offset
+  if ((size_t)count*(size_t)valueCount*sizeof(float) > 0xFFFF) {
+    jsvUnLock(batch);
+    return false;
+  }
+  /* All values go in one Float32Array, one column of 'count' per name,
+   * so adding a sample doesn't need to look anything up. When sent, each
+   * column becomes a view on the same buffer (see jsiBatchEventsFlush) */
+  JsVar *data = jsvObjectGetChildIfExists(batch, "data");
+  if (data) {
+    JsVar *fields = jsvObjectGetChildIfExists(batch, "fields");
+    bool matches = fields && jsvIsArrayBuffer(data) && jsvGetArrayLength(fields)==(JsVarInt)valueCount;
+    jsvUnLock(fields);
+    if (!matches) { // the batch was started by a JS event (or other fields) - send what we have
+      jsvUnLock(data);
+      jsiBatchEventsFlush(batch);
+      data = 0;
+    }
+  }
+  if (data) {
+    n = (int)jsvObjectGetIntegerChild(batch, "n");
+  } else {
+    data = jsvNewTypedArray(ARRAYBUFFERVIEW_FLOAT32, count*valueCount);
+    JsVar *fields = jsvNewEmptyArray();
+    if (!data || !fields) { // out of memory - we lose this sample
+      jsvUnLock3(fields, data, batch);
+      return true;
+    }
+    for (int i=0;i<valueCount;i++)
+      jsvArrayPushAndUnLock(fields, jsvNewFromString(names[i]));
+    jsvObjectSetChildAndUnLock(batch, "fields", fields);
+    jsiBatchEventsStart(batch, data);
+  }
+  size_t len;
+  float *ptr = (float*)jsvGetDataPointer(data, &len);
+  for (int i=0;i<valueCount;i++) {
+    if (ptr) ptr[i*count + n] = (float)values[i];
+    else jsiBatchEventsSetFloat(data, i*count + n, values[i]);
+  }
+  jsvUnLock(data);
+  jsiBatchEventsAdded(batch, n, count);
+  jsvUnLock(batch);
+  return true;
+}
+
+void jsiBatchEvents(JsVar *object, JsVar *eventName, int count, JsVarFloat maxDelay) {
+  JsVar *batch = jsiBatchEventsGet(object, eventName, 0);
+  if (batch) {
+    jsiBatchEventsFlush(batch);
+    jsvUnLock(batch);
+  }
+  JsVar *batches = jsvObjectGetChild(object, JSI_BATCH_NAME, JSV_OBJECT);
+  if (!batches) return;
+  if (count<=0) {
+    JsVar *batchName = jsvFindChildFromVar(batches, eventName, false);
+    if (batchName) jsvRemoveChildAndUnLock(batches, batchName);
+    if (!jsvGetChildren(batches)) jsvObjectRemoveChild(object, JSI_BATCH_NAME);
+  } else {
+    batch = jsvNewObject();
+    if (batch) {
+      jsvObjectSetChild(batch, "data", 0);
+      jsvObjectSetChildAndUnLock(batch, "n", jsvNewFromInteger(0));
+      jsvObjectSetChildAndUnLock(batch, "count", jsvNewFromInteger(count));
+      jsvObjectSetChildAndUnLock(batch, "maxDelay", jsvNewFromFloat(maxDelay));
+      jsvObjectSetChild(batch, "timer", 0);
+      jsvObjectSetChild(batch, "obj", object);
+      jsvObjectSetChild(batch, "name", eventName);
+      jsvObjectSetChildVar(batches, eventName, batch);
+      jsvUnLock(batch);
+    }
+  }
+  jsvUnLock(batches);
+}
+#endif
+
 bool jsiObjectHasCallbacks(JsVar *object, const char *callbackName) {
   JsVar *callback = jsvObjectGetChildIfExists(object, callbackName);
   bool hasCallbacks = !jsvIsUndefined(callback);
@@ -1696,26 +2348,70 @@ bool jsiObjectHasCallbacks(JsVar *object, const char *callbackName) {
 void jsiQueueObjectCallbacks(JsVar *object, const char *callbackName, JsVar **args, int argCount) {
   JsVar *callback = jsvObjectGetChildIfExists(object, callbackName);
   if (!callback) return;
+#ifndef SAVE_ON_FLASH
+  JsVar *batch = jsiBatchEventsGet(object, 0, callbackName);
+  if (batch) {
+    jsiBatchEventsAdd(batch, args, argCount);
+    jsvUnLock2(batch, callback);
+    return;
+  }
+#endif
+  jsiQueueEvents(object, callback, args, argCount);
+  jsvUnLock(callback);
+}
+
+void jsiQueueObjectCallbacksVar(JsVar *object, JsVar *eventName, JsVar **args, int argCount) {
+  JsVar *callback = jsvSkipNameAndUnLock(jsvFindChildFromVar(object, eventName, false));
+  if (!callback) return;
+#ifndef SAVE_ON_FLASH
+  JsVar *batch = jsiBatchEventsGet(object, eventName, 0);
+  if (batch) {
+    jsiBatchEventsAdd(batch, args, argCount);
+    jsvUnLock2(batch, callback);
+    return;
+  }
+#endif
   jsiQueueEvents(object, callback, args, argCount);
   jsvUnLock(callback);
 }
 
+/// Are there any events waiting to be executed?
+static bool jsiHasEvents() {
+#ifdef ESPR_EVENT_QUEUE
+  if (jsiEventQueueCount) return true;
+#endif
+  return !jsvArrayIsEmpty(events);
+}
+
 void jsiExecuteEvents() {
-  bool hasEvents = !jsvArrayIsEmpty(events);
+  bool hasEvents = jsiHasEvents();
   if (hasEvents) jsiSetBusy(BUSY_INTERACTIVE, true);
-  while (!jsvArrayIsEmpty(events)) {
-    JsVar *event = jsvSkipNameAndUnLock(jsvArrayPopFirst(events));
-    // Get function to execute
-    JsVar *func = jsvObjectGetChildIfExists(event, "func");
-    JsVar *thisVar = jsvObjectGetChildIfExists(event, "this");
-    JsVar *argsArray = jsvObjectGetChildIfExists(event, "args");
-    // free actual event
-    jsvUnLock(event);
-    // now run..
-    jsiExecuteEventCallbackArgsArray(thisVar, func, argsArray);
-    jsvUnLock(argsArray);
-    //jsPrint("Event Done\n");
-    jsvUnLock2(func, thisVar);
+  while (jsiHasEvents()) {
+#ifdef ESPR_EVENT_QUEUE
+    // Everything in the ring was queued before anything in `events`, so run the ring first
+    while (jsiEventQueueCount) {
+      JsVar *func, *thisVar, *args[ESPR_EVENT_QUEUE_ARGS];
+      unsigned int argCount;
+      jsiEventQueuePop(&func, &thisVar, args, &argCount);
+      jsiExecuteEventCallback(thisVar, func, argCount, args);
+      jsvUnLockMany(argCount, args);
+      jsvUnLock2(func, thisVar);
+    }
+#endif
+    while (!jsvArrayIsEmpty(events)) {
+      JsVar *event = jsvSkipNameAndUnLock(jsvArrayPopFirst(events));
+      // Get function to execute
+      JsVar *func = jsvObjectGetChildIfExists(event, "func");
+      JsVar *thisVar = jsvObjectGetChildIfExists(event, "this");
+      JsVar *argsArray = jsvObjectGetChildIfExists(event, "args");
+      // free actual event
+      jsvUnLock(event);
+      // now run..
+      jsiExecuteEventCallbackArgsArray(thisVar, func, argsArray);
+      jsvUnLock(argsArray);
+      //jsPrint("Event Done\n");
+      jsvUnLock2(func, thisVar);
+    }
   }
   if (hasEvents) {
     jsiSetBusy(BUSY_INTERACTIVE, false);
@@ -1905,6 +2601,93 @@ void jsiHandleIOEventForConsole(IOEvent *event) {
   jsiSetBusy(BUSY_INTERACTIVE, false);
 }
 
+/** Run the callback for a timer that has expired ('timerTime' is relative to
+ * jsiLastIdleTime, so <=0). Returns true if the timer should now be removed,
+ * or false if it is an interval, in which case *interval is set to it */
+static bool jsiExecuteTimer(JsVar *timerPtr, JsSysTime timerTime, JsSysTime *interval) {
+  JsVar *timerCallback = jsvObjectGetChildIfExists(timerPtr, "callback");
+  JsVar *watchPtr = jsvObjectGetChildIfExists(timerPtr, "watch"); // for debounce - may be undefined
+  bool exec = true;
+  JsVar *data = 0;
+  if (watchPtr) {
+    bool watchState = jsvObjectGetBoolChild(watchPtr, "state");
+    bool timerState = jsvObjectGetBoolChild(timerPtr, "state");
+    jsvObjectSetChildAndUnLock(watchPtr, "state", jsvNewFromBool(timerState));
+    exec = false;
+    if (watchState!=timerState) {
+      // Create the 'time' variable that will be passed to the user and stored as last time
+      JsVarInt delay = jsvObjectGetIntegerChild(watchPtr, "debounce");
+      JsVar *timePtr = jsvNewFromFloat(jshGetMillisecondsFromTime(jsiLastIdleTime+timerTime-delay)/1000);
+      // If it's the right edge...
+      if (jsiShouldExecuteWatch(watchPtr, timerState)) {
+        data = jsvNewObject();
+        // if we were from a watch then we were delayed by the debounce time...
+        if (data) {
+          exec = true;
+          // if it was a watch, set the last state up
+          jsvObjectSetChildAndUnLock(data, "state", jsvNewFromBool(timerState));
+          // set up the lastTime variable of data to what was in the watch
+          jsvObjectSetChildAndUnLock(data, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
+          // set up the watches lastTime to this one
+          jsvObjectSetChild(data, "time", timePtr); // don't unlock - use this later
+          jsvObjectSetChildAndUnLock(data, "pin", jsvObjectGetChildIfExists(watchPtr, "pin"));
+        }
+      }
+      // Update lastTime regardless of which edge we're watching
+      jsvObjectSetChildAndUnLock(watchPtr, "lastTime", timePtr);
+    }
+  }
+  bool removeTimer = false;
+  if (exec) {
+    bool execResult;
+    if (data) {
+      execResult = jsiExecuteEventCallback(0, timerCallback, 1, &data);
+    } else {
+      JsVar *argsArray = jsvObjectGetChildIfExists(timerPtr, "args");
+      execResult = jsiExecuteEventCallbackArgsArray(0, timerCallback, argsArray);
+      jsvUnLock(argsArray);
+    }
+    if (!execResult) {
+      JsVar *intervalVar = jsvObjectGetChildIfExists(timerPtr, "interval");
+      if (intervalVar) { // if interval then it's setInterval not setTimeout
+        jsvUnLock(intervalVar);
+        jsError("Ctrl-C while processing interval - removing it.");
+        jsErrorFlags |= JSERR_CALLBACK;
+        removeTimer = true;
+      }
+    }
+  }
+  jsvUnLock(data);
+  if (watchPtr) { // if we had a watch pointer, be sure to remove us from it
+    jsvObjectRemoveChild(watchPtr, "timeout");
+    // Deal with non-recurring watches
+    if (exec) {
+      bool watchRecurring = jsvObjectGetBoolChild(watchPtr,  "recur");
+      if (!watchRecurring) {
+        JsVar *watchArrayPtr = jsvLock(watchArray);
+        JsVar *watchNamePtr = jsvGetIndexOf(watchArrayPtr, watchPtr, true);
+        if (watchNamePtr) {
+          jsvRemoveChildAndUnLock(watchArrayPtr, watchNamePtr);
+        }
+        jsvUnLock(watchArrayPtr);
+        Pin pin = jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin"));
+        if (!jsiIsWatchingPin(pin))
+          jshPinWatch(pin, false, JSPW_NONE);
+      }
+    }
+    jsvUnLock(watchPtr);
+  }
+  // Load interval *after* executing code, in case it has changed
+  JsVar *intervalVar = jsvObjectGetChildIfExists(timerPtr, "interval");
+  if (!removeTimer && intervalVar) {
+    *interval = jsvGetLongInteger(intervalVar);
+  } else {
+    removeTimer = true;
+  }
+  jsvUnLock2(timerCallback,intervalVar);
+  return removeTimer;
+}
+
 void jsiIdle() {
   // This is how many times we have been here and not done anything.
   // It will be zeroed if we do stuff later
@@ -1917,7 +2700,12 @@ void jsiIdle() {
   // Just process what was in the event queue at the start
   int maxEvents = jshGetEventsUsed();
 
-  while ((maxEvents--)>0 && jshPopIOEvent(&event)) {
+  while ((maxEvents--)>0 &&
+#ifdef ESPR_EVENT_QUEUE
+         // leave IO events where they are (so flow control can kick in) if we can't keep up
+         jsiEventQueueCount < ESPR_EVENT_QUEUE_SIZE*3/4 &&
+#endif
+         jshPopIOEvent(&event)) {
     jsiSetBusy(BUSY_INTERACTIVE, true);
     wasBusy = true;
 
@@ -2010,8 +2798,8 @@ void jsiIdle() {
             bool oldWatchState = jsvObjectGetBoolChild(watchPtr, "state");
             JsVar *timeout = jsvObjectGetChildIfExists(watchPtr, "timeout");
             if (timeout) { // if we had a timeout, update the callback time
-              JsSysTime timeoutTime = jsiLastIdleTime + (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timeout, "time"));
-              jsvUnLock(jsvObjectSetChild(timeout, "time", jsvNewFromLongInteger((JsSysTime)(eventTime - jsiLastIdleTime) + debounce)));
+              JsSysTime timeoutTime = jsiLastIdleTime + jsiTimerGetTime(timeout);
+              jsiTimerSetTime(timeout, (JsSysTime)(eventTime - jsiLastIdleTime) + debounce);
               jsvObjectSetChildAndUnLock(timeout, "state", jsvNewFromBool(pinIsHigh));
               if (eventTime > timeoutTime && pinIsHigh!=oldWatchState) {
                 // timeout should have fired, but we didn't get around to executing it!
@@ -2094,6 +2882,11 @@ void jsiIdle() {
   }
 
   // Check timers
+#ifdef ESPR_TIMER_HEAP
+  // (timers' "time" is relative to jsiLastIdleTime before we update it)
+  if (!jsiTimerHeapVar && !jsiTimerHeapFailed && jsiHasTimers())
+    jsiTimerHeapBuild();
+#endif
   JsSysTime minTimeUntilNext = JSSYSTIME_MAX;
   JsSysTime time = jshGetSystemTime();
   JsSysTime timePassed = time - jsiLastIdleTime;
@@ -2106,6 +2899,50 @@ void jsiIdle() {
     jsiTimeSinceCtrlC = 0xFFFFFFFF;
 #endif
 
+#ifdef ESPR_TIMER_HEAP
+  if (jsiTimerHeapVar) {
+    JsVar *timerArrayPtr = jsvLock(timerArray);
+    // Timers rescheduled in this pass (eg. short intervals) wait for the next one
+    uint32_t firstNewSeq = jsiTimerHeapSeq;
+    jsiTimerHeapCheckStale();
+    jsiTimerHeapPopStale();
+    while (jsiTimerHeapCount &&
+           jsiTimerHeap[0].time <= jsiLastIdleTime &&
+           (int32_t)(jsiTimerHeap[0].seq - firstNewSeq) < 0) {
+      JsiTimerHeapEntry entry = jsiTimerHeap[0];
+      jsiTimerHeapRemoveAt(0);
+      JsVar *timerName = _jsvGetAddressOf(entry.name); // already locked by the heap
+      JsVar *timerPtr = jsvSkipName(timerName);
+      jsiTimerHeapCurrent = entry.name;
+      // we're now doing work
+      jsiSetBusy(BUSY_INTERACTIVE, true);
+      wasBusy = true;
+      JsSysTime interval = 0;
+      bool removeTimer = jsiExecuteTimer(timerPtr, entry.time - jsiLastIdleTime, &interval);
+      if (!jsiTimerHeapCurrent) {
+        // removed (eg. clearTimeout) while it was executing
+      } else if (removeTimer || !jsiTimerHeapVar || !jsiTimerHeapPush(timerName, entry.time + interval)) {
+        if (!removeTimer) { // we couldn't reschedule in the heap, so go back to scanning
+          jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(entry.time + interval - jsiLastIdleTime));
+          jsiTimerHeapFree();
+          jsiTimerHeapFailed = true;
+        } else {
+          jsvRemoveChild(timerArrayPtr, timerName);
+        }
+      }
+      jsiTimerHeapCurrent = 0;
+      jsvUnLock2(timerPtr, timerName);
+      if (!jsiTimerHeapVar) break;
+      jsiTimerHeapPopStale(); // timers may have been removed while it executed
+    }
+    if (jsiTimerHeapCount) {
+      minTimeUntilNext = jsiTimerHeap[0].time - jsiLastIdleTime;
+      if (minTimeUntilNext < 0) minTimeUntilNext = 0;
+    }
+    jsvUnLock(timerArrayPtr);
+  } else
+#endif
+  {
   JsVar *timerArrayPtr = jsvLock(timerArray);
   JsvObjectIterator it;
   // Go through all intervals and decrement time
@@ -2131,82 +2968,9 @@ void jsiIdle() {
         // we're now doing work
         jsiSetBusy(BUSY_INTERACTIVE, true);
         wasBusy = true;
-        JsVar *timerCallback = jsvObjectGetChildIfExists(timerPtr, "callback");
-        JsVar *watchPtr = jsvObjectGetChildIfExists(timerPtr, "watch"); // for debounce - may be undefined
-        bool exec = true;
-        JsVar *data = 0;
-        if (watchPtr) {
-          bool watchState = jsvObjectGetBoolChild(watchPtr, "state");
-          bool timerState = jsvObjectGetBoolChild(timerPtr, "state");
-          jsvObjectSetChildAndUnLock(watchPtr, "state", jsvNewFromBool(timerState));
-          exec = false;
-          if (watchState!=timerState) {
-            // Create the 'time' variable that will be passed to the user and stored as last time
-            JsVarInt delay = jsvObjectGetIntegerChild(watchPtr, "debounce");
-            JsVar *timePtr = jsvNewFromFloat(jshGetMillisecondsFromTime(jsiLastIdleTime+timerTime-delay)/1000);
-            // If it's the right edge...
-            if (jsiShouldExecuteWatch(watchPtr, timerState)) {
-              data = jsvNewObject();
-              // if we were from a watch then we were delayed by the debounce time...
-              if (data) {
-                exec = true;
-                // if it was a watch, set the last state up
-                jsvObjectSetChildAndUnLock(data, "state", jsvNewFromBool(timerState));
-                // set up the lastTime variable of data to what was in the watch
-                jsvObjectSetChildAndUnLock(data, "lastTime", jsvObjectGetChildIfExists(watchPtr, "lastTime"));
-                // set up the watches lastTime to this one
-                jsvObjectSetChild(data, "time", timePtr); // don't unlock - use this later
-                jsvObjectSetChildAndUnLock(data, "pin", jsvObjectGetChildIfExists(watchPtr, "pin"));
-              }
-            }
-            // Update lastTime regardless of which edge we're watching
-            jsvObjectSetChildAndUnLock(watchPtr, "lastTime", timePtr);
-          }
-        }
-        bool removeTimer = false;
-        if (exec) {
-          bool execResult;
-          if (data) {
-            execResult = jsiExecuteEventCallback(0, timerCallback, 1, &data);
-          } else {
-            JsVar *argsArray = jsvObjectGetChildIfExists(timerPtr, "args");
-            execResult = jsiExecuteEventCallbackArgsArray(0, timerCallback, argsArray);
-            jsvUnLock(argsArray);
-          }
-          if (!execResult) {
-            JsVar *interval = jsvObjectGetChildIfExists(timerPtr, "interval");
-            if (interval) { // if interval then it's setInterval not setTimeout
-              jsvUnLock(interval);
-              jsError("Ctrl-C while processing interval - removing it.");
-              jsErrorFlags |= JSERR_CALLBACK;
-              removeTimer = true;
-            }
-          }
-        }
-        jsvUnLock(data);
-        if (watchPtr) { // if we had a watch pointer, be sure to remove us from it
-          jsvObjectRemoveChild(watchPtr, "timeout");
-          // Deal with non-recurring watches
-          if (exec) {
-            bool watchRecurring = jsvObjectGetBoolChild(watchPtr,  "recur");
-            if (!watchRecurring) {
-              JsVar *watchArrayPtr = jsvLock(watchArray);
-              JsVar *watchNamePtr = jsvGetIndexOf(watchArrayPtr, watchPtr, true);
-              if (watchNamePtr) {
-                jsvRemoveChildAndUnLock(watchArrayPtr, watchNamePtr);
-              }
-              jsvUnLock(watchArrayPtr);
-              Pin pin = jshGetPinFromVarAndUnLock(jsvObjectGetChildIfExists(watchPtr, "pin"));
-              if (!jsiIsWatchingPin(pin))
-                jshPinWatch(pin, false, JSPW_NONE);
-            }
-          }
-          jsvUnLock(watchPtr);
-        }
-        // Load interval *after* executing code, in case it has changed
-        JsVar *interval = jsvObjectGetChildIfExists(timerPtr, "interval");
-        if (!removeTimer && interval) {
-          timerTime = timerTime + jsvGetLongInteger(interval);
+        JsSysTime interval = 0;
+        if (!jsiExecuteTimer(timerPtr, timerTime, &interval)) {
+          timerTime = timerTime + interval;
           jsvObjectSetChildAndUnLock(timerPtr, "time", jsvNewFromLongInteger(timerTime));
         } else {
           // free
@@ -2215,7 +2979,6 @@ void jsiIdle() {
           hasDeletedTimer = true;
           timerTime = -1;
         }
-        jsvUnLock2(timerCallback,interval);
       }
       // update the time until the next timer
       if (timerTime>=0 && timerTime < minTimeUntilNext)
@@ -2228,6 +2991,7 @@ void jsiIdle() {
     jsvObjectIteratorFree(&it);
   } while (jsiStatus & JSIS_TIMERS_CHANGED);
   jsvUnLock(timerArrayPtr);
+  }
   /* We might have left the timers loop with stuff to do because the contents of it
    * changed. It's not a big deal because it could only have changed because a timer
    * got executed - so `wasBusy` got set and we know we're going to go around the
@@ -2238,7 +3002,7 @@ void jsiIdle() {
   if (jswIdle()) wasBusy = true;
 
   // Just in case we got any events to do and didn't clear loopsIdling before
-  if (wasBusy || !jsvArrayIsEmpty(events) )
+  if (wasBusy || jsiHasEvents())
     loopsIdling = 0;
 
   if (wasBusy)
@@ -2312,6 +3076,23 @@ void jsiIdle() {
   if (jsiStatus & JSIS_WATCHDOG_AUTO)
     jshKickWatchDog();
 
+#ifdef ESPR_GC_INCREMENTAL
+  /* If we're getting low on memory, do a short slice of Garbage Collection
+   * each time around this loop (even if we're busy) rather than waiting
+   * until we have time to do it all at once. Counting free vars takes a
+   * while, so if we're busy we only check every 16 times around. */
+  static unsigned char gcCheckCount = 0;
+  if (jsvGarbageCollectInProgress() ||
+      (jsvGCSliceTime && (loopsIdling==1 || !(++gcCheckCount&15)) &&
+       !jsvMoreFreeVariablesThan(JS_VARS_BEFORE_INCREMENTAL_GC))) {
+    jsiSetBusy(BUSY_INTERACTIVE, true);
+    bool inProgress = jsvGarbageCollectStep();
+    jsiSetBusy(BUSY_INTERACTIVE, false);
+    /* If there's more to do, return without sleeping so we come
+     * straight back (handling any events that came in first) */
+    if (inProgress) return;
+  } else
+#endif
   /* if we've been around this loop, there is nothing to do, and
    * we have a spare 10ms then let's do some Garbage Collection
    * if we think we need to */
@@ -2327,6 +3108,19 @@ void jsiIdle() {
     return;
   }
 
+#ifdef ESPR_STORAGE_COMPACT_IDLE
+  /* If there's nothing else to do, compact Storage a slice at a time so
+   * erased files are cleared up before Storage fills and we'd have to
+   * stop for a long time to compact it all at once. */
+  if (loopsIdling>=1 && jsfCompactSliceTime>0 && !jshHasEvents() &&
+      minTimeUntilNext > jshGetTimeFromMilliseconds(jsfCompactSliceTime)) {
+    jsiSetBusy(BUSY_INTERACTIVE, true);
+    bool inProgress = jsfCompactIdle();
+    jsiSetBusy(BUSY_INTERACTIVE, false);
+    if (inProgress) return;
+  }
+#endif
+
   // Go to sleep!
   if (loopsIdling>=1 && // once around the idle loop without having done any work already (just in case)
 #if defined(USB) && !defined(EMSCRIPTEN)
@@ -2440,6 +3234,9 @@ void jsiDumpState(vcbprintf_callback user_callback, void *user_data) {
   }
   jsvObjectIteratorFree(&it);
   // Now do timers
+#ifdef ESPR_TIMER_HEAP
+  jsiTimerHeapSync();
+#endif
   JsVar *timerArrayPtr = jsvLock(timerArray);
   jsvObjectIteratorNew(&it, timerArrayPtr);
   jsvUnLock(timerArrayPtr);
@@ -2498,6 +3295,18 @@ void jsiDumpState(vcbprintf_callback user_callback, void *user_data) {
 JsVarInt jsiTimerAdd(JsVar *timerPtr) {
   JsVar *timerArrayPtr = jsvLock(timerArray);
   JsVarInt itemIndex = jsvArrayAddToEnd(timerArrayPtr, timerPtr, 1) - 1;
+#ifdef ESPR_TIMER_HEAP
+  if (jsiTimerHeapVar && itemIndex>=0) {
+    jsiTimerHeapCheckStale(); // so cancelling and re-adding timers doesn't grow the heap
+    JsVar *timerName = jsvLock(jsvGetLastChild(timerArrayPtr));
+    JsSysTime timerTime = (JsSysTime)jsvGetLongIntegerAndUnLock(jsvObjectGetChildIfExists(timerPtr, "time"));
+    if (!jsiTimerHeapPush(timerName, jsiLastIdleTime + timerTime)) {
+      jsiTimerHeapFree(); // go back to scanning timerArray
+      jsiTimerHeapFailed = true;
+    }
+    jsvUnLock(timerName);
+  }
+#endif
   jsvUnLock(timerArrayPtr);
   return itemIndex;
 }
@@ -24,6 +24,7 @@
 #define JSI_INIT_CODE_NAME "init" ///< used to temporarily store initialisation JS code for state in save()
 #define JSI_LOAD_CODE_NAME "load" ///< used to temporarily store the name of a file to load from Storage when load(xyz) is used
 #define JSI_JSFLAGS_NAME "flags"
+#define JSI_EVENTS_NAME "events" ///< used to keep events that are still queued while in save()
 #define JSI_ONINIT_NAME "onInit"
 
 /// autoLoad = do we load the current state if it exists?
@@ -53,6 +54,19 @@ void jsiQueueEvents(JsVar *object, JsVar *callback, JsVar **args, int argCount);
 bool jsiObjectHasCallbacks(JsVar *object, const char *callbackName);
 /// Queue up callbacks for other things (touchscreen? network?)
 void jsiQueueObjectCallbacks(JsVar *object, const char *callbackName, JsVar **args, int argCount);
+/// Same as jsiQueueObjectCallbacks, but with the callback name (eg. "#ondata") as a String
+void jsiQueueObjectCallbacksVar(JsVar *object, JsVar *eventName, JsVar **args, int argCount);
+#ifndef SAVE_ON_FLASH
+/// Batch events called 'eventName' (eg. "#ondata") on object into one callback per 'count' (or per 'maxDelay' ms). count<=0 stops batching
+void jsiBatchEvents(JsVar *object, JsVar *eventName, int count, JsVarFloat maxDelay);
+/** For native events that are just a few numbers (eg. accelerometer). If events called callbackName (eg. "#onaccel")
+ * on object are being batched, add the values to the batch without creating an object, and return true */
+bool jsiBatchEventsAddFloats(JsVar *object, const char *callbackName, const char **names, const JsVarFloat *values, int valueCount);
+#endif
+#ifdef ESPR_EVENT_QUEUE
+/// How many events couldn't be queued at all (because we were out of memory)
+extern unsigned int jsiEventsDropped;
+#endif
 /// Execute the given function/string/array of functions and return true on success, false on failure (break during execution)
 bool jsiExecuteEventCallback(JsVar *thisVar, JsVar *callbackVar, unsigned int argCount, JsVar **argPtr);
 /// Same as above, but with a JsVarArray (this calls jsiExecuteEventCallback, so use jsiExecuteEventCallback where possible)
@@ -187,6 +201,10 @@ extern JsVarRef watchArray; // Linked List of input watches to check and run
 
 extern JsVarInt jsiTimerAdd(JsVar *timerPtr);
 extern void jsiTimersChanged(); // Flag timers changed so we can skip out of the loop if needed
+extern JsSysTime jsiTimerGetTime(JsVar *timerPtr); ///< Get the time until a timer fires, relative to jsiLastIdleTime
+extern void jsiTimerSetTime(JsVar *timerPtr, JsSysTime time); ///< Set the time until a timer fires, relative to jsiLastIdleTime
+extern void jsiTimerRemoved(JsVar *timerPtr); ///< Call before removing a timer from timerArray
+extern void jsiTimersTimeChanged(JsSysTime diff); ///< The time that timers are relative to has jumped by 'diff' (eg. setTime)
 // end for jswrap_interactive/io.c ------------------------------------------------
 
 #ifdef USE_DEBUGGER
@@ -17,6 +17,7 @@
 #include "jsjit.h"
 #include "jsjitc.h"
 #include "jsinteractive.h"
+#include "jsnative.h"
 
 #define JSP_ASSERT_MATCH(TOKEN) { assert(0+lex->tk==(TOKEN));jslGetNextToken(); } // Match where if we have the wrong token, it's an internal error
 #define JSP_MATCH_WITH_RETURN(TOKEN, RETURN_VAL) if (!jslMatch((TOKEN))) return RETURN_VAL;
@@ -33,8 +34,22 @@ void jsjBlockOrStatement();
 // ----------------------------------------------------------------------------
 // These are helper functions that get called FROM the JITed code
 
+#ifdef JSJ_X86_64
+// On x86-64 a struct of 2 pointers is returned in RAX,RDX, which jsjcCall moves to r0,r1
+typedef struct { JsVar *a, *parent; } JsjObjectLookupResult;
+#else
+// On ARM a uint64_t is returned in r0,r1
+typedef uint64_t JsjObjectLookupResult;
+#endif
+
+#ifdef JSJ_X86_64
+typedef struct { size_t value; JsVar *box; } JsjIntVarResult;
+#else
+typedef uint64_t JsjIntVarResult;
+#endif
+
 /// Look up 'parent.a[index]'. Utility function called from JIT code
-uint64_t _jsjxObjectLookup(JsVar *index, JsVar *parent, JsVar *a) {
+JsjObjectLookupResult _jsjxObjectLookup(JsVar *index, JsVar *parent, JsVar *a) {
   JsVar *resultParent = jsvSkipNameWithParent(a,true,parent);
   jsvUnLock2(a, parent);
   JsVar *resultA = 0;
@@ -50,7 +65,12 @@ uint64_t _jsjxObjectLookup(JsVar *index, JsVar *parent, JsVar *a) {
     }
   }
   jsvUnLock(index);
+#ifdef JSJ_X86_64
+  JsjObjectLookupResult r = { resultA, resultParent };
+  return r;
+#else
   return ((uint64_t)(size_t)resultA) | (((uint64_t)(size_t)resultParent)<<32);
+#endif
 }
 
 // Like jspeFunctionCall but we unlock ALL the vars supplied
@@ -145,6 +165,31 @@ NO_INLINE void _jsxArrayNewElement(JsVar *array, uint32_t index, JsVar *value) {
 NO_INLINE JsVar *_jsxGetThis() {
   return jsvLockAgain( execInfo.thisVar ? execInfo.thisVar : execInfo.root );
 }
+
+// Get a local variable we keep as a native int as a JsVar. If it's stopped being an int, the value is in 'box'
+NO_INLINE JsVar *_jsxGetIntVar(JsVarInt value, JsVar *box) {
+  if (box) return jsvLockAgain(box);
+  return jsvNewFromInteger(value);
+}
+
+/* Set a local variable we keep as a native int (unlocks 'value' and the old 'box'). Returns
+the new int value, and a new box if 'value' wasn't an int */
+NO_INLINE JsjIntVarResult _jsxSetIntVar(JsVar *value, JsVar *box) {
+  jsvUnLock(box);
+  value = jsvSkipNameAndUnLock(value);
+  JsVarInt i = 0;
+  if (jsvIsInt(value)) {
+    i = jsvGetInteger(value);
+    jsvUnLock(value);
+    value = 0;
+  }
+#ifdef JSJ_X86_64
+  JsjIntVarResult r = { (uint32_t)i, value };
+  return r;
+#else
+  return ((uint64_t)(uint32_t)i) | (((uint64_t)(size_t)value)<<32);
+#endif
+}
 // ----------------------------------------------------------------------------
 
 void jsjPopAsVar(int reg) {
@@ -171,11 +216,16 @@ void jsjPopAsBool(int reg) {
 }
 
 void jsjPopAndUnLock() {
-  jsjPopAsVar(0); // a -> r0
-  // optimisation: if item on stack is NOT a variable, no need to covert+unlock!
+  JsjValueType varType = jsjcPop(0); // a -> r0
+  if (varType==JSJVT_INT || varType==JSJVT_BOOL) return; // not a variable, no need to convert+unlock
   jsjcCall(jsvUnLock); // we're throwing this away now - unlock
 }
 
+// Get the offset from SP of the item at 'index' in the variables at the bottom of our stack
+int jsjStackOffset(int index) {
+  return (jit.stackDepth - (index+1)) * JSJ_WORD_SIZE;
+}
+
 // Write the code to create variable 'var' in register 'reg'. Clobbers r0-r3
 void jsjJsVar(int reg, JsVar *var) {
   if (jsvIsString(var)) {
@@ -205,12 +255,16 @@ void jsjFunctionReturn(bool isReturnStatement) {
   int oldStackDepth = jit.stackDepth;
   if (jit.varCount) {
     jsjcMov(4, 0); // save r0 (return value)
-    jsjcMov(1, JSJAR_SP);
-    jsjcLiteral32(0, jit.stackDepth);
-    for (int i=0;i<jit.stackDepth;i++) // we don't want to be trying to unlock ints!
-      assert(jit.typeStack[i]==JSJVT_JSVAR || jit.typeStack[i]==JSJVT_JSVAR_NO_NAME);
-    jsjcCall(jsvUnLockMany);
-    jsjcAddSP(4*jit.varCount); // pop off anything on the stack
+    if (jit.intSlotCount) // native ints are at the top of our variables, and don't need unlocking
+      jsjcAddSP(JSJ_WORD_SIZE*jit.intSlotCount);
+    if (jit.varCount > jit.intSlotCount) {
+      jsjcMov(1, JSJAR_SP);
+      jsjcLiteral32(0, jit.stackDepth);
+      for (int i=0;i<jit.stackDepth;i++) // we don't want to be trying to unlock ints!
+        assert(jit.typeStack[i]==JSJVT_JSVAR || jit.typeStack[i]==JSJVT_JSVAR_NO_NAME);
+      jsjcCall(jsvUnLockMany);
+      jsjcAddSP(JSJ_WORD_SIZE*(jit.varCount-jit.intSlotCount)); // pop off anything on the stack
+    }
     jsjcMov(0, 4); // restore r0
   }
   // actual stack depth is stackDepth but at this point varCount==stackDepth we hope
@@ -222,11 +276,107 @@ void jsjFunctionReturn(bool isReturnStatement) {
     jit.stackDepth = oldStackDepth;
 }
 
+// Stop keeping a local variable as a native int (JSJP_TYPES)
+void jsjIntVarReject(int intVar) {
+  if (intVar<0 || !jit.intVars[intVar].isInt) return;
+  jit.intVars[intVar].isInt = false;
+  jit.intVarsChanged = true; // we'll need another pass
+}
+
+/* Return the index in jit.intVars of the local variable 'name' if we're keeping it as a native int, or -1.
+In JSJP_TYPES this also checks the variable is definitely declared by the time we get here */
+int jsjIntVarGet(JsVar *name) {
+  JsVar *indexName = jsvFindChildFromVar(jit.intVarNames, name, false);
+  if (!indexName) return -1;
+  int intVar = jsvGetIntegerAndUnLock(jsvSkipNameAndUnLock(indexName));
+  if (intVar<0 || !jit.intVars[intVar].isInt) return -1;
+  JsjIntVar *v = &jit.intVars[intVar];
+  if (jit.phase == JSJP_TYPES && v->regionDepth &&
+      (jit.regionDepth < v->regionDepth || jit.regions[v->regionDepth-1] != v->regionId)) {
+    // We're not inside the region the variable was declared in, so it might not have been declared
+    jsjIntVarReject(intVar);
+    return -1;
+  }
+  return intVar;
+}
+
+/* JSJP_TYPES: Called for every reference to a variable. The first reference decides whether it
+could be an int - it has to be a declaration (not a global) */
+void jsjIntVarReference(JsVar *name, LEX_TYPES creationOp) {
+  JsVar *indexName = jsvFindChildFromVar(jit.intVarNames, name, true/*addIfNotFound*/);
+  if (!indexName) return;
+  JsVar *index = jsvSkipName(indexName);
+  if (!index) { // first reference
+    int intVar = -1;
+    if (creationOp!=LEX_ID && jit.intVarCount<JSJ_INT_VARS_MAX && jit.regionDepth<=JSJ_REGION_STACK_SIZE) {
+      intVar = jit.intVarCount++;
+      JsjIntVar *v = &jit.intVars[intVar];
+      v->isInt = true;
+      v->isConst = creationOp==LEX_R_CONST;
+      v->regionDepth = (uint8_t)jit.regionDepth;
+      v->regionId = jit.regionDepth ? jit.regions[jit.regionDepth-1] : 0;
+      v->boxIndex = -1;
+      v->intIndex = -1;
+    }
+    index = jsvNewFromInteger(intVar);
+    jsvSetValueOfName(indexName, index);
+  } else
+    jsjIntVarGet(name); // rejects it if it might not have been declared yet
+  jsvUnLock2(index, indexName);
+}
+
+// Called after JSJP_SCAN to add the native ints for int variables to the stack (after all the JsVars, so they're easy to skip when unlocking)
+void jsjIntVarsAllocate() {
+  jit.intSlotCount = 0;
+  for (int i=0;i<jit.intVarCount;i++) {
+    JsjIntVar *v = &jit.intVars[i];
+    if (!v->isInt) continue;
+    assert(v->boxIndex>=0);
+    jsjcDebugPrintf("; Int Variable %d\n", i);
+    v->intIndex = (int16_t)jit.varCount++;
+    jit.intSlotCount++;
+    jsjcLiteral32(0, 0);
+    jsjcPush(0, JSJVT_INT);
+  }
+}
+
+// In native int code, if 'cond' is set then jump back to the generic version of the code we're in (see jsjIntFastPathStart)
+void jsjIntGuard(JsjAsmCondition cond) {
+  jsjcBranchConditionalRelative(cond, jit.intBailout - (jsjcGetByteCount()+JSJ_BRANCH_CONDITIONAL_LONG_LENGTH), JSJC_FORCE_4BYTE);
+}
+
+// In native int code, jump to the generic version if this int variable has stopped being an int. Clobbers 'reg'
+void jsjIntVarGuard(int intVar, int reg) {
+  jsjcLoadImm(reg, JSJAR_SP, jsjStackOffset(jit.intVars[intVar].boxIndex));
+  jsjcTest(reg);
+  jsjIntGuard(JSJAC_NE);
+}
+
+// In native int code, load the value of an int variable into 'reg'
+void jsjIntVarLoad(int intVar, int reg) {
+  jsjIntVarGuard(intVar, reg);
+  jsjcLoadImm(reg, JSJAR_SP, jsjStackOffset(jit.intVars[intVar].intIndex));
+}
+
+// Push the value of an int variable onto the stack as a JsVar
+void jsjIntVarPushAsVar(int intVar) {
+  jsjcLoadImm(0, JSJAR_SP, jsjStackOffset(jit.intVars[intVar].intIndex));
+  jsjcLoadImm(1, JSJAR_SP, jsjStackOffset(jit.intVars[intVar].boxIndex));
+  jsjcCall(_jsxGetIntVar); // JsVar *_jsxGetIntVar(JsVarInt value, JsVar *box)
+  jsjcPush(0, JSJVT_JSVAR_NO_NAME); // a value, not a NAME
+}
+
 /* Called when we encounter an ID. This checks if it's in our 'jit.vars'
 list and if not either creates (creationOp==LEX_R_VAR/LET/CONST) or
 tries to find it (creationOp==LEX_ID) it in our global scope.
 hasInitialiser=true if an initial value is already on the stack */
 void jsjFactorIDAndUnLock(JsVar *name, LEX_TYPES creationOp) {
+  if (jit.phase == JSJP_TYPES) { // we're only working out which variables can be ints
+    jsjIntVarReference(name, creationOp);
+    jsvUnLock(name);
+    return;
+  }
+  int intVar = jsjIntVarGet(name);
   // search for var in our list...
   JsVar *varIndex = jsvFindChildFromVar(jit.vars, name, true/*addIfNotFound*/);
   JsVar *varIndexVal = jsvSkipName(varIndex);
@@ -234,33 +384,44 @@ void jsjFactorIDAndUnLock(JsVar *name, LEX_TYPES creationOp) {
     // We don't have it yet - create a var list entry
     varIndexVal = jsvNewFromInteger(jit.varCount++);
     jsvSetValueOfName(varIndex, varIndexVal);
-    jsjcLiteralString(0, name, true); // null terminated string in r0
-    if (creationOp==LEX_ID) { // Just a normal ID
-      jsjcDebugPrintf("; Find Variable %j\n", name);
-      jsjcCall(jspGetNamedVariable); // Find the var in the current scopes (always returns something even if it's jsvNewChild)
-    } else if (creationOp==LEX_R_VAR || creationOp==LEX_R_LET || creationOp==LEX_R_CONST) {
-      jsjcDebugPrintf("; Variable Decl %j\n", name);
-      // _jsxAddVar(r0:name)
-      jsjcCall(_jsxAddVar); // add the variable
-    } else assert(0);
-    jsjcPush(0, JSJVT_JSVAR); // We're pushing a NAME here
+    if (intVar>=0) { // A native int - the int goes after all the JsVars, this is the 'box' used if it stops being an int
+      jsjcDebugPrintf("; Int Variable Decl %j\n", name);
+      jit.intVars[intVar].boxIndex = (int16_t)(jit.varCount-1);
+      jsjcLiteral32(0, 0);
+      jsjcPush(0, JSJVT_JSVAR_NO_NAME);
+    } else {
+      jsjcLiteralString(0, name, true); // null terminated string in r0
+      if (creationOp==LEX_ID) { // Just a normal ID
+        jsjcDebugPrintf("; Find Variable %j\n", name);
+        jsjcCall(jspGetNamedVariable); // Find the var in the current scopes (always returns something even if it's jsvNewChild)
+      } else if (creationOp==LEX_R_VAR || creationOp==LEX_R_LET || creationOp==LEX_R_CONST) {
+        jsjcDebugPrintf("; Variable Decl %j\n", name);
+        // _jsxAddVar(r0:name)
+        jsjcCall(_jsxAddVar); // add the variable
+      } else assert(0);
+      jsjcPush(0, JSJVT_JSVAR); // We're pushing a NAME here
+    }
   }
   // Now, we have the var already - just reference it
   int varIndexI = jsvGetIntegerAndUnLock(varIndexVal);
   if (jit.phase == JSJP_EMIT) {
     jsjcDebugPrintf("; Reference var %j\n", name);
-    jsjcLoadImm(0, JSJAR_SP, (jit.stackDepth - (varIndexI+1)) * 4);
-    jsjcCall(jsvLockAgain);
-    jsjcPush(0, JSJVT_JSVAR); // We're pushing a NAME here
+    if (intVar>=0) { // it's a native int - we can't make a NAME for it, so just push the value
+      jsjIntVarPushAsVar(intVar);
+    } else {
+      jsjcLoadImm(0, JSJAR_SP, jsjStackOffset(varIndexI));
+      jsjcCall(jsvLockAgain);
+      jsjcPush(0, JSJVT_JSVAR); // We're pushing a NAME here
+    }
   }
   jsvUnLock2(varIndex, name);
 }
 
 void jsjFactorObject() {
   if (jit.phase == JSJP_EMIT) {
-    // create the object
+    // create the object - it stays on the top of the stack while we add elements (r4 could be overwritten by nested objects)
     jsjcCall(jsvNewObject);
-    jsjcMov(4, 0); // Store it in r4
+    jsjcPush(0, JSJVT_JSVAR_NO_NAME);
   }
   /* JSON-style object definition */
   JSP_ASSERT_MATCH('{');
@@ -283,9 +444,10 @@ void jsjFactorObject() {
     jsjAssignmentExpression();
     if (jit.phase == JSJP_EMIT) {
       varName = jsvAsArrayIndexAndUnLock(varName);
+      jsjPopNoName(4); // r4 = item (jsjJsVar clobbers r0-r3)
       jsjJsVar(1, varName); // r1 = index
-      jsjcMov(0, 4); // r0 = array
-      jsjPopNoName(2); // r2 = array item
+      jsjcMov(2, 4); // r2 = item
+      jsjcLoadImm(0, JSJAR_SP, 0); // r0 = object
       jsjcCall(_jsxObjectNewElement);
     }
     jsvUnLock(varName);
@@ -293,19 +455,16 @@ void jsjFactorObject() {
     if (lex->tk != '}') JSP_MATCH(',');
   }
   JSP_ASSERT_MATCH('}');
-  if (jit.phase == JSJP_EMIT) {
-    // push the finished object on the stack
-    jsjcPush(4, JSJVT_JSVAR_NO_NAME);
-  }
+  // the finished object is already on the stack
 }
 
 void jsjFactorArray() {
   uint32_t idx = 0; // current array index
 
   if (jit.phase == JSJP_EMIT) {
-    // create the array
+    // create the array - it stays on the top of the stack while we add elements
     jsjcCall(jsvNewEmptyArray);
-    jsjcMov(4, 0); // Store it in r4
+    jsjcPush(0, JSJVT_JSVAR_NO_NAME);
   }
 
   /* JSON-style array */
@@ -314,9 +473,9 @@ void jsjFactorArray() {
     if (lex->tk != ',') { // #287 - [,] and [1,2,,4] are allowed
       jsjAssignmentExpression();
       if (jit.phase == JSJP_EMIT) {
-        jsjcMov(0, 4); // r0 = array
+        jsjPopNoName(2); // r2 = array item (may call a function, so do this first)
+        jsjcLoadImm(0, JSJAR_SP, 0); // r0 = array
         jsjcLiteral32(1, idx); // r1 = index
-        jsjPopNoName(2); // r2 = array item
         jsjcCall(_jsxArrayNewElement);
       }
     }
@@ -325,25 +484,39 @@ void jsjFactorArray() {
   }
   JSP_MATCH(']');
   if (jit.phase == JSJP_EMIT) {
-    jsjcMov(0, 4); // r0 = array
+    jsjcLoadImm(0, JSJAR_SP, 0); // r0 = array
     jsjcLiteral32(1, idx); // r1 = array size
     jsjcLiteral32(2, 0); // r1 = truncate = false
     jsjcCall(jsvSetArrayLength);
-    // push the finished array on
-    jsjcPush(4, JSJVT_JSVAR_NO_NAME);
+    // the finished array is already on the stack
   }
 }
 
+// Is this token an assignment ('=', '+=', etc)?
+bool jsjIsAssignment(int tk) {
+  return tk=='=' || tk==LEX_PLUSEQUAL || tk==LEX_MINUSEQUAL ||
+         tk==LEX_MULEQUAL || tk==LEX_DIVEQUAL || tk==LEX_MODEQUAL ||
+         tk==LEX_ANDEQUAL || tk==LEX_OREQUAL ||
+         tk==LEX_XOREQUAL || tk==LEX_RSHIFTEQUAL ||
+         tk==LEX_LSHIFTEQUAL || tk==LEX_RSHIFTUNSIGNEDEQUAL;
+}
+
 void jsjFactor() {
   if (lex->tk==LEX_ID) {
     JsVar *name = jslGetTokenValueAsVar();
     JSP_ASSERT_MATCH(LEX_ID);
-    jsjFactorIDAndUnLock(name, LEX_ID);
+    if (jit.phase == JSJP_TYPES && (jsjIsAssignment(lex->tk) || lex->tk==LEX_PLUSPLUS || lex->tk==LEX_MINUSMINUS)) {
+      // Written to by something jsjIntVarAssignment couldn't handle - it can't be an int
+      jsjFactorIDAndUnLock(jsvLockAgain(name), LEX_ID);
+      jsjIntVarReject(jsjIntVarGet(name));
+      jsvUnLock(name);
+    } else
+      jsjFactorIDAndUnLock(name, LEX_ID);
   } else if (lex->tk==LEX_INT) {
     int64_t v = stringToInt(jslGetTokenValueAsString());
     JSP_ASSERT_MATCH(LEX_INT);
     if (jit.phase == JSJP_EMIT) {
-      if (v>>32) {
+      if (v>>31) { // jsvNewFromInteger takes a signed 32 bit int
         jsjcLiteral64(0, (uint64_t)v);
         jsjcCall(jsvNewFromLongInteger);
       } else {
@@ -512,12 +685,15 @@ void jsjFactorFunctionCall() {
       DEBUG_JIT("; FUNCTION CALL argPtr\n");
       jsjcMov(7, JSJAR_SP); // r7 = argPtr
       jsjcPush(7, JSJVT_INT); // argPtr (5th arg - on stack)
+#ifdef JSJ_X86_64
+      jsjcMov(JSJAR_r8, 7); // ... except on x86-64 where it's passed in a register
+#endif
       // Args are in the wrong order - we have to swap them around if we have >1!
       if (argCount>1) {
         DEBUG_JIT("; FUNCTION CALL reverse arguments\n");
         for (int i=0;i<argCount/2;i++) {
-          int a1 = i*4;
-          int a2 = (argCount-(i+1))*4;
+          int a1 = i*JSJ_WORD_SIZE;
+          int a2 = (argCount-(i+1))*JSJ_WORD_SIZE;
           jsjcLoadImm(0, 7, a1); // r0 = memory[argPtr+a1]
           jsjcLoadImm(1, 7, a2); // ...
           jsjcStoreImm(0, 7, a2);
@@ -530,17 +706,17 @@ void jsjFactorFunctionCall() {
       // Get function var and parent (r7 == SP)
 
       if (parentOnStack) { // parent
-        jsjcLoadImm(0, 7, 4*(argCount+1)); // r0 = funcName
-        jsjcLoadImm(1, 7, 4*(argCount));
+        jsjcLoadImm(0, 7, JSJ_WORD_SIZE*(argCount+1)); // r0 = funcName
+        jsjcLoadImm(1, 7, JSJ_WORD_SIZE*(argCount));
       } else { // no parent
-        jsjcLoadImm(0, 7, 4*argCount); // r0 = funcName
+        jsjcLoadImm(0, 7, JSJ_WORD_SIZE*argCount); // r0 = funcName
         jsjcLiteral32(1, 0);
       }
       jsjcLiteral32(2, 0); // isParsing = false
       jsjcLiteral32(3, argCount); // argCount 4th arg
       jsjcCall(_jsjxFunctionCallAndUnLock); // a = _jsjxFunctionCallAndUnLock(funcName, thisArg/parent, isParsing, argCount, argPtr[on stack]);
       DEBUG_JIT("; FUNCTION CALL cleanup stack\n");
-      jsjcAddSP(4*(2+argCount+(parentOnStack?1:0))); // pop off argPtr + all the arguments + funcName + parent
+      jsjcAddSP(JSJ_WORD_SIZE*(2+argCount+(parentOnStack?1:0))); // pop off argPtr + all the arguments + funcName + parent
       parentOnStack = false;
       jsjcPush(0, JSJVT_JSVAR); // push return value from jspeFunctionCall (FIXME: can we be sure this isn't a NAME so use JSJVT_JSVAR_NO_NAME? I think so)
       DEBUG_JIT("; FUNCTION CALL end\n");
@@ -573,6 +749,11 @@ void jsjPostfixExpression() {
     // PREFIX expression =>  ++i, --i
     int op = lex->tk;
     JSP_ASSERT_MATCH(op);
+    if (jit.phase == JSJP_TYPES && lex->tk==LEX_ID) { // a variable modified like this can't be an int
+      JsVar *name = jslGetTokenValueAsVar();
+      jsjIntVarReject(jsjIntVarGet(name));
+      jsvUnLock(name);
+    }
     jsjPostfixExpression(); // recurse to get our var...
     if (jit.phase == JSJP_EMIT) {
       jsjPopAsVar(0); // old value -> r0
@@ -785,11 +966,7 @@ NO_INLINE void jsjAssignmentExpression() {
   // parse LHS
   jsjConditionalExpression();
   if (!JSJ_PARSING) return;
-  if (lex->tk=='=' || lex->tk==LEX_PLUSEQUAL || lex->tk==LEX_MINUSEQUAL ||
-      lex->tk==LEX_MULEQUAL || lex->tk==LEX_DIVEQUAL || lex->tk==LEX_MODEQUAL ||
-      lex->tk==LEX_ANDEQUAL || lex->tk==LEX_OREQUAL ||
-      lex->tk==LEX_XOREQUAL || lex->tk==LEX_RSHIFTEQUAL ||
-      lex->tk==LEX_LSHIFTEQUAL || lex->tk==LEX_RSHIFTUNSIGNEDEQUAL) {
+  if (jsjIsAssignment(lex->tk)) {
 
     int op = lex->tk;
     JSP_ASSERT_MATCH(op);
@@ -834,6 +1011,319 @@ void jsjExpression() {
   }
 }
 
+// ----------------------------------------------------------------------------
+/* Native integer expressions. These only use int variables, int literals and simple maths
+(+ - & | ^ << >> ~ and comparisons), and evaluate entirely in registers r0.. with no calls.
+They're always parsed twice - once with jit.intEmit=false to check it can be done, and then
+with jit.intEmit=true to emit the code. */
+
+JsjValueType jsjIntExpression(int reg);
+
+// Can this binary operator be done natively on ints? Returns the type of the result, or JSJVT_JSVAR if not
+JsjValueType jsjIntOperationType(int op) {
+  switch (op) {
+  case '+': case '-':
+  case '&': case '|': case '^':
+  case LEX_LSHIFT: case LEX_RSHIFT: return JSJVT_INT;
+  case '<': case '>': case LEX_LEQUAL: case LEX_GEQUAL:
+  case LEX_EQUAL: case LEX_NEQUAL: case LEX_TYPEEQUAL: case LEX_NTYPEEQUAL: return JSJVT_BOOL;
+  default: return JSJVT_JSVAR;
+  }
+}
+
+// reg = reg op regB, for an op where jsjIntOperationType(op)!=JSJVT_JSVAR
+void jsjIntOperation(int op, int reg, int regB) {
+  JsjAsmCondition cond;
+  switch (op) {
+  case '<': cond = JSJAC_LT; break;
+  case '>': cond = JSJAC_GT; break;
+  case LEX_LEQUAL: cond = JSJAC_LE; break;
+  case LEX_GEQUAL: cond = JSJAC_GE; break;
+  case LEX_EQUAL: case LEX_TYPEEQUAL: cond = JSJAC_EQ; break;
+  case LEX_NEQUAL: case LEX_NTYPEEQUAL: cond = JSJAC_NE; break;
+  default:
+    jsjcIntOp(op, reg, regB);
+    if (op=='+' || op=='-') jsjIntGuard(JSJAC_VS); // overflowed - it's not an int any more
+    return;
+  }
+  jsjcCompare(reg, regB);
+  jsjcSetBool(cond, reg);
+}
+
+JsjValueType jsjIntFactor(int reg) {
+  if (reg>=JSJ_INT_REGS) return JSJVT_JSVAR; // too complicated
+  if (lex->tk==LEX_ID) {
+    JsVar *name = jslGetTokenValueAsVar();
+    int intVar = jsjIntVarGet(name);
+    jsvUnLock(name);
+    if (intVar<0) return JSJVT_JSVAR;
+    JSP_ASSERT_MATCH(LEX_ID);
+    if (jit.intEmit) jsjIntVarLoad(intVar, reg);
+  } else if (lex->tk==LEX_INT) {
+    int64_t v = stringToInt(jslGetTokenValueAsString());
+    if (v>>31) return JSJVT_JSVAR; // too big
+    JSP_ASSERT_MATCH(LEX_INT);
+    if (jit.intEmit) jsjcLiteral32(reg, (uint32_t)v);
+  } else if (lex->tk=='(') {
+    JSP_ASSERT_MATCH('(');
+    if (jsjIntExpression(reg)!=JSJVT_INT || lex->tk!=')') return JSJVT_JSVAR;
+    JSP_ASSERT_MATCH(')');
+  } else
+    return JSJVT_JSVAR;
+  // if this is a member access, function call, x++, etc then it's not something we can handle
+  if (lex->tk=='.' || lex->tk=='[' || lex->tk=='(' || lex->tk==LEX_TEMPLATE_LITERAL ||
+      lex->tk==LEX_PLUSPLUS || lex->tk==LEX_MINUSMINUS)
+    return JSJVT_JSVAR;
+  return JSJVT_INT;
+}
+
+JsjValueType jsjIntUnaryExpression(int reg) {
+  if (lex->tk=='+') { // does nothing to an int
+    JSP_ASSERT_MATCH('+');
+    return jsjIntUnaryExpression(reg);
+  } else if (lex->tk=='~') {
+    JSP_ASSERT_MATCH('~');
+    if (reg+1>=JSJ_INT_REGS || jsjIntUnaryExpression(reg)!=JSJVT_INT) return JSJVT_JSVAR;
+    if (jit.intEmit) { // x^-1 (MVN would set the top 32 bits on 64 bit platforms)
+      jsjcLiteral32(reg+1, 0xFFFFFFFF);
+      jsjcIntOp('^', reg, reg+1);
+    }
+    return JSJVT_INT;
+  }
+  return jsjIntFactor(reg);
+}
+
+// Like __jsjBinaryExpression. 't' is the type of the value in 'reg' we already parsed
+JsjValueType __jsjIntBinaryExpression(int reg, JsjValueType t, unsigned int lastPrecedence) {
+  unsigned int precedence = jsjGetBinaryExpressionPrecedence(lex->tk);
+  while (t==JSJVT_INT && precedence && precedence>lastPrecedence) {
+    int op = lex->tk;
+    JsjValueType opType = jsjIntOperationType(op);
+    if (opType==JSJVT_JSVAR) return JSJVT_JSVAR;
+    JSP_ASSERT_MATCH(op);
+    if (__jsjIntBinaryExpression(reg+1, jsjIntUnaryExpression(reg+1), precedence)!=JSJVT_INT)
+      return JSJVT_JSVAR;
+    if (jit.intEmit) jsjIntOperation(op, reg, reg+1);
+    t = opType;
+    precedence = jsjGetBinaryExpressionPrecedence(lex->tk);
+  }
+  return t;
+}
+
+/* Parse a native integer expression into 'reg' and return JSJVT_INT (or JSJVT_BOOL for a comparison).
+Returns JSJVT_JSVAR if the expression can't be done natively (the lexer position is then undefined) */
+JsjValueType jsjIntExpression(int reg) {
+  return __jsjIntBinaryExpression(reg, jsjIntUnaryExpression(reg), 0);
+}
+
+// Is this the end of an expression statement (so we know we parsed the whole thing)?
+bool jsjIsExpressionEnd() {
+  return lex->tk==';' || lex->tk==',' || lex->tk==')' || lex->tk=='}' || lex->tk==LEX_EOF ||
+         (jslIsIDOrReservedWord() && lex->tk!=LEX_R_IN && lex->tk!=LEX_R_INSTANCEOF);
+}
+
+/* Check (without emitting code) whether what follows is a whole native integer expression
+that will fit in registers 'reg' onwards. If so, skip over it and return true. If not, leave the
+lexer where it was and return false */
+bool jsjIntExpressionCheck(int reg) {
+  size_t start = lex->tokenStart;
+  jit.intEmit = false;
+  if (jsjIntExpression(reg)==JSJVT_INT && jsjIsExpressionEnd())
+    return true;
+  jslSeekTo(start);
+  return false;
+}
+
+/* We emit native int code after the generic code for the same expression, and jump into
+the generic code if a guard fails (overflow, or a variable that's no longer an int):
+
+    B native        ; skip generic code
+  generic:          ; <- jit.intBailout
+    ...
+    B end
+  native:
+    ...
+  end:
+
+Call this when the generic code has been parsed into 'slowBlock', and then jsjIntFastPathEnd */
+JsVar *jsjIntFastPathStart(JsVar *slowBlock) {
+  JsVar *oldBlock = jsjcStartBlock();
+  jit.intBailout = -(int)(jsvGetStringLength(slowBlock) + JSJ_BRANCH_LONG_LENGTH);
+  jit.intEmit = true;
+  return oldBlock;
+}
+
+void jsjIntFastPathEnd(JsVar *slowBlock, JsVar *oldBlock) {
+  jit.intEmit = false;
+  JsVar *fastBlock = jsjcStopBlock(oldBlock);
+  DEBUG_JIT("; INT skip generic code\n");
+  jsjcBranchRelative(jsvGetStringLength(slowBlock) + JSJ_BRANCH_LONG_LENGTH, JSJC_NONE);
+  DEBUG_JIT("; INT generic code\n");
+  jsjcEmitBlock(slowBlock);
+  jsjcBranchRelative(jsvGetStringLength(fastBlock), JSJC_FORCE_4BYTE);
+  DEBUG_JIT("; INT native code\n");
+  jsjcEmitBlock(fastBlock);
+  DEBUG_JIT("; INT end\n");
+  jsvUnLock2(slowBlock, fastBlock);
+}
+
+/* Assign to an int variable (emit phase only). op is '=' for 'x=...', the maths op for 'x+=...', or
+'+'/'-' with hasRHS=false for x++/x--. The lexer is at the start of the right hand side */
+void jsjIntVarAssign(int intVar, int op, bool hasRHS) {
+  JsjIntVar *v = &jit.intVars[intVar];
+  size_t rhsStart = lex->tokenStart;
+  DEBUG_JIT("; INT variable assignment\n");
+  JsVar *oldBlock = jsjcStartBlock();
+  if (op!='=') jsjIntVarPushAsVar(intVar);
+  if (hasRHS) {
+    jsjAssignmentExpression();
+  } else {
+    jsjcLiteral32(0, 1);
+    jsjcCall(jsvNewFromInteger);
+    jsjcPush(0, JSJVT_JSVAR_NO_NAME);
+  }
+  if (op!='=') {
+    jsjPopAsVar(1); // b -> r1
+    jsjPopAsVar(0); // a -> r0
+    jsjcLiteral8(2, (uint8_t)op);
+    jsjcCall(_jsxMathsOpSkipNamesAndUnLock); // unlocks arguments
+    jsjcPush(0, JSJVT_JSVAR_NO_NAME);
+  }
+  jsjPopNoName(0); // r0 = new value
+  jsjcLoadImm(1, JSJAR_SP, jsjStackOffset(v->boxIndex)); // r1 = old box
+  jsjcCall(_jsxSetIntVar); // (int,box) = _jsxSetIntVar(JsVar *value, JsVar *box)
+  jsjcStoreImm(0, JSJAR_SP, jsjStackOffset(v->intIndex));
+  jsjcStoreImm(1, JSJAR_SP, jsjStackOffset(v->boxIndex));
+  JsVar *slowBlock = jsjcStopBlock(oldBlock);
+  // now the native version
+  if (hasRHS) jslSeekTo(rhsStart);
+  oldBlock = jsjIntFastPathStart(slowBlock);
+  if (op=='=') {
+    jsjIntVarGuard(intVar, 0); // if there's a box we have to use _jsxSetIntVar to free it
+    jsjIntExpression(0);
+  } else {
+    jsjIntVarLoad(intVar, 0);
+    if (hasRHS) jsjIntExpression(1);
+    else jsjcLiteral32(1, 1);
+    jsjIntOperation(op, 0, 1);
+  }
+  jsjcStoreImm(0, JSJAR_SP, jsjStackOffset(v->intIndex));
+  jsjIntFastPathEnd(slowBlock, oldBlock);
+}
+
+/* Handle 'x=...', 'x+=...', 'x++', etc as a statement where x is an int variable. If the
+right hand side isn't a native integer expression this returns false and leaves the lexer where it
+was (and in JSJP_TYPES, x stops being an int) */
+bool jsjIntVarAssignment() {
+  if (jit.phase == JSJP_SCAN) return false; // the normal code finds all the variables
+  size_t start = lex->tokenStart;
+  JsVar *name = 0;
+  int op = 0;
+  bool hasRHS = false;
+  if (lex->tk==LEX_PLUSPLUS || lex->tk==LEX_MINUSMINUS) { // ++x
+    op = (lex->tk==LEX_PLUSPLUS) ? '+' : '-';
+    JSP_ASSERT_MATCH(lex->tk);
+    if (lex->tk==LEX_ID) {
+      name = jslGetTokenValueAsVar();
+      JSP_ASSERT_MATCH(LEX_ID);
+    }
+  } else if (lex->tk==LEX_ID) {
+    name = jslGetTokenValueAsVar();
+    JSP_ASSERT_MATCH(LEX_ID);
+    if (lex->tk==LEX_PLUSPLUS || lex->tk==LEX_MINUSMINUS) { // x++
+      op = (lex->tk==LEX_PLUSPLUS) ? '+' : '-';
+      JSP_ASSERT_MATCH(lex->tk);
+    } else if (lex->tk=='=' || lex->tk==LEX_PLUSEQUAL || lex->tk==LEX_MINUSEQUAL ||
+               lex->tk==LEX_ANDEQUAL || lex->tk==LEX_OREQUAL || lex->tk==LEX_XOREQUAL ||
+               lex->tk==LEX_LSHIFTEQUAL || lex->tk==LEX_RSHIFTEQUAL) { // x = ...
+      if (lex->tk=='=') op='=';
+      else if (lex->tk==LEX_PLUSEQUAL) op='+';
+      else if (lex->tk==LEX_MINUSEQUAL) op='-';
+      else if (lex->tk==LEX_ANDEQUAL) op='&';
+      else if (lex->tk==LEX_OREQUAL) op='|';
+      else if (lex->tk==LEX_XOREQUAL) op='^';
+      else if (lex->tk==LEX_LSHIFTEQUAL) op=LEX_LSHIFT;
+      else op=LEX_RSHIFT;
+      JSP_ASSERT_MATCH(lex->tk);
+      hasRHS = true;
+    }
+  }
+  int intVar = (name && op) ? jsjIntVarGet(name) : -1;
+  bool isInt = intVar>=0;
+  if (isInt && jit.phase == JSJP_TYPES && jit.intVars[intVar].isConst) {
+    jsjIntVarReject(intVar); // leave writing to a const to the generic code
+    isInt = false;
+  }
+  size_t rhsStart = lex->tokenStart;
+  if (isInt)
+    isInt = hasRHS ? jsjIntExpressionCheck(op=='=' ? 0 : 1) : jsjIsExpressionEnd();
+  if (!isInt) {
+    if (hasRHS && jit.phase == JSJP_TYPES) jsjIntVarReject(intVar);
+    jsvUnLock(name);
+    jslSeekTo(start);
+    return false;
+  }
+  jsvUnLock(name);
+  if (jit.phase == JSJP_EMIT) {
+    if (hasRHS) jslSeekTo(rhsStart);
+    jsjIntVarAssign(intVar, op, hasRHS);
+  }
+  return true;
+}
+
+/* Parse an expression used as a statement (or a for loop iterator) where we don't need the
+result, handling assignments to int variables natively */
+void jsjStatementExpression() {
+  while (JSJ_PARSING) {
+    if (!jsjIntVarAssignment()) {
+      jsjAssignmentExpression();
+      if (jit.phase == JSJP_EMIT)
+        jsjPopAndUnLock();
+    }
+    if (lex->tk!=',') return;
+    JSP_ASSERT_MATCH(',');
+  }
+}
+
+/* Parse the condition of an if/for/while/do, and compare so that JSJAC_EQ is set if it was
+false. If it's a native integer expression (eg 'i<10') we handle it natively */
+void jsjConditionExpression(int terminator) {
+  size_t start = lex->tokenStart;
+  bool isInt = false;
+  if (jit.phase == JSJP_EMIT) {
+    jit.intEmit = false;
+    isInt = jsjIntExpression(0)!=JSJVT_JSVAR && lex->tk==terminator;
+    jslSeekTo(start);
+  }
+  JsVar *oldBlock = isInt ? jsjcStartBlock() : 0;
+  jsjExpression();
+  if (jit.phase == JSJP_EMIT)
+    jsjPopAsBool(0);
+  if (isInt) {
+    JsVar *slowBlock = jsjcStopBlock(oldBlock);
+    jslSeekTo(start);
+    oldBlock = jsjIntFastPathStart(slowBlock);
+    if (jsjIntExpression(0)==JSJVT_INT) { // convert to a boolean
+      jsjcTest(0);
+      jsjcSetBool(JSJAC_NE, 0);
+    }
+    jsjIntFastPathEnd(slowBlock, oldBlock);
+  }
+  if (jit.phase == JSJP_EMIT)
+    jsjcCompareImm(0, 0);
+}
+
+// Called when we start parsing code that may not run, or may run more than once (see JsjIntVar)
+void jsjRegionStart() {
+  if (jit.regionDepth < JSJ_REGION_STACK_SIZE)
+    jit.regions[jit.regionDepth] = ++jit.regionCount;
+  jit.regionDepth++;
+}
+
+void jsjRegionEnd() {
+  jit.regionDepth--;
+}
+
 // Returns true if isFunctionRoot and we had a RETURN statement (so we definitely already returned;
 bool jsjBlockNoBrackets() {
   // if isFunctionRoot we're at the root scope
@@ -863,20 +1353,44 @@ void jsjStatementVar() {
     JsVar *name = jslGetTokenValueAsVar();
     JSP_ASSERT_MATCH(LEX_ID);
     bool hasInitialiser = lex->tk == '=';
-    /* create the variable locally, and in our var table. If we're emitting now
-    and there's no initial value, we don't need to do anything */
-    if (hasInitialiser || jit.phase != JSJP_EMIT)
-      jsjFactorIDAndUnLock(name, declType);
-    if (hasInitialiser) { // sort out initialiser
-      DEBUG_JIT_EMIT("; Variable's initialiser\n");
-      JSP_ASSERT_MATCH('=');
-      jsjAssignmentExpression();
-      if (jit.phase == JSJP_EMIT) {
-        // _jsxVarInitialAssign(r0:var, r1:isConstant, r2:initialValue)
-        jsjcLiteral8(1, (declType==LEX_R_CONST)?1:0); // r1 -> if we're a constant
-        jsjPopAsVar(2); // r2 -> initial value
-        jsjPopAsVar(0); // r0 -> variable (from jsjFactorIDAndUnLock)
-        jsjcCall(_jsxVarInitialAssign); // set the var's initial value
+    int intVar = (jit.phase == JSJP_EMIT) ? jsjIntVarGet(name) : -1;
+    if (jit.phase == JSJP_TYPES) {
+      jsjFactorIDAndUnLock(jsvLockAgain(name), declType);
+      intVar = jsjIntVarGet(name);
+      jsvUnLock(name);
+      bool isInt = false;
+      if (hasInitialiser) {
+        JSP_ASSERT_MATCH('=');
+        // it can only be an int if it's initialised with an int
+        isInt = intVar>=0 && jsjIntExpressionCheck(0);
+        if (!isInt) jsjAssignmentExpression();
+      }
+      if (!isInt) jsjIntVarReject(intVar);
+    } else if (intVar>=0) { // a native int
+      jsvUnLock(name);
+      if (hasInitialiser) {
+        DEBUG_JIT("; Int variable's initialiser\n");
+        JSP_ASSERT_MATCH('=');
+        jsjIntVarAssign(intVar, '=', true);
+      }
+    } else {
+      /* create the variable locally, and in our var table. If we're emitting now
+      and there's no initial value, we don't need to do anything */
+      if (hasInitialiser || jit.phase != JSJP_EMIT)
+        jsjFactorIDAndUnLock(name, declType);
+      else
+        jsvUnLock(name);
+      if (hasInitialiser) { // sort out initialiser
+        DEBUG_JIT_EMIT("; Variable's initialiser\n");
+        JSP_ASSERT_MATCH('=');
+        jsjAssignmentExpression();
+        if (jit.phase == JSJP_EMIT) {
+          // _jsxVarInitialAssign(r0:var, r1:isConstant, r2:initialValue)
+          jsjcLiteral8(1, (declType==LEX_R_CONST)?1:0); // r1 -> if we're a constant
+          jsjPopAsVar(2); // r2 -> initial value
+          jsjPopAsVar(0); // r0 -> variable (from jsjFactorIDAndUnLock)
+          jsjcCall(_jsxVarInitialAssign); // set the var's initial value
+        }
       }
     }
     hasComma = lex->tk == ',';
@@ -888,16 +1402,14 @@ void jsjStatementIf() {
   JSP_ASSERT_MATCH(LEX_R_IF);
   DEBUG_JIT_EMIT("; IF condition\n");
   JSP_MATCH('(');
-  jsjExpression();
-  if (jit.phase == JSJP_EMIT) {
-    jsjPopAsBool(0);
-    jsjcCompareImm(0, 0);
-  }
+  jsjConditionExpression(')');
   JSP_MATCH(')');
 
   DEBUG_JIT_EMIT("; capture IF true block\n");
   JsVar *oldBlock = jsjcStartBlock();
+  jsjRegionStart();
   jsjBlockOrStatement();
+  jsjRegionEnd();
   JsVar *trueBlock = jsjcStopBlock(oldBlock);
   JsVar *falseBlock = 0;
 
@@ -905,7 +1417,9 @@ void jsjStatementIf() {
     JSP_ASSERT_MATCH(LEX_R_ELSE);
     DEBUG_JIT_EMIT("; capture IF false block\n");
     oldBlock = jsjcStartBlock();
+    jsjRegionStart();
     jsjBlockOrStatement();
+    jsjRegionEnd();
     falseBlock = jsjcStopBlock(oldBlock);
   }
   if (jit.phase == JSJP_EMIT) {
@@ -940,40 +1454,37 @@ void jsjStatementFor() {
   int codePosCondition = jsjcGetByteCount();
   DEBUG_JIT_EMIT("; FOR condition\n");
   if (lex->tk != ';') {
-    jsjExpression(); // condition
-    if (jit.phase == JSJP_EMIT) {
-      jsjPopAsBool(0);
-      jsjcCompareImm(0, 0);
-    }
+    jsjConditionExpression(';'); // condition
     // We add a jump to the end after we've parsed everything and know the size
   }
   JSP_MATCH(';');
   DEBUG_JIT_EMIT("; Parsing FOR Iterator block\n");
   JsVar *oldBlock = jsjcStartBlock();
+  jsjRegionStart();
   if (lex->tk != ')')  { // we could have 'for (;;)'
-    jsjExpression(); // iterator
-    if (jit.phase == JSJP_EMIT) {
-      jsjPopAndUnLock();
-    }
+    jsjStatementExpression(); // iterator
   }
+  jsjRegionEnd();
   JsVar *iteratorBlock = jsjcStopBlock(oldBlock);
   JSP_MATCH(')'); // FIXME: clean up on exit
   // Now parse the actual code to execute
   DEBUG_JIT_EMIT("; Parsing FOR Main block\n");
   oldBlock = jsjcStartBlock();
+  jsjRegionStart();
   jsjBlockOrStatement();
+  jsjRegionEnd();
   JsVar *mainBlock = jsjcStopBlock(oldBlock);
   DEBUG_JIT_EMIT("; Branch OVER main block to END\n");
   // Now figure out the jump length and jump (if condition is false)
   if (jit.phase == JSJP_EMIT) {
-    jsjcBranchConditionalRelative(JSJAC_EQ, jsvGetStringLength(iteratorBlock) + jsvGetStringLength(mainBlock) + 4, JSJC_FORCE_4BYTE);
+    jsjcBranchConditionalRelative(JSJAC_EQ, jsvGetStringLength(iteratorBlock) + jsvGetStringLength(mainBlock) + JSJ_BRANCH_LONG_LENGTH, JSJC_FORCE_4BYTE);
     DEBUG_JIT_EMIT("; FOR Main block\n");
     jsjcEmitBlock(mainBlock);
     DEBUG_JIT_EMIT("; FOR Iterator block\n");
     jsjcEmitBlock(iteratorBlock);
     // after the iterator, jump back to condition
     DEBUG_JIT_EMIT("; FOR jump back to condition\n");
-    jsjcBranchRelative(codePosCondition - (jsjcGetByteCount()+4), JSJC_FORCE_4BYTE);
+    jsjcBranchRelative(codePosCondition - (jsjcGetByteCount()+JSJ_BRANCH_LONG_LENGTH), JSJC_FORCE_4BYTE);
     DEBUG_JIT_EMIT("; FOR end\n");
   }
   jsvUnLock2(mainBlock, iteratorBlock);
@@ -985,39 +1496,36 @@ void jsjStatementDoOrWhile(bool isWhile) {
     JSP_ASSERT_MATCH(LEX_R_WHILE);
     DEBUG_JIT_EMIT("; WHILE condition\n");
     JSP_MATCH('(');
-    jsjExpression();
-    if (jit.phase == JSJP_EMIT) {
-      // do this here so our stack counter stays at the right level
-      jsjPopAsBool(0);
-      jsjcCompareImm(0, 0);
-    }
+    jsjConditionExpression(')'); // do this here so our stack counter stays at the right level
     JSP_MATCH(')');
     DEBUG_JIT_EMIT("; Parsing WHILE main block\n");
     JsVar *oldBlock = jsjcStartBlock();
+    jsjRegionStart();
     jsjBlockOrStatement();
+    jsjRegionEnd();
     JsVar *mainBlock = jsjcStopBlock(oldBlock);
     if (jit.phase == JSJP_EMIT) {
       DEBUG_JIT_EMIT("; WHILE condition jump\n");
-      jsjcBranchConditionalRelative(JSJAC_EQ, jsvGetStringLength(mainBlock) + 4, JSJC_FORCE_4BYTE);
+      jsjcBranchConditionalRelative(JSJAC_EQ, jsvGetStringLength(mainBlock) + JSJ_BRANCH_LONG_LENGTH, JSJC_FORCE_4BYTE);
       DEBUG_JIT_EMIT("; WHILE Main block\n");
       jsjcEmitBlock(mainBlock);
       DEBUG_JIT_EMIT("; WHILE jump back to condition\n");
-      jsjcBranchRelative(codePosStart - (jsjcGetByteCount()+4), JSJC_FORCE_4BYTE);
+      jsjcBranchRelative(codePosStart - (jsjcGetByteCount()+JSJ_BRANCH_LONG_LENGTH), JSJC_FORCE_4BYTE);
     }
     jsvUnLock(mainBlock);
   } else { // do..while loop
     JSP_ASSERT_MATCH(LEX_R_DO);
     DEBUG_JIT_EMIT("; DO Main block\n");
+    jsjRegionStart();
     jsjBlockOrStatement();
+    jsjRegionEnd();
     JSP_ASSERT_MATCH(LEX_R_WHILE);
     DEBUG_JIT_EMIT("; DO condition\n");
     JSP_MATCH('(');
-    jsjExpression();
+    jsjConditionExpression(')');
     JSP_MATCH(')');
     if (jit.phase == JSJP_EMIT) {
-      jsjPopAsBool(0);
-      jsjcCompareImm(0, 0);
-      jsjcBranchConditionalRelative(JSJAC_NE, codePosStart - (jsjcGetByteCount()+4), JSJC_FORCE_4BYTE);
+      jsjcBranchConditionalRelative(JSJAC_NE, codePosStart - (jsjcGetByteCount()+JSJ_BRANCH_CONDITIONAL_LONG_LENGTH), JSJC_FORCE_4BYTE);
     }
   }
 }
@@ -1048,9 +1556,7 @@ void jsjStatement() {
       lex->tk=='[' ||
       lex->tk=='(') {
     /* Execute a simple statement that only contains basic arithmetic... */
-    jsjExpression();
-    if (jit.phase == JSJP_EMIT)
-      jsjPopAndUnLock();
+    jsjStatementExpression();
   } else if (lex->tk=='{') {
     /* A block of code */
     jsjBlock();
@@ -1111,8 +1617,18 @@ JsVar *jsjParseFunction() {
   jsjFunctionStart();
   // Parse the function
   size_t codeStartPosition = lex->tokenLastStart;
+  // Work out which local variables can be native ints. Every time one isn't, others might not be either so go again
+  do {
+    jit.phase = JSJP_TYPES; DEBUG_JIT("; ============ TYPES PHASE\n");
+    jit.intVarsChanged = false;
+    jit.regionCount = 0;
+    jsjBlockNoBrackets();
+    jslSeekTo(codeStartPosition);
+  } while (JSJ_PARSING && jit.intVarsChanged);
+  DEBUG_JIT("; INT VARS %j\n", jit.intVarNames);
   jit.phase = JSJP_SCAN; DEBUG_JIT("; ============ SCAN PHASE\n");
   jsjBlockNoBrackets();
+  jsjIntVarsAllocate();
   if (JSJ_PARSING) { // if no error, re-parse and create code
     jslSeekTo(codeStartPosition);
     jit.phase = JSJP_EMIT; DEBUG_JIT("; ============ EMIT PHASE\n");
@@ -1123,6 +1639,9 @@ JsVar *jsjParseFunction() {
       DEBUG_JIT_EMIT("; END of function - return undefined\n");
       jsjcLiteral32(0, 0);
       jsjFunctionReturn(false/*isReturnStatement*/);
+    } else {
+      // the 'return' at the end already removed our variables from the stack
+      jit.stackDepth = 0;
     }
   }
   JsVar *v = jsjcStop();
@@ -1151,13 +1670,11 @@ JsVar *jsjEvaluateVar(JsVar *str) {
   // Function init code
   jsjFunctionStart();
   // Parse the expression
-  JslCharPos codeStartPosition;
-  jslCharPosFromLex(&codeStartPosition);
+  size_t codeStartPosition = lex.tokenStart; // start of the first token (not the char after it)
   jit.phase = JSJP_SCAN;
   jsjExpression();
   if (JSJ_PARSING) { // if no error, re-parse and create code
-    jslSeekToP(&codeStartPosition);
-    jslCharPosFree(&codeStartPosition);
+    jslSeekTo(codeStartPosition);
     jit.phase = JSJP_EMIT;
     jsjExpression();
     jsjPopNoName(0); // a -> r0, we only want the value, so skip the name if there was one
@@ -1181,4 +1698,13 @@ JsVar *jsjEvaluate(const char *str) {
   return v;
 }
 
+JsVar *jsjExecute(JsVar *code, JsVar *thisVar) {
+  char *nativePtr = jsvGetFlatStringPointer(code);
+  if (!nativePtr) return 0;
+#ifndef JSJ_X86_64
+  nativePtr++; // thumb
+#endif
+  return jsnCallFunction(nativePtr, JSWAT_JSVAR/*JS Variable as return type*/, thisVar, NULL, 0);
+}
+
 #endif /*#ifdef ESPR_JIT*/
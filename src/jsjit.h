@@ -27,5 +27,8 @@ JsVar *jsjEvaluate(const char *str);
 // parse a function and return a native string of the code. Assumes '{' has already been parsed
 JsVar *jsjParseFunction();
 
+// Run code returned from jsjParseFunction/jsjEvaluate (the flat string must be in executable memory)
+JsVar *jsjExecute(JsVar *code, JsVar *thisVar);
+
 #endif /* JSJIT_H_ */
 #endif /* ESPR_JIT */
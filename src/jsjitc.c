@@ -8,7 +8,7 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  *
  * ----------------------------------------------------------------------------
- * Recursive descent JIT
+ * Recursive descent JIT - code generation (ARM Thumb-2 or x86-64)
  * ----------------------------------------------------------------------------
 
  https://developer.arm.com/documentation/ddi0308/d/Thumb-Instructions/Alphabetical-list-of-Thumb-instructions?lang=en
@@ -44,6 +44,7 @@ const char *JSJAC_STRINGS = JSJAC_STRING;
 const char *jsjcGetTypeName(JsjValueType t) {
   switch(t) {
     case JSJVT_INT: return "int";
+    case JSJVT_BOOL: return "bool";
     case JSJVT_JSVAR: return "JsVar";
     case JSJVT_JSVAR_NO_NAME: return "JsVar-value";
     default: return "unknown";
@@ -74,12 +75,20 @@ void jsjcStart() {
   jit.vars = jsvNewObject();
   jit.varCount = 0;
   jit.stackDepth = 0;
+  jit.intVarNames = jsvNewObject();
+  jit.intVarCount = 0;
+  jit.intSlotCount = 0;
+  jit.regionDepth = 0;
+  jit.regionCount = 0;
+  jit.intEmit = false;
 }
 
 JsVar *jsjcStop() {
   jsjcDebugPrintf("; VARS: %j\n", jit.vars);
   jsvUnLock(jit.vars);
   jit.vars = 0;
+  jsvUnLock(jit.intVarNames);
+  jit.intVarNames = 0;
   assert(jspHasError() || jit.stackDepth == 0); // stack depth may be wrong if there's an exception
 
   assert(jit.blockCount==0);
@@ -152,14 +161,6 @@ JsVar *jsjcStopBlock(JsVar *oldBlock) {
   return v;
 }
 
-void jsjcEmit16(uint16_t v) {
-  //DEBUG_JIT("> %04x\n", v);
-  char *bytes = (char *)&v;
-  //jsvAppendStringBuf(jit.code, bytes, 2);
-  jsvStringIteratorAppend(&jit.codeIt, bytes[0]);
-  jsvStringIteratorAppend(&jit.codeIt, bytes[1]);
-}
-
 // Emit a whole block of code
 void jsjcEmitBlock(JsVar *block) {
   DEBUG_JIT("... code block ...\n");
@@ -170,6 +171,476 @@ int jsjcGetByteCount() {
   return jsvGetStringLength(jit.code);
 }
 
+// Convert the var type in the given reg to a JsVar
+void jsjcConvertToJsVar(int reg, JsjValueType varType) {
+  if (varType==JSJVT_JSVAR || varType==JSJVT_JSVAR_NO_NAME) return; // no conversion needed
+  if (varType==JSJVT_INT || varType==JSJVT_BOOL) {
+    if (reg) jsjcMov(0, reg);
+    if (varType==JSJVT_BOOL) jsjcCall(jsvNewFromBool);
+    else jsjcCall(jsvNewFromInteger); // FIXME: what about clobbering r1-r3? Do a push/pop?
+    if (reg) jsjcMov(reg, 0);
+    return;
+  }
+  assert(0);
+}
+
+// Get the type of the variable on the top of the stack
+JsjValueType jsjcGetTopType() {
+  assert(jit.stackDepth>0);
+  if (jit.stackDepth==0) return JSJVT_INT; // Error!
+  if (jit.stackDepth>JSJ_TYPE_STACK_SIZE) return JSJVT_JSVAR; // If too many types, assume JSVAR (we convert when we push)
+  return jit.typeStack[jit.stackDepth-1];
+}
+
+#ifdef JSJ_X86_64
+/* x86-64 (System V ABI) backend. The front-end thinks in terms of ARM registers, so
+ we map r0..r3 (ARM's argument registers) onto the first 4 SysV argument registers,
+ and r4..r7 (which ARM preserves over calls) onto registers that are callee-saved
+ on x86-64 too. */
+
+// x86 register numbers
+#define X86_RAX 0
+#define X86_RCX 1
+#define X86_RDX 2
+#define X86_RBX 3
+#define X86_RSP 4
+#define X86_RBP 5
+#define X86_RSI 6
+#define X86_RDI 7
+
+static const int8_t jsjcX86Regs[16] = {
+  X86_RDI, X86_RSI, X86_RDX, X86_RCX, // r0..r3
+  X86_RBX, 12/*r12*/, 13/*r13*/, 14/*r14*/, // r4..r7
+  8/*r8*/, -1, -1, -1, -1, // r8 is only used for the 5th function argument
+  X86_RSP, -1, -1 // SP, LR, PC
+};
+static const char *jsjcX86RegNames[16] = {
+  "RAX","RCX","RDX","RBX","RSP","RBP","RSI","RDI",
+  "R8","R9","R10","R11","R12","R13","R14","R15"
+};
+// JsjAsmCondition -> x86 condition code (for Jcc)
+static const uint8_t jsjcX86Conditions[14] = {
+  0x4/*E*/, 0x5/*NE*/, 0x3/*AE*/, 0x2/*B*/, 0x8/*S*/, 0x9/*NS*/, 0x0/*O*/,
+  0x1/*NO*/, 0x7/*A*/, 0x6/*BE*/, 0xD/*GE*/, 0xC/*L*/, 0xF/*G*/, 0xE/*LE*/
+};
+
+// Get the x86 register for one of our registers
+static int jsjcX86Reg(int reg) {
+  assert(reg>=0 && reg<16 && jsjcX86Regs[reg]>=0);
+  return jsjcX86Regs[reg];
+}
+#define X86_NAME(reg) jsjcX86RegNames[jsjcX86Reg(reg)]
+
+static void jsjcEmit8(uint8_t v) {
+  jsvStringIteratorAppend(&jit.codeIt, (char)v);
+}
+
+static void jsjcEmit32(uint32_t v) {
+  for (int i=0;i<4;i++)
+    jsjcEmit8((uint8_t)(v>>(i*8)));
+}
+
+// REX prefix for a 64 bit operation. x86reg goes in ModRM.reg, x86rm in ModRM.rm
+static void jsjcEmitRexW(int x86reg, int x86rm) {
+  jsjcEmit8((uint8_t)(0x48 | ((x86reg&8)?4:0) | ((x86rm&8)?1:0)));
+}
+
+// REX prefix only if needed for a 32 bit operation on x86rm
+static void jsjcEmitRexB(int x86rm) {
+  if (x86rm&8) jsjcEmit8(0x41);
+}
+
+// ModRM for register-register
+static void jsjcEmitModRMReg(int x86reg, int x86rm) {
+  jsjcEmit8((uint8_t)(0xC0 | ((x86reg&7)<<3) | (x86rm&7)));
+}
+
+// ModRM for [x86base + offset] (always uses a 32 bit offset)
+static void jsjcEmitModRMMem(int x86reg, int x86base, int offset) {
+  jsjcEmit8((uint8_t)(0x80 | ((x86reg&7)<<3) | (x86base&7)));
+  if ((x86base&7)==X86_RSP) jsjcEmit8(0x24); // RSP/R12 as a base need a SIB byte
+  jsjcEmit32((uint32_t)offset);
+}
+
+// MOV x86to, x86from (64 bit)
+static void jsjcX86Mov(int x86to, int x86from) {
+  jsjcEmitRexW(x86from, x86to);
+  jsjcEmit8(0x89);
+  jsjcEmitModRMReg(x86from, x86to);
+}
+
+void jsjcLiteral8(int reg, uint8_t data) {
+  jsjcLiteral32(reg, data);
+}
+
+void jsjcLiteral16(int reg, bool hi16, uint16_t data) {
+  if (!hi16) {
+    jsjcLiteral32(reg, data);
+    return;
+  }
+  // like MOVT - keep the bottom 16 bits and set the top 16
+  int r = jsjcX86Reg(reg);
+  DEBUG_JIT("AND %s,#0xFFFF\n", X86_NAME(reg));
+  jsjcEmitRexB(r);
+  jsjcEmit8(0x81);
+  jsjcEmitModRMReg(4, r);
+  jsjcEmit32(0xFFFF);
+  DEBUG_JIT("OR %s,#0x%08x\n", X86_NAME(reg), ((uint32_t)data)<<16);
+  jsjcEmitRexB(r);
+  jsjcEmit8(0x81);
+  jsjcEmitModRMReg(1, r);
+  jsjcEmit32(((uint32_t)data)<<16);
+}
+
+void jsjcLiteral32(int reg, uint32_t data) {
+  DEBUG_JIT("MOV %s,#0x%08x\n", X86_NAME(reg), data);
+  // 32 bit operations zero the top 32 bits of the register
+  int r = jsjcX86Reg(reg);
+  jsjcEmitRexB(r);
+  jsjcEmit8((uint8_t)(0xB8 + (r&7)));
+  jsjcEmit32(data);
+}
+
+void jsjcLiteral64(int reg, uint64_t data) {
+  DEBUG_JIT("MOV %s,#0x%08x%08x\n", X86_NAME(reg), (uint32_t)(data>>32), (uint32_t)data);
+  int r = jsjcX86Reg(reg);
+  jsjcEmitRexW(0, r);
+  jsjcEmit8((uint8_t)(0xB8 + (r&7)));
+  jsjcEmit32((uint32_t)data);
+  jsjcEmit32((uint32_t)(data>>32));
+  if (reg==0) {
+    // doubles are passed in XMM0, so put it there too in case this is for jsvNewFromFloat
+    DEBUG_JIT("MOVQ XMM0,%s\n", X86_NAME(reg));
+    jsjcEmit8(0x66);
+    jsjcEmitRexW(0, r);
+    jsjcEmit8(0x0F);
+    jsjcEmit8(0x6E);
+    jsjcEmitModRMReg(0, r);
+  }
+}
+
+int jsjcLiteralString(int reg, JsVar *str, bool nullTerminate) {
+  /* We store the String data here in-line, so get its address relative to RIP then jump forward over the data. */
+  int len = (int)jsvGetStringLength(str);
+  int realLen = len + (nullTerminate?1:0);
+  int branchLen = jsjcGetBranchRelativeLength(realLen);
+  // Write location of data to register - it's just after the jump
+  int r = jsjcX86Reg(reg);
+  DEBUG_JIT("LEA %s,[RIP+%d]\n", X86_NAME(reg), branchLen);
+  jsjcEmitRexW(r, 0);
+  jsjcEmit8(0x8D);
+  jsjcEmit8((uint8_t)(0x05 | ((r&7)<<3))); // [RIP+disp32]
+  jsjcEmit32((uint32_t)branchLen);
+  // jump over the data
+  jsjcBranchRelative(realLen, JSJC_NONE);
+  // write the data
+  DEBUG_JIT("... %d bytes data (%q) ...\n", (uint32_t)(realLen), str);
+  JsvStringIterator it;
+  jsvStringIteratorNew(&it, str, 0);
+  while (jsvStringIteratorHasChar(&it))
+    jsjcEmit8((uint8_t)jsvStringIteratorGetCharAndNext(&it));
+  jsvStringIteratorFree(&it);
+  if (nullTerminate) jsjcEmit8(0);
+  return len;
+}
+
+// Compare a register with a literal. jsjcBranchConditionalRelative can then be called
+void jsjcCompareImm(int reg, int literal) {
+  DEBUG_JIT("CMP %s(low byte),#%d\n", X86_NAME(reg), literal);
+  assert(literal>=0 && literal<256);
+  /* We only compare the bottom byte - this is only used on the result of functions
+   returning bool, and the ABI leaves the top bits of those undefined */
+  int r = jsjcX86Reg(reg);
+  jsjcEmit8((uint8_t)(0x40 | ((r&8)?1:0))); // REX is needed to get DIL/SIL rather than BH/DH
+  jsjcEmit8(0x80);
+  jsjcEmitModRMReg(7, r);
+  jsjcEmit8((uint8_t)literal);
+}
+
+// Get length of jsjcBranchRelative in bytes
+int jsjcGetBranchRelativeLength(int bytes) {
+  if (bytes<-128 || bytes>127)
+    return JSJ_BRANCH_LONG_LENGTH;
+  return 2;
+}
+
+// Jump a number of bytes forward or back, return number of bytes used for op
+int jsjcBranchRelative(int bytes, JsjsEmitOptions options) {
+  // x86 jumps are relative to the end of the instruction, which is what we're given
+  if (jsjcGetBranchRelativeLength(bytes)==2 && !(options&JSJC_FORCE_4BYTE)) {
+    DEBUG_JIT("JMP %s%d (addr 0x%04x)\n", (bytes>=0)?"+":"", (uint32_t)(bytes), jsjcGetByteCount()+2+bytes);
+    jsjcEmit8(0xEB);
+    jsjcEmit8((uint8_t)bytes);
+    return 2;
+  } else {
+    DEBUG_JIT("JMP.32 %s%d (addr 0x%04x)\n", (bytes>=0)?"+":"", (uint32_t)(bytes), jsjcGetByteCount()+JSJ_BRANCH_LONG_LENGTH+bytes);
+    jsjcEmit8(0xE9);
+    jsjcEmit32((uint32_t)bytes);
+    return JSJ_BRANCH_LONG_LENGTH;
+  }
+}
+
+// Get length of jsjcBranchConditionalRelative in bytes
+int jsjcGetBranchConditionalRelativeLength(int bytes) {
+  if (bytes<-128 || bytes>127)
+    return JSJ_BRANCH_CONDITIONAL_LONG_LENGTH;
+  return 2;
+}
+
+// Jump a number of bytes forward or back, based on condition flags, return number of bytes used for op
+int jsjcBranchConditionalRelative(JsjAsmCondition cond, int bytes, JsjsEmitOptions options) {
+  assert(cond<14); // no 'always' or SVC
+  uint8_t cc = jsjcX86Conditions[cond];
+  if (jsjcGetBranchConditionalRelativeLength(bytes)==2 && !(options&JSJC_FORCE_4BYTE)) {
+    DEBUG_JIT("J<%s> %s%d (addr 0x%04x)\n", &JSJAC_STRINGS[cond*3], (bytes>=0)?"+":"", (uint32_t)(bytes), jsjcGetByteCount()+2+bytes);
+    jsjcEmit8((uint8_t)(0x70 | cc));
+    jsjcEmit8((uint8_t)bytes);
+    return 2;
+  } else {
+    DEBUG_JIT("J<%s>.32 %s%d (addr 0x%04x)\n", &JSJAC_STRINGS[cond*3], (bytes>=0)?"+":"", (uint32_t)(bytes), jsjcGetByteCount()+JSJ_BRANCH_CONDITIONAL_LONG_LENGTH+bytes);
+    jsjcEmit8(0x0F);
+    jsjcEmit8((uint8_t)(0x80 | cc));
+    jsjcEmit32((uint32_t)bytes);
+    return JSJ_BRANCH_CONDITIONAL_LONG_LENGTH;
+  }
+}
+
+#ifdef DEBUG_JIT_CALLS
+void _jsjcCall(void *c, const char *name) {
+#else
+void jsjcCall(void *c) {
+#endif
+  /* The ABI needs the stack 16 byte aligned when we call. jsjcPushAll leaves it
+  aligned, and everything else we put on the stack is 8 bytes so we know at compile time */
+  bool alignStack = jit.stackDepth&1;
+  uint64_t addr = (uint64_t)(size_t)c;
+  DEBUG_JIT("MOV RAX,#0x%08x%08x\n", (uint32_t)(addr>>32), (uint32_t)addr);
+  jsjcEmitRexW(0, X86_RAX);
+  jsjcEmit8(0xB8 + X86_RAX);
+  jsjcEmit32((uint32_t)addr);
+  jsjcEmit32((uint32_t)(addr>>32));
+  if (alignStack) {
+    DEBUG_JIT("SUB RSP,#8   (align stack)\n");
+    jsjcEmit8(0x48); jsjcEmit8(0x83); jsjcEmit8(0xEC); jsjcEmit8(8);
+  }
+#ifdef DEBUG_JIT_CALLS
+  DEBUG_JIT("CALL RAX (%s)\n", name);
+#else
+  DEBUG_JIT("CALL RAX\n");
+#endif
+  jsjcEmit8(0xFF);
+  jsjcEmitModRMReg(2, X86_RAX);
+  if (alignStack) {
+    DEBUG_JIT("ADD RSP,#8\n");
+    jsjcEmit8(0x48); jsjcEmit8(0x83); jsjcEmit8(0xC4); jsjcEmit8(8);
+  }
+  /* Results come back in RAX (and RDX for 16 byte structs - see _jsjxObjectLookup)
+  but the front-end expects them in r0 (and r1). Both RSI and RDX are clobbered by the
+  call anyway so it's safe to always copy both */
+  DEBUG_JIT("MOV RDI,RAX; MOV RSI,RDX\n");
+  jsjcX86Mov(X86_RDI, X86_RAX);
+  jsjcX86Mov(X86_RSI, X86_RDX);
+}
+
+void jsjcMov(int regTo, int regFrom) {
+  DEBUG_JIT("MOV %s <- %s\n", X86_NAME(regTo), X86_NAME(regFrom));
+  jsjcX86Mov(jsjcX86Reg(regTo), jsjcX86Reg(regFrom));
+}
+
+void jsjcAdd(int regTo, int regFrom, int lit) {
+  DEBUG_JIT("LEA %s <- [%s + #%d]\n", X86_NAME(regTo), X86_NAME(regFrom), lit);
+  int to = jsjcX86Reg(regTo);
+  int from = jsjcX86Reg(regFrom);
+  jsjcEmitRexW(to, from);
+  jsjcEmit8(0x8D);
+  jsjcEmitModRMMem(to, from, lit);
+}
+
+// Move negated register
+void jsjcMVN(int regTo, int regFrom) {
+  if (regTo != regFrom) jsjcMov(regTo, regFrom);
+  DEBUG_JIT("NOT %s\n", X86_NAME(regTo));
+  int r = jsjcX86Reg(regTo);
+  jsjcEmitRexW(0, r);
+  jsjcEmit8(0xF7);
+  jsjcEmitModRMReg(2, r);
+}
+
+// regTo = regTo & regFrom
+void jsjcAND(int regTo, int regFrom) {
+  DEBUG_JIT("AND %s <- %s\n", X86_NAME(regTo), X86_NAME(regFrom));
+  int to = jsjcX86Reg(regTo);
+  int from = jsjcX86Reg(regFrom);
+  jsjcEmitRexW(from, to);
+  jsjcEmit8(0x21);
+  jsjcEmitModRMReg(from, to);
+}
+
+// REX prefix only if needed for a 32 bit operation with x86reg in ModRM.reg and x86rm in ModRM.rm
+static void jsjcEmitRexRB(int x86reg, int x86rm) {
+  if ((x86reg|x86rm)&8)
+    jsjcEmit8((uint8_t)(0x40 | ((x86reg&8)?4:0) | ((x86rm&8)?1:0)));
+}
+
+void jsjcIntOp(int op, int regTo, int regFrom) {
+  int to = jsjcX86Reg(regTo);
+  int from = jsjcX86Reg(regFrom);
+  if (op==LEX_LSHIFT || op==LEX_RSHIFT) {
+    /* The shift count has to be in CL, which is r3, so work in R10 and save RCX in R11.
+    x86 only uses the bottom 5 bits of the count for 32 bit shifts, which is what JS wants */
+    DEBUG_JIT("%s %s <- %s   (32 bit, via R10/CL)\n", (op==LEX_LSHIFT)?"SHL":"SAR", X86_NAME(regTo), X86_NAME(regFrom));
+    jsjcX86Mov(11, X86_RCX);
+    jsjcX86Mov(10, to);
+    jsjcX86Mov(X86_RCX, from);
+    jsjcEmit8(0x41); // REX.B for R10 - and as it's a 32 bit op the top 32 bits are zeroed
+    jsjcEmit8(0xD3);
+    jsjcEmitModRMReg((op==LEX_LSHIFT)?4:7, 10);
+    jsjcX86Mov(X86_RCX, 11);
+    jsjcX86Mov(to, 10);
+    return;
+  }
+  uint8_t opcode;
+  const char *name;
+  switch (op) {
+    case '+': opcode = 0x01; name = "ADD"; break;
+    case '-': opcode = 0x29; name = "SUB"; break;
+    case '&': opcode = 0x21; name = "AND"; break;
+    case '|': opcode = 0x09; name = "OR"; break;
+    case '^': opcode = 0x31; name = "XOR"; break;
+    default: assert(0); return;
+  }
+  DEBUG_JIT("%s %s <- %s   (32 bit)\n", name, X86_NAME(regTo), X86_NAME(regFrom));
+  // 32 bit operations zero the top 32 bits of the register, so ints are always stored zero-extended
+  jsjcEmitRexRB(from, to);
+  jsjcEmit8(opcode);
+  jsjcEmitModRMReg(from, to);
+}
+
+void jsjcCompare(int regA, int regB) {
+  DEBUG_JIT("CMP %s,%s   (32 bit)\n", X86_NAME(regA), X86_NAME(regB));
+  int a = jsjcX86Reg(regA);
+  int b = jsjcX86Reg(regB);
+  jsjcEmitRexRB(b, a);
+  jsjcEmit8(0x39);
+  jsjcEmitModRMReg(b, a);
+}
+
+void jsjcTest(int reg) {
+  DEBUG_JIT("TEST %s,%s\n", X86_NAME(reg), X86_NAME(reg));
+  int r = jsjcX86Reg(reg);
+  jsjcEmitRexW(r, r);
+  jsjcEmit8(0x85);
+  jsjcEmitModRMReg(r, r);
+}
+
+void jsjcSetBool(JsjAsmCondition cond, int reg) {
+  assert(cond<14);
+  DEBUG_JIT("SET<%s> %s; MOVZX %s\n", &JSJAC_STRINGS[cond*3], X86_NAME(reg), X86_NAME(reg));
+  int r = jsjcX86Reg(reg);
+  // REX is always needed so we get DIL/SIL rather than BH/DH
+  jsjcEmit8((uint8_t)(0x40 | ((r&8)?1:0)));
+  jsjcEmit8(0x0F);
+  jsjcEmit8((uint8_t)(0x90 | jsjcX86Conditions[cond]));
+  jsjcEmitModRMReg(0, r);
+  jsjcEmit8((uint8_t)(0x40 | ((r&8)?5:0)));
+  jsjcEmit8(0x0F);
+  jsjcEmit8(0xB6);
+  jsjcEmitModRMReg(r, r);
+}
+
+void jsjcPush(int reg, JsjValueType type) {
+  DEBUG_JIT("PUSH %s   (%s => stack depth %d)\n", X86_NAME(reg), jsjcGetTypeName(type), jit.stackDepth+1);
+  if (jit.stackDepth>=JSJ_TYPE_STACK_SIZE) { // not enough space on type staclk
+    DEBUG_JIT("!!! not enough space on type stack - converting to JsVar\n");
+    jsjcConvertToJsVar(reg, type);
+    type = JSJVT_JSVAR;
+  } else
+    jit.typeStack[jit.stackDepth] = type;
+  jit.stackDepth++;
+  int r = jsjcX86Reg(reg);
+  jsjcEmitRexB(r);
+  jsjcEmit8((uint8_t)(0x50 + (r&7)));
+}
+
+JsjValueType jsjcPop(int reg) {
+  JsjValueType varType = jsjcGetTopType();
+  jit.stackDepth--;
+  DEBUG_JIT("POP %s   (%s <= stack depth %d)\n", X86_NAME(reg), jsjcGetTypeName(varType), jit.stackDepth);
+  int r = jsjcX86Reg(reg);
+  jsjcEmitRexB(r);
+  jsjcEmit8((uint8_t)(0x58 + (r&7)));
+  return varType;
+}
+
+void jsjcAddSP(int amt) {
+  assert((amt%JSJ_WORD_SIZE)==0 && amt>0);
+  jit.stackDepth -= amt/JSJ_WORD_SIZE; // stack grows down -> negate
+  DEBUG_JIT("ADD RSP,#%d   (stack depth now %d)\n", amt, jit.stackDepth);
+  jsjcEmitRexW(0, X86_RSP);
+  jsjcEmit8(0x81);
+  jsjcEmitModRMReg(0, X86_RSP);
+  jsjcEmit32((uint32_t)amt);
+}
+
+void jsjcSubSP(int amt) {
+  assert((amt%JSJ_WORD_SIZE)==0 && amt>0);
+  jit.stackDepth += amt/JSJ_WORD_SIZE; // stack grows down -> negate
+  DEBUG_JIT("SUB RSP,#%d   (stack depth now %d)\n", amt, jit.stackDepth);
+  jsjcEmitRexW(0, X86_RSP);
+  jsjcEmit8(0x81);
+  jsjcEmitModRMReg(5, X86_RSP);
+  jsjcEmit32((uint32_t)amt);
+}
+
+void jsjcLoadImm(int reg, int regAddr, int offset) {
+  DEBUG_JIT("MOV %s,[%s+#%d]\n", X86_NAME(reg), X86_NAME(regAddr), offset);
+  int r = jsjcX86Reg(reg);
+  int base = jsjcX86Reg(regAddr);
+  jsjcEmitRexW(r, base);
+  jsjcEmit8(0x8B);
+  jsjcEmitModRMMem(r, base, offset);
+}
+
+void jsjcStoreImm(int reg, int regAddr, int offset) {
+  DEBUG_JIT("MOV [%s+#%d],%s\n", X86_NAME(regAddr), offset, X86_NAME(reg));
+  int r = jsjcX86Reg(reg);
+  int base = jsjcX86Reg(regAddr);
+  jsjcEmitRexW(r, base);
+  jsjcEmit8(0x89);
+  jsjcEmitModRMMem(r, base, offset);
+}
+
+void jsjcPushAll() {
+  // 5 registers + the return address leaves the stack 16 byte aligned
+  DEBUG_JIT("PUSH {RBP,RBX,R12,R13,R14}\n");
+  jsjcEmit8(0x55);
+  jsjcEmit8(0x53);
+  jsjcEmit8(0x41); jsjcEmit8(0x54);
+  jsjcEmit8(0x41); jsjcEmit8(0x55);
+  jsjcEmit8(0x41); jsjcEmit8(0x56);
+}
+void jsjcPopAllAndReturn() {
+  DEBUG_JIT("MOV RAX,RDI   (return value)\n");
+  jsjcX86Mov(X86_RAX, X86_RDI);
+  DEBUG_JIT("POP {R14,R13,R12,RBX,RBP}; RET\n");
+  jsjcEmit8(0x41); jsjcEmit8(0x5E);
+  jsjcEmit8(0x41); jsjcEmit8(0x5D);
+  jsjcEmit8(0x41); jsjcEmit8(0x5C);
+  jsjcEmit8(0x5B);
+  jsjcEmit8(0x5D);
+  jsjcEmit8(0xC3);
+}
+
+#else // ARM Thumb-2
+
+void jsjcEmit16(uint16_t v) {
+  //DEBUG_JIT("> %04x\n", v);
+  char *bytes = (char *)&v;
+  //jsvAppendStringBuf(jit.code, bytes, 2);
+  jsvStringIteratorAppend(&jit.codeIt, bytes[0]);
+  jsvStringIteratorAppend(&jit.codeIt, bytes[1]);
+}
+
 void jsjcLiteral8(int reg, uint8_t data) {
   assert(reg<8);
   // https://web.eecs.umich.edu/~prabal/teaching/eecs373-f11/readings/ARMv7-M_ARM.pdf page 347
@@ -372,16 +843,63 @@ void jsjcAND(int regTo, int regFrom) {
   jsjcEmit16((uint16_t)(0b0100000000000000 | (regFrom<<3) | (regTo)));
 }
 
-// Convert the var type in the given reg to a JsVar
-void jsjcConvertToJsVar(int reg, JsjValueType varType) {
-  if (varType==JSJVT_JSVAR || varType==JSJVT_JSVAR_NO_NAME) return; // no conversion needed
-  if (varType==JSJVT_INT) {
-    if (reg) jsjcMov(0, reg);
-    jsjcCall(jsvNewFromInteger); // FIXME: what about clobbering r1-r3? Do a push/pop?
-    if (reg) jsjcMov(reg, 0);
-    return;
+void jsjcIntOp(int op, int regTo, int regFrom) {
+  assert(regTo>=0 && regTo<8);
+  assert(regFrom>=0 && regFrom<8);
+  switch (op) {
+    case '+':
+      DEBUG_JIT("ADDS r%d <- r%d + r%d\n", regTo, regTo, regFrom);
+      jsjcEmit16((uint16_t)(0b0001100000000000 | (regFrom<<6) | (regTo<<3) | regTo));
+      break;
+    case '-':
+      DEBUG_JIT("SUBS r%d <- r%d - r%d\n", regTo, regTo, regFrom);
+      jsjcEmit16((uint16_t)(0b0001101000000000 | (regFrom<<6) | (regTo<<3) | regTo));
+      break;
+    case '&':
+      jsjcAND(regTo, regFrom);
+      break;
+    case '|':
+      DEBUG_JIT("ORRS r%d <- r%d\n", regTo, regFrom);
+      jsjcEmit16((uint16_t)(0b0100001100000000 | (regFrom<<3) | regTo));
+      break;
+    case '^':
+      DEBUG_JIT("EORS r%d <- r%d\n", regTo, regFrom);
+      jsjcEmit16((uint16_t)(0b0100000001000000 | (regFrom<<3) | regTo));
+      break;
+    case LEX_LSHIFT:
+    case LEX_RSHIFT:
+      // Thumb uses the bottom byte of the shift count, but JS only wants the bottom 5 bits
+      DEBUG_JIT("LSLS r%d <- r%d,#27; LSRS r%d <- r%d,#27\n", regFrom, regFrom, regFrom, regFrom);
+      jsjcEmit16((uint16_t)(0b0000000000000000 | (27<<6) | (regFrom<<3) | regFrom));
+      jsjcEmit16((uint16_t)(0b0000100000000000 | (27<<6) | (regFrom<<3) | regFrom));
+      DEBUG_JIT("%s r%d <- r%d\n", (op==LEX_LSHIFT)?"LSLS":"ASRS", regTo, regFrom);
+      jsjcEmit16((uint16_t)(((op==LEX_LSHIFT)?0b0100000010000000:0b0100000100000000) | (regFrom<<3) | regTo));
+      break;
+    default: assert(0);
   }
-  assert(0);
+}
+
+void jsjcCompare(int regA, int regB) {
+  DEBUG_JIT("CMP r%d,r%d\n", regA, regB);
+  assert(regA>=0 && regA<8);
+  assert(regB>=0 && regB<8);
+  jsjcEmit16((uint16_t)(0b0100001010000000 | (regB<<3) | regA));
+}
+
+void jsjcTest(int reg) {
+  jsjcCompareImm(reg, 0);
+}
+
+void jsjcSetBool(JsjAsmCondition cond, int reg) {
+  assert(cond<14);
+  assert(reg>=0 && reg<8);
+  // https://developer.arm.com/documentation/ddi0308/d/Thumb-Instructions/Alphabetical-list-of-Thumb-instructions/IT
+  DEBUG_JIT("ITE %s; MOV r%d,#1; MOV r%d,#0\n", &JSJAC_STRINGS[cond*3], reg, reg);
+  int mask = ((~cond)&1)<<3 | 0b0100; // 'then' followed by 'else'
+  jsjcEmit16((uint16_t)(0b1011111100000000 | (cond<<4) | mask));
+  // MOV inside an IT block doesn't set the flags
+  jsjcEmit16((uint16_t)(0b0010000000000000 | (reg<<8) | 1));
+  jsjcEmit16((uint16_t)(0b0010000000000000 | (reg<<8) | 0));
 }
 
 void jsjcPush(int reg, JsjValueType type) {
@@ -397,14 +915,6 @@ void jsjcPush(int reg, JsjValueType type) {
   jsjcEmit16((uint16_t)(0b1011010000000000 | (1<<reg)));
 }
 
-// Get the type of the variable on the top of the stack
-JsjValueType jsjcGetTopType() {
-  assert(jit.stackDepth>0);
-  if (jit.stackDepth==0) return JSJVT_INT; // Error!
-  if (jit.stackDepth>JSJ_TYPE_STACK_SIZE) return JSJVT_JSVAR; // If too many types, assume JSVAR (we convert when we push)
-  return jit.typeStack[jit.stackDepth-1];
-}
-
 JsjValueType jsjcPop(int reg) {
   JsjValueType varType = jsjcGetTopType();
   jit.stackDepth--;
@@ -432,10 +942,10 @@ void jsjcLoadImm(int reg, int regAddr, int offset) {
   assert((offset&3)==0 && offset>=0);
   // https://developer.arm.com/documentation/ddi0308/d/Thumb-Instructions/Alphabetical-list-of-Thumb-instructions/LDR--immediate-
   if (regAddr == JSJAR_SP) {
-    assert(reg<2);
-    assert(offset<4096);
+    assert(reg<8);
+    assert(offset<1024);
     DEBUG_JIT("LDR r%d,[SP,#%d]\n", reg, offset);
-    jsjcEmit16((uint16_t)(0b1001100000000000 | (offset>>2) | (reg<<10)));
+    jsjcEmit16((uint16_t)(0b1001100000000000 | (offset>>2) | (reg<<8)));
   } else {
     assert(reg<8);
     assert(regAddr<8);
@@ -446,11 +956,18 @@ void jsjcLoadImm(int reg, int regAddr, int offset) {
 }
 
 void jsjcStoreImm(int reg, int regAddr, int offset) {
-  assert((offset&3)==0 && offset>=0 && offset<128);
+  assert((offset&3)==0 && offset>=0);
   assert(reg<8);
-  assert(regAddr<8);
-  DEBUG_JIT("STR r%d,r%d,#%d\n", reg, regAddr, offset);
-  jsjcEmit16((uint16_t)(0b0110000000000000 | ((offset>>2)<<6) | (regAddr<<3) | reg));
+  if (regAddr == JSJAR_SP) {
+    assert(offset<1024);
+    DEBUG_JIT("STR r%d,[SP,#%d]\n", reg, offset);
+    jsjcEmit16((uint16_t)(0b1001000000000000 | (offset>>2) | (reg<<8)));
+  } else {
+    assert(regAddr<8);
+    assert(offset<128);
+    DEBUG_JIT("STR r%d,r%d,#%d\n", reg, regAddr, offset);
+    jsjcEmit16((uint16_t)(0b0110000000000000 | ((offset>>2)<<6) | (regAddr<<3) | reg));
+  }
 }
 
 void jsjcPushAll() {
@@ -468,4 +985,5 @@ void jsjcPopAllAndReturn() {
   jsjcEmit16(0b0100011100000000 | (reg<<3));
 }*/
 
+#endif // JSJ_X86_64
 #endif /* ESPR_JIT */
@@ -19,6 +19,18 @@
 #include "jsjit.h"
 #include "jsvariterator.h"
 
+#if defined(__x86_64__) && !defined(ESPR_JIT_THUMB)
+// Emit x86-64 code so JIT'd functions can be run (and benchmarked) on Linux. Define ESPR_JIT_THUMB to get ARM Thumb output instead
+#define JSJ_X86_64
+#define JSJ_WORD_SIZE 8 ///< Size in bytes of one item on the stack
+#define JSJ_BRANCH_LONG_LENGTH 5 ///< Length of jsjcBranchRelative with JSJC_FORCE_4BYTE (jmp rel32)
+#define JSJ_BRANCH_CONDITIONAL_LONG_LENGTH 6 ///< Length of jsjcBranchConditionalRelative with JSJC_FORCE_4BYTE (jcc rel32)
+#else
+#define JSJ_WORD_SIZE 4 ///< Size in bytes of one item on the stack
+#define JSJ_BRANCH_LONG_LENGTH 4 ///< Length of jsjcBranchRelative with JSJC_FORCE_4BYTE
+#define JSJ_BRANCH_CONDITIONAL_LONG_LENGTH 4 ///< Length of jsjcBranchConditionalRelative with JSJC_FORCE_4BYTE
+#endif
+
 // Write debug info to the console
 #define DEBUG_JIT jsjcDebugPrintf
 // Write debug info to the console IF we're in the 'emit' phase
@@ -27,9 +39,13 @@
 void jsjcDebugPrintf(const char *fmt, ...);
 
 #define JSJ_TYPE_STACK_SIZE 64 // Most amount of types stored on stack
+#define JSJ_INT_VARS_MAX 16 // Most local variables we'll try and keep as native ints
+#define JSJ_REGION_STACK_SIZE 16 // How deeply nested conditional code can be before we stop keeping variables as ints
+#define JSJ_INT_REGS 4 // How many registers (r0..) native integer expressions can use
 
 typedef enum {
   JSJVT_INT,
+  JSJVT_BOOL,         ///< An int that is only ever 0 or 1
   JSJVT_JSVAR,        ///< A JsVar
   JSJVT_JSVAR_NO_NAME ///< A JsVar, and we know it's not a name so it doesn't need SkipName
 } PACKED_FLAGS JsjValueType;
@@ -59,6 +75,9 @@ typedef enum {
   JSJAR_r1,
   JSJAR_r2,
   // ...
+#ifdef JSJ_X86_64
+  JSJAR_r8 = 8, ///< x86-64 only - the 5th function argument is passed in a register, not on the stack
+#endif
   JSJAR_SP = 13,
   JSJAR_LR = 14,
   JSJAR_PC = 15,
@@ -66,15 +85,28 @@ typedef enum {
 
 typedef enum {
   JSJP_UNKNOWN,
+  JSJP_TYPES, /// work out which local variables can be stored as ints
   JSJP_SCAN, /// scan for variables used
   JSJP_EMIT  /// emit code
 } JsjPhase;
 
+/* A local variable that we might be able to keep as a native int. In the JSJP_TYPES phase
+we assume every 'var/let/const' with an integer initialiser is an int, and then drop any
+that are assigned something else, or could be used before they are declared. */
+typedef struct {
+  bool isInt;          ///< Is this still stored as an int?
+  bool isConst;        ///< Was it declared with 'const'?
+  uint8_t regionDepth; ///< How many conditional regions deep the declaration was
+  uint16_t regionId;   ///< The innermost region the declaration was in
+  int16_t boxIndex;    ///< Index on the stack of the 'box' - a JsVar used instead if the value stops being an int
+  int16_t intIndex;    ///< Index on the stack of the native int
+} JsjIntVar;
+
 
 typedef struct {
   /// Which compilation phase are we in?
   JsjPhase phase;
-  /// The ARM Thumb-2 code we're in the process of creating
+  /// The ARM Thumb-2 (or x86-64) code we're in the process of creating
   JsVar *code;
   /// An iterator to increase write speed for code
   JsvStringIterator codeIt;
@@ -90,6 +122,26 @@ typedef struct {
   int stackDepth;
   /// For each item on the stack, we store its type
   JsjValueType typeStack[JSJ_TYPE_STACK_SIZE];
+  /// An Object mapping var name -> index in intVars
+  JsVar *intVarNames;
+  /// Local variables we're keeping as ints
+  JsjIntVar intVars[JSJ_INT_VARS_MAX];
+  /// How many items in intVars are used
+  int intVarCount;
+  /// How many words on the top of the variables on the stack are native ints (not JsVars)
+  int intSlotCount;
+  /// Set in JSJP_TYPES if a variable stopped being an int (so we need another pass)
+  bool intVarsChanged;
+  /// The ids of the conditional regions (if/loop bodies/etc) we're currently in
+  uint16_t regions[JSJ_REGION_STACK_SIZE];
+  /// How many conditional regions deep are we?
+  int regionDepth;
+  /// How many conditional regions have we seen so far (used to make ids)
+  uint16_t regionCount;
+  /// Are we emitting native code for an integer expression (otherwise we're just checking if it is one)
+  bool intEmit;
+  /// If a guard in an integer expression fails, we jump here to run the generic code instead
+  int intBailout;
 } JsjInfo;
 
 // JIT state
@@ -121,7 +173,7 @@ void jsjcLiteral8(int reg, uint8_t data);
 void jsjcLiteral16(int reg, bool hi16, uint16_t data);
 // Add 32 bit literal
 void jsjcLiteral32(int reg, uint32_t data);
-// Add 64 bit literal in reg,reg+1
+// Add 64 bit literal in reg,reg+1 (on x86-64, in reg - and also xmm0 if reg==0 so it can be used as a double argument)
 void jsjcLiteral64(int reg, uint64_t data);
 // Call a function
 #ifdef DEBUG_JIT_CALLS
@@ -132,7 +184,7 @@ void jsjcCall(void *c);
 #endif
 // Store a string of data and put the address in a register. Returns the length
 int jsjcLiteralString(int reg, JsVar *str, bool nullTerminate);
-// Compare a register with a literal. jsjcBranchConditionalRelative can then be called
+// Compare a register with a literal. jsjcBranchConditionalRelative can then be called (on x86-64 only the bottom byte is compared, as this is only used for bools)
 void jsjcCompareImm(int reg, int literal);
 // Get length of jsjcBranchRelative in bytes
 int jsjcGetBranchRelativeLength(int bytes);
@@ -150,6 +202,14 @@ void jsjcAdd(int regTo, int regFrom, int lit);
 void jsjcMVN(int regTo, int regFrom);
 // regTo = regTo & regFrom
 void jsjcAND(int regTo, int regFrom);
+// 32 bit integer maths: regTo = regTo op regFrom, for op = + - & | ^ LEX_LSHIFT LEX_RSHIFT. + and - set the overflow flag (JSJAC_VS)
+void jsjcIntOp(int op, int regTo, int regFrom);
+// Compare two registers as signed 32 bit ints. jsjcBranchConditionalRelative/jsjcSetBool can then be called
+void jsjcCompare(int regA, int regB);
+// Compare a whole register (even a pointer) with zero, so JSJAC_EQ is set if it was zero
+void jsjcTest(int reg);
+// reg = 1 if the condition flags match cond, or 0 if not
+void jsjcSetBool(JsjAsmCondition cond, int reg);
 // Convert the var type in the given reg to a JsVar
 void jsjcConvertToJsVar(int reg, JsjValueType varType);
 // Push a register onto the stack
@@ -158,9 +218,9 @@ void jsjcPush(int reg, JsjValueType type);
 JsjValueType jsjcGetTopType();
 // Pop off the stack to a register
 JsjValueType jsjcPop(int reg);
-// Add a value to the stack pointer (only multiple of 4)
+// Add a value to the stack pointer (only multiple of JSJ_WORD_SIZE)
 void jsjcAddSP(int amt);
-// Subtract a value from the stack pointer (only multiple of 4)
+// Subtract a value from the stack pointer (only multiple of JSJ_WORD_SIZE)
 void jsjcSubSP(int amt);
 // reg = mem[regAddr + offset]
 void jsjcLoadImm(int reg, int regAddr, int offset);
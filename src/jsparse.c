@@ -368,8 +368,9 @@ NO_INLINE bool jspeFunctionDefinitionInternal(JsVar *funcVar, bool expressionOnl
           JsVar *funcScopeVar = jspeiGetScopesAsVar();
           if (funcScopeVar)
             jsvAddNamedChildAndUnLock(funcVar, funcScopeVar, JSPARSE_FUNCTION_SCOPE_NAME);
-          JSP_MATCH('}');
+          jsvUnLock(tokenValue);
           jslCharPosFree(&funcCodeStart);
+          JSP_MATCH('}');
           return true;
         } else {
           if (funcCodeVar) {
@@ -689,7 +690,7 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
       uint16_t functionLineNumber = 0;
 #endif
 #ifdef ESPR_JIT
-      bool functionIsJIT = false; // is functionCode actually Thumb Assembly (for JS)
+      bool functionIsJIT = false; // is functionCode actually native code (for JS)
 #endif
 
       /** NOTE: We expect that the function object will have:
@@ -812,9 +813,7 @@ NO_INLINE JsVar *jspeFunctionCall(JsVar *function, JsVar *functionName, JsVar *t
            * points to assembly code...
            */
           if (functionIsJIT) {
-            void *nativePtr = jsvGetFlatStringPointer(functionCode);
-            if (nativePtr)
-              returnVar = jsnCallFunction(nativePtr+1/*thumb*/, JSWAT_JSVAR/*JS Variable as return type*/, thisVar, NULL, 0);
+            returnVar = jsjExecute(functionCode, thisVar);
           } else
 #endif
           /* we just want to execute the block, but something could
@@ -979,16 +978,97 @@ JsVar *jspGetNamedVariable(const char *tokenName) {
   return a;
 }
 
+#ifdef ESPR_INLINE_CACHE
+/* Looking up a field in the prototype chain or in the built-in functions (eg.
+ * `Math.sin` or `g.setPixel`) is slow, so we keep a small cache of what we found.
+ * Entries are chosen based on the position in the code and the object, so each
+ * place in the code tends to get its own entry, but the object, name and
+ * jsvShapeEpoch are all checked before an entry is used. */
+#ifndef ESPR_INLINE_CACHE_SIZE
+#define ESPR_INLINE_CACHE_SIZE 64 ///< Number of entries in the inline cache (power of 2)
+#endif
+
+/* Entries hold a reference (not a lock, as the same object could be in more
+ * entries than we can lock it) so the cache is cleared before a GC or defrag */
+typedef struct {
+  JsVar *object; ///< The object the field was looked up on (referenced)
+  JsVar *name; ///< The NAME that was found in the prototype chain, or one we made to hold a built-in function (referenced)
+  unsigned int epoch; ///< jsvShapeEpoch when this entry was set
+} JspInlineCacheEntry;
+
+static JspInlineCacheEntry jspInlineCache[ESPR_INLINE_CACHE_SIZE];
+
+static JspInlineCacheEntry *jspInlineCacheGetEntry(JsVar *object) {
+  size_t key = (size_t)object / sizeof(JsVar);
+  if (lex) key += (lex->tokenStart + (size_t)lex->sourceVar / sizeof(JsVar)) * 31;
+  return &jspInlineCache[key & (ESPR_INLINE_CACHE_SIZE-1)];
+}
+
+static void jspInlineCacheClearEntry(JspInlineCacheEntry *entry) {
+  JsVar *object = entry->object, *name = entry->name;
+  entry->object = 0;
+  entry->name = 0;
+  jsvUnRef(object);
+  jsvUnRef(name);
+}
+
+static void jspInlineCacheSet(JspInlineCacheEntry *entry, JsVar *object, JsVar *child, const char *name) {
+  JsVar *cacheName;
+  if (jsvIsName(child)) {
+    cacheName = jsvRef(child);
+  } else if (jsvIsNativeFunction(child)) {
+    // Make a name to hold the built-in function - don't cache built-in properties as they are worked out each time
+    cacheName = jsvMakeIntoVariableName(jsvNewFromString(name), child);
+    if (!cacheName) return;
+    jsvRef(cacheName);
+    jsvUnLock(cacheName);
+  } else return;
+  if (entry->name) jspInlineCacheClearEntry(entry);
+  entry->object = jsvRef(object);
+  entry->name = cacheName;
+  entry->epoch = jsvShapeEpoch;
+}
+
+/// Remove everything from the inline cache. Returns true if anything was removed
+bool jspInlineCacheClear() {
+  bool cleared = false;
+  for (int i=0;i<ESPR_INLINE_CACHE_SIZE;i++) {
+    if (jspInlineCache[i].name) {
+      jspInlineCacheClearEntry(&jspInlineCache[i]);
+      cleared = true;
+    }
+  }
+  return cleared;
+}
+#endif
+
 /// Used by jspGetNamedField / jspGetVarNamedField
 static NO_INLINE JsVar *jspGetNamedFieldInParents(JsVar *object, const char* name, bool returnName) {
+  JsVar *child = 0;
+#ifdef ESPR_INLINE_CACHE
+  JspInlineCacheEntry *cacheEntry = 0;
+  if (jsvHasChildren(object)) {
+    cacheEntry = jspInlineCacheGetEntry(object);
+    if (cacheEntry->object==object &&
+        cacheEntry->epoch==jsvShapeEpoch &&
+        jsvIsStringEqual(cacheEntry->name, name))
+      child = jsvLockAgain(cacheEntry->name);
+  }
+  if (!child) {
+#endif
   // Now look in prototypes
-  JsVar * child = jspeiFindChildFromStringInParents(object, name);
+  child = jspeiFindChildFromStringInParents(object, name);
 
   /* Check for builtins via separate function
    * This way we save on RAM for built-ins because everything comes out of program code */
   if (!child) {
     child = jswFindBuiltInFunction(object, name);
   }
+#ifdef ESPR_INLINE_CACHE
+    if (cacheEntry && child)
+      jspInlineCacheSet(cacheEntry, object, child, name);
+  }
+#endif
 
   /* We didn't get here if we found a child in the object itself, so
    * if we're here then we probably have the wrong name - so for example
@@ -1564,40 +1644,36 @@ JsVar *jspeTemplateLiteral() {
       JsvStringIterator it, dit;
       jsvStringIteratorNew(&it, template, 0);
       jsvStringIteratorNew(&dit, a, 0);
+      size_t textStart = 0; // start of the text that we haven't copied into 'a' yet
       while (jsvStringIteratorHasChar(&it)) {
         char ch = jsvStringIteratorGetCharAndNext(&it);
-        if (ch=='$') {
-          ch = jsvStringIteratorGetChar(&it);
-          if (ch=='{') {
-            // Now parse out the expression
-            jsvStringIteratorNext(&it);
-            int brackets = 1;
-            JsVar *expr = jsvNewFromEmptyString();
-            if (!expr) break;
-            JsvStringIterator eit;
-            jsvStringIteratorNew(&eit, expr, 0);
-            while (jsvStringIteratorHasChar(&it)) {
-              ch = jsvStringIteratorGetCharAndNext(&it);
-              if (ch=='{') brackets++;
-              if (ch=='}') {
-                brackets--;
-                if (!brackets) break;
-              }
-              jsvStringIteratorAppend(&eit, ch);
+        if (ch=='$' && jsvStringIteratorGetChar(&it)=='{') {
+          // copy all the text before the '$' at once
+          size_t exprStart = jsvStringIteratorGetIndex(&it)+1;
+          jsvStringIteratorAppendString(&dit, template, textStart, (int)(exprStart-2-textStart));
+          // Now find the end of the expression
+          jsvStringIteratorNext(&it);
+          int brackets = 1;
+          while (jsvStringIteratorHasChar(&it)) {
+            ch = jsvStringIteratorGetCharAndNext(&it);
+            if (ch=='{') brackets++;
+            if (ch=='}') {
+              brackets--;
+              if (!brackets) break;
             }
-            jsvStringIteratorFree(&eit);
-            JsVar *result = jspEvaluateExpressionVar(expr);
-            jsvUnLock(expr);
-            result = jsvAsStringAndUnLock(result);
-            jsvStringIteratorAppendString(&dit, result, 0, JSVAPPENDSTRINGVAR_MAXLENGTH);
-            jsvUnLock(result);
-          } else {
-            jsvStringIteratorAppend(&dit, '$');
           }
-        } else {
-          jsvStringIteratorAppend(&dit, ch);
+          textStart = jsvStringIteratorGetIndex(&it);
+          JsVar *expr = jsvNewFromEmptyString();
+          if (!expr) break;
+          jsvAppendStringVar(expr, template, exprStart, (brackets ? textStart : textStart-1) - exprStart);
+          JsVar *result = jspEvaluateExpressionVar(expr);
+          jsvUnLock(expr);
+          result = jsvAsStringAndUnLock(result);
+          jsvStringIteratorAppendString(&dit, result, 0, JSVAPPENDSTRINGVAR_MAXLENGTH);
+          jsvUnLock(result);
         }
       }
+      jsvStringIteratorAppendString(&dit, template, textStart, JSVAPPENDSTRINGVAR_MAXLENGTH);
       jsvStringIteratorFree(&it);
       jsvStringIteratorFree(&dit);
     }
@@ -3208,6 +3284,9 @@ void jspSoftKill() {
   assert(execInfo.baseScope==execInfo.root);
   assert(execInfo.blockScope==0);
   assert(execInfo.blockCount==0);
+#endif
+#ifdef ESPR_INLINE_CACHE
+  jspInlineCacheClear();
 #endif
   jsvUnLock(execInfo.scopesVar);
   execInfo.scopesVar = 0;
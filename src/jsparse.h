@@ -202,6 +202,10 @@ JsVar *jspGetNamedVariable(const char *tokenName);
  * passing a char* rather than a JsVar it's because we're looking up via
  * a symbol rather than a variable. To handle these use jspGetVarNamedField  */
 JsVar *jspGetNamedField(JsVar *object, const char* name, bool returnName);
+#ifdef ESPR_INLINE_CACHE
+/// Remove everything from the inline cache used by jspGetNamedField. Returns true if anything was removed
+bool jspInlineCacheClear();
+#endif
 JsVar *jspGetVarNamedField(JsVar *object, JsVar *nameVar, bool returnName);
 
 // These are exported for the Web IDE's compiler. See exportPtrs in jswrap_process.c
@@ -405,6 +405,17 @@ bool jstGetLastBufferTimerTask(JsVar *var, UtilTimerTask *task) {
   JsVarRef ref = jsvGetRef(var);
   return utilTimerGetLastTask(jstBufferTaskChecker, (void*)&ref, task);
 }
+
+/// Return true if a timer task is using the variable 'ref' as a buffer. Call with interrupts off
+bool jstIsBufferTimerTaskRef(JsVarRef ref) {
+  unsigned char ptr = utilTimerTasksTail;
+  while (ptr != utilTimerTasksHead) {
+    if (jstBufferTaskChecker(&utilTimerTasks[ptr], (void*)&ref))
+      return true;
+    ptr = (ptr+1) & (UTILTIMERTASK_TASKS-1);
+  }
+  return false;
+}
 #endif
 
 bool jstPinOutputAtTime(JsSysTime time, uint32_t *timerOffset, Pin *pins, int pinCount, uint8_t value) {
@@ -127,6 +127,9 @@ bool jstGetLastPinTimerTask(Pin pin, UtilTimerTask *task);
 /// Return true if a timer task for the given variable exists (and set 'task' to it)
 bool jstGetLastBufferTimerTask(JsVar *var, UtilTimerTask *task);
 
+/// Return true if a timer task is using the variable 'ref' as a buffer. Call with interrupts off
+bool jstIsBufferTimerTaskRef(JsVarRef ref);
+
 /** returns false if timer queue was full... Changes the state of one or more pins at a certain time in the future (using a timer)
  * See utilTimerInsertTask for notes on timerOffset
  */
@@ -324,6 +324,15 @@ typedef int64_t JsSysTime;
 #define JS_VARS_BEFORE_IDLE_GC 32
 #endif
 
+/* With ESPR_GC_INCREMENTAL, if we have less free variables than this then
+ * start an incremental garbage collection on idle. It doesn't stop
+ * everything while it runs, so we can start it earlier. */
+#ifdef JSVAR_CACHE_SIZE
+#define JS_VARS_BEFORE_INCREMENTAL_GC (JSVAR_CACHE_SIZE/8)
+#else
+#define JS_VARS_BEFORE_INCREMENTAL_GC (jsvGetMemoryTotal()/8)
+#endif
+
 // javascript specific names
 #define JSPARSE_RETURN_VAR JS_HIDDEN_CHAR_STR"rtn" // variable name used for returning function results
 #define JSPARSE_PROTOTYPE_VAR "prototype"
@@ -21,6 +21,7 @@
 #include "jswrap_object.h" // for jswrap_object_toString
 #include "jswrap_arraybuffer.h" // for jsvNewTypedArray
 #include "jswrap_dataview.h" // for jsvNewDataViewWithData
+#include "jstimer.h" // for jstIsBufferTimerTaskRef
 #if defined(ESPR_JIT) && defined(LINUX)
 #include <sys/mman.h>
 #endif
@@ -64,6 +65,80 @@ volatile bool touchedFreeList = false;
 volatile JsVarRef jsVarFirstEmpty; ///< reference of first unused variable (variables are in a linked list)
 volatile MemBusyType isMemoryBusy; ///< Are we doing garbage collection or similar, so can't access memory?
 
+#ifdef ESPR_INLINE_CACHE
+unsigned int jsvShapeEpoch = 0;
+#endif
+
+#ifdef ESPR_OBJECT_INDEX
+static void jsvObjectIndexRemove(JsVar *parent);
+static void jsvObjectIndexRemoveFreed();
+static void jsvObjectIndexRemoveAll();
+#endif
+
+#ifdef ESPR_FREE_RUN_INDEX
+#ifndef ESPR_FREE_RUN_SLOTS
+#define ESPR_FREE_RUN_SLOTS 4 ///< How many runs of free vars of each size we remember
+#endif
+#define JSV_FREE_RUN_BUCKETS 12 ///< Runs of 2^n..2^(n+1)-1 free vars go in bucket n (and bigger runs go in the last one)
+#define JSV_FREE_RUN_MIN 2 ///< Don't remember runs shorter than this - a flat string needs at least 2 vars
+
+typedef struct {
+  JsVarRef pred; ///< The free var whose nextSibling is 'start', or 0 if 'start' is jsVarFirstEmpty
+  JsVarRef start; ///< The first free var in the run, or 0 if this slot is unused
+  JsVarRef len; ///< How many contiguous free vars there were when we found the run
+} JsvFreeRun;
+
+static JsvFreeRun jsvFreeRuns[JSV_FREE_RUN_BUCKETS][ESPR_FREE_RUN_SLOTS];
+static void jsvFreeRunIndexRebuild();
+static void jsvFreeRunFreed(JsVarRef pred, JsVarRef start, unsigned int len, JsVarRef next);
+#endif
+
+#ifdef ESPR_GC_INCREMENTAL
+#ifndef ESPR_GC_STACK_SIZE
+#ifdef RESIZABLE_JSVARS
+#define ESPR_GC_STACK_SIZE 4096 ///< How many marked vars can be waiting to have their children scanned by the incremental GC
+#else
+#define ESPR_GC_STACK_SIZE 128 ///< How many marked vars can be waiting to have their children scanned by the incremental GC
+#endif
+#endif
+#ifndef ESPR_GC_SLICE_TIME
+#define ESPR_GC_SLICE_TIME 2 ///< Default maximum time in milliseconds for each slice of incremental GC
+#endif
+#define JSV_GC_MAX_RESCANS 8 ///< If the mark stack overflows more than this many times in one cycle, finish marking in one go
+#define JSV_GC_TIME_CHECK_MASK 31 ///< Check the time after every (JSV_GC_TIME_CHECK_MASK+1) units of GC work
+
+typedef enum {
+  JSV_GC_IDLE,   ///< No incremental GC cycle in progress
+  JSV_GC_FLAG,   ///< Setting JSV_GARBAGE_COLLECT on all unlocked vars, and marking locked vars
+  JSV_GC_MARK,   ///< Scanning the children of vars on the mark stack
+  JSV_GC_RESCAN, ///< The mark stack overflowed, so scanning the children of every marked var
+  JSV_GC_SWEEP,  ///< Marking is finished, so freeing any var that still has JSV_GARBAGE_COLLECT set
+} PACKED_FLAGS JsvGCState;
+
+JsVarFloat jsvGCSliceTime = ESPR_GC_SLICE_TIME;
+static volatile JsvGCState jsvGCState = JSV_GC_IDLE;
+static JsVarRef jsvGCCursor; ///< Next var to look at in JSV_GC_FLAG/JSV_GC_RESCAN/JSV_GC_SWEEP
+static JsVarRef jsvGCStack[ESPR_GC_STACK_SIZE]; ///< Vars that have been marked but not scanned
+static unsigned int jsvGCStackSize;
+static volatile bool jsvGCOverflow; ///< Some vars were marked without being put on jsvGCStack
+static unsigned char jsvGCRescans; ///< How many times we've been into JSV_GC_RESCAN this cycle
+static JsVarRef jsvGCFreedFirst, jsvGCFreedLast; ///< Vars freed so far by JSV_GC_SWEEP, to add to the free list when it's done
+
+static void jsvGCMarkModified(JsVar *v);
+static void jsvGCMarkSibling(JsVar *v, JsVarRef r);
+static void jsvGCMarkLocked(JsVar *v);
+static void jsvGCNewFlatString(JsVar *flatString, unsigned int blocks);
+/* Write barriers. Once a cycle has started, a var that has already been
+ * scanned mustn't end up as the only link to an unmarked var. So if a var's
+ * children change we scan it (again), and if a name is linked in next to
+ * another name we mark the name that was linked. */
+#define JSV_GC_CHILD_BARRIER(v) if (jsvGCState!=JSV_GC_IDLE) jsvGCMarkModified(v)
+#define JSV_GC_SIBLING_BARRIER(v,r) if (jsvGCState!=JSV_GC_IDLE && (r)) jsvGCMarkSibling(v,r)
+#else
+#define JSV_GC_CHILD_BARRIER(v)
+#define JSV_GC_SIBLING_BARRIER(v,r)
+#endif
+
 // ----------------------------------------------------------------------------
 // ----------------------------------------------------------------------------
 
@@ -76,10 +151,10 @@ JsVarRefSigned jsvGetFirstChildSigned(const JsVar *v) {
 JsVarRef jsvGetLastChild(const JsVar *v) { return v->varData.ref.lastChild; }
 JsVarRef jsvGetNextSibling(const JsVar *v) { return v->varData.ref.nextSibling; }
 JsVarRef jsvGetPrevSibling(const JsVar *v) { return v->varData.ref.prevSibling; }
-void jsvSetFirstChild(JsVar *v, JsVarRef r) { v->varData.ref.firstChild = r; }
-void jsvSetLastChild(JsVar *v, JsVarRef r) { v->varData.ref.lastChild = r; }
-void jsvSetNextSibling(JsVar *v, JsVarRef r) { v->varData.ref.nextSibling = r; }
-void jsvSetPrevSibling(JsVar *v, JsVarRef r) { v->varData.ref.prevSibling = r; }
+void jsvSetFirstChild(JsVar *v, JsVarRef r) { v->varData.ref.firstChild = r; JSV_GC_CHILD_BARRIER(v); }
+void jsvSetLastChild(JsVar *v, JsVarRef r) { v->varData.ref.lastChild = r; JSV_GC_CHILD_BARRIER(v); }
+void jsvSetNextSibling(JsVar *v, JsVarRef r) { v->varData.ref.nextSibling = r; JSV_GC_SIBLING_BARRIER(v,r); }
+void jsvSetPrevSibling(JsVar *v, JsVarRef r) { v->varData.ref.prevSibling = r; JSV_GC_SIBLING_BARRIER(v,r); }
 
 JsVarRefCounter jsvGetRefs(JsVar *v) { return v->varData.ref.refs; }
 void jsvSetRefs(JsVar *v, JsVarRefCounter refs) { v->varData.ref.refs = refs; }
@@ -267,6 +342,7 @@ void jsvCreateEmptyVarList() {
   JsVar firstVar; // temporary var to simplify code in the loop below
   jsvSetNextSibling(&firstVar, 0);
   JsVar *lastEmpty = &firstVar;
+  jsvStringTailCacheClear(); // vars may have moved
 
   JsVarRef i;
   for (i=1;i<=jsVarsSize;i++) {
@@ -282,6 +358,9 @@ void jsvCreateEmptyVarList() {
   jsvSetNextSibling(lastEmpty, 0);
   jsVarFirstEmpty = jsvGetNextSibling(&firstVar);
   isMemoryBusy = MEM_NOT_BUSY;
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunIndexRebuild();
+#endif
 }
 
 /* Removes the empty variable counter, cleaving clear runs of 0s
@@ -291,6 +370,7 @@ void jsvClearEmptyVarList() {
   assert(!isMemoryBusy);
   isMemoryBusy = MEMBUSY_SYSTEM;
   jsVarFirstEmpty = 0;
+  jsvStringTailCacheClear();
   JsVarRef i;
   for (i=1;i<=jsVarsSize;i++) {
     JsVar *var = jsvGetAddressOf(i);
@@ -303,6 +383,9 @@ void jsvClearEmptyVarList() {
     }
   }
   isMemoryBusy = MEM_NOT_BUSY;
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunIndexRebuild();
+#endif
 }
 
 void jsvSoftInit() {
@@ -310,6 +393,12 @@ void jsvSoftInit() {
 }
 
 void jsvSoftKill() {
+#ifdef ESPR_OBJECT_INDEX
+  jsvObjectIndexRemoveAll(); // don't save indexes - they're rebuilt when needed
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  jsvGCState = JSV_GC_IDLE; // anything part way through a cycle is found by jsvClearEmptyVarList/the next GC
+#endif
   jsvClearEmptyVarList();
 }
 
@@ -359,6 +448,12 @@ void jsvInit(unsigned int size) {
 }
 
 void jsvKill() {
+#ifdef ESPR_OBJECT_INDEX
+  jsvObjectIndexRemoveAll();
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  jsvGCState = JSV_GC_IDLE;
+#endif
 #ifdef RESIZABLE_JSVARS
   unsigned int i;
   for (i=0;i<jsVarsSize>>JSVAR_BLOCK_SHIFT;i++) {
@@ -372,7 +467,11 @@ void jsvKill() {
   jsVarBlocks = 0;
   jsVarsSize = 0;
 #elif defined(JSVAR_MALLOC)
+#if defined(ESPR_JIT) && defined(LINUX)
+  munmap(jsVars, sizeof(JsVar) * jsVarsSize);
+#else
   free(jsVars);
+#endif
   jsVars = NULL;
   jsVarsSize = 0;
 #endif
@@ -391,6 +490,19 @@ JsVar *jsvFindOrCreateRoot() {
 }
 #endif
 
+#ifdef ESPR_JSVAR_STATS
+JsVarStats jsvStats;
+
+void jsvStatsReset() {
+  memset(&jsvStats, 0, sizeof(jsvStats));
+}
+
+void jsvStatsSample() {
+  unsigned int usage = jsvGetMemoryUsage();
+  if (usage > jsvStats.peakUsage) jsvStats.peakUsage = usage;
+}
+#endif
+
 /// Get number of memory records (JsVars) used
 unsigned int jsvGetMemoryUsage() {
   unsigned int usage = 0;
@@ -413,6 +525,20 @@ unsigned int jsvGetMemoryTotal() {
   return jsVarsSize;
 }
 
+/** Get the address of a var, and set *count to the number of vars from it
+ * (including itself) that are contiguous in memory. With RESIZABLE_JSVARS
+ * memory is split into blocks, so saving/loading all variables in one go
+ * must be done a chunk at a time. */
+JsVar *jsvGetContiguousVars(JsVarRef ref, unsigned int *count) {
+  assert(ref && ref<=jsVarsSize);
+#ifdef RESIZABLE_JSVARS
+  *count = JSVAR_BLOCK_SIZE - ((unsigned int)(ref-1)&(JSVAR_BLOCK_SIZE-1));
+#else
+  *count = jsVarsSize + 1 - (unsigned int)ref;
+#endif
+  return jsvGetAddressOf(ref);
+}
+
 /// Try and allocate more memory - only works if RESIZABLE_JSVARS is defined
 void jsvSetMemoryTotal(unsigned int jsNewVarCount) {
 #ifdef RESIZABLE_JSVARS
@@ -428,8 +554,15 @@ void jsvSetMemoryTotal(unsigned int jsNewVarCount) {
   jsVarBlocks = realloc(jsVarBlocks, sizeof(JsVar*)*newBlockCount);
   // allocate more blocks
   unsigned int i;
-  for (i=oldBlockCount;i<newBlockCount;i++)
+  for (i=oldBlockCount;i<newBlockCount;i++) {
+#if defined(ESPR_JIT) && defined(LINUX)
+    // JIT code is stored in flat strings, so these must be executable too
+    jsVarBlocks[i] = (JsVar *)mmap(NULL, sizeof(JsVar) * JSVAR_BLOCK_SIZE, PROT_EXEC | PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+#else
     jsVarBlocks[i] = malloc(sizeof(JsVar) * JSVAR_BLOCK_SIZE);
+#endif
+  }
   /** and now reset all the newly allocated vars. We know jsVarFirstEmpty
    * is 0 (because jsiFreeMoreMemory returned 0) so we can just assign it.  */
   assert(!jsVarFirstEmpty);
@@ -437,6 +570,9 @@ void jsvSetMemoryTotal(unsigned int jsNewVarCount) {
   // jsiConsolePrintf("Resized memory from %d blocks to %d\n", oldBlockCount, newBlockCount);
   touchedFreeList = true;
   isMemoryBusy = MEM_NOT_BUSY;
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunIndexRebuild();
+#endif
 #else
   NOT_USED(jsNewVarCount);
   assert(0);
@@ -568,6 +704,9 @@ void jsvResetVariable(JsVar *v, JsVarFlags flags) {
       ((uint8_t*)v)[i] = 0;
   }
   v->flags = flags | JSV_LOCK_ONE;
+#ifdef ESPR_JSVAR_STATS
+  jsvStats.allocs++;
+#endif
   // This code really *should* be faster as it really does just
   // create a handful of stores and the ARM assembly looks great.
   // Somehow it's slower though!
@@ -636,6 +775,7 @@ JsVar *jsvNewWithFlags(JsVarFlags flags) {
 
 static void jsvFreePtrInternal(JsVar *var) {
   assert(jsvGetLocks(var)==0);
+  jsvStringTailCacheRemove(var);
   var->flags = JSV_UNUSED;
   // add this to our free list
   jshInterruptOff(); // to allow this to be used from an IRQ
@@ -650,6 +790,7 @@ void jsvFreePtrStringExt(JsVar* var) {
   if (!ref) return;
   JsVar* ext = jsvGetAddressOf(ref);
   while (true) {
+    jsvStringTailCacheRemove(ext);
     ext->flags = JSV_UNUSED;
     ref = jsvGetLastChild(ext);
     if (!ref) break;
@@ -717,10 +858,16 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
     jshInterruptOff(); // to allow this to be used from an IRQ
     JsVarRef insertBefore = jsVarFirstEmpty;
     JsVarRef insertAfter = 0;
+#ifndef ESPR_FREE_RUN_INDEX
     while (insertBefore && insertBefore<i) {
       insertAfter = insertBefore;
       insertBefore = jsvGetNextSibling(jsvGetAddressOf(insertBefore));
     }
+#else
+    // No need to search - the blocks stay together at the start of the free list, and we remember where they are
+    JsVarRef runNext = insertBefore;
+    unsigned int runLength = (unsigned int)count;
+#endif
     // free in reverse, so the free list ends up in kind of the right order
     while (count--) {
       JsVar *p = jsvGetAddressOf(i--);
@@ -735,6 +882,9 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
     else
       jsVarFirstEmpty = insertBefore;
     touchedFreeList = true;
+#ifdef ESPR_FREE_RUN_INDEX
+    jsvFreeRunFreed(insertAfter, insertBefore, runLength, runNext);
+#endif
     jshInterruptOn();
   }
 
@@ -742,6 +892,9 @@ ALWAYS_INLINE void jsvFreePtr(JsVar *var) {
     can be ints or strings */
 
   if (jsvHasChildren(var)) {
+#ifdef ESPR_OBJECT_INDEX
+    jsvObjectIndexRemove(var);
+#endif
     JsVarRef childref = jsvGetLastChild(var);
 #ifdef CLEAR_MEMORY_ON_FREE
     jsvSetFirstChild(var, 0);
@@ -797,6 +950,13 @@ JsVar *jsvLock(JsVarRef ref) {
   //var->locks++;
   assert(jsvGetLocks(var) < JSV_LOCK_MAX);
   var->flags += JSV_LOCK_ONE;
+#ifdef ESPR_JSVAR_STATS
+  jsvStats.locks++;
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  // locked vars are GC roots, so if we're part way through a GC cycle we must mark this
+  if (var->flags & JSV_GARBAGE_COLLECT) jsvGCMarkLocked(var);
+#endif
 #ifdef DEBUG
   if (jsvGetLocks(var)==0) {
     jsError("Too many locks to Variable!");
@@ -817,6 +977,12 @@ JsVar *jsvLockAgain(JsVar *var) {
   assert(var);
   assert(jsvGetLocks(var) < JSV_LOCK_MAX);
   var->flags += JSV_LOCK_ONE;
+#ifdef ESPR_JSVAR_STATS
+  jsvStats.locks++;
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  if (var->flags & JSV_GARBAGE_COLLECT) jsvGCMarkLocked(var);
+#endif
   return var;
 }
 
@@ -927,8 +1093,154 @@ JsVarRef jsvUnRefRef(JsVarRef ref) {
   return 0;
 }
 
-JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
-  bool firstRun = true;
+#ifdef ESPR_FREE_RUN_INDEX
+/* Index of runs of contiguous free vars, so that jsvNewFlatStringOfLength
+ * doesn't have to walk the free list looking for one. Runs are bucketed by
+ * the log2 of their length. Allocating normal vars doesn't touch the index,
+ * so each run is checked before it's used: if 'pred' is still free and its
+ * nextSibling is still 'start' then the run is still in the free list. The
+ * index is rebuilt after GC, and when it doesn't know about a big enough run. */
+
+/// Which bucket should a run of 'len' vars go in?
+static unsigned int jsvFreeRunBucket(unsigned int len) {
+  unsigned int bucket = 0;
+  while ((len>>=1) && bucket<JSV_FREE_RUN_BUCKETS-1) bucket++;
+  return bucket;
+}
+
+/// Is 'next' the var straight after 'curr' in memory, so they can both be part of the same flat string?
+static ALWAYS_INLINE bool jsvFreeRunIsNext(JsVarRef curr, JsVarRef next) {
+#ifdef RESIZABLE_JSVARS
+  if (!(curr & (JSVAR_BLOCK_SIZE-1))) return false; // curr is the last var in its block
+#endif
+  return next == curr+1;
+}
+
+/// Remember a run of free vars (replacing the smallest run in the bucket if it's full)
+static void jsvFreeRunAdd(JsVarRef pred, JsVarRef start, unsigned int len) {
+  if (len < JSV_FREE_RUN_MIN) return;
+  JsvFreeRun *runs = jsvFreeRuns[jsvFreeRunBucket(len)];
+  JsvFreeRun *run = &runs[0];
+  for (int i=0;i<ESPR_FREE_RUN_SLOTS;i++) {
+    if (!runs[i].start || runs[i].start==start) {
+      run = &runs[i];
+      break;
+    }
+    if (runs[i].len < run->len) run = &runs[i];
+  }
+  if (run->start && run->start!=start && run->len>=len) return; // we already know about bigger runs
+  run->pred = pred;
+  run->start = start;
+  run->len = (JsVarRef)len;
+}
+
+/// Forget all the runs we know about, and walk the free list to find them again
+static void jsvFreeRunIndexRebuild() {
+  memset(jsvFreeRuns, 0, sizeof(jsvFreeRuns));
+  touchedFreeList = false;
+  JsVarRef pred = 0;
+  JsVarRef start = jsVarFirstEmpty;
+  JsVarRef curr = start;
+  unsigned int len = 0;
+  // if an IRQ changes the free list we just stop - any runs we found will be checked before they're used
+  while (curr && !touchedFreeList) {
+    JsVarRef next = jsvGetNextSibling(jsvGetAddressOf(curr));
+    len++;
+    if (!jsvFreeRunIsNext(curr, next)) {
+      jsvFreeRunAdd(pred, start, len);
+      pred = curr;
+      start = next;
+      len = 0;
+    }
+    curr = next;
+  }
+}
+
+/// A flat string's data has just been put back in the free list between 'pred' and 'next'
+static void jsvFreeRunFreed(JsVarRef pred, JsVarRef start, unsigned int len, JsVarRef next) {
+  JsVarRef last = (JsVarRef)(start+len-1);
+  if (next) {
+    for (int b=0;b<JSV_FREE_RUN_BUCKETS;b++)
+      for (int i=0;i<ESPR_FREE_RUN_SLOTS;i++) {
+        JsvFreeRun *run = &jsvFreeRuns[b][i];
+        if (run->start!=next) continue;
+        if (jsvFreeRunIsNext(last, next)) { // it's straight after us - join it on
+          len += run->len;
+          run->start = 0;
+        } else // it now comes after us in the free list
+          run->pred = last;
+      }
+  }
+  jsvFreeRunAdd(pred, start, len);
+}
+
+/// Vars first..last have been used for a flat string, so forget any runs that refer to them
+static void jsvFreeRunAllocated(JsVarRef first, JsVarRef last) {
+  for (int b=0;b<JSV_FREE_RUN_BUCKETS;b++)
+    for (int i=0;i<ESPR_FREE_RUN_SLOTS;i++) {
+      JsvFreeRun *run = &jsvFreeRuns[b][i];
+      if ((run->start>=first && run->start<=last) || (run->pred>=first && run->pred<=last))
+        run->start = 0;
+    }
+}
+
+/** Use the index to find 'blocks' contiguous free vars and remove them from
+ * the free list. Returns 0 if the index doesn't know of a big enough run. */
+static JsVar *jsvFreeRunAlloc(unsigned int blocks) {
+  JsVar *result = 0;
+  jshInterruptOff(); // to allow this to be used from an IRQ
+  // look in the smallest bucket first, so we don't break up big runs
+  for (unsigned int b=jsvFreeRunBucket(blocks);b<JSV_FREE_RUN_BUCKETS && !result;b++) {
+    for (int i=0;i<ESPR_FREE_RUN_SLOTS && !result;i++) {
+      JsvFreeRun *run = &jsvFreeRuns[b][i];
+      if (!run->start || run->len<blocks) continue;
+      JsVarRef pred = run->pred;
+      JsVarRef start = run->start;
+      unsigned int len = run->len;
+      run->start = 0; // we'll add back whatever is left
+      // is the run still in the free list?
+      if (jsVarFirstEmpty==start) pred = 0;
+      else if (!pred ||
+               (jsvGetAddressOf(pred)->flags&JSV_VARTYPEMASK)!=JSV_UNUSED ||
+               jsvGetNextSibling(jsvGetAddressOf(pred))!=start)
+        continue;
+      // the data after the header must be aligned on a 4 byte boundary
+      unsigned int skip = 0;
+      while (((size_t)(jsvGetAddressOf(start)+skip+1))&3) skip++;
+      // check the vars really are still contiguous
+      JsVarRef last = start;
+      unsigned int count = 1;
+      JsVarRef next = jsvGetNextSibling(jsvGetAddressOf(last));
+      while (count < blocks+skip && jsvFreeRunIsNext(last, next)) {
+        last = next;
+        count++;
+        next = jsvGetNextSibling(jsvGetAddressOf(last));
+      }
+      if (count < blocks+skip) {
+        // part of it has been used - remember what's left
+        jsvFreeRunAdd(pred, start, count);
+        continue;
+      }
+      if (skip) {
+        pred = (JsVarRef)(start+skip-1);
+        start = (JsVarRef)(start+skip);
+      }
+      // unlink it from the free list
+      if (pred) jsvSetNextSibling(jsvGetAddressOf(pred), next);
+      else jsVarFirstEmpty = next;
+      if (len > blocks+skip)
+        jsvFreeRunAdd(pred, next, len-(blocks+skip));
+      result = jsvGetAddressOf(start);
+    }
+  }
+  jshInterruptOn();
+  return result;
+}
+#endif
+
+/// Create a flat string - if canGC is false, don't garbage collect if we can't find enough contiguous free vars
+static JsVar *jsvNewFlatStringOfLengthInternal(unsigned int byteLength, bool canGC) {
+  bool firstRun = canGC;
   // Work out how many blocks we need. One for the header, plus some for the characters
   size_t requiredBlocks = 1 + ((byteLength+sizeof(JsVar)-1) / sizeof(JsVar));
   JsVar *flatString = 0;
@@ -942,6 +1254,25 @@ JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
     messed with the free list in the mean time (which we check for with
     touchedFreeList). If someone has messed with it, we restart.*/
     bool memoryTouched = true;
+#ifdef ESPR_FREE_RUN_INDEX
+    // The index can't be used while the incremental GC is sweeping, as freed vars aren't in the free list yet
+    if (!jshIsInInterrupt()
+#ifdef ESPR_GC_INCREMENTAL
+        && jsvGCState!=JSV_GC_SWEEP
+#endif
+        ) {
+      memoryTouched = false; // we don't need to search the free list
+      flatString = jsvFreeRunAlloc((unsigned int)requiredBlocks);
+      if (!flatString) { // maybe there's a run we don't know about
+        jsvFreeRunIndexRebuild();
+        flatString = jsvFreeRunAlloc((unsigned int)requiredBlocks);
+      }
+      if (flatString) {
+        jsvResetVariable(flatString, JSV_FLAT_STRING);
+        flatString->varData.integer = (JsVarInt)byteLength;
+      }
+    }
+#endif
     while (memoryTouched) {
       memoryTouched = false;
       touchedFreeList = false;
@@ -1007,6 +1338,15 @@ JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
     jsvGarbageCollect();
   };
   if (!flatString) return 0;
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunAllocated(jsvGetRef(flatString), (JsVarRef)(jsvGetRef(flatString)+requiredBlocks-1));
+#endif
+#ifdef ESPR_GC_INCREMENTAL
+  if (jsvGCState!=JSV_GC_IDLE) jsvGCNewFlatString(flatString, (unsigned int)requiredBlocks);
+#endif
+#ifdef ESPR_JSVAR_STATS
+  jsvStats.allocs += requiredBlocks-1; // jsvResetVariable counted the header
+#endif
   /* We now have the string! All that's left is to clear it */
   // clear data
   memset((char*)&flatString[1], 0, sizeof(JsVar)*(requiredBlocks-1));
@@ -1018,6 +1358,10 @@ JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
   return flatString;
 }
 
+JsVar *jsvNewFlatStringOfLength(unsigned int byteLength) {
+  return jsvNewFlatStringOfLengthInternal(byteLength, true);
+}
+
 static JsVar *jsvNewNameOrString(const char *str, bool isName) {
   // Create a var
   JsVar *first = jsvNewWithFlags(isName ? JSV_NAME_STRING_0 : JSV_STRING_0);
@@ -1276,6 +1620,7 @@ JsVar *jsvMakeIntoVariableName(JsVar *var, JsVar *valueOrZero) {
       jsvStringIteratorFree(&it);
 
       // "set" string length
+      jsvStringTailCacheRemove(var); // the StringExts are about to change
       JsVar* last = var;
       while (jsvGetLastChild(last)) last = jsvGetAddressOf(jsvGetLastChild(last)); // TODO lock?
 
@@ -1845,11 +2190,7 @@ void jsvAppendString(JsVar *var, const char *str) {
   JsvStringIterator dst;
   jsvStringIteratorNew(&dst, var, 0);
   jsvStringIteratorGotoEnd(&dst);
-  // now start appending
-  /* This isn't as fast as something single-purpose, but it's not that bad,
-   * and is less likely to break :) */
-  while (*str)
-    jsvStringIteratorAppend(&dst, *(str++));
+  jsvStringIteratorAppendBuf(&dst, str, strlen(str));
   jsvStringIteratorFree(&dst);
 }
 
@@ -1859,20 +2200,13 @@ void jsvAppendStringBuf(JsVar *var, const char *str, size_t length) {
   JsvStringIterator dst;
   jsvStringIteratorNew(&dst, var, 0);
   jsvStringIteratorGotoEnd(&dst);
-  // now start appending
-  /* This isn't as fast as something single-purpose, but it's not that bad,
-   * and is less likely to break :) */
-  while (length) {
-    jsvStringIteratorAppend(&dst, *(str++));
-    length--;
-  }
+  jsvStringIteratorAppendBuf(&dst, str, length);
   jsvStringIteratorFree(&dst);
 }
 
 /// Special version of append designed for use with vcbprintf_callback (See jsvAppendPrintf)
 void jsvStringIteratorPrintfCallback(const char *str, void *user_data) {
-  while (*str)
-    jsvStringIteratorAppend((JsvStringIterator *)user_data, *(str++));
+  jsvStringIteratorAppendBuf((JsvStringIterator *)user_data, str, strlen(str));
 }
 
 void jsvAppendPrintf(JsVar *var, const char *fmt, ...) {
@@ -1911,16 +2245,8 @@ void jsvAppendStringVar(JsVar *var, const JsVar *str, size_t stridx, size_t maxL
   JsvStringIterator dst;
   jsvStringIteratorNew(&dst, var, 0);
   jsvStringIteratorGotoEnd(&dst);
-  // now start appending
-  /* This isn't as fast as something single-purpose, but it's not that bad,
-     * and is less likely to break :) */
-  JsvStringIterator it;
-  jsvStringIteratorNewConst(&it, str, stridx);
-  while (jsvStringIteratorHasChar(&it) && (maxLength-->0)) {
-    char ch = jsvStringIteratorGetCharAndNext(&it);
-    jsvStringIteratorAppend(&dst, ch);
-  }
-  jsvStringIteratorFree(&it);
+  if (maxLength > JSVAPPENDSTRINGVAR_MAXLENGTH) maxLength = JSVAPPENDSTRINGVAR_MAXLENGTH;
+  jsvStringIteratorAppendString(&dst, (JsVar*)str, stridx, (int)maxLength);
   jsvStringIteratorFree(&dst);
 }
 
@@ -2829,6 +3155,263 @@ JsVar *jsvCopy(JsVar *src, bool copyChildren) {
   return dst;
 }
 
+#ifdef ESPR_OBJECT_INDEX
+/* Objects with lots of keys (eg. the root scope) can have a hash index built
+ * for them, so that looking up a key by string doesn't have to walk every
+ * child. The index is an open-addressed table of NAME refs stored in a
+ * (locked) flat string. It's built lazily when a lookup has to walk more than
+ * JSV_OBJECT_INDEX_THRESHOLD children, kept up to date by jsvAddName and
+ * jsvRemoveChild, and simply thrown away whenever refs might change (GC of
+ * the object, defrag, save to flash). Only String keys are indexed.
+ *
+ * Arrays whose integer keys are 0..n-1 (no holes) get a 'dense' index instead,
+ * where table[i] is the NAME for element i. Appending keeps it up to date, but
+ * anything else that changes the integer keys (holes, inserting, removing
+ * anything but the last element) throws it away. */
+#ifndef ESPR_OBJECT_INDEX_SLOTS
+#define ESPR_OBJECT_INDEX_SLOTS 8 ///< How many objects can be indexed at once
+#endif
+#define JSV_OBJECT_INDEX_THRESHOLD 32 ///< If a lookup walks more children than this, build an index
+#define JSV_OBJECT_INDEX_MIN_SIZE 64 ///< Minimum number of entries in an index (power of 2)
+
+typedef struct {
+  JsVarRef obj; ///< The object that is indexed, or 0 if this slot is unused
+  JsVarRef table; ///< A locked flat string containing 'size' JsVarRefs
+  unsigned int size; ///< Number of entries in the table (always a power of 2)
+  unsigned int count; ///< Number of names stored in the table (for arrays, elements 0..count-1 are in table[0..count-1])
+} JsvObjectIndex;
+
+static JsvObjectIndex jsvObjectIndexes[ESPR_OBJECT_INDEX_SLOTS];
+static unsigned int jsvObjectIndexesUsed = 0; ///< How many slots in jsvObjectIndexes are used (so we can skip checks)
+static unsigned int jsvObjectIndexNextSlot = 0; ///< Next slot to replace when all are full
+static JsVarRef jsvObjectIndexFailed = 0; ///< The last object we couldn't build an index for - don't try again until after the next GC
+
+static unsigned int jsvObjectIndexHashString(const char *name) {
+  unsigned int hash = 0;
+  while (*name) hash = hash*31 + (unsigned char)*(name++);
+  return hash;
+}
+
+static unsigned int jsvObjectIndexHashVar(JsVar *name) {
+  unsigned int hash = 0;
+  JsvStringIterator it;
+  jsvStringIteratorNew(&it, name, 0);
+  while (jsvStringIteratorHasChar(&it))
+    hash = hash*31 + (unsigned char)jsvStringIteratorGetCharAndNext(&it);
+  jsvStringIteratorFree(&it);
+  return hash;
+}
+
+static ALWAYS_INLINE JsVarRef *jsvObjectIndexGetTable(JsvObjectIndex *idx) {
+  return (JsVarRef*)jsvGetFlatStringPointer(jsvGetAddressOf(idx->table));
+}
+
+/// Return the index for this object, or 0 if there isn't one
+static ALWAYS_INLINE JsvObjectIndex *jsvObjectIndexGet(JsVar *parent) {
+  if (!jsvObjectIndexesUsed) return 0;
+  JsVarRef ref = jsvGetRef(parent);
+  for (int i=0;i<ESPR_OBJECT_INDEX_SLOTS;i++)
+    if (jsvObjectIndexes[i].obj == ref)
+      return &jsvObjectIndexes[i];
+  return 0;
+}
+
+static void jsvObjectIndexFree(JsvObjectIndex *idx) {
+  jsvUnLock(jsvGetAddressOf(idx->table)); // nothing else references this, so it'll be freed
+  idx->obj = 0;
+  idx->table = 0;
+  jsvObjectIndexesUsed--;
+}
+
+/// Remove the index for this object if there is one (eg. because it is being freed)
+static void jsvObjectIndexRemove(JsVar *parent) {
+  if (jsvObjectIndexFailed==jsvGetRef(parent)) jsvObjectIndexFailed = 0;
+  JsvObjectIndex *idx = jsvObjectIndexGet(parent);
+  if (idx) jsvObjectIndexFree(idx);
+}
+
+/// Remove indexes for any objects that have just been (or are about to be) garbage collected
+static void jsvObjectIndexRemoveFreed() {
+  jsvObjectIndexFailed = 0; // there may be enough memory now
+  for (int i=0;i<ESPR_OBJECT_INDEX_SLOTS && jsvObjectIndexesUsed;i++)
+    if (jsvObjectIndexes[i].obj) {
+      JsVar *obj = jsvGetAddressOf(jsvObjectIndexes[i].obj);
+      if ((obj->flags&JSV_VARTYPEMASK)==JSV_UNUSED || (obj->flags&JSV_GARBAGE_COLLECT))
+        jsvObjectIndexFree(&jsvObjectIndexes[i]);
+    }
+}
+
+/// Remove all indexes (they're rebuilt when they're next needed)
+static void jsvObjectIndexRemoveAll() {
+  jsvObjectIndexFailed = 0;
+  for (int i=0;i<ESPR_OBJECT_INDEX_SLOTS && jsvObjectIndexesUsed;i++)
+    if (jsvObjectIndexes[i].obj)
+      jsvObjectIndexFree(&jsvObjectIndexes[i]);
+}
+
+static void jsvObjectIndexInsert(JsVarRef *table, unsigned int size, JsVarRef nameRef, unsigned int hash) {
+  unsigned int mask = size-1;
+  while (table[hash&mask]) hash++;
+  table[hash&mask] = nameRef;
+}
+
+/// Add a NAME that has just been added to parent to parent's index (if it has one)
+static void jsvObjectIndexAddName(JsVar *parent, JsVar *name) {
+  JsvObjectIndex *idx = jsvObjectIndexGet(parent);
+  if (!idx) return;
+  if (jsvIsArray(parent)) {
+    if (!jsvIsInt(name)) return;
+    if (name->varData.integer == (JsVarInt)idx->count && idx->count < idx->size)
+      jsvObjectIndexGetTable(idx)[idx->count++] = jsvGetRef(name); // appended
+    else // a hole, or no space - remove it and let it be rebuilt on the next lookup
+      jsvObjectIndexFree(idx);
+    return;
+  }
+  if (!jsvIsString(name)) return;
+  if ((idx->count+1)*2 > idx->size) {
+    // too full - remove it and let it be rebuilt bigger on the next lookup
+    jsvObjectIndexFree(idx);
+    return;
+  }
+  jsvObjectIndexInsert(jsvObjectIndexGetTable(idx), idx->size, jsvGetRef(name), jsvObjectIndexHashVar(name));
+  idx->count++;
+}
+
+/// Remove a NAME that is about to be removed from parent from parent's index (if it has one)
+static void jsvObjectIndexRemoveName(JsVar *parent, JsVar *name) {
+  JsvObjectIndex *idx = jsvObjectIndexGet(parent);
+  if (!idx) return;
+  JsVarRef *table = jsvObjectIndexGetTable(idx);
+  if (jsvIsArray(parent)) {
+    if (!jsvIsInt(name)) return;
+    if (idx->count && table[idx->count-1]==jsvGetRef(name))
+      table[--idx->count] = 0; // popped
+    else // leaves a hole (or the rest get renumbered)
+      jsvObjectIndexFree(idx);
+    return;
+  }
+  if (!jsvIsString(name)) return;
+  unsigned int mask = idx->size-1;
+  JsVarRef nameRef = jsvGetRef(name);
+  unsigned int i = jsvObjectIndexHashVar(name)&mask;
+  while (table[i] != nameRef) {
+    if (!table[i]) return; // not found - we never added it (eg. jsvIsNewChild)
+    i = (i+1)&mask;
+  }
+  // Remove it, and shift back any entries that were displaced past it
+  unsigned int j = i;
+  while (true) {
+    j = (j+1)&mask;
+    if (!table[j]) break;
+    unsigned int k = jsvObjectIndexHashVar(jsvGetAddressOf(table[j]))&mask;
+    // if k (the ideal slot for j) is cyclically in (i,j] we can't move it
+    if ((i<=j) ? (i<k && k<=j) : (i<k || k<=j)) continue;
+    table[i] = table[j];
+    i = j;
+  }
+  table[i] = 0;
+  idx->count--;
+}
+
+/** Look up an element in an array's dense index. Returns false if the index
+ * was out of date (so has been removed) and the caller must search instead. */
+static bool jsvObjectIndexFindArrayElement(JsvObjectIndex *idx, JsVarInt index, JsVar **result) {
+  *result = 0;
+  if (index<0 || index>=(JsVarInt)idx->count) return true; // no element
+  JsVar *child = jsvGetAddressOf(jsvObjectIndexGetTable(idx)[index]);
+  if (jsvIsInt(child) && child->varData.integer == index) {
+    *result = jsvLockAgain(child);
+    return true;
+  }
+  // keys were renumbered in place (eg. Array.reverse)
+  jsvObjectIndexFree(idx);
+  return false;
+}
+
+/// Build an index for this object
+static NO_INLINE void jsvObjectIndexBuild(JsVar *parent) {
+  if (isMemoryBusy || jshIsInInterrupt() || jsvObjectIndexFailed==jsvGetRef(parent)) return;
+  bool isArray = jsvIsArray(parent);
+  unsigned int children = 0;
+  JsVarRef childref = jsvGetFirstChild(parent);
+  while (childref) {
+    JsVar *child = jsvGetAddressOf(childref);
+    if (!isArray) children++;
+    else if (jsvIsInt(child)) {
+      if (child->varData.integer != (JsVarInt)children) { // has holes - can't index it
+        jsvObjectIndexFailed = jsvGetRef(parent);
+        return;
+      }
+      children++;
+    }
+    childref = jsvGetNextSibling(child);
+  }
+  unsigned int size = JSV_OBJECT_INDEX_MIN_SIZE;
+  if (isArray) while (size < children*2) size <<= 1; // leave space to push onto the end
+  else while (size < children*4) size <<= 1; // keep load factor <0.25 so we don't need to rebuild immediately
+#ifdef RESIZABLE_JSVARS
+  // flat strings can't be bigger than a block of vars, so don't keep trying
+  if (size*sizeof(JsVarRef) >= (JSVAR_BLOCK_SIZE-1)*sizeof(JsVar)) {
+    jsvObjectIndexFailed = jsvGetRef(parent);
+    return;
+  }
+#endif
+  /* Don't GC if there's no space - this gets called from lookups, so if
+   * memory is fragmented we'd end up doing a GC for every one */
+  JsVar *tableVar = jsvNewFlatStringOfLengthInternal((unsigned int)(size*sizeof(JsVarRef)), false);
+  if (!tableVar) { // not enough memory - we'll just do it the slow way
+    jsvObjectIndexFailed = jsvGetRef(parent);
+    return;
+  }
+  // find a slot, or replace one if they're all used
+  JsvObjectIndex *idx = 0;
+  for (int i=0;i<ESPR_OBJECT_INDEX_SLOTS && !idx;i++)
+    if (!jsvObjectIndexes[i].obj)
+      idx = &jsvObjectIndexes[i];
+  if (!idx) {
+    idx = &jsvObjectIndexes[jsvObjectIndexNextSlot];
+    jsvObjectIndexNextSlot = (jsvObjectIndexNextSlot+1) % ESPR_OBJECT_INDEX_SLOTS;
+    jsvObjectIndexFree(idx);
+  }
+  // tableVar stays locked so it isn't GC'd or moved
+  idx->obj = jsvGetRef(parent);
+  idx->table = jsvGetRef(tableVar);
+  idx->size = size;
+  idx->count = 0;
+  jsvObjectIndexesUsed++;
+  JsVarRef *table = jsvObjectIndexGetTable(idx);
+  childref = jsvGetFirstChild(parent);
+  while (childref) {
+    JsVar *child = jsvGetAddressOf(childref);
+    if (isArray) {
+      if (jsvIsInt(child))
+        table[idx->count++] = childref;
+    } else if (jsvIsString(child)) {
+      jsvObjectIndexInsert(table, size, childref, jsvObjectIndexHashVar(child));
+      idx->count++;
+    }
+    childref = jsvGetNextSibling(child);
+  }
+}
+#endif // ESPR_OBJECT_INDEX
+
+#ifdef ESPR_INLINE_CACHE
+/** Called when a child is added to/removed from parent. If parent could be in
+ * a prototype chain (or have its own members looked up), bump jsvShapeEpoch so
+ * jsparse's inline cache is invalidated. Objects and functions that aren't
+ * referenced from anywhere yet (eg. object literals being built) can't be,
+ * but a function's 'prototype' always matters. */
+static ALWAYS_INLINE void jsvShapeChanged(JsVar *parent, JsVar *name) {
+  if (jsvIsObject(parent)) {
+    if (jsvGetRefs(parent) || jsvIsRoot(parent))
+      jsvShapeEpoch++;
+  } else if (jsvIsFunction(parent)) {
+    if (jsvGetRefs(parent) || jsvIsStringEqual(name, JSPARSE_PROTOTYPE_VAR))
+      jsvShapeEpoch++;
+  }
+}
+#endif
+
 void jsvAddName(JsVar *parent, JsVar *namedChild) {
   namedChild = jsvRef(namedChild); // ref here VERY important as adding to structure!
   assert(jsvIsName(namedChild));
@@ -2882,6 +3465,12 @@ void jsvAddName(JsVar *parent, JsVar *namedChild) {
     jsvSetFirstChild(parent, r);
     jsvSetLastChild(parent, r);
   }
+#ifdef ESPR_OBJECT_INDEX
+  jsvObjectIndexAddName(parent, namedChild);
+#endif
+#ifdef ESPR_INLINE_CACHE
+  jsvShapeChanged(parent, namedChild);
+#endif
 }
 
 JsVar *jsvAddNamedChild(JsVar *parent, JsVar *value, const char *name) {
@@ -2900,6 +3489,13 @@ void jsvAddNamedChildAndUnLock(JsVar *parent, JsVar *value, const char *name) {
 JsVar *jsvSetValueOfName(JsVar *name, JsVar *src) {
   assert(name && jsvIsName(name));
   assert(name!=src); // no infinite loops!
+#ifdef ESPR_INLINE_CACHE
+  /* If we're setting __proto__ or prototype the prototype chain of
+   * something may have changed (check the first char to keep this fast) */
+  if (jsvIsString(name) && (name->varData.str[0]=='_' || name->varData.str[0]=='p') &&
+      (jsvIsStringEqual(name, JSPARSE_INHERITS_VAR) || jsvIsStringEqual(name, JSPARSE_PROTOTYPE_VAR)))
+    jsvShapeEpoch++;
+#endif
   // all is fine, so replace the existing child...
   /* Existing child may be null in the case of Z = 0 where
    * we create 'Z' and pass it down to '=' to have the value
@@ -2964,17 +3560,40 @@ JsVar *jsvFindChildFromString(JsVar *parent, const char *name) {
   }
 
   assert(jsvHasChildren(parent));
-  JsVarRef childref = jsvGetFirstChild(parent);
+  JsVarRef childref;
+#ifdef ESPR_OBJECT_INDEX
+  bool canIndex = !jsvIsArray(parent);
+  JsvObjectIndex *idx = canIndex ? jsvObjectIndexGet(parent) : 0;
+  if (idx) {
+    JsVarRef *table = jsvObjectIndexGetTable(idx);
+    unsigned int mask = idx->size-1;
+    unsigned int i = jsvObjectIndexHashString(name);
+    while ((childref = table[i&mask])) {
+      JsVar *child = jsvGetAddressOf(childref);
+      if (*(int*)fastCheck==*(int*)child->varData.str &&
+          jsvIsStringEqual(child, name))
+        return jsvLockAgain(child);
+      i++;
+    }
+    return 0;
+  }
+  unsigned int childCount = 0;
+#endif
+  JsVar *found = 0;
+  childref = jsvGetFirstChild(parent);
   if (!superFastCheck) { // more than 4 chars so we MUST use stringequal
     while (childref) {
       // Don't Lock here, just use GetAddressOf - to try and speed up the finding
       JsVar *child = jsvGetAddressOf(childref);
       if (*(int*)fastCheck==*(int*)child->varData.str && // speedy check of first 4 bytes
           jsvIsStringEqual(child, name)) {
-        // found it! unlock parent but leave child locked
-        return jsvLockAgain(child);
+        found = child;
+        break;
       }
       childref = jsvGetNextSibling(child);
+#ifdef ESPR_OBJECT_INDEX
+      childCount++;
+#endif
     }
   } else { // 4 or less chars, so if 4 chars match, there is no StringExt + length matches, then we're good without jsvIsStringEqual
     int charsInName = 0;
@@ -2985,13 +3604,21 @@ JsVar *jsvFindChildFromString(JsVar *parent, const char *name) {
       if (*(int*)fastCheck==*(int*)child->varData.str &&
           !child->varData.ref.lastChild &&
           jsvGetCharactersInVar(child)==charsInName) { // no extra stringexts - so it really is that small
-        // found it! unlock parent but leave child locked
-        return jsvLockAgain(child);
+        found = child;
+        break;
       }
       childref = jsvGetNextSibling(child);
+#ifdef ESPR_OBJECT_INDEX
+      childCount++;
+#endif
     }
   }
-  return 0;
+#ifdef ESPR_OBJECT_INDEX
+  if (canIndex && childCount > JSV_OBJECT_INDEX_THRESHOLD)
+    jsvObjectIndexBuild(parent);
+#endif
+  // found it! leave child locked
+  return jsvLockAgainSafe(found);
 }
 
 JsVar *jsvFindOrAddChildFromString(JsVar *parent, const char *name) {
@@ -3055,21 +3682,57 @@ JsVar *jsvAsName(JsVar *var) {
 /** Non-recursive finding */
 JsVar *jsvFindChildFromVar(JsVar *parent, JsVar *childName, bool addIfNotFound) {
   JsVar *child;
-  JsVarRef childref = jsvGetFirstChild(parent);
+  JsVarRef childref;
+#ifdef ESPR_OBJECT_INDEX
+  bool isArray = jsvIsArray(parent);
+  bool canIndex = isArray ? jsvIsInt(childName) : jsvIsString(childName);
+  JsvObjectIndex *idx = canIndex ? jsvObjectIndexGet(parent) : 0;
+  if (idx && isArray) {
+    if (jsvObjectIndexFindArrayElement(idx, jsvGetInteger(childName), &child)) {
+      if (child) return child;
+      childref = 0; // not found - skip the search below
+    } else
+      childref = jsvGetFirstChild(parent);
+  } else if (idx) {
+    JsVarRef *table = jsvObjectIndexGetTable(idx);
+    unsigned int mask = idx->size-1;
+    unsigned int i = jsvObjectIndexHashVar(childName);
+    while ((childref = table[i&mask])) {
+      child = jsvGetAddressOf(childref);
+      if (jsvIsBasicVarEqual(child, childName))
+        return jsvLockAgain(child);
+      i++;
+    }
+    childref = 0; // not found - skip the search below
+  } else
+    childref = jsvGetFirstChild(parent);
+  unsigned int childCount = 0;
+#else
+  childref = jsvGetFirstChild(parent);
+#endif
 
   // TODO: could split this into separate loops looking for Numeric/String
 
+  child = 0;
   while (childref) {
     child = jsvLock(childref);
     if (jsvIsBasicVarEqual(child, childName)) {
       // found it! unlock parent but leave child locked
-      return child;
+      break;
     }
     childref = jsvGetNextSibling(child);
     jsvUnLock(child);
+    child = 0;
+#ifdef ESPR_OBJECT_INDEX
+    childCount++;
+#endif
   }
+#ifdef ESPR_OBJECT_INDEX
+  if (canIndex && childCount > JSV_OBJECT_INDEX_THRESHOLD)
+    jsvObjectIndexBuild(parent);
+#endif
+  if (child) return child;
 
-  child = 0;
   if (addIfNotFound && childName) {
     child = jsvAsName(childName);
     jsvAddName(parent, child);
@@ -3085,6 +3748,12 @@ void jsvRemoveChild(JsVar *parent, JsVar *child) {
 #endif
   JsVarRef childref = jsvGetRef(child);
   bool wasChild = false;
+#ifdef ESPR_OBJECT_INDEX
+  jsvObjectIndexRemoveName(parent, child);
+#endif
+#ifdef ESPR_INLINE_CACHE
+  jsvShapeChanged(parent, child);
+#endif
   // unlink from parent
   if (jsvGetFirstChild(parent) == childref) {
     jsvSetFirstChild(parent, jsvGetNextSibling(child));
@@ -3369,6 +4038,12 @@ size_t jsvCountJsVarsUsed(JsVar *v) {
 }
 
 JsVar *jsvGetArrayIndex(const JsVar *arr, JsVarInt index) {
+#ifdef ESPR_OBJECT_INDEX
+  JsvObjectIndex *idx = jsvObjectIndexGet((JsVar*)arr);
+  JsVar *found;
+  if (idx && jsvObjectIndexFindArrayElement(idx, index, &found))
+    return found;
+#endif
   JsVarRef childref = jsvGetLastChild(arr);
   JsVarInt lastArrayIndex = 0;
   // Look at last non-string element!
@@ -3601,6 +4276,9 @@ JsVar *jsvArrayPop(JsVar *arr) {
 /// Removes the first element of an array, and returns that element (or 0 if empty). DOES NOT RENUMBER.
 JsVar *jsvArrayPopFirst(JsVar *arr) {
   assert(jsvIsArray(arr));
+#ifdef ESPR_OBJECT_INDEX
+  jsvObjectIndexRemove(arr);
+#endif
   if (jsvGetFirstChild(arr)) {
     JsVar *child = jsvLock(jsvGetFirstChild(arr));
     if (jsvGetFirstChild(arr) == jsvGetLastChild(arr))
@@ -3680,6 +4358,9 @@ JsVar *jsvArrayJoin(JsVar *arr, JsVar *filler, bool ignoreNull) {
 /// Insert a new element before beforeIndex, DOES NOT UPDATE INDICES
 void jsvArrayInsertBefore(JsVar *arr, JsVar *beforeIndex, JsVar *element) {
   if (beforeIndex) {
+#ifdef ESPR_OBJECT_INDEX
+    jsvObjectIndexRemove(arr);
+#endif
     JsVar *idxVar = jsvMakeIntoVariableName(jsvNewFromInteger(0), element);
     if (!idxVar) return; // out of memory
 
@@ -3925,7 +4606,9 @@ static JsVar *jsvGetPathTo_int(JsVar *root, JsVar *element, int maxDepth, JsVar
     if (el == element && root != ignoreParent) {
       // if we found it - send the key name back!
       JsVar *name = jsvAsStringAndUnLock(jsvIteratorGetKey(&it));
+      jsvUnLock2(el, found);
       jsvIteratorFree(&it);
+      *depth = 1;
       return name;
     } else if (jsvIsObject(el) || jsvIsArray(el) || jsvIsFunction(el)) {
       // recursively search
@@ -3941,6 +4624,7 @@ static JsVar *jsvGetPathTo_int(JsVar *root, JsVar *element, int maxDepth, JsVar
       }
       jsvUnLock(n);
     }
+    jsvUnLock(el);
     jsvIteratorNext(&it);
   }
   jsvIteratorFree(&it);
@@ -4154,10 +4838,119 @@ static bool jsvGarbageCollectMarkUsed(JsVar *var) {
   return true;
 }
 
+#ifdef ESPR_INLINE_CACHE
+/** jsparse's inline cache references vars without them being reachable, so it
+ * must be cleared before we sweep. Returns 1 if that freed anything. */
+static unsigned int jsvGarbageCollectClearCaches() {
+  JsVarRef firstEmpty = jsVarFirstEmpty;
+  jspInlineCacheClear();
+  return (jsVarFirstEmpty!=firstEmpty) ? 1 : 0; // so we're not reported as having freed nothing
+}
+#endif
+
+/** Free var (which has JSV_GARBAGE_COLLECT set) without adding it to the
+ * free list. Returns the number of blocks that were freed, starting at var */
+static unsigned int jsvGarbageCollectFree(JsVar *var) {
+  jsvStringTailCacheRemove(var);
+  if (jsvIsFlatString(var)) {
+    // If we're a flat string, there are more blocks to free.
+    unsigned int count = (unsigned int)jsvGetFlatStringBlocks(var);
+    for (unsigned int i=0;i<=count;i++)
+      var[i].flags = JSV_UNUSED;
+    return count+1;
+  }
+  // otherwise just free 1 block
+  if (jsvHasSingleChild(var)) {
+    /* If this had a child that wasn't listed for GC then we need to
+     * unref it. Everything else is fine because it'll disappear anyway.
+     * We don't have to check if we should free this other variable
+     * here because we know the GC picked up it was referenced from
+     * somewhere else. */
+    JsVarRef ch = jsvGetFirstChild(var);
+    if (ch) {
+      JsVar *child = jsvGetAddressOf(ch); // not locked
+      if (child->flags!=JSV_UNUSED && // not already GC'd!
+          !(child->flags&JSV_GARBAGE_COLLECT)) // not marked for GC
+        jsvUnRef(child);
+    }
+  }
+  /* Sanity checks here. We're making sure that any variables that are
+   * linked from this one have either already been garbage collected or
+   * are marked for GC */
+  assert(!jsvHasChildren(var) || !jsvGetFirstChild(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetFirstChild(var))) ||
+      jsvGetAddressOf(jsvGetFirstChild(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetFirstChild(var))->flags&JSV_GARBAGE_COLLECT));
+  assert(!jsvHasChildren(var) || !jsvGetLastChild(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetLastChild(var))) ||
+      jsvGetAddressOf(jsvGetLastChild(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetLastChild(var))->flags&JSV_GARBAGE_COLLECT));
+  assert(!jsvIsName(var) || !jsvGetPrevSibling(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetPrevSibling(var))) ||
+      jsvGetAddressOf(jsvGetPrevSibling(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetPrevSibling(var))->flags&JSV_GARBAGE_COLLECT));
+  assert(!jsvIsName(var) || !jsvGetNextSibling(var) ||
+      jsvGetLocks(jsvGetAddressOf(jsvGetNextSibling(var))) ||
+      jsvGetAddressOf(jsvGetNextSibling(var))->flags==JSV_UNUSED ||
+      (jsvGetAddressOf(jsvGetNextSibling(var))->flags&JSV_GARBAGE_COLLECT));
+  // free!
+  var->flags = JSV_UNUSED;
+  return 1;
+}
+
+/** Free everything that still has JSV_GARBAGE_COLLECT set. Also rebuild
+ * the free list - this means that every new variable that gets allocated
+ * gets allocated towards the start of memory, which hopefully helps
+ * compact everything towards the start. Returns the number of vars freed. */
+static unsigned int jsvGarbageCollectSweep() {
+  JsVarRef i;
+  unsigned int freedCount = 0;
+  jsVarFirstEmpty = 0;
+  JsVar *lastEmpty = 0;
+  for (i=1;i<=jsVarsSize;i++)  {
+    JsVar *var = jsvGetAddressOf(i);
+    if (var->flags & JSV_GARBAGE_COLLECT) {
+      unsigned int count = jsvGarbageCollectFree(var);
+      freedCount += count;
+      // add all the blocks to our free list
+      while (true) {
+        if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
+        else jsVarFirstEmpty = i;
+        lastEmpty = jsvGetAddressOf(i);
+        if (!--count) break;
+        i++;
+      }
+    } else if (jsvIsFlatString(var)) {
+      // if we have a flat string, skip forward that many blocks
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
+    } else if (var->flags == JSV_UNUSED) {
+      // this is already free - add it to the free list
+      if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
+      else jsVarFirstEmpty = i;
+      lastEmpty = var;
+    }
+  }
+  if (lastEmpty) jsvSetNextSibling(lastEmpty, 0);
+#ifdef ESPR_FREE_RUN_INDEX
+  jsvFreeRunIndexRebuild();
+#endif
+  return freedCount;
+}
+
 /** Run a garbage collection sweep - return nonzero if things have been freed */
 int jsvGarbageCollect() {
   if (isMemoryBusy) return 0;
+#ifdef ESPR_GC_INCREMENTAL
+  jsvGCState = JSV_GC_IDLE; // we're doing everything now, so forget any incremental GC in progress
+#endif
+#ifdef ESPR_INLINE_CACHE
+  unsigned int cacheFreedCount = jsvGarbageCollectClearCaches();
+#endif
   isMemoryBusy = MEMBUSY_GC;
+#ifdef ESPR_JSVAR_STATS
+  jsvStatsSample();
+  jsvStats.gcRuns++;
+#endif
   JsVarRef i;
   // Add GC flags to anything that is currently used
   for (i=1;i<=jsVarsSize;i++)  {
@@ -4178,185 +4971,447 @@ int jsvGarbageCollect() {
         // this could fail due to stack exhausted (eg big linked list)
         // JSV_GARBAGE_COLLECT are left set, but not a big problem as next GC will clear them
         isMemoryBusy = MEM_NOT_BUSY;
+#ifdef ESPR_INLINE_CACHE
+        return (int)cacheFreedCount; // clearing the caches may still have freed something
+#else
         return 0;
+#endif
       }
     }
     // if we have a flat string, skip that many blocks
     if (jsvIsFlatString(var))
       i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
   }
-  /* now sweep for things that we can GC!
-   * Also update the free list - this means that every new variable that
-   * gets allocated gets allocated towards the start of memory, which
-   * hopefully helps compact everything towards the start. */
-  unsigned int freedCount = 0;
-  jsVarFirstEmpty = 0;
-  JsVar *lastEmpty = 0;
-  for (i=1;i<=jsVarsSize;i++)  {
-    JsVar *var = jsvGetAddressOf(i);
-    if (var->flags & JSV_GARBAGE_COLLECT) {
-      if (jsvIsFlatString(var)) {
-        // If we're a flat string, there are more blocks to free.
-        unsigned int count = (unsigned int)jsvGetFlatStringBlocks(var);
-        freedCount+=count;
-        // Free the first block
-        var->flags = JSV_UNUSED;
-        // add this to our free list
-        if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-        else jsVarFirstEmpty = i;
-        lastEmpty = var;
-        // free subsequent blocks
-        while (count-- > 0) {
-          i++;
-          var = jsvGetAddressOf((JsVarRef)(i));
-          var->flags = JSV_UNUSED;
-          // add this to our free list
-          if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-          else jsVarFirstEmpty = i;
-          lastEmpty = var;
-        }
-      } else {
-        // otherwise just free 1 block
-        if (jsvHasSingleChild(var)) {
-          /* If this had a child that wasn't listed for GC then we need to
-           * unref it. Everything else is fine because it'll disappear anyway.
-           * We don't have to check if we should free this other variable
-           * here because we know the GC picked up it was referenced from
-           * somewhere else. */
-          JsVarRef ch = jsvGetFirstChild(var);
-          if (ch) {
-            JsVar *child = jsvGetAddressOf(ch); // not locked
-            if (child->flags!=JSV_UNUSED && // not already GC'd!
-                !(child->flags&JSV_GARBAGE_COLLECT)) // not marked for GC
-              jsvUnRef(child);
-          }
-        }
-        /* Sanity checks here. We're making sure that any variables that are
-         * linked from this one have either already been garbage collected or
-         * are marked for GC */
-        assert(!jsvHasChildren(var) || !jsvGetFirstChild(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetFirstChild(var))) ||
-            jsvGetAddressOf(jsvGetFirstChild(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetFirstChild(var))->flags&JSV_GARBAGE_COLLECT));
-        assert(!jsvHasChildren(var) || !jsvGetLastChild(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetLastChild(var))) ||
-            jsvGetAddressOf(jsvGetLastChild(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetLastChild(var))->flags&JSV_GARBAGE_COLLECT));
-        assert(!jsvIsName(var) || !jsvGetPrevSibling(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetPrevSibling(var))) ||
-            jsvGetAddressOf(jsvGetPrevSibling(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetPrevSibling(var))->flags&JSV_GARBAGE_COLLECT));
-        assert(!jsvIsName(var) || !jsvGetNextSibling(var) ||
-            jsvGetLocks(jsvGetAddressOf(jsvGetNextSibling(var))) ||
-            jsvGetAddressOf(jsvGetNextSibling(var))->flags==JSV_UNUSED ||
-            (jsvGetAddressOf(jsvGetNextSibling(var))->flags&JSV_GARBAGE_COLLECT));
-        // free!
-        var->flags = JSV_UNUSED;
-        // add this to our free list
-        if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-        else jsVarFirstEmpty = i;
-        lastEmpty = var;
-        freedCount++;
+  // now sweep for things that we can GC!
+  unsigned int freedCount = jsvGarbageCollectSweep();
+  isMemoryBusy = MEM_NOT_BUSY;
+#ifdef ESPR_OBJECT_INDEX
+  if (freedCount) jsvObjectIndexRemoveFreed();
+#endif
+#ifdef ESPR_INLINE_CACHE
+  freedCount += cacheFreedCount;
+#endif
+  return (int)freedCount;
+}
+
+#ifdef ESPR_GC_INCREMENTAL
+/* Incremental GC. This is the same mark and sweep as jsvGarbageCollect,
+ * but done a bit at a time from the idle loop. While marking, vars with
+ * JSV_GARBAGE_COLLECT set are 'white' (not found yet), vars on jsvGCStack
+ * are 'grey' (found, but children not scanned) and everything else is
+ * 'black'. JS code runs between slices, so locking a white var marks it
+ * (locked vars are roots) and the write barriers stop a black var from
+ * being the only link to a white one. If jsvGCStack fills up we set
+ * jsvGCOverflow, and later scan the children of every marked var. Once
+ * nothing is grey, nothing can reach the white vars any more so we can
+ * free them a slice at a time too. */
+
+/// Add a marked var to the stack of vars whose children need scanning
+static void jsvGCPush(JsVar *v) {
+  if (jsvGCState==JSV_GC_SWEEP) return;
+  JsVarRef ref = jsvGetRef(v);
+  if (jsvGCStackSize && jsvGCStack[jsvGCStackSize-1]==ref) return; // already there
+  // don't touch the stack from an IRQ, as we could be part way through a slice
+  if (jsvGCStackSize<ESPR_GC_STACK_SIZE && !jshIsInInterrupt())
+    jsvGCStack[jsvGCStackSize++] = ref;
+  else
+    jsvGCOverflow = true;
+}
+
+/// Mark a white var as used, and queue it to have its children scanned
+static void jsvGCMark(JsVar *v) {
+  v->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+  jsvGCPush(v);
+}
+
+static void jsvGCScan(JsVar *var);
+
+static void jsvGCMarkRef(JsVarRef ref) {
+  if (!ref) return;
+  JsVar *v = jsvGetAddressOf(ref);
+  if (!(v->flags & JSV_GARBAGE_COLLECT)) return;
+  if (jsvHasChildren(v) || jsvHasSingleChild(v)) {
+    jsvGCMark(v);
+  } else { // no need to use the stack for things like strings and numbers
+    v->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+    jsvGCScan(v);
+  }
+}
+
+/// Called from jsvLock when locking a white var
+static void jsvGCMarkLocked(JsVar *v) {
+  if (jsvGCState==JSV_GC_IDLE) return; // flags left over from a failed jsvGarbageCollect
+  /* Once we're sweeping, white vars can't be reached and some of their
+   * children may already have been freed, so it's too late to mark them.
+   * Anything locking one has found garbage by scanning memory directly */
+  assert(jsvGCState!=JSV_GC_SWEEP);
+  if (jsvGCState==JSV_GC_SWEEP) return;
+  jsvGCMark(v);
+}
+
+/// Called from JSV_GC_CHILD_BARRIER when v's firstChild/lastChild has changed
+static void jsvGCMarkModified(JsVar *v) {
+  // free vars don't matter, and white vars will be scanned if they're found
+  if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED || (v->flags & JSV_GARBAGE_COLLECT)) return;
+  jsvGCPush(v);
+}
+
+/// Called from JSV_GC_SIBLING_BARRIER when r has been linked next to v
+static void jsvGCMarkSibling(JsVar *v, JsVarRef r) {
+  // only names use siblings as references (free vars use them for the free list)
+  if (jsvIsName(v) && !jsvIsArrayBufferName(v))
+    jsvGCMarkRef(r);
+}
+
+/// A flat string was allocated - make sure we don't treat its data as vars
+static void jsvGCNewFlatString(JsVar *flatString, unsigned int blocks) {
+  JsVarRef first = jsvGetRef(flatString);
+  JsVarRef last = (JsVarRef)(first+blocks-1);
+  if (jsvGCCursor>first && jsvGCCursor<=last)
+    jsvGCCursor = (JsVarRef)(last+1);
+  for (unsigned int i=0;i<jsvGCStackSize;i++)
+    if (jsvGCStack[i]>first && jsvGCStack[i]<=last)
+      jsvGCStack[i] = 0;
+}
+
+/// Mark everything that is directly referenced from var
+static void jsvGCScan(JsVar *var) {
+  if (jsvHasStringExt(var)) {
+    // string extensions have no other children, so just mark them all now
+    JsVarRef child = jsvGetLastChild(var);
+    while (child) {
+      JsVar *childVar = jsvGetAddressOf(child);
+      childVar->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+      child = jsvGetLastChild(childVar);
+    }
+  }
+  // intentionally no else
+  if (jsvHasSingleChild(var)) {
+    jsvGCMarkRef(jsvGetFirstChild(var));
+  } else if (jsvHasChildren(var)) {
+    JsVarRef child = jsvGetFirstChild(var);
+    while (child) {
+      JsVar *childVar = jsvGetAddressOf(child);
+      if (childVar->flags & JSV_GARBAGE_COLLECT) {
+        // Scan names right now, rather than filling the stack with them
+        childVar->flags &= (JsVarFlags)~JSV_GARBAGE_COLLECT;
+        jsvGCScan(childVar);
       }
-    } else if (jsvIsFlatString(var)) {
-      // if we have a flat string, skip forward that many blocks
-      i = (JsVarRef)(i+jsvGetFlatStringBlocks(var));
-    } else if (var->flags == JSV_UNUSED) {
-      // this is already free - add it to the free list
-      if (lastEmpty) jsvSetNextSibling(lastEmpty, i);
-      else jsVarFirstEmpty = i;
-      lastEmpty = var;
+      child = jsvGetNextSibling(childVar);
     }
   }
-  if (lastEmpty) jsvSetNextSibling(lastEmpty, 0);
+}
+
+/** Do one small unit of incremental marking. Returns false when marking
+ * is finished. */
+static bool jsvGCMarkStep() {
+  JsVar *var;
+  if (jsvGCState!=JSV_GC_FLAG && jsvGCStackSize) {
+    JsVarRef ref = jsvGCStack[--jsvGCStackSize];
+    if (ref) {
+      var = jsvGetAddressOf(ref);
+      // it may have been freed (or flagged after being pushed, in which case it'll be scanned if it's found)
+      if ((var->flags&JSV_VARTYPEMASK)!=JSV_UNUSED && !(var->flags & JSV_GARBAGE_COLLECT))
+        jsvGCScan(var);
+    }
+    return true;
+  }
+  if (jsvGCState==JSV_GC_MARK) {
+    if (!jsvGCOverflow) return false; // nothing left to scan - we're done!
+    // Some marked vars never made it onto the stack, so we must look at everything
+    jsvGCOverflow = false;
+    jsvGCRescans++;
+    jsvGCState = JSV_GC_RESCAN;
+    jsvGCCursor = 1;
+    return true;
+  }
+  // JSV_GC_FLAG or JSV_GC_RESCAN - look at the next var
+  if (jsvGCCursor > jsVarsSize) {
+    jsvGCState = JSV_GC_MARK;
+    return true;
+  }
+  var = jsvGetAddressOf(jsvGCCursor);
+  if ((var->flags&JSV_VARTYPEMASK) != JSV_UNUSED) {
+    if (jsvGCState==JSV_GC_FLAG) {
+      if (jsvGetLocks(var)) jsvGCMark(var);
+      else var->flags |= (JsVarFlags)JSV_GARBAGE_COLLECT;
+    } else if (!(var->flags & JSV_GARBAGE_COLLECT)) {
+      jsvGCScan(var);
+    }
+    // if we have a flat string, skip that many blocks
+    if (jsvIsFlatString(var))
+      jsvGCCursor = (JsVarRef)(jsvGCCursor+jsvGetFlatStringBlocks(var));
+  }
+  jsvGCCursor++;
+  return true;
+}
+
+/** Free the next var if it's garbage. Returns false when the sweep is
+ * finished. */
+static bool jsvGCSweepStep() {
+  if (jsvGCCursor > jsVarsSize) return false;
+  JsVar *var = jsvGetAddressOf(jsvGCCursor);
+  if (var->flags & JSV_GARBAGE_COLLECT) {
+    unsigned int count = jsvGarbageCollectFree(var);
+    // keep a list of what we freed in order, so we still allocate from the start of memory first
+    while (true) {
+      if (jsvGCFreedLast) jsvSetNextSibling(jsvGetAddressOf(jsvGCFreedLast), jsvGCCursor);
+      else jsvGCFreedFirst = jsvGCCursor;
+      jsvGCFreedLast = jsvGCCursor;
+      if (!--count) break;
+      jsvGCCursor++;
+    }
+  } else if (jsvIsFlatString(var)) {
+    jsvGCCursor = (JsVarRef)(jsvGCCursor+jsvGetFlatStringBlocks(var));
+  }
+  jsvGCCursor++;
+  return true;
+}
+
+bool jsvGarbageCollectInProgress() {
+  return jsvGCState!=JSV_GC_IDLE;
+}
+
+void jsvGarbageCollectFinish() {
+  if (jsvGCState==JSV_GC_IDLE) return;
+  JsVarFloat sliceTime = jsvGCSliceTime;
+  jsvGCSliceTime = 0; // do everything in one go
+  jsvGarbageCollectStep();
+  jsvGCSliceTime = sliceTime;
+}
+
+bool jsvGarbageCollectStep() {
+  if (isMemoryBusy) return jsvGCState!=JSV_GC_IDLE;
+  if (jsvGCState==JSV_GC_IDLE) {
+    if (!jsvGCSliceTime) return false;
+#ifdef ESPR_JSVAR_STATS
+    jsvStatsSample();
+#endif
+    jsvGCState = JSV_GC_FLAG;
+    jsvGCCursor = 1;
+    jsvGCStackSize = 0;
+    jsvGCOverflow = false;
+    jsvGCRescans = 0;
+  }
+  JsSysTime endTime = jshGetSystemTime() + jshGetTimeFromMilliseconds(jsvGCSliceTime);
+  unsigned int n = 0;
+  bool working = true;
+  if (jsvGCState!=JSV_GC_SWEEP) {
+    isMemoryBusy = MEMBUSY_GC;
+    if (jsvGCSliceTime && jsvGCRescans<=JSV_GC_MAX_RESCANS) {
+      while ((working = jsvGCMarkStep()) &&
+             ((++n & JSV_GC_TIME_CHECK_MASK) || jshGetSystemTime()<endTime) &&
+             jsvGCRescans<=JSV_GC_MAX_RESCANS);
+    }
+    /* If we've been disabled, or we keep overflowing the stack (because
+     * the code is changing things as fast as we can mark them) just finish
+     * marking now */
+    if (working && (!jsvGCSliceTime || jsvGCRescans>JSV_GC_MAX_RESCANS)) {
+      while (jsvGCMarkStep());
+      working = false;
+    }
+    isMemoryBusy = MEM_NOT_BUSY;
+    if (working) return true; // more to do next time
+    // Marking is finished, so nothing can get to the white vars any more
+#ifdef ESPR_INLINE_CACHE
+    jsvGarbageCollectClearCaches(); // ... apart from jsparse's inline cache
+#endif
+#ifdef ESPR_OBJECT_INDEX
+    jsvObjectIndexRemoveFreed(); // their refs could be reused before we're done
+#endif
+    jsvGCState = JSV_GC_SWEEP;
+    jsvGCCursor = 1;
+    jsvGCFreedFirst = 0;
+    jsvGCFreedLast = 0;
+    working = true;
+  }
+  isMemoryBusy = MEMBUSY_GC;
+  if (jsvGCSliceTime) {
+    while ((working = jsvGCSweepStep()) &&
+           ((++n & JSV_GC_TIME_CHECK_MASK) || jshGetSystemTime()<endTime));
+  } else {
+    while (jsvGCSweepStep());
+    working = false;
+  }
+  if (!working) {
+    // Sweep finished - add everything we freed to the start of the free list
+    if (jsvGCFreedLast) {
+      jshInterruptOff();
+      jsvSetNextSibling(jsvGetAddressOf(jsvGCFreedLast), jsVarFirstEmpty);
+      jsVarFirstEmpty = jsvGCFreedFirst;
+      touchedFreeList = true;
+      jshInterruptOn();
+    }
+    jsvGCState = JSV_GC_IDLE;
+#ifdef ESPR_JSVAR_STATS
+    jsvStats.gcRuns++;
+#endif
+#ifdef ESPR_FREE_RUN_INDEX
+    jsvFreeRunIndexRebuild(); // what we freed was added in memory order, so there are probably some new runs
+#endif
+  }
   isMemoryBusy = MEM_NOT_BUSY;
-  return (int)freedCount;
+  return working;
 }
+#endif // ESPR_GC_INCREMENTAL
 
 #ifndef SAVE_ON_FLASH
-void jsvDefragment() {
-  /* FIXME: we should surely be able to go through without `defragVars`,
-  and just work from the beginning to the end. We really need to be able
-  to move flat strings: https://github.com/espruino/Espruino/issues/1740 */
-  // garbage collect - removes cruft
-  // also puts free list in order
-  jsvGarbageCollect();
-  // Fill defragVars with defraggable variables
-  jshInterruptOff();
-  const int DEFRAGVARS = 256; // POWER OF 2
-  JsVarRef defragVars[DEFRAGVARS];
-  memset(defragVars, 0, sizeof(defragVars));
-  int defragVarIdx = 0;
+#define JSV_DEFRAG_BREAKS 256 ///< How many places the distance vars move by can change in one pass of jsvDefragment
+
+unsigned int jsvDefragLargestFreeRunBefore; ///< Largest free run before the last jsvDefragment
+unsigned int jsvDefragLargestFreeRunAfter; ///< Largest free run after the last jsvDefragment
+
+/// Get the size (in blocks) of the biggest contiguous area of free memory - the largest flat string we could allocate
+unsigned int jsvGetLargestFreeRun() {
+  unsigned int largest = 0, run = 0;
   for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
-    JsVarRef vr = (JsVarRef)(i+1);
-    JsVar *v = _jsvGetAddressOf(vr);
-    if ((v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED) {
-      if (jsvIsFlatString(v)) {
+    JsVar *v = _jsvGetAddressOf((JsVarRef)(i+1));
+#ifdef RESIZABLE_JSVARS
+    if (!(i&(JSVAR_BLOCK_SIZE-1))) run = 0; // blocks aren't contiguous
+#endif
+    if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED) {
+      if (++run > largest) largest = run;
+    } else {
+      run = 0;
+      if (jsvIsFlatString(v))
         i += (unsigned int)jsvGetFlatStringBlocks(v); // skip forward
-      } else if (jsvGetLocks(v)==0) {
-        defragVars[defragVarIdx] = vr;
-        defragVarIdx = (defragVarIdx+1) & (DEFRAGVARS-1);
-        // why do we roll over and not stop?
-      }
     }
   }
-  // Now go through defragVars defragging them
-  defragVarIdx--;
-  if (defragVarIdx<0) defragVarIdx+=DEFRAGVARS;
-  while (defragVars[defragVarIdx]) {
-    JsVarRef defragFromRef = defragVars[defragVarIdx];
-    JsVarRef defragToRef = jsVarFirstEmpty;
-    if (!defragToRef || defragFromRef<defragToRef) {
-      // we're done!
-      break;
+  return largest;
+}
+
+/** Vars at and after 'from' (until the next break) move down by 'delta' blocks */
+typedef struct {
+  JsVarRef from;
+  JsVarRef delta;
+} JsvDefragBreak;
+
+/// Where does the var at 'ref' move to?
+static JsVarRef jsvDefragForward(JsvDefragBreak *breaks, unsigned int breakCount, JsVarRef ref) {
+  if (!ref || !breakCount || ref<breaks[0].from) return ref;
+  // binary search for the last break at or before ref
+  unsigned int lo = 0, hi = breakCount;
+  while (hi-lo > 1) {
+    unsigned int mid = (lo+hi)>>1;
+    if (breaks[mid].from <= ref) lo = mid;
+    else hi = mid;
+  }
+  return (JsVarRef)(ref - breaks[lo].delta);
+}
+
+/// Can a var of 'blocks' blocks be put at 'ref'? Returns the first ref at or after 'ref' where it can
+static JsVarRef jsvDefragFit(JsVarRef ref, unsigned int blocks, bool isFlat) {
+  if (!isFlat) return ref;
+  while (true) {
+#ifdef RESIZABLE_JSVARS
+    // a flat string can't span two of our blocks of memory
+    if (((ref-1)>>JSVAR_BLOCK_SHIFT) != ((ref+blocks-2)>>JSVAR_BLOCK_SHIFT))
+      ref = (JsVarRef)((((ref-1)>>JSVAR_BLOCK_SHIFT)+1)<<JSVAR_BLOCK_SHIFT)+1;
+#endif
+    // flat string data must be aligned on a 4 byte boundary (as in jsvNewFlatStringOfLength)
+    if (!(((size_t)(jsvGetAddressOf(ref)+1))&3)) return ref;
+    ref++;
+  }
+}
+
+/** Do one pass of sliding compaction - moving every var that isn't locked
+ * down into free space below it and updating all refs to it. Returns true
+ * if there is more to do (because we ran out of space for breaks). */
+static bool jsvDefragmentPass() {
+  JsvDefragBreak breaks[JSV_DEFRAG_BREAKS];
+  unsigned int breakCount = 0;
+  JsVarRef delta = 0; // how far the current vars are moving
+  JsVarRef dest = 1; // where the next var will go
+  JsVarRef limit = (JsVarRef)(jsVarsSize+1); // vars from here on don't move in this pass
+  bool moved = false;
+  // Work out where everything goes
+  JsVarRef i = 1;
+  while (i<=jsVarsSize) {
+    JsVar *v = jsvGetAddressOf(i);
+    if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED) {
+      i++;
+      continue;
     }
-    // relocate!
-    JsVar *defragFrom = _jsvGetAddressOf(defragFromRef);
-    JsVar *defragTo = _jsvGetAddressOf(defragToRef);
-    jsVarFirstEmpty = jsvGetNextSibling(defragTo); // move our reference to the next in the free list
-    // copy data
-    *defragTo = *defragFrom;
-    defragFrom->flags = JSV_UNUSED;
-    // find references!
-    for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
-      JsVarRef vr = (JsVarRef)(i+1);
-      JsVar *v = _jsvGetAddressOf(vr);
-      if ((v->flags&JSV_VARTYPEMASK)!=JSV_UNUSED) {
-        if (jsvIsFlatString(v)) {
-          i += (unsigned int)jsvGetFlatStringBlocks(v); // skip forward
-        } else {
-          if (jsvHasSingleChild(v))
-            if (jsvGetFirstChild(v)==defragFromRef)
-              jsvSetFirstChild(v,defragToRef);
-          if (jsvHasStringExt(v))
-            if (jsvGetLastChild(v)==defragFromRef)
-              jsvSetLastChild(v,defragToRef);
-          if (jsvHasChildren(v)) {
-            if (jsvGetFirstChild(v)==defragFromRef)
-              jsvSetFirstChild(v,defragToRef);
-            if (jsvGetLastChild(v)==defragFromRef)
-              jsvSetLastChild(v,defragToRef);
-          }
-          if (jsvIsName(v)) {
-            if (jsvGetNextSibling(v)==defragFromRef)
-              jsvSetNextSibling(v,defragToRef);
-            if (jsvGetPrevSibling(v)==defragFromRef)
-              jsvSetPrevSibling(v,defragToRef);
-          }
-        }
+    bool isFlat = jsvIsFlatString(v);
+    unsigned int blocks = isFlat ? 1+(unsigned int)jsvGetFlatStringBlocks(v) : 1;
+    JsVarRef to = i;
+    // Locked vars may have their address in use. Buffers used by timer tasks are accessed from IRQs
+    if (!jsvGetLocks(v) && !(isFlat && jstIsBufferTimerTaskRef(i)))
+      to = jsvDefragFit(dest, blocks, isFlat);
+    if ((JsVarRef)(i-to) != delta) {
+      if (breakCount>=JSV_DEFRAG_BREAKS-1) {
+        // out of space - nothing from here on moves (we kept a break spare to say so)
+        limit = i;
+        breaks[breakCount].from = i;
+        breaks[breakCount].delta = 0;
+        breakCount++;
+        break;
       }
+      delta = (JsVarRef)(i-to);
+      breaks[breakCount].from = i;
+      breaks[breakCount].delta = delta;
+      breakCount++;
     }
-    // zero element and move to next...
-    defragVars[defragVarIdx] = 0;
-    defragVarIdx--;
-    if (defragVarIdx<0) defragVarIdx+=DEFRAGVARS;
-    // bump watchdog just in case it took too long
-    jshKickWatchDog();
-    jshKickSoftWatchDog();
+    if (delta) moved = true;
+    dest = (JsVarRef)(to+blocks);
+    i = (JsVarRef)(i+blocks);
   }
+  if (!moved) return false;
+  // Update references in every var (while they're still in their old places)
+  for (i=1;i<=jsVarsSize;i++) {
+    JsVar *v = jsvGetAddressOf(i);
+    if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED) continue;
+    if (jsvHasSingleChild(v) || jsvHasChildren(v))
+      jsvSetFirstChild(v, jsvDefragForward(breaks, breakCount, jsvGetFirstChild(v)));
+    if (jsvHasStringExt(v) || jsvHasChildren(v))
+      jsvSetLastChild(v, jsvDefragForward(breaks, breakCount, jsvGetLastChild(v)));
+    if (jsvIsName(v)) {
+      jsvSetNextSibling(v, jsvDefragForward(breaks, breakCount, jsvGetNextSibling(v)));
+      jsvSetPrevSibling(v, jsvDefragForward(breaks, breakCount, jsvGetPrevSibling(v)));
+    }
+    if (jsvIsFlatString(v))
+      i = (JsVarRef)(i+jsvGetFlatStringBlocks(v)); // skip forward
+  }
+  // ... and the few refs that are kept outside of vars
+  timerArray = jsvDefragForward(breaks, breakCount, timerArray);
+  watchArray = jsvDefragForward(breaks, breakCount, watchArray);
+  /* Now move everything. Vars only ever move down, so going upwards we
+   * never overwrite anything we haven't copied yet. Mark each block as
+   * free as we leave it - if something else moves in it'll be overwritten */
+  for (unsigned int b=0;b<breakCount;b++) {
+    delta = breaks[b].delta;
+    if (!delta) continue;
+    JsVarRef end = (b+1<breakCount) ? breaks[b+1].from : limit;
+    for (i=breaks[b].from;i<end;i++) {
+      JsVar *from = jsvGetAddressOf(i);
+      *jsvGetAddressOf((JsVarRef)(i-delta)) = *from;
+      from->flags = JSV_UNUSED;
+    }
+  }
+  // bump watchdog just in case it took too long
+  jshKickWatchDog();
+  jshKickSoftWatchDog();
+  return limit<=jsVarsSize;
+}
+
+void jsvDefragment() {
+#ifdef ESPR_OBJECT_INDEX
+  // indexes store refs which we're about to change, and they're locked flat strings anyway
+  jsvObjectIndexRemoveAll();
+#endif
+  // garbage collect - removes cruft (and jsparse's caches, which store refs)
+  jsvGarbageCollect();
+  jsvDefragLargestFreeRunBefore = jsvGetLargestFreeRun();
+  jshInterruptOff();
+  /* Slide everything that isn't locked down to the start of memory,
+   * including flat strings (so ArrayBuffers' backing stores move too).
+   * We only have room to remember JSV_DEFRAG_BREAKS places where vars
+   * move by a different amount, so we may need more than one pass */
+  while (jsvDefragmentPass());
   // rebuild free var list
   jsvCreateEmptyVarList();
   jshInterruptOn();
+  jsvDefragLargestFreeRunAfter = jsvGetLargestFreeRun();
 }
 #endif
 
@@ -294,9 +294,15 @@ void jsvSoftKill(); ///< called when saving to flash
 JsVar *jsvFindOrCreateRoot(); ///< Find or create the ROOT variable item - used mainly if recovering from a saved state.
 unsigned int jsvGetMemoryUsage(); ///< Get number of memory records (JsVars) used
 unsigned int jsvGetMemoryTotal(); ///< Get total amount of memory records
+JsVar *jsvGetContiguousVars(JsVarRef ref, unsigned int *count); ///< Get the address of a var, and the number of vars from it that are contiguous in memory (for bulk copies)
 bool jsvIsMemoryFull(); ///< Get whether memory is full or not
 bool jsvMoreFreeVariablesThan(unsigned int vars); ///< Return whether there are more free variables than the parameter (faster than checking no of vars used)
 void jsvShowAllocated(); ///< Show what is still allocated, for debugging memory problems
+#ifdef ESPR_INLINE_CACHE
+/** Incremented whenever something changes that could alter the result of a
+ * lookup in a prototype chain - see jspGetNamedFieldInParents */
+extern unsigned int jsvShapeEpoch;
+#endif
 /// Try and allocate more memory - only works if RESIZABLE_JSVARS is defined
 void jsvSetMemoryTotal(unsigned int jsNewVarCount);
 /// Scan memory to find any JsVar that references a specific memory range, and if so update what it points to to p[oint to the new address
@@ -741,8 +747,45 @@ void jsvTrace(JsVar *var, int indent);
 /** Run a garbage collection sweep - return nonzero if things have been freed */
 int jsvGarbageCollect();
 
+#ifdef ESPR_GC_INCREMENTAL
+extern JsVarFloat jsvGCSliceTime; ///< Maximum milliseconds for each slice of incremental GC (0 = don't do incremental GC)
+
+/** Do a slice of incremental garbage collection (at most jsvGCSliceTime ms
+ * of marking), starting a new cycle if one isn't in progress. Returns true
+ * if the cycle isn't finished yet and this should be called again. */
+bool jsvGarbageCollectStep();
+/// Is an incremental garbage collection cycle in progress?
+bool jsvGarbageCollectInProgress();
+/** If an incremental garbage collection cycle is in progress, finish it now.
+ * Must be called before scanning memory and locking vars that may be garbage */
+void jsvGarbageCollectFinish();
+#else
+#define jsvGarbageCollectFinish()
+#endif
+
+#ifdef ESPR_JSVAR_STATS
+/// Counters of what the variable store has been doing, for benchmarking (see `--bench` on Linux)
+typedef struct {
+  uint64_t allocs;         ///< JsVars allocated (a flat string counts all its blocks)
+  uint64_t locks;          ///< Calls to jsvLock/jsvLockAgain
+  unsigned int gcRuns;     ///< Garbage collections finished (full or incremental)
+  unsigned int peakUsage;  ///< Most JsVars in use, sampled as each GC starts and by jsvStatsSample
+} JsVarStats;
+extern JsVarStats jsvStats;
+/// Zero all of jsvStats
+void jsvStatsReset();
+/// Update jsvStats.peakUsage with the current memory usage
+void jsvStatsSample();
+#endif
+
 /** Defragement memory - this could take a while with interrupts turned off! */
 void jsvDefragment();
+#ifndef SAVE_ON_FLASH
+/// Get the size (in blocks) of the biggest contiguous area of free memory - the largest flat string we could allocate
+unsigned int jsvGetLargestFreeRun();
+extern unsigned int jsvDefragLargestFreeRunBefore; ///< Largest free run before the last jsvDefragment
+extern unsigned int jsvDefragLargestFreeRunAfter; ///< Largest free run after the last jsvDefragment
+#endif
 
 // Dump any locked variables that aren't referenced from `global` - for debugging memory leaks
 void jsvDumpLockedVars();
@@ -404,8 +404,24 @@ void jsvStringIteratorGetPtrAndNext(JsvStringIterator *it, unsigned char **data,
   jsvStringIteratorNextInline(it);
 }
 
+#ifdef ESPR_STRING_TAIL_CACHE
+JsvStringTailCache jsvStringTailCache;
+#endif
+
 void jsvStringIteratorGotoEnd(JsvStringIterator *it) {
   assert(it->var);
+#ifdef ESPR_STRING_TAIL_CACHE
+  JsVar *str = jsvHasStringExt(it->var) ? it->var : 0;
+  size_t strIndex = it->varIndex;
+  if (str && str==jsvStringTailCache.str) {
+    // we've been to the end of this string before - skip straight there
+    JsVar *tail = jsvLockAgain(jsvStringTailCache.tail);
+    jsvUnLock(it->var);
+    it->var = tail;
+    it->varIndex = strIndex + jsvStringTailCache.tailIndex;
+    it->charsInVar = jsvGetCharactersInVar(tail);
+  }
+#endif
   while (jsvGetLastChild(it->var)) {
     JsVar *next = jsvLock(jsvGetLastChild(it->var));
     jsvUnLock(it->var);
@@ -413,6 +429,13 @@ void jsvStringIteratorGotoEnd(JsvStringIterator *it) {
     it->varIndex += it->charsInVar;
     it->charsInVar = jsvGetCharactersInVar(it->var);
   }
+#ifdef ESPR_STRING_TAIL_CACHE
+  if (str && it->var!=str) {
+    jsvStringTailCache.str = str;
+    jsvStringTailCache.tail = it->var;
+    jsvStringTailCache.tailIndex = it->varIndex - strIndex;
+  }
+#endif
   it->ptr = &it->var->varData.str[0];
   if (it->charsInVar) it->charIdx = it->charsInVar-1;
   else it->charIdx = 0;
@@ -481,12 +504,44 @@ void jsvStringIteratorAppend(JsvStringIterator *it, char ch) {
   jsvSetCharactersInVar(it->var, it->charsInVar);
 }
 
+void jsvStringIteratorAppendBuf(JsvStringIterator *it, const char *data, size_t len) {
+  while (len) {
+    // append one char (adding a new StringExt if this var is full)...
+    jsvStringIteratorAppend(it, *(data++));
+    len--;
+    if (!it->var) return; // out of memory
+    // ... then copy as much as we can into the rest of the var
+    size_t maxChars = jsvGetMaxCharactersInVar(it->var);
+    if (!len || it->charsInVar >= maxChars) continue;
+    size_t n = maxChars - it->charsInVar;
+    if (n > len) n = len;
+    memcpy(&it->ptr[it->charsInVar], data, n);
+    data += n;
+    len -= n;
+    it->charsInVar += n;
+    it->charIdx = it->charsInVar-1;
+    jsvSetCharactersInVar(it->var, it->charsInVar);
+  }
+}
+
 void jsvStringIteratorAppendString(JsvStringIterator *it, JsVar *str, size_t startIdx, int maxLength) {
   JsvStringIterator sit;
   jsvStringIteratorNew(&sit, str, startIdx);
   while (jsvStringIteratorHasChar(&sit) && maxLength>0) {
+#ifdef ESP8266
+    // Native strings may be in flash, which has to be read with READ_FLASH_UINT8
     jsvStringIteratorAppend(it, jsvStringIteratorGetCharAndNext(&sit));
     maxLength--;
+#else
+    // copy the rest of this var's characters all at once
+    size_t len = sit.charsInVar - sit.charIdx;
+    if (len > (size_t)maxLength) len = (size_t)maxLength;
+    jsvStringIteratorAppendBuf(it, &sit.ptr[sit.charIdx], len);
+    maxLength -= (int)len;
+    // don't move on until we've copied, as flash strings reuse the same buffer
+    sit.charIdx += len-1;
+    jsvStringIteratorNext(&sit);
+#endif
   }
   jsvStringIteratorFree(&sit);
 }
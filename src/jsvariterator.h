@@ -180,6 +180,31 @@ static ALWAYS_INLINE void jsvStringIteratorNextInline(JsvStringIterator *it) {
 /// Go to the end of the string iterator - for use with jsvStringIteratorAppend
 void jsvStringIteratorGotoEnd(JsvStringIterator *it);
 
+#ifdef ESPR_STRING_TAIL_CACHE
+/** Where the last string that jsvStringIteratorGotoEnd walked along ended, so that
+ * appending to it again (eg. `s += ...` in a loop) can jump straight to the end
+ * rather than walking every StringExt */
+typedef struct {
+  JsVar *str; ///< The var jsvStringIteratorGotoEnd started from (or 0 if the cache is empty)
+  JsVar *tail; ///< The last StringExt of str
+  size_t tailIndex; ///< Index of the start of tail, relative to the start of str
+} JsvStringTailCache;
+extern JsvStringTailCache jsvStringTailCache;
+
+/// Must be called when var is freed (or its StringExts change), in case it's in the cache
+static ALWAYS_INLINE void jsvStringTailCacheRemove(JsVar *var) {
+  if (var==jsvStringTailCache.str || var==jsvStringTailCache.tail)
+    jsvStringTailCache.str = 0;
+}
+/// Must be called when vars are moved or reinitialised
+static ALWAYS_INLINE void jsvStringTailCacheClear() {
+  jsvStringTailCache.str = 0;
+}
+#else
+#define jsvStringTailCacheRemove(var)
+#define jsvStringTailCacheClear()
+#endif
+
 /// Go to the given (non-UTF8) position in the string iterator. Needs the string again in case we're going back and need to start from the beginning
 void jsvStringIteratorGoto(JsvStringIterator *it, JsVar *str, size_t startIdx);
 
@@ -189,6 +214,9 @@ void jsvStringIteratorGotoUTF8(JsvStringIterator *it, JsVar *str, size_t idx);
 /// Append a character TO THE END of a string iterator
 void jsvStringIteratorAppend(JsvStringIterator *it, char ch);
 
+/// Append len characters from data TO THE END of a string iterator (copying as much as will fit into each var at once)
+void jsvStringIteratorAppendBuf(JsvStringIterator *it, const char *data, size_t len);
+
 /// Append an entire JsVar string TO THE END of a string iterator
 void jsvStringIteratorAppendString(JsvStringIterator *it, JsVar *str, size_t startIdx, int maxLength);
 
@@ -762,6 +762,16 @@ code.
 * `unsyncFiles` - When writing files, *don't* flush all data to the SD card
   after each command (the default is *to* flush). This is much faster, but can
   cause filesystem damage if power is lost without the filesystem unmounted.
+* `compressSave` - (only on builds with `ESPR_VARIMAGE_SNAPSHOT`) When calling
+  `save()`, write a compressed image of variables rather than an uncompressed
+  snapshot. The snapshot loads much faster but uses more flash.
+* `gcSliceTime` - (only on builds with `ESPR_GC_INCREMENTAL`) The maximum
+  number of milliseconds to spend on each slice of garbage collection when
+  idle. Set to `0` to garbage collect all at once.
+* `compactSliceTime` - (only on builds with `ESPR_STORAGE_COMPACT_IDLE`) The
+  maximum number of milliseconds to spend on each slice of Storage compaction
+  when idle. Set to `0` to only compact when Storage is full. Storage is safe
+  if power is lost between slices, but not during one.
 */
 /*JSON{
   "type" : "staticmethod",
@@ -1446,12 +1456,22 @@ Show fragmentation.
 * `#` is a normal variable
 * `L` is a locked variable (address used, cannot be moved)
 * `=` represents data in a Flat String (must be contiguous)
+
+Afterwards the amount of free memory, how many separate areas it is in, and
+the size of the largest area (in blocks) are shown, along with what the
+largest area was before and after the last call to `E.defrag()`.
  */
 void jswrap_e_dumpFragmentation() {
   int l = 0;
+  unsigned int freeBlocks = 0, freeAreas = 0;
+  bool lastFree = false;
   for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
     JsVar *v = _jsvGetAddressOf(i+1);
-    if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED) {
+    bool isFree = (v->flags&JSV_VARTYPEMASK)==JSV_UNUSED;
+    if (isFree && !lastFree) freeAreas++;
+    lastFree = isFree;
+    if (isFree) {
+      freeBlocks++;
       jsiConsolePrint(" ");
       if (l++>80) { jsiConsolePrint("\n");l=0; }
     } else {
@@ -1469,6 +1489,10 @@ void jswrap_e_dumpFragmentation() {
     }
   }
   jsiConsolePrint("\n");
+  jsiConsolePrintf("Free: %d blocks in %d areas, largest %d blocks", freeBlocks, freeAreas, jsvGetLargestFreeRun());
+  if (jsvDefragLargestFreeRunAfter)
+    jsiConsolePrintf(" (last defrag %d -> %d)", jsvDefragLargestFreeRunBefore, jsvDefragLargestFreeRunAfter);
+  jsiConsolePrint("\n");
 }
 
 /*JSON{
@@ -1482,6 +1506,7 @@ Dumps a comma-separated list of all allocated variables along with the variables
 they link to. Can be used to visualise where memory is used.
  */
 void jswrap_e_dumpVariables() {
+  jsvGarbageCollectFinish(); // we lock every var, so none can be part way through being freed
   jsiConsolePrintf("ref,size,flags,name,links...\n");
   for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
     JsVarRef ref = i+1;
@@ -1539,7 +1564,11 @@ void jswrap_e_dumpVariables() {
   "name" : "defrag",
   "generate" : "jsvDefragment"
 }
-BETA: defragment memory!
+Defragment memory. Everything that isn't locked (including Flat Strings and
+the data in ArrayBuffers) is moved down to the start of memory, so there is as
+much contiguous free space as possible for new Flat Strings.
+
+Use `E.dumpFragmentation()` to see the effect.
 */
 
 /*TYPESCRIPT
@@ -2544,3 +2573,79 @@ void jswrap_espruino_stopEventPropagation() {
     jsExceptionHere(JSET_ERROR, "E.stopEventPropagation() called when not handling events");
   }
 }
+
+/*JSON{
+  "type" : "staticmethod",
+  "class" : "E",
+  "name" : "batchEvents",
+  "ifndef" : "SAVE_ON_FLASH",
+  "generate" : "jswrap_espruino_batchEvents",
+  "params" : [
+    ["obj","JsVar","The object that emits the events, for instance `Bangle`"],
+    ["event","JsVar","The name of the event, for instance `'accel'`"],
+    ["options","JsVar","[optional] An object `{count, maxDelay}`, or `undefined` to stop batching"]
+  ],
+  "typescript" : "batchEvents(obj: any, event: string, options?: { count?: number, maxDelay?: number }): void;"
+}
+Rather than calling event handlers once for every event, collect events into
+batches and call the handlers once per batch. This is useful for events that
+happen very often (like `Bangle.on('accel', ...)` at 100Hz), as Espruino only
+has to wake up and call into JS once for each batch.
+
+Only the first argument of each event is batched. Handlers are called with a
+single argument:
+
+* If the events had numbers, a `Float32Array` of them
+* If the events had objects, an object with the same keys, where numeric
+  fields are `Float32Array`s and other fields are `Array`s
+* Otherwise, an `Array`
+
+```
+E.batchEvents(Bangle, 'accel', {count:25, maxDelay:500});
+Bangle.on('accel', function(a) {
+  // a.x, a.y, a.z, a.diff and a.mag are Float32Arrays of up to 25 items
+});
+```
+
+`options` is of the form:
+
+```
+{
+  count : int,     // default 10, handlers are called once this many events have been collected
+                   //   (0 stops batching)
+  maxDelay : float // default 0, if set, handlers are called at most this many milliseconds
+                   //   after the first event in a batch, even if there are fewer than 'count'
+}
+```
+
+Call `E.batchEvents(obj, event)` (or set `count:0`) to stop batching. Any events
+that have already been batched are sent to the handlers first. If an event's
+argument is a different type to the ones already batched (eg. an object after
+numbers), the existing batch is sent first.
+ */
+void jswrap_espruino_batchEvents(JsVar *obj, JsVar *event, JsVar *options) {
+  if (!jsvHasChildren(obj)) {
+    jsExceptionHere(JSET_TYPEERROR, "First argument must be an object, got %t", obj);
+    return;
+  }
+  if (!jsvIsString(event)) {
+    jsExceptionHere(JSET_TYPEERROR, "Event name must be a String, got %t", event);
+    return;
+  }
+  JsVarInt count = jsvIsUndefined(options) ? 0 : 10;
+  JsVarFloat maxDelay = 0;
+  jsvConfigObject configs[] = {
+    {"count", JSV_INTEGER, &count},
+    {"maxDelay", JSV_FLOAT, &maxDelay}
+  };
+  if (!jsvReadConfigObject(options, configs, sizeof(configs) / sizeof(jsvConfigObject)))
+    return;
+  if (count<0) {
+    jsExceptionHere(JSET_ERROR, "count can't be negative");
+    return;
+  }
+  JsVar *eventName = jsvVarPrintf(JS_EVENT_PREFIX"%v", event);
+  if (!eventName) return; // no memory
+  jsiBatchEvents(obj, eventName, (int)count, maxDelay);
+  jsvUnLock(eventName);
+}
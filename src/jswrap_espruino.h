@@ -79,5 +79,6 @@ void jswrap_espruino_setRTCPrescaler(int prescale);
 int jswrap_espruino_getRTCPrescaler(bool calibrate);
 JsVar *jswrap_espruino_decodeUTF8(JsVar *str, JsVar *lookup, JsVar *replaceFn);
 void jswrap_espruino_stopEventPropagation();
+void jswrap_espruino_batchEvents(JsVar *obj, JsVar *event, JsVar *options);
 
 #endif // JSWRAP_ESPRUINO_H_
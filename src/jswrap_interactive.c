@@ -342,6 +342,7 @@ To set the timezone for all new Dates, use `E.setTimeZone(hours)`.
 void jswrap_interactive_setTime(JsVarFloat time) {
   jshInterruptOff();
   JsSysTime stime = jshGetTimeFromMilliseconds(time*1000);
+  jsiTimersTimeChanged(stime - jsiLastIdleTime);
   jsiLastIdleTime = stime;
   JsSysTime oldtime = jshGetSystemTime();
   // set system time
@@ -553,9 +554,10 @@ void _jswrap_interface_clearTimeoutOrInterval(JsVar *idVarArr, bool isTimeout) {
     while (jsvObjectIteratorHasValue(&it)) {
       JsVar *timerPtr = jsvObjectIteratorGetValue(&it);
       JsVar *watchPtr = jsvObjectGetChildIfExists(timerPtr, "watch");
-      if (!watchPtr)
+      if (!watchPtr) {
+        jsiTimerRemoved(timerPtr);
         jsvObjectIteratorRemoveAndGotoNext(&it, timerArrayPtr);
-      else
+      } else
         jsvObjectIteratorNext(&it);
       jsvUnLock2(watchPtr, timerPtr);
     }
@@ -567,8 +569,12 @@ void _jswrap_interface_clearTimeoutOrInterval(JsVar *idVarArr, bool isTimeout) {
       jsExceptionHere(JSET_ERROR, "clear%s(undefined) not allowed. Use clear%s() instead", name, name);
     } else {
       JsVar *child = jsvIsBasic(idVar) ? jsvFindChildFromVar(timerArrayPtr, idVar, false) : 0;
-      if (child)
+      if (child) {
+        JsVar *timerPtr = jsvSkipName(child);
+        jsiTimerRemoved(timerPtr);
+        jsvUnLock(timerPtr);
         jsvRemoveChildAndUnLock(timerArrayPtr, child);
+      }
       jsvUnLock(idVar);
     }
   }
@@ -610,7 +616,7 @@ void jswrap_interface_changeInterval(JsVar *idVar, JsVarFloat interval) {
     JsVar *timer = jsvSkipNameAndUnLock(timerName);
     JsSysTime intervalInt = jshGetTimeFromMilliseconds(interval);
     jsvObjectSetChildAndUnLock(timer, "interval", jsvNewFromLongInteger(intervalInt));
-    jsvObjectSetChildAndUnLock(timer, "time", jsvNewFromLongInteger((jshGetSystemTime()-jsiLastIdleTime) + intervalInt));
+    jsiTimerSetTime(timer, (jshGetSystemTime()-jsiLastIdleTime) + intervalInt);
     jsvUnLock(timer);
     // timerName already unlocked
     jsiTimersChanged(); // mark timers as changed
@@ -18,6 +18,8 @@
 #include "jsparse.h"
 #include "jsinteractive.h"
 #include "jswrapper.h"
+#include "jswrap_serial.h"
+#include "jsserial.h"
 
 const unsigned int JSON_LIMIT_AMOUNT = 15; // how big does an array get before we start to limit what we show
 const unsigned int JSON_LIMITED_AMOUNT = 5; // When limited, how many items do we show at the beginning and end
@@ -55,34 +57,694 @@ with JSON.parse or eval.
 * Typed arrays like `new Uint8Array(5)` will be dumped as if they were arrays,
   not as if they were objects (since it is more compact)
  */
+/// Fill in whitespace (at least 11 chars) from the 'space' argument of JSON.stringify, and return the extra flags needed
+static JSONFlags jsonGetWhitespace(JsVar *space, char *whitespace) {
+  whitespace[0] = 0;
+  if (jsvIsUndefined(space) || jsvIsNull(space)) {
+    // nothing
+  } else if (jsvIsNumeric(space)) {
+    int s = (int)jsvGetInteger(space);
+    if (s<0) s=0;
+    if (s>10) s=10;
+    whitespace[s] = 0;
+    while (s) whitespace[--s]=' ';
+  } else {
+    size_t l = jsvGetString(space, whitespace, 10);
+    whitespace[l]=0; // add trailing 0
+  }
+  return strlen(whitespace) ? (JSON_ALL_NEWLINES|JSON_PRETTY) : JSON_NONE;
+}
+
 JsVar *jswrap_json_stringify(JsVar *v, JsVar *replacer, JsVar *space) {
   NOT_USED(replacer);
   JSONFlags flags = JSON_IGNORE_FUNCTIONS|JSON_NO_UNDEFINED|JSON_ARRAYBUFFER_AS_ARRAY|JSON_JSON_COMPATIBILE|JSON_ALLOW_TOJSON;
   JsVar *result = jsvNewFromEmptyString();
   if (result) {// could be out of memory
-    char whitespace[11] = "";
-    if (jsvIsUndefined(space) || jsvIsNull(space)) {
-      // nothing
-    } else if (jsvIsNumeric(space)) {
-      int s = (int)jsvGetInteger(space);
-      if (s<0) s=0;
-      if (s>10) s=10;
-      whitespace[s] = 0;
-      while (s) whitespace[--s]=' ';
-    } else {
-      size_t l = jsvGetString(space, whitespace, sizeof(whitespace)-1);
-      whitespace[l]=0; // add trailing 0
-    }
-    if (strlen(whitespace)) flags |= JSON_ALL_NEWLINES|JSON_PRETTY;
+    char whitespace[11];
+    flags |= jsonGetWhitespace(space, whitespace);
     jsfGetJSONWhitespace(v, result, flags, whitespace);
   }
   return result;
 }
 
+/*JSON{
+  "type" : "staticmethod",
+  "ifndef" : "SAVE_ON_FLASH",
+  "class" : "E",
+  "name" : "writeJSON",
+  "generate" : "jswrap_e_writeJSON",
+  "params" : [
+    ["destination","JsVar","An object with a `write` method, like `Serial1`, a Socket, an HTTP response or a `StorageFile`"],
+    ["data","JsVar","The data to be converted to JSON"],
+    ["space","JsVar","[optional] The number of spaces to use for padding, a string, or null/undefined for no whitespace"]
+  ],
+  "return" : ["int","The number of characters written"],
+  "typescript" : "writeJSON(destination: { write: (data: string) => any }, data: any, space?: number | string): number;"
+}
+Write `data` as JSON to `destination`. This is the same as
+`destination.write(JSON.stringify(data, undefined, space))` except the JSON
+is never all in RAM at once - it is written in small chunks as it is
+generated, so big objects can be written even if there isn't enough memory
+for the whole JSON string.
+
+```
+E.writeJSON(Serial1, {a:1,b:[1,2,3]});
+E.writeJSON(require("Storage").open("log.json","w"), log);
+require("http").createServer(function (req, res) {
+  res.writeHead(200, {'Content-Type': 'application/json'});
+  E.writeJSON(res, state);
+  res.end();
+}).listen(80);
+```
+
+If `destination` is a Serial device, characters are sent straight to it
+without creating any Strings.
+
+**Note:** Sockets and HTTP responses still buffer everything written until
+it has been sent, but this avoids having a second copy of the data.
+ */
+#ifndef SAVE_ON_FLASH
+typedef struct {
+  JsVar *destination;
+  JsVar *writeFunc;
+  bool isSerial; ///< If set, we send characters with serialSend rather than calling writeFunc
+  serial_sender serialSend;
+  serial_sender_data serialSendData;
+  JsVar *chunk; ///< The last chunk we passed to writeFunc
+} JsonWriteInfo;
+
+static bool jswrap_e_writeJSON_cb(const char *data, size_t len, void *user_data) {
+  JsonWriteInfo *info = (JsonWriteInfo*)user_data;
+  if (info->isSerial) {
+    for (size_t i=0;i<len;i++)
+      info->serialSend((unsigned char)data[i], &info->serialSendData);
+    return true;
+  }
+  /* If write() didn't keep the last chunk we can just overwrite it, rather than allocating
+  a new one each time (which means a GC per chunk if memory is nearly full) */
+  JsVar *chunk = info->chunk;
+  if (chunk && (jsvGetRefs(chunk) || jsvGetLocks(chunk)>1 || jsvGetStringLength(chunk)!=len)) {
+    jsvUnLock(chunk);
+    chunk = 0;
+  }
+  if (chunk) {
+    JsvStringIterator it;
+    jsvStringIteratorNew(&it, chunk, 0);
+    for (size_t i=0;i<len;i++)
+      jsvStringIteratorSetCharAndNext(&it, data[i]);
+    jsvStringIteratorFree(&it);
+  } else {
+    chunk = jsvNewStringOfLength((unsigned int)len, data);
+    if (!chunk) return false; // out of memory
+  }
+  info->chunk = chunk;
+  jsvUnLock(jspExecuteFunction(info->writeFunc, info->destination, 1, &chunk));
+  return !jspHasError();
+}
+
+int jswrap_e_writeJSON(JsVar *destination, JsVar *data, JsVar *space) {
+  JsonWriteInfo info;
+  info.destination = destination;
+  info.chunk = 0;
+  info.writeFunc = jspGetNamedField(destination, "write", false);
+  if (!jsvIsFunction(info.writeFunc)) {
+    jsvUnLock(info.writeFunc);
+    jsExceptionHere(JSET_TYPEERROR, "Destination must have a write method");
+    return 0;
+  }
+  // Built-in Serial.write on a Serial device? Send straight to it
+  info.isSerial = jsvIsNativeFunction(info.writeFunc) &&
+                  jsvGetNativeFunctionPtr(info.writeFunc)==(void*)jswrap_serial_write &&
+                  jsserialGetSendFunction(destination, &info.serialSend, &info.serialSendData);
+  JSONFlags flags = JSON_IGNORE_FUNCTIONS|JSON_NO_UNDEFINED|JSON_ARRAYBUFFER_AS_ARRAY|JSON_JSON_COMPATIBILE|JSON_ALLOW_TOJSON;
+  char whitespace[11];
+  flags |= jsonGetWhitespace(space, whitespace);
+  size_t len = jsfGetJSONStreamed(data, flags, whitespace, jswrap_e_writeJSON_cb, &info);
+  jsvUnLock2(info.writeFunc, info.chunk);
+  return (int)len;
+}
+#endif
+
+#ifndef SAVE_ON_FLASH
+/* JSON parser. This doesn't use the JS lexer: it works directly on the
+   string's data a contiguous segment at a time (the whole string if it's
+   flat/native/memory-mapped, otherwise one block or flash buffer), parses
+   numbers as it goes and only falls back to the lexer for the rare strings
+   that contain UTF8. Unquoted field names aren't normally allowed, but if
+   flags&JSON_DROP_QUOTES we'll allow them. */
+typedef struct {
+  JsVar *source;       ///< The string we're parsing
+  const char *seg;     ///< The contiguous segment of the string we're in
+  size_t segStart;     ///< Index in the string of the start of seg
+  size_t segEnd;       ///< Index in the string of the end of seg
+  bool isIterator;     ///< If true, the string isn't contiguous and 'it' is used to get the next segment
+  JsvStringIterator it;
+  size_t pos;          ///< Index of 'ch' in the string
+  int ch;              ///< Current character, or -1 at the end of the string
+  JSONFlags flags;
+  bool hasLex;         ///< Have we initialised 'lex'?
+  JsLex lex;           ///< Used for parsing strings that contain UTF8
+} JsonParser;
+
+#define JSON_STRING_BUFFER 64 ///< Characters we decode before adding them to a string
+
+#define JSON_SEG_CHAR(p, idx) ((unsigned char)READ_FLASH_UINT8(&(p)->seg[(idx) - (p)->segStart]))
+
+/// Load the segment containing 'pos'
+static void jsonLoadSegment(JsonParser *p) {
+  if (p->isIterator) {
+    jsvStringIteratorGoto(&p->it, p->source, p->pos); // fast, as we're going forwards
+    if (jsvStringIteratorHasChar(&p->it)) {
+      p->seg = p->it.ptr;
+      p->segStart = p->it.varIndex;
+      p->segEnd = p->it.varIndex + p->it.charsInVar;
+      p->ch = JSON_SEG_CHAR(p, p->pos);
+      return;
+    }
+  }
+  p->ch = -1;
+}
+
+static ALWAYS_INLINE void jsonNextCh(JsonParser *p) {
+  p->pos++;
+  if (p->pos < p->segEnd)
+    p->ch = JSON_SEG_CHAR(p, p->pos);
+  else
+    jsonLoadSegment(p);
+}
+
+/// Move to the given (later) position in the string
+static void jsonSeek(JsonParser *p, size_t pos) {
+  p->pos = pos;
+  if (pos >= p->segStart && pos < p->segEnd)
+    p->ch = JSON_SEG_CHAR(p, pos);
+  else
+    jsonLoadSegment(p);
+}
+
+/// Look at the character after the current one (or -1)
+static int jsonPeekCh(JsonParser *p) {
+  if (p->pos+1 < p->segEnd)
+    return JSON_SEG_CHAR(p, p->pos+1);
+  if (!p->isIterator) return -1;
+  JsvStringIterator it;
+  jsvStringIteratorClone(&it, &p->it);
+  jsvStringIteratorGoto(&it, p->source, p->pos+1);
+  int ch = jsvStringIteratorHasChar(&it) ? (unsigned char)jsvStringIteratorGetChar(&it) : -1;
+  jsvStringIteratorFree(&it);
+  return ch;
+}
+
+/// Skip whitespace and comments (as the JS lexer allowed them)
+static void jsonSkipWhitespace(JsonParser *p) {
+  while (true) {
+    while (p->ch>=0 && isWhitespaceInline((char)p->ch))
+      jsonNextCh(p);
+    if (p->ch!='/') return;
+    int next = jsonPeekCh(p);
+    if (next=='/') {
+      while (p->ch>=0 && p->ch!='\n') jsonNextCh(p);
+    } else if (next=='*') {
+      jsonNextCh(p);
+      jsonNextCh(p);
+      while (p->ch>=0 && !(p->ch=='*' && jsonPeekCh(p)=='/'))
+        jsonNextCh(p);
+      if (p->ch<0) return;
+      jsonNextCh(p);
+      jsonNextCh(p);
+    } else return;
+  }
+}
+
+/// Return the lexer token that the current character would start (for error messages)
+static void jsonTokenAsString(JsonParser *p, char *str, size_t len) {
+  int tk = p->ch;
+  if (tk<0) tk = LEX_EOF;
+  else if (tk=='"' || tk=='\'') tk = LEX_STR;
+  else if (isNumericInline((char)tk)) tk = LEX_INT;
+  else if (isAlphaInline((char)tk) || tk=='$') tk = LEX_ID;
+  jslTokenAsString(tk, str, len);
+}
+
+/// Read an identifier (true/false/null or an unquoted field name) into buf
+static size_t jsonGetIdentifier(JsonParser *p, char *buf, size_t len) {
+  size_t n = 0;
+  while (p->ch>=0 && (isAlphaInline((char)p->ch) || isNumericInline((char)p->ch) || p->ch=='$')) {
+    if (n < len-1) buf[n++] = (char)p->ch;
+    jsonNextCh(p);
+  }
+  buf[n] = 0;
+  return n;
+}
+
+static JsVar *jsonParseString(JsonParser *p);
+
+/// Report that we got something other than 'expected'. Like jslMatchError, this consumes identifiers/strings to report them
+static void jsonMatchError(JsonParser *p, int expected) {
+  char gotStr[30];
+  char expStr[30];
+  char value[JS_ERROR_TOKEN_BUF_SIZE];
+  if (p->ch>=0 && (isAlphaInline((char)p->ch) || p->ch=='$')) {
+    jsonGetIdentifier(p, value, sizeof(value));
+    espruino_snprintf(gotStr, sizeof(gotStr), "ID:%s", value);
+  } else if (p->ch=='"' || p->ch=='\'') {
+    JsVar *str = jsonParseString(p);
+    if (jspHasError()) { // eg. unfinished string
+      jsvUnLock(str);
+      return;
+    }
+    jsvGetString(str, value, sizeof(value));
+    jsvUnLock(str);
+    espruino_snprintf(gotStr, sizeof(gotStr), "String:'%s'", value);
+  } else
+    jsonTokenAsString(p, gotStr, sizeof(gotStr));
+  jslTokenAsString(expected, expStr, sizeof(expStr));
+  jsExceptionHere(JSET_SYNTAXERROR, "Got %s expected %s", gotStr, expStr);
+}
+
+/// Match the given character (and any whitespace after it)
+static bool jsonMatch(JsonParser *p, char ch) {
+  if (p->ch != ch) {
+    jsonMatchError(p, ch);
+    return false;
+  }
+  jsonNextCh(p);
+  jsonSkipWhitespace(p);
+  return true;
+}
 
+/// Parse a number. We've already skipped any '-', and apply it here
+static JsVar *jsonParseNumber(JsonParser *p, bool negate) {
+  char buf[JSLEX_MAX_TOKEN_LENGTH];
+  size_t n = 0;
+  long long v = 0;
+  bool isFloat = false;
+  bool isSimple = true; // decimal integer with no leading 0, that we've parsed into 'v'
+  bool canBeFloating = true;
+  if (p->ch=='0') {
+    buf[n++] = '0';
+    jsonNextCh(p);
+    if (p->ch=='x' || p->ch=='X' || p->ch=='b' || p->ch=='B' || p->ch=='o' || p->ch=='O') {
+      buf[n++] = (char)p->ch;
+      jsonNextCh(p);
+      canBeFloating = false;
+    }
+    isSimple = false; // leave octal/hex/binary to stringToInt
+  }
+  int digits = 0;
+  while (p->ch>=0 && (isNumericInline((char)p->ch) || (!canBeFloating && isHexadecimal((char)p->ch)) || p->ch=='_')) {
+    if (p->ch!='_') {
+      if (n < sizeof(buf)-1) buf[n++] = (char)p->ch;
+      v = v*10 + (p->ch-'0');
+      digits++;
+    }
+    jsonNextCh(p);
+  }
+  if (digits>18) isSimple = false; // could have overflowed
+  if (canBeFloating && p->ch=='.') {
+    isFloat = true;
+    if (n < sizeof(buf)-1) buf[n++] = '.';
+    jsonNextCh(p);
+    while (p->ch>=0 && (isNumericInline((char)p->ch) || p->ch=='_')) {
+      if (p->ch!='_' && n < sizeof(buf)-1) buf[n++] = (char)p->ch;
+      jsonNextCh(p);
+    }
+  }
+  if (canBeFloating && (p->ch=='e' || p->ch=='E')) {
+    isFloat = true;
+    if (n < sizeof(buf)-1) buf[n++] = (char)p->ch;
+    jsonNextCh(p);
+    if (p->ch=='-' || p->ch=='+') {
+      if (n < sizeof(buf)-1) buf[n++] = (char)p->ch;
+      jsonNextCh(p);
+    }
+    while (p->ch>=0 && (isNumericInline((char)p->ch) || p->ch=='_')) {
+      if (p->ch!='_' && n < sizeof(buf)-1) buf[n++] = (char)p->ch;
+      jsonNextCh(p);
+    }
+  }
+  buf[n] = 0;
+  jsonSkipWhitespace(p);
+  if (isFloat || (canBeFloating && digits>18)) { // float, or too big for a long long
+    JsVarFloat f = stringToFloat(buf);
+    return jsvNewFromFloat(negate ? -f : f);
+  }
+  if (!isSimple) v = stringToInt(buf);
+  return jsvNewFromLongInteger(negate ? -v : v);
+}
+
+#ifdef ESPR_UNICODE_SUPPORT
+/// Parse a string that contains UTF8 using the JS lexer, starting from the quote at 'start'
+static JsVar *jsonParseStringWithLexer(JsonParser *p, size_t start) {
+  JsLex *oldLex = jslSetLex(&p->lex);
+  if (!p->hasLex) {
+    jslInit(p->source);
+    p->hasLex = true;
+  }
+  jslSeekTo(start); // fast, as we're going forwards
+  JsVar *a = 0;
+  if (lex->tk == LEX_STR) {
+    a = jslGetTokenValueAsVar();
+    if (lex->isUTF8)  // If the parsed string was UTF8, we should wrap it up
+      a = jsvNewUTF8StringAndUnLock(a);
+  } else {
+    char buf[32];
+    jslTokenAsString(lex->tk, buf, sizeof(buf));
+    jsExceptionHere(JSET_SYNTAXERROR, "Expecting valid value, got %s", buf);
+  }
+  size_t end = jsvStringIteratorGetIndex(&lex->it) - 1; // the lexer is at the character after the string
+  jslSetLex(oldLex);
+  jsonSeek(p, end);
+  jsonSkipWhitespace(p);
+  return a;
+}
+#endif
+
+/// Add the characters in buf to the string we're decoding (creating it if needed)
+static bool jsonStringAppend(JsVar **str, JsvStringIterator *out, const char *buf, size_t len) {
+  if (!*str) {
+    *str = jsvNewFromEmptyString();
+    if (!*str) return false; // out of memory
+    jsvStringIteratorNew(out, *str, 0);
+  }
+  for (size_t i=0;i<len;i++)
+    jsvStringIteratorAppend(out, buf[i]);
+  return true;
+}
+
+static void jsonStringFree(JsVar *str, JsvStringIterator *out) {
+  if (!str) return;
+  jsvStringIteratorFree(out);
+  jsvUnLock(str);
+}
+
+/// Is this a character in a string that we can copy without decoding?
+static ALWAYS_INLINE bool jsonIsPlainChar(int ch, int delim) {
+  return ch!=delim && ch!='\\' && ch!='\n'
+#ifdef ESPR_UNICODE_SUPPORT
+      && ch<0x80
+#endif
+      ;
+}
+
+/// Parse a string (we're on the opening quote)
+static JsVar *jsonParseString(JsonParser *p) {
+#ifdef ESPR_UNICODE_SUPPORT
+  size_t start = p->pos;
+#endif
+  int delim = p->ch;
+  jsonNextCh(p);
+  // If there's nothing to decode and it's all in this segment, we can create the string in one go
+  size_t end = p->pos;
+  while (end < p->segEnd && jsonIsPlainChar(JSON_SEG_CHAR(p, end), delim))
+    end++;
+  if (end < p->segEnd && JSON_SEG_CHAR(p, end)==delim) {
+    JsVar *str = jsvNewStringOfLength((unsigned int)(end - p->pos), &p->seg[p->pos - p->segStart]);
+    jsonSeek(p, end+1);
+    jsonSkipWhitespace(p);
+    return str;
+  }
+  JsVar *str = 0;
+  JsvStringIterator out; // valid once str is set
+  char buf[JSON_STRING_BUFFER];
+  size_t n = 0;
+  while (true) {
+    // copy characters that don't need decoding straight out of the segment
+    while (p->ch>=0 && jsonIsPlainChar(p->ch, delim)) {
+      size_t i = p->pos;
+      end = p->segEnd;
+      if (end-i > sizeof(buf)-n) end = i + sizeof(buf)-n;
+      while (i<end && jsonIsPlainChar(JSON_SEG_CHAR(p, i), delim))
+        buf[n++] = (char)JSON_SEG_CHAR(p, i++);
+      jsonSeek(p, i);
+      if (n==sizeof(buf)) {
+        if (!jsonStringAppend(&str, &out, buf, n)) return 0;
+        n = 0;
+      }
+    }
+    if (p->ch == delim) break;
+    char ch = (char)p->ch;
+    if (p->ch<0 || ch=='\n') {
+      jsExceptionHere(JSET_SYNTAXERROR, "Expecting valid value, got UNFINISHED STRING");
+      jsonStringFree(str, &out);
+      return 0;
+    }
+#ifdef ESPR_UNICODE_SUPPORT
+    if (p->ch>=0x80) { // UTF8 - let the lexer handle it
+      jsonStringFree(str, &out);
+      return jsonParseStringWithLexer(p, start);
+    }
+#endif
+    jsonNextCh(p);
+    if (ch=='\\') {
+      ch = (char)p->ch;
+      switch (p->ch) {
+      case 'n' : ch = 0x0A; jsonNextCh(p); break;
+      case 'b' : ch = 0x08; jsonNextCh(p); break;
+      case 'f' : ch = 0x0C; jsonNextCh(p); break;
+      case 'r' : ch = 0x0D; jsonNextCh(p); break;
+      case 't' : ch = 0x09; jsonNextCh(p); break;
+      case 'v' : ch = 0x0B; jsonNextCh(p); break;
+      case 'u' :
+      case 'x' : { // hex digits
+        bool isUTF8 = p->ch=='u';
+        jsonNextCh(p);
+        int codepoint = 0;
+        for (int i=isUTF8?4:2;i>0;i--) {
+          int digit = (p->ch>=0) ? chtod((char)p->ch) : -1;
+          if (digit<0 || digit>15) {
+            jsExceptionHere(JSET_ERROR, "Invalid escape sequence");
+            jsonStringFree(str, &out);
+            return 0;
+          }
+          codepoint = (codepoint<<4) | digit;
+          jsonNextCh(p);
+        }
+#ifdef ESPR_UNICODE_SUPPORT
+        if (isUTF8 && codepoint>=0x80) { // needs UTF8 encoding - let the lexer handle it
+          jsonStringFree(str, &out);
+          return jsonParseStringWithLexer(p, start);
+        }
+#endif
+        ch = (char)codepoint;
+      } break;
+      default:
+        if (p->ch>='0' && p->ch<='7') { // octal digits
+          int codepoint = 0;
+          for (int i=0;i<3 && p->ch>='0' && p->ch<='7';i++) {
+            codepoint = (codepoint<<3) | (p->ch-'0');
+            jsonNextCh(p);
+          }
+          ch = (char)codepoint;
+        } else if (p->ch>=0) {
+          // for anything else, just push the character through
+          jsonNextCh(p);
+        }
+        break;
+      }
+    }
+    buf[n++] = ch;
+    if (n==sizeof(buf)) {
+      if (!jsonStringAppend(&str, &out, buf, n)) return 0;
+      n = 0;
+    }
+  }
+  jsonNextCh(p); // closing quote
+  jsonSkipWhitespace(p);
+  if (!str) // short, so we can allocate it at exactly the right size
+    return jsvNewStringOfLength((unsigned int)n, buf);
+  jsonStringAppend(&str, &out, buf, n);
+  jsvStringIteratorFree(&out);
+  return str;
+}
+
+/// Parse an object's field name (quoted, or unquoted if JSON_DROP_QUOTES)
+static JsVar *jsonParseKey(JsonParser *p) {
+  if (p->ch=='"' || p->ch=='\'')
+    return jsonParseString(p);
+  if ((p->flags&JSON_DROP_QUOTES) && p->ch>=0 && // Storage.writeJSON also drops quotes on numeric keys
+      (isAlphaInline((char)p->ch) || isNumericInline((char)p->ch) || p->ch=='$')) {
+    char buf[JSLEX_MAX_TOKEN_LENGTH];
+    size_t l = jsonGetIdentifier(p, buf, sizeof(buf));
+    jsonSkipWhitespace(p);
+    return jsvNewStringOfLength((unsigned int)l, buf);
+  }
+  jsonMatchError(p, LEX_STR);
+  return 0;
+}
+
+static JsVar *jsonParseValue(JsonParser *p) {
+  switch (p->ch) {
+  case '"':
+  case '\'':
+    return jsonParseString(p);
+  case '-': {
+    jsonNextCh(p);
+    jsonSkipWhitespace(p);
+    if (!(p->ch>=0 && (isNumericInline((char)p->ch) || p->ch=='.'))) {
+      jsonMatchError(p, LEX_INT);
+      return 0;
+    }
+    return jsonParseNumber(p, true);
+  }
+  case '[': {
+    if (!jspCheckStackPosition()) return 0;
+    JsVar *arr = jsvNewEmptyArray(); if (!arr) return 0;
+    jsonMatch(p, '[');
+    while (p->ch != ']' && !jspHasError()) {
+      JsVar *value = jsonParseValue(p);
+      if (!value ||
+          (p->ch!=']' && !jsonMatch(p, ','))) {
+        jsvUnLock2(value, arr);
+        return 0;
+      }
+      jsvArrayPush(arr, value);
+      jsvUnLock(value);
+    }
+    if (!jsonMatch(p, ']')) {
+      jsvUnLock(arr);
+      return 0;
+    }
+    return arr;
+  }
+  case '{': {
+    if (!jspCheckStackPosition()) return 0;
+    JsVar *obj = jsvNewObject(); if (!obj) return 0;
+    jsonMatch(p, '{');
+    while (p->ch != '}' && !jspHasError()) {
+      JsVar *key = jsonParseKey(p);
+      if (!key) {
+        jsvUnLock(obj);
+        return 0;
+      }
+      key = jsvAsArrayIndexAndUnLock(key);
+      JsVar *value = 0;
+      if (!jsonMatch(p, ':') ||
+          !(value=jsonParseValue(p)) ||
+          (p->ch!='}' && !jsonMatch(p, ','))) {
+        jsvUnLock3(key, value, obj);
+        return 0;
+      }
+      // we don't check for duplicate keys, so can just add to the end
+      jsvAddName(obj, jsvMakeIntoVariableName(key, value));
+      jsvUnLock2(value, key);
+    }
+    if (!jsonMatch(p, '}')) {
+      jsvUnLock(obj);
+      return 0;
+    }
+    return obj;
+  }
+  default:
+    if (p->ch>=0 && (isNumericInline((char)p->ch) ||
+        (p->ch=='.' && isNumeric((char)jsonPeekCh(p)))))
+      return jsonParseNumber(p, false);
+    if (p->ch>=0 && isAlphaInline((char)p->ch)) {
+      char buf[8];
+      jsonGetIdentifier(p, buf, sizeof(buf));
+      jsonSkipWhitespace(p);
+      if (!strcmp(buf,"true")) return jsvNewFromBool(true);
+      if (!strcmp(buf,"false")) return jsvNewFromBool(false);
+      if (!strcmp(buf,"null")) return jsvNewWithFlags(JSV_NULL);
+      jsExceptionHere(JSET_SYNTAXERROR, "Expecting valid value, got ID");
+      return 0;
+    }
+    char buf[32];
+    jsonTokenAsString(p, buf, sizeof(buf));
+    jsExceptionHere(JSET_SYNTAXERROR, "Expecting valid value, got %s", buf);
+    return 0; // undefined = error
+  }
+}
+
+/// Move past a string without decoding it (we're on the opening quote)
+static bool jsonSkipString(JsonParser *p) {
+  int delim = p->ch;
+  jsonNextCh(p);
+  while (true) {
+    size_t i = p->pos;
+    while (i < p->segEnd && jsonIsPlainChar(JSON_SEG_CHAR(p, i), delim))
+      i++;
+    if (i != p->pos) jsonSeek(p, i);
+    if (p->ch==delim) break;
+    if (p->ch<0 || p->ch=='\n') {
+      jsExceptionHere(JSET_SYNTAXERROR, "Expecting valid value, got UNFINISHED STRING");
+      return false;
+    }
+    if (p->ch=='\\') jsonNextCh(p); // skip whatever is escaped
+    jsonNextCh(p);
+  }
+  jsonNextCh(p); // closing quote
+  jsonSkipWhitespace(p);
+  return true;
+}
+
+/// Move past a value without creating any variables (except for numbers/true/false/null, which are small)
+static bool jsonSkipValue(JsonParser *p) {
+  if (p->ch=='"' || p->ch=='\'')
+    return jsonSkipString(p);
+  if (p->ch!='[' && p->ch!='{') {
+    JsVar *v = jsonParseValue(p);
+    jsvUnLock(v);
+    return v!=0;
+  }
+  // Arrays and objects - just match up the brackets
+  int depth = 0;
+  do {
+    if (p->ch=='"' || p->ch=='\'') {
+      if (!jsonSkipString(p)) return false;
+      continue;
+    }
+    if (p->ch<0) {
+      jsonMatchError(p, depth ? ']' : LEX_EOF);
+      return false;
+    }
+    if (p->ch=='[' || p->ch=='{') depth++;
+    else if (p->ch==']' || p->ch=='}') depth--;
+    jsonNextCh(p);
+    jsonSkipWhitespace(p);
+  } while (depth>0);
+  return true;
+}
+
+/* Move to the value at 'key' in the array or object we're on the start of. Returns
+false (with no exception) if there isn't one, or false with an exception on an error. */
+static bool jsonSeekChild(JsonParser *p, JsVar *key) {
+  if (p->ch=='[') {
+    JsVar *idx = jsvAsArrayIndex(key);
+    JsVarInt i = jsvIsInt(idx) ? jsvGetInteger(idx) : -1;
+    jsvUnLock(idx);
+    if (i<0) return false;
+    jsonMatch(p, '[');
+    while (p->ch!=']' && !jspHasError()) {
+      if (!i--) return true;
+      if (!jsonSkipValue(p) ||
+          (p->ch!=']' && !jsonMatch(p, ',')))
+        return false;
+    }
+  } else if (p->ch=='{') {
+    JsVar *keyStr = jsvAsString(key);
+    jsonMatch(p, '{');
+    while (p->ch!='}' && !jspHasError()) {
+      JsVar *k = jsonParseKey(p);
+      bool found = k && jsvIsBasicVarEqual(k, keyStr);
+      jsvUnLock(k);
+      if (!k || !jsonMatch(p, ':')) break;
+      if (found) {
+        jsvUnLock(keyStr);
+        return true;
+      }
+      if (!jsonSkipValue(p) ||
+          (p->ch!='}' && !jsonMatch(p, ',')))
+        break;
+    }
+    jsvUnLock(keyStr);
+  }
+  return false;
+}
+#else
 /* Parse JSON from the current lexer. unquoted fields aren't normally allowed,
    but if flags&JSON_DROP_QUOTES we'll allow them */
-JsVar *jswrap_json_parse_internal(JSONFlags flags) {
+static JsVar *jswrap_json_parse_internal(JSONFlags flags) {
   switch (lex->tk) {
   case LEX_R_TRUE:  jslGetNextToken(); return jsvNewFromBool(true);
   case LEX_R_FALSE: jslGetNextToken(); return jsvNewFromBool(false);
@@ -168,6 +830,7 @@ JsVar *jswrap_json_parse_internal(JSONFlags flags) {
   }
   }
 }
+#endif
 
 /*JSON{
   "type" : "staticmethod",
@@ -181,10 +844,55 @@ JsVar *jswrap_json_parse_internal(JSONFlags flags) {
 }
 Parse the given JSON string into a JavaScript object
 
-NOTE: This implementation uses eval() internally, and as such it is unsafe as it
-can allow arbitrary JS commands to be executed.
+**Note:** This is slightly more lenient than the JSON standard: single-quoted
+strings, JavaScript escape codes, comments, hex/octal/binary numbers and
+trailing commas are all allowed, and anything after the first value is ignored.
  */
+#ifndef SAVE_ON_FLASH
+static bool jsonParserInit(JsonParser *p, JsVar *v, JSONFlags flags) {
+  p->source = jsvAsString(v);
+  if (!p->source) return false;
+#ifdef ESPR_UNICODE_SUPPORT
+  if (jsvIsUTF8String(p->source)) { // we parse the bytes, and the lexer re-encodes any UTF8 strings
+    JsVar *backing = jsvGetUTF8BackingString(p->source);
+    jsvUnLock(p->source);
+    p->source = backing;
+  }
+#endif
+  p->flags = flags;
+  p->hasLex = false;
+  p->pos = 0;
+  size_t len;
+  p->seg = jsvGetDataPointer(p->source, &len);
+  p->segStart = 0;
+  p->segEnd = p->seg ? len : 0;
+  p->isIterator = !p->seg;
+  if (p->isIterator)
+    jsvStringIteratorNew(&p->it, p->source, 0);
+  jsonSeek(p, 0);
+  jsonSkipWhitespace(p);
+  return true;
+}
+
+static void jsonParserKill(JsonParser *p) {
+  if (p->isIterator) jsvStringIteratorFree(&p->it);
+  if (p->hasLex) {
+    JsLex *oldLex = jslSetLex(&p->lex);
+    jslKill();
+    jslSetLex(oldLex);
+  }
+  jsvUnLock(p->source);
+}
+#endif
+
 JsVar *jswrap_json_parse_ext(JsVar *v, JSONFlags flags) {
+#ifndef SAVE_ON_FLASH
+  JsonParser p;
+  if (!jsonParserInit(&p, v, flags)) return 0;
+  JsVar *res = jsonParseValue(&p);
+  jsonParserKill(&p);
+  return res;
+#else
   JsLex lex;
   JsVar *str = jsvAsString(v);
   JsLex *oldLex = jslSetLex(&lex);
@@ -194,7 +902,48 @@ JsVar *jswrap_json_parse_ext(JsVar *v, JSONFlags flags) {
   jslKill();
   jslSetLex(oldLex);
   return res;
+#endif
+}
+
+#ifndef SAVE_ON_FLASH
+/* Parse only the value at 'path' (an array of field names/indices) in the JSON, skipping
+over everything before it without creating variables for it. Returns undefined if
+there's nothing at 'path'. Anything after the value isn't checked. */
+JsVar *jswrap_json_parse_path(JsVar *v, JSONFlags flags, JsVar *path) {
+  JsonParser p;
+  if (!jsonParserInit(&p, v, flags)) return 0;
+  bool found = true;
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, path);
+  while (found && jsvObjectIteratorHasValue(&it)) {
+    JsVar *key = jsvObjectIteratorGetValue(&it);
+    found = jsonSeekChild(&p, key);
+    jsvUnLock(key);
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  JsVar *res = found ? jsonParseValue(&p) : 0;
+  jsonParserKill(&p);
+  return res;
+}
+#else
+JsVar *jswrap_json_parse_path(JsVar *v, JSONFlags flags, JsVar *path) {
+  // No skipping here - parse everything and then look up the path
+  JsVar *res = jswrap_json_parse_ext(v, flags);
+  JsvObjectIterator it;
+  jsvObjectIteratorNew(&it, path);
+  while (res && jsvObjectIteratorHasValue(&it)) {
+    JsVar *key = jsvObjectIteratorGetValue(&it);
+    JsVar *child = (jsvIsObject(res) || jsvIsArray(res)) ? jsvSkipNameAndUnLock(jspGetVarNamedField(res, key, false)) : 0;
+    jsvUnLock2(key, res);
+    res = child;
+    jsvObjectIteratorNext(&it);
+  }
+  jsvObjectIteratorFree(&it);
+  return res;
 }
+#endif
+
 JsVar *jswrap_json_parse(JsVar *v) {
   return jswrap_json_parse_ext(v, 0);
 }
@@ -525,6 +1274,47 @@ void jsfGetJSON(JsVar *var, JsVar *result, JSONFlags flags) {
   jsfGetJSONWhitespace(var, result, flags, 0);
 }
 
+typedef struct {
+  jsf_json_stream_callback callback; ///< Called with each full buffer (or 0 if we're just counting)
+  void *user_data;
+  size_t length;  ///< Total characters so far
+  size_t bufLen;  ///< Characters in buf
+  char buf[JSON_STREAM_CHUNK_SIZE];
+} JsonStream;
+
+static void jsonStreamFlush(JsonStream *s) {
+  if (s->bufLen && s->callback && !s->callback(s->buf, s->bufLen, s->user_data))
+    s->callback = 0; // error - don't call again
+  s->bufLen = 0;
+}
+
+static void jsonStreamCallback(const char *str, void *user_data) {
+  JsonStream *s = (JsonStream*)user_data;
+  size_t l = strlen(str);
+  s->length += l;
+  if (!s->callback) return;
+  while (l) {
+    size_t n = sizeof(s->buf) - s->bufLen;
+    if (n>l) n=l;
+    memcpy(&s->buf[s->bufLen], str, n);
+    s->bufLen += n;
+    str += n;
+    l -= n;
+    if (s->bufLen==sizeof(s->buf)) jsonStreamFlush(s);
+  }
+}
+
+size_t jsfGetJSONStreamed(JsVar *var, JSONFlags flags, const char *whitespace, jsf_json_stream_callback callback, void *user_data) {
+  JsonStream s;
+  s.callback = callback;
+  s.user_data = user_data;
+  s.length = 0;
+  s.bufLen = 0;
+  jsfGetJSONWithCallback(var, NULL, flags, whitespace, jsonStreamCallback, &s);
+  jsonStreamFlush(&s);
+  return s.length;
+}
+
 void jsfPrintJSON(JsVar *var, JSONFlags flags) {
   jsfGetJSONWithCallback(var, NULL, flags, 0, vcbprintf_callback_jsiConsolePrintString, 0);
 }
@@ -39,7 +39,9 @@ typedef enum {
 
 JsVar *jswrap_json_stringify(JsVar *v, JsVar *replacer, JsVar *space);
 JsVar *jswrap_json_parse_ext(JsVar *v, JSONFlags flags);
+JsVar *jswrap_json_parse_path(JsVar *v, JSONFlags flags, JsVar *path);
 JsVar *jswrap_json_parse(JsVar *v);
+int jswrap_e_writeJSON(JsVar *destination, JsVar *data, JsVar *space);
 
 /* This is like jsfGetJSONWithCallback, but handles ONLY functions (and does not print the initial 'function' text) */
 void jsfGetJSONForFunctionWithCallback(JsVar *var, JSONFlags flags, vcbprintf_callback user_callback, void *user_data);
@@ -56,6 +58,15 @@ void jsfGetJSONWhitespace(JsVar *var, JsVar *result, JSONFlags flags, const char
 /* Convenience function for using jsfGetJSONWithCallback - print to var */
 void jsfGetJSON(JsVar *var, JsVar *result, JSONFlags flags);
 
+#ifndef JSON_STREAM_CHUNK_SIZE
+#define JSON_STREAM_CHUNK_SIZE 256 ///< Size of the chunks jsfGetJSONStreamed outputs (a multiple of the flash write size)
+#endif
+/// Called by jsfGetJSONStreamed with each chunk of JSON. Return false to stop getting any more chunks
+typedef bool (*jsf_json_stream_callback)(const char *data, size_t len, void *user_data);
+/* Convenience function for using jsfGetJSONWithCallback - output JSON in chunks of up to JSON_STREAM_CHUNK_SIZE
+without ever having it all in RAM. If callback==0 the JSON is just counted. Returns the length in characters */
+size_t jsfGetJSONStreamed(JsVar *var, JSONFlags flags, const char *whitespace, jsf_json_stream_callback callback, void *user_data);
+
 /* Convenience function for using jsfGetJSONWithCallback - print to console */
 void jsfPrintJSON(JsVar *var, JSONFlags flags);
 /* Convenience function for using jsfGetJSONForFunctionWithCallback - print to console */
@@ -980,10 +980,8 @@ void jswrap_object_emit(JsVar *parent, JsVar *event, JsVar *argArray) {
   jsvObjectIteratorFree(&it);
 
 
-  JsVar *callback = jsvSkipNameAndUnLock(jsvFindChildFromVar(parent, eventName, 0));
+  jsiQueueObjectCallbacksVar(parent, eventName, args, (int)n);
   jsvUnLock(eventName);
-  if (callback) jsiQueueEvents(parent, callback, args, (int)n);
-  jsvUnLock(callback);
 
   // unlock
   jsvUnLockMany(n, args);
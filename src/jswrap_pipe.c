@@ -29,6 +29,9 @@
 #include "jswrap_pipe.h"
 #include "jswrap_object.h"
 #include "jswrap_stream.h"
+#include "jswrap_serial.h"
+#include "jswrap_storage.h"
+#include "jsserial.h"
 
 static JsVar* pipeGetArray(bool create) {
   return jsvObjectGetChild(execInfo.hiddenRoot, "pipes", create ? JSV_ARRAY : 0);
@@ -95,6 +98,30 @@ static void handlePipeClose(JsVar *arr, JsvObjectIterator *it, JsVar* pipe) {
   jsvRemoveChildAndUnLock(arr,idx);
 }
 
+/* Send the next chunk of a StorageFile straight from flash to a Serial device,
+ * without creating any Strings. Returns false if there was no more data */
+static bool handlePipeStorageFileToDevice(JsVar *source, JsVar *destination, int chunkSize) {
+  serial_sender serialSend;
+  serial_sender_data serialSendData;
+  if (!jsserialGetSendFunction(destination, &serialSend, &serialSendData))
+    return false;
+  int len;
+  bool ended;
+  uint32_t addr = jswrap_storagefile_readSpan(source, chunkSize, false, &len, &ended);
+  if (!addr || !len) return false;
+  unsigned char buf[32];
+  while (len) {
+    int l = len;
+    if (l>(int)sizeof(buf)) l=(int)sizeof(buf);
+    jshFlashRead(buf, addr, (uint32_t)l);
+    for (int i=0;i<l;i++)
+      serialSend(buf[i], &serialSendData);
+    addr += (uint32_t)l;
+    len -= l;
+  }
+  return true;
+}
+
 static bool handlePipe(JsVar *arr, JsvObjectIterator *it, JsVar* pipe) {
   bool paused = jsvObjectGetBoolChild(pipe,"drainWait");
   if (paused) return false;
@@ -104,7 +131,9 @@ static bool handlePipe(JsVar *arr, JsvObjectIterator *it, JsVar* pipe) {
   JsVar *destination = jsvObjectGetChildIfExists(pipe,"destination");
 
   bool dataTransferred = false;
-  if(source && destination && chunkSize) {
+  if (source && destination && chunkSize && jsvObjectGetBoolChild(pipe,"fromStorage")) {
+    dataTransferred = handlePipeStorageFileToDevice(source, destination, jsvGetInteger(chunkSize));
+  } else if(source && destination && chunkSize) {
     JsVar *readFunc = jspGetNamedField(source, "read", false);
     JsVar *writeFunc = jspGetNamedField(destination, "write", false);
     if (jsvIsFunction(readFunc) && jsvIsFunction(writeFunc)) { // do the objects have the necessary methods on them?
@@ -293,6 +322,11 @@ void jswrap_pipe(JsVar* source, JsVar* dest, JsVar* options) {
         jswrap_object_addEventListener(source, "close", jswrap_pipe_src_close_listener, JSWAT_THIS_ARG);
         jswrap_object_addEventListener(dest, "drain", jswrap_pipe_drain_listener, JSWAT_VOID | (JSWAT_JSVAR << (JSWAT_BITS*1)));
         jswrap_object_addEventListener(dest, "close", jswrap_pipe_dst_close_listener, JSWAT_THIS_ARG);
+        // If we're piping a StorageFile to a Serial device, we can send data straight from flash
+        if (jsvIsInstanceOf(source, "StorageFile") &&
+            DEVICE_IS_SERIAL(jsiGetDeviceFromClass(dest)) &&
+            jsvGetNativeFunctionPtr(writeFunc)==(void*)jswrap_serial_write)
+          jsvObjectSetChildAndUnLock(pipe, "fromStorage", jsvNewFromBool(true));
         // set up the rest of the pipe
         jsvObjectSetChildAndUnLock(pipe, "chunkSize", jsvNewFromInteger(chunkSize));
         jsvObjectSetChildAndUnLock(pipe, "end", jsvNewFromBool(callEnd));
@@ -186,6 +186,8 @@ memory usage.
 * `gc` : Memory freed during the GC pass
 * `gctime` : Time taken for GC pass (in milliseconds)
 * `blocksize` : Size of a block (variable) in bytes
+* `eventsDropped` : (if built with `ESPR_EVENT_QUEUE`) How many events (eg.
+  `Serial.on('data')`) were lost because there wasn't the memory to queue them
 * `stackEndAddress` : (on ARM) the address (that can be used with peek/poke/etc)
   of the END of the stack. The stack grows down, so unless you do a lot of
   recursion the bytes above this can be used.
@@ -234,6 +236,9 @@ JsVar *jswrap_process_memory(JsVar *gc) {
       jsvObjectSetChildAndUnLock(obj, "gctime", jsvNewFromFloat(jshGetMillisecondsFromTime(time2-time1)));
     }
     jsvObjectSetChildAndUnLock(obj, "blocksize", jsvNewFromInteger(sizeof(JsVar)));
+#ifdef ESPR_EVENT_QUEUE
+    jsvObjectSetChildAndUnLock(obj, "eventsDropped", jsvNewFromInteger((JsVarInt)jsiEventsDropped));
+#endif
 
 #ifdef ARM
     extern uint32_t LINKER_END_VAR; // end of ram used (variables) - should be 'void', but 'int' avoids warnings
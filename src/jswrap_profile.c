@@ -0,0 +1,341 @@
+/*
+ * This file is part of Espruino, a JavaScript interpreter for Microcontrollers
+ *
+ * Copyright (C) 2013 Gordon Williams <gw@pur3.co.uk>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * ----------------------------------------------------------------------------
+ * This file is designed to be parsed during the build process
+ *
+ * JavaScript sampling profiler
+ * ----------------------------------------------------------------------------
+ */
+#include "jswrap_profile.h"
+#include "jsparse.h"
+#include "jslex.h"
+#include "jsinteractive.h"
+#include "jstimer.h"
+#ifdef LINUX
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+#ifdef ESPR_PROFILE
+
+#define PROFILE_MAX_PROBES 8 ///< How many table entries we look at before giving up on a sample
+
+/** One place in the code that samples were taken at. Samples are counted
+ * straight into a fixed table from the timer IRQ (or SIGPROF on Linux), so
+ * nothing is allocated and no JsVars are touched while profiling. We only
+ * work out which function and line each entry is from when profiling stops. */
+typedef struct {
+  JsVar *source;             ///< lex->sourceVar - the String of code being executed (0 = unused entry)
+  uint32_t position;         ///< lex->tokenStart - where in 'source' we were
+  uint32_t count;            ///< How many samples were taken here
+#ifndef ESPR_NO_LINE_NUMBERS
+  uint16_t lineNumberOffset; ///< lex->lineNumberOffset - the line 'source' starts on
+#endif
+} JsProfileEntry;
+
+static JsProfileEntry profileEntries[ESPR_PROFILE];
+static volatile bool profileRunning;
+static uint32_t profileSamples; ///< Total samples taken
+static uint32_t profileIdle;    ///< Samples taken when no JS code was executing
+static uint32_t profileDropped; ///< Samples we had no space in profileEntries for
+static JsVarFloat profileInterval; ///< Milliseconds between samples
+
+/// Take a sample - called from an IRQ/signal handler
+static void jswrap_profile_sample() {
+  profileSamples++;
+  JsLex *l = lex;
+  if (!l || !l->sourceVar) {
+    profileIdle++;
+    return;
+  }
+  JsVar *source = l->sourceVar;
+  uint32_t position = (uint32_t)l->tokenStart;
+  unsigned int h = (unsigned int)((((size_t)source)>>2) * 31 + position) % ESPR_PROFILE;
+  for (int i=0;i<PROFILE_MAX_PROBES;i++) {
+    JsProfileEntry *e = &profileEntries[h];
+    if (!e->source) {
+      e->position = position;
+#ifndef ESPR_NO_LINE_NUMBERS
+      e->lineNumberOffset = l->lineNumberOffset;
+#endif
+      e->count = 1;
+      e->source = source;
+      return;
+    }
+    if (e->source==source && e->position==position) {
+      e->count++;
+      return;
+    }
+    if (++h >= ESPR_PROFILE) h = 0;
+  }
+  profileDropped++;
+}
+
+#ifdef LINUX
+static void jswrap_profile_sigprof(int sig) {
+  NOT_USED(sig);
+  jswrap_profile_sample();
+}
+#else
+static void jswrap_profile_timer(JsSysTime time, void *userdata) {
+  NOT_USED(time);
+  NOT_USED(userdata);
+  jswrap_profile_sample();
+}
+#endif
+
+static void jswrap_profile_stopSampling() {
+  if (!profileRunning) return;
+  profileRunning = false;
+#ifdef LINUX
+  struct itimerval t;
+  memset(&t, 0, sizeof(t));
+  setitimer(ITIMER_PROF, &t, NULL);
+  signal(SIGPROF, SIG_IGN);
+#else
+  jstStopExecuteFn(jswrap_profile_timer, NULL);
+#endif
+}
+
+/*JSON{
+  "type" : "kill",
+  "generate" : "jswrap_profile_kill",
+  "ifdef" : "ESPR_PROFILE"
+}*/
+void jswrap_profile_kill() {
+  jswrap_profile_stopSampling();
+}
+
+/*JSON{
+  "type" : "staticmethod",
+  "ifdef" : "ESPR_PROFILE",
+  "class" : "E",
+  "name" : "profileStart",
+  "generate" : "jswrap_e_profileStart",
+  "params" : [
+    ["interval","JsVar","[optional] The time in milliseconds between samples (default 1)"]
+  ]
+}
+Start the sampling profiler. Every `interval` milliseconds (of CPU time on
+Linux) the position of the JavaScript code that is executing is recorded,
+until `E.profileStop()` is called to get the results.
+
+Samples are counted in a fixed-size table (`ESPR_PROFILE` entries) from an
+interrupt, so profiling doesn't allocate any variables, and when the profiler
+isn't running it costs nothing at all.
+
+```
+E.profileStart();
+myApp();
+setTimeout(function() {
+  print(E.profileStop().functions[0]);
+  // {name:"drawGraph", line:23, samples:412, lines:{24:30, 27:382}}
+}, 1000);
+```
+ */
+void jswrap_e_profileStart(JsVar *interval) {
+  JsVarFloat ms = jsvIsUndefined(interval) ? 1 : jsvGetFloat(interval);
+  if (!(ms>0)) {
+    jsExceptionHere(JSET_ERROR, "Invalid interval");
+    return;
+  }
+  jswrap_profile_stopSampling();
+  memset(profileEntries, 0, sizeof(profileEntries));
+  profileSamples = 0;
+  profileIdle = 0;
+  profileDropped = 0;
+  profileInterval = ms;
+  profileRunning = true;
+#ifdef LINUX
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = jswrap_profile_sigprof;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+  struct itimerval t;
+  long us = (long)(ms*1000);
+  if (us<1) us = 1;
+  t.it_interval.tv_sec = us / 1000000;
+  t.it_interval.tv_usec = us % 1000000;
+  t.it_value = t.it_interval;
+  setitimer(ITIMER_PROF, &t, NULL);
+#else
+  JsSysTime period = jshGetTimeFromMilliseconds(ms);
+  uint32_t timerOffset = jstGetUtilTimerOffset();
+  if (!jstExecuteFn(jswrap_profile_timer, NULL, period, (uint32_t)period, &timerOffset)) {
+    profileRunning = false;
+    jsExceptionHere(JSET_ERROR, "Unable to start profiler");
+  }
+#endif
+}
+
+/// Get the object in 'functions' for the function whose code is 'source', creating it if needed
+static JsVar *jswrap_profile_getFunction(JsVar *functions, JsVarRef source) {
+  char key[16];
+  itostr((JsVarInt)source, key, 10);
+  JsVar *fn = jsvObjectGetChildIfExists(functions, key);
+  if (!fn) {
+    fn = jsvNewObject();
+    if (!fn) return 0;
+    jsvObjectSetChildAndUnLock(fn, "name", jsvNewFromString(source ? "(top level)" : "(unknown)"));
+    jsvObjectSetChildAndUnLock(fn, "samples", jsvNewFromInteger(0));
+    jsvObjectSetChildAndUnLock(fn, "lines", jsvNewObject());
+    jsvObjectSetChild(functions, key, fn);
+  }
+  return fn;
+}
+
+/// Name every function in 'functions' (keyed by the ref of its code) that we can find a function for
+static void jswrap_profile_nameFunctions(JsVar *functions) {
+  char key[16];
+  /* We lock every function we find, including garbage, so make sure an
+   * incremental GC isn't part way through freeing them */
+  jsvGarbageCollectFinish();
+  for (unsigned int i=0;i<jsvGetMemoryTotal();i++) {
+    JsVar *v = _jsvGetAddressOf((JsVarRef)(i+1));
+    if ((v->flags&JSV_VARTYPEMASK)==JSV_UNUSED) continue;
+    if (jsvIsFlatString(v)) {
+      i += (unsigned int)jsvGetFlatStringBlocks(v); // skip forward
+      continue;
+    }
+    if (!jsvIsFunction(v) || jsvIsNativeFunction(v)) continue;
+    v = jsvLockAgain(v);
+    JsVar *code = jsvObjectGetChildIfExists(v, JSPARSE_FUNCTION_CODE_NAME);
+    itostr((JsVarInt)jsvGetRef(code), key, 10);
+    jsvUnLock(code);
+    JsVar *fn = code ? jsvObjectGetChildIfExists(functions, key) : 0;
+    if (fn) {
+      JsVar *name = jsvGetPathTo(execInfo.root, v, 4, 0);
+      if (!name) name = jsvObjectGetChildIfExists(v, JSPARSE_FUNCTION_NAME_NAME);
+      if (!name) name = jsvNewFromString("(anonymous)");
+      jsvObjectSetChildAndUnLock(fn, "name", jsvAsString(name));
+      jsvUnLock2(name, fn);
+    }
+    jsvUnLock(v);
+  }
+}
+
+/*JSON{
+  "type" : "staticmethod",
+  "ifdef" : "ESPR_PROFILE",
+  "class" : "E",
+  "name" : "profileStop",
+  "generate" : "jswrap_e_profileStop",
+  "return" : ["JsVar","An object containing the profile results, or `undefined` if the profiler wasn't running"]
+}
+Stop the sampling profiler started with `E.profileStart()`, and return what it
+found:
+
+```
+{
+  interval : 1,   // milliseconds between samples
+  samples : 1000, // how many samples were taken
+  idle : 200,     // how many samples found no JS code executing
+  dropped : 0,    // how many samples there was no room to record
+  functions : [   // where samples were taken, most samples first
+    { name : "drawGraph", // the path to the function, or "(top level)" for code not in a function
+      line : 23,          // the line the function starts on (if known)
+      samples : 412,      // samples in this function (not including functions it called)
+      lines : { 24 : 30, 27 : 382 } }, // samples on each line
+    ...
+  ]
+}
+```
+
+Time spent in built-in functions is counted against the line they were called
+from. Lines are numbered from the start of the file if the code was uploaded
+with line numbers (as the Web IDE does), otherwise lines in a function are
+counted from the first line of its code. If `dropped` is nonzero there were more different places in the code than
+could be recorded (increase `ESPR_PROFILE`, or profile for less time).
+ */
+JsVar *jswrap_e_profileStop() {
+  if (!profileRunning) return 0;
+  jswrap_profile_stopSampling();
+  JsVar *result = jsvNewObject();
+  JsVar *functions = jsvNewObject();
+  if (!result || !functions) {
+    jsvUnLock2(result, functions);
+    return 0;
+  }
+  jsvObjectSetChildAndUnLock(result, "interval", jsvNewFromFloat(profileInterval));
+  jsvObjectSetChildAndUnLock(result, "samples", jsvNewFromInteger((JsVarInt)profileSamples));
+  jsvObjectSetChildAndUnLock(result, "idle", jsvNewFromInteger((JsVarInt)profileIdle));
+  jsvObjectSetChildAndUnLock(result, "dropped", jsvNewFromInteger((JsVarInt)profileDropped));
+  // Group the entries by the code they were in
+  for (int i=0;i<ESPR_PROFILE;i++) {
+    JsProfileEntry *e = &profileEntries[i];
+    if (!e->source) continue;
+    // the code may have been freed since the sample was taken
+    JsVarRef ref = jsvGetRef(e->source);
+    JsVar *source = 0;
+    if (ref && ref<=jsvGetMemoryTotal() && _jsvGetAddressOf(ref)==e->source &&
+        (e->source->flags&JSV_VARTYPEMASK)!=JSV_UNUSED && jsvIsString(e->source))
+      source = jsvLock(ref);
+    else
+      ref = 0;
+    JsVar *fn = jswrap_profile_getFunction(functions, ref);
+    if (!fn) {
+      jsvUnLock(source);
+      break;
+    }
+    jsvObjectSetChildAndUnLock(fn, "samples", jsvNewFromInteger(jsvObjectGetIntegerChild(fn, "samples") + (JsVarInt)e->count));
+    if (source) {
+      size_t line, col;
+      jsvGetLineAndCol(source, e->position, &line, &col);
+#ifndef ESPR_NO_LINE_NUMBERS
+      if (e->lineNumberOffset) {
+        line += e->lineNumberOffset - 1;
+        jsvObjectSetChildAndUnLock(fn, "line", jsvNewFromInteger(e->lineNumberOffset));
+      }
+#endif
+      // integer keys, so lines[n] finds them
+      JsVar *lines = jsvObjectGetChildIfExists(fn, "lines");
+      JsVar *lineIndex = jsvNewFromInteger((JsVarInt)line);
+      JsVar *lineName = jsvFindChildFromVar(lines, lineIndex, true);
+      if (lineName) {
+        JsVar *count = jsvNewFromInteger(jsvGetIntegerAndUnLock(jsvSkipName(lineName)) + (JsVarInt)e->count);
+        jsvSetValueOfName(lineName, count);
+        jsvUnLock(count);
+      }
+      jsvUnLock3(lineName, lineIndex, lines);
+      jsvUnLock(source);
+    }
+    jsvUnLock(fn);
+  }
+  jswrap_profile_nameFunctions(functions);
+  // Output the functions as an array, most samples first
+  JsVar *sorted = jsvNewEmptyArray();
+  while (sorted && jsvGetChildren(functions)) {
+    JsVar *best = 0;
+    JsVarInt bestSamples = -1;
+    JsvObjectIterator it;
+    jsvObjectIteratorNew(&it, functions);
+    while (jsvObjectIteratorHasValue(&it)) {
+      JsVar *fn = jsvObjectIteratorGetValue(&it);
+      JsVarInt samples = jsvObjectGetIntegerChild(fn, "samples");
+      if (samples > bestSamples) {
+        jsvUnLock(best);
+        best = jsvObjectIteratorGetKey(&it);
+        bestSamples = samples;
+      }
+      jsvUnLock(fn);
+      jsvObjectIteratorNext(&it);
+    }
+    jsvObjectIteratorFree(&it);
+    jsvArrayPushAndUnLock(sorted, jsvSkipName(best));
+    jsvRemoveChildAndUnLock(functions, best);
+  }
+  jsvUnLock(functions);
+  jsvObjectSetChildAndUnLock(result, "functions", sorted);
+  return result;
+}
+
+#endif // ESPR_PROFILE
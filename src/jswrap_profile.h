@@ -0,0 +1,23 @@
+/*
+ * This file is part of Espruino, a JavaScript interpreter for Microcontrollers
+ *
+ * Copyright (C) 2013 Gordon Williams <gw@pur3.co.uk>
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * ----------------------------------------------------------------------------
+ * JavaScript sampling profiler
+ * ----------------------------------------------------------------------------
+ */
+#ifndef JSWRAP_PROFILE_H_
+#define JSWRAP_PROFILE_H_
+
+#include "jsvar.h"
+
+void jswrap_profile_kill();
+void jswrap_e_profileStart(JsVar *interval);
+JsVar *jswrap_e_profileStop();
+
+#endif // JSWRAP_PROFILE_H_
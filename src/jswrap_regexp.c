@@ -19,252 +19,961 @@
 #include "jslex.h"
 #include "jsinteractive.h"
 
-/* TODO:
+/* Regular expressions are compiled once (when the RegExp is created) to a
+ * small bytecode program, which is stored on the RegExp as a hidden string.
+ * 'exec' runs it with a backtracking VM that keeps its own stack (so it
+ * doesn't recurse on the C stack) and has a step budget so that patterns like
+ * /(a*)*b/ fail with an error rather than locking up.
  *
- * Handling of 'global' flag especially
- * lastIndex support?
+ * Before running the VM at each position in the string, we check that the
+ * string contains any literal text every match has to contain, and skip
+ * straight to characters that a match could start with.
  */
 
-#define MAX_GROUPS 9
-#define NO_RANGE  256
+#define REGEXP_PROGRAM_NAME JS_HIDDEN_CHAR_STR"prg" // the compiled program
+
+#define MAX_GROUPS 9        ///< Maximum number of capture groups
+#define MAX_LOOPS 8         ///< Maximum number of loops over things that could match an empty string
+#define MAX_PROGRAM 1024    ///< Maximum size of compiled code
+#define MAX_LITERAL 16      ///< Maximum length of the literal text that every match must contain
+#define REPEAT_MAX 0xFFFE   ///< Maximum count in {n,m}
+#define REPEAT_INFINITE 0xFFFF
+#define STACK_SIZE 32       ///< Backtracking entries kept on the C stack before we move to JsVar memory
+#define STEPS_PER_CHAR 256  ///< Step budget for one match attempt, for each character left in the string
+#define NO_POSITION ((size_t)0xFFFFFFFF) ///< Also fits in RegexBacktrack
+
+typedef enum {
+  RX_MATCH,   ///< Match found
+  RX_CHAR,    ///< c : match character c (lowercase if ignoring case)
+  RX_ANY,     ///< match any character
+  RX_CLASS,   ///< flags, n, n*(lo,hi) : match a character set
+  RX_BOL,     ///< start of string
+  RX_EOL,     ///< end of string
+  RX_WORDB,   ///< word boundary
+  RX_NWORDB,  ///< not a word boundary
+  RX_SPLIT,   ///< a16, b16 : try a, and if that fails try b (relative to the next instruction)
+  RX_JMP,     ///< a16 : jump (relative to the next instruction)
+  RX_SAVE,    ///< n : save position in capture slot n
+  RX_BACKREF, ///< n : match the same text that group n did
+  RX_REPEAT,  ///< min16, max16, greedy, atom : match a single character atom min..max times
+  RX_MARK,    ///< n : remember position in loop register n
+  RX_CHECK,   ///< n : fail if we haven't moved since RX_MARK n (stops loops of empty matches)
+} RegexOp;
+
+// Flags for RX_CLASS
+#define RXC_INVERT 1
+#define RXC_DIGIT 2
+#define RXC_NOTDIGIT 4
+#define RXC_WORD 8
+#define RXC_NOTWORD 16
+#define RXC_SPACE 32
+#define RXC_NOTSPACE 64
+
+// Program header: flags, groups, first char, literal length, literal, [first character bitmap], code
+#define RXH_FLAGS 0
+#define RXH_GROUPS 1
+#define RXH_FIRSTCHAR 2
+#define RXH_LITERAL_LEN 3
+#define RXH_LITERAL 4
+#define RXH_FIRSTSET_LEN 32
+// Flags in the program header
+#define RXP_IGNORECASE 1
+#define RXP_ANCHORED 2  ///< Can only match at the start of the string
+#define RXP_FIRSTSET 4  ///< There's a bitmap of the characters a match can start with
+#define RXP_FIRSTCHAR 8 ///< A match can only start with RXH_FIRSTCHAR
+
+static int rxGet16(const unsigned char *p) {
+  return (int16_t)(p[0] | (p[1]<<8));
+}
+
+static unsigned int rxGetU16(const unsigned char *p) {
+  return (unsigned int)(p[0] | (p[1]<<8));
+}
+
+static void rxSet16(unsigned char *p, int v) {
+  p[0] = (unsigned char)(v&255);
+  p[1] = (unsigned char)((v>>8)&255);
+}
+
+static size_t rxOpSize(const unsigned char *op) {
+  switch (op[0]) {
+    case RX_CHAR:
+    case RX_SAVE:
+    case RX_BACKREF:
+    case RX_MARK:
+    case RX_CHECK: return 2;
+    case RX_CLASS: return 3 + 2*(size_t)op[2];
+    case RX_SPLIT: return 5;
+    case RX_JMP: return 3;
+    case RX_REPEAT: return 6 + rxOpSize(&op[6]);
+    default: return 1;
+  }
+}
+
+static bool rxIsWordChar(int ch) {
+  return ch>=0 && (isAlpha((char)ch) || isNumeric((char)ch));
+}
+
+/// Is ch in the RX_CLASS character set (ignoring RXC_INVERT)?
+static bool rxClassContains(const unsigned char *op, char ch) {
+  unsigned char flags = op[1];
+  if ((flags&RXC_DIGIT) && isNumeric(ch)) return true;
+  if ((flags&RXC_NOTDIGIT) && !isNumeric(ch)) return true;
+  if ((flags&RXC_WORD) && rxIsWordChar((unsigned char)ch)) return true;
+  if ((flags&RXC_NOTWORD) && !rxIsWordChar((unsigned char)ch)) return true;
+  if ((flags&RXC_SPACE) && isWhitespace(ch)) return true;
+  if ((flags&RXC_NOTSPACE) && !isWhitespace(ch)) return true;
+  const unsigned char *range = &op[3];
+  int i;
+  for (i=0;i<op[2];i++,range+=2)
+    if ((unsigned char)ch>=range[0] && (unsigned char)ch<=range[1]) return true;
+  return false;
+}
+
+/// Does the single character atom (RX_CHAR/ANY/CLASS) match ch? (ch<0 is the end of the string)
+static bool rxAtomMatch(const unsigned char *op, int ch, bool ignoreCase) {
+  if (ch<0) return false;
+  char c = (char)ch;
+  if (op[0]==RX_CHAR)
+    return (unsigned char)(ignoreCase ? charToLowerCase(c) : c) == op[1];
+  if (op[0]==RX_ANY) return true;
+  bool match = rxClassContains(op, c);
+  if (!match && ignoreCase)
+    match = rxClassContains(op, charToLowerCase(c)) || rxClassContains(op, charToUpperCase(c));
+  return match != ((op[1]&RXC_INVERT)!=0);
+}
+
+static bool rxInSet(const unsigned char *set, int ch) {
+  return (set[ch>>3] & (1<<(ch&7))) != 0;
+}
+
+/** Add the characters the code at 'pc' could start a match with to 'set' (if set!=0).
+ * Returns true if it could match an empty string (or it's too complicated to tell) */
+static bool rxFirstSet(const unsigned char *code, int pc, unsigned char *set, bool ignoreCase, int depth) {
+  while (depth<8) {
+    const unsigned char *op = &code[pc];
+    switch (op[0]) {
+      case RX_REPEAT:
+      case RX_CHAR:
+      case RX_ANY:
+      case RX_CLASS: {
+        const unsigned char *atom = op[0]==RX_REPEAT ? &op[6] : op;
+        int ch;
+        if (set)
+          for (ch=0;ch<256;ch++)
+            if (rxAtomMatch(atom, ch, ignoreCase)) set[ch>>3] |= (unsigned char)(1<<(ch&7));
+        if (op[0]!=RX_REPEAT || rxGetU16(&op[1])) return false;
+        break;
+      }
+      case RX_SPLIT:
+        if (rxFirstSet(code, pc+5+rxGet16(&op[1]), set, ignoreCase, depth+1)) return true;
+        pc += 5+rxGet16(&op[3]);
+        depth++;
+        continue;
+      case RX_JMP:
+        if (rxGet16(&op[1])<0) return true; // a loop - too complicated
+        pc += 3+rxGet16(&op[1]);
+        continue;
+      case RX_SAVE:
+      case RX_MARK:
+      case RX_CHECK:
+        break;
+      default: // RX_MATCH, assertions and backreferences
+        return true;
+    }
+    pc += (int)rxOpSize(op);
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
 
 typedef struct {
-  JsVar *sourceStr;
-  size_t startIndex;
+  const char *re;       ///< Current position in the regex source
+  unsigned char *code;  ///< Compiled code
+  size_t len;           ///< Length of compiled code
   bool ignoreCase;
-  bool rangeMatch;
-  short rangeFirstChar;
-  int groups;
-  size_t groupStart[MAX_GROUPS];
-  size_t groupEnd[MAX_GROUPS];
-} matchInfo;
+  bool failed;          ///< An error happened (and an exception has been raised)
+  bool alternation;     ///< Was there a '|' outside of any group?
+  int groups;           ///< Capture groups used
+  int loops;            ///< Loop registers used
+  char literal[MAX_LITERAL]; ///< The longest run of literal characters outside of groups
+  int literalLen;
+  char run[MAX_LITERAL];     ///< The run of literal characters we're in now
+  int runLen;
+} RegexCompiler;
 
-static JsVar *matchhere(char *regexp, JsvStringIterator *txtIt, matchInfo info);
+#define RXA_NONE 0  ///< Not something that can be repeated (eg. '^')
+#define RXA_CHAR 1  ///< A single character (RX_CHAR/ANY/CLASS)
+#define RXA_GROUP 2 ///< Anything else
 
-static JsVar *matchfound(JsvStringIterator *txtIt, matchInfo info) {
-  JsVar *rmatch = jsvNewEmptyArray();
-  size_t endIndex = jsvStringIteratorGetIndex(txtIt);
-  JsVar *matchStr = jsvNewFromStringVar(info.sourceStr, info.startIndex, endIndex-info.startIndex);
-  jsvSetArrayItem(rmatch, 0, matchStr);
-  jsvUnLock(matchStr);
-  int i;
-  for (i=0;i<info.groups;i++) {
-    matchStr = jsvNewFromStringVar(info.sourceStr, info.groupStart[i], info.groupEnd[i]-info.groupStart[i]);
-    jsvSetArrayItem(rmatch, i+1, matchStr);
-    jsvUnLock(matchStr);
+static void rxParseAlternation(RegexCompiler *c, int depth);
+
+static void rxError(RegexCompiler *c, const char *msg) {
+  if (!c->failed) jsExceptionHere(JSET_ERROR, "%s", msg);
+  c->failed = true;
+}
+
+/// Make space for n bytes of code at 'at'
+static bool rxMakeSpace(RegexCompiler *c, size_t at, size_t n) {
+  if (c->failed) return false;
+  if (c->len+n > MAX_PROGRAM) {
+    rxError(c, "RegEx too long");
+    return false;
   }
-  jsvObjectSetChildAndUnLock(rmatch, "index", jsvNewFromInteger((JsVarInt)info.startIndex));
-  jsvObjectSetChild(rmatch, "input", info.sourceStr);
+  memmove(&c->code[at+n], &c->code[at], c->len-at);
+  c->len += n;
+  return true;
+}
 
-  return rmatch;
+static void rxEmit(RegexCompiler *c, unsigned char b) {
+  if (rxMakeSpace(c, c->len, 1))
+    c->code[c->len-1] = b;
 }
 
-// No match found, so search to end of regex to see if there's an '|'
-static JsVar *nomatchfound(char *regexp, matchInfo info) {
-  if (!jspCheckStackPosition()) return 0;
-  // TODO: | inside a group?
-  while (*regexp && *regexp!='|') {
-    if (*regexp=='\\') {
-      regexp++; // end of regex after escape char!
-      if (!*regexp) return 0;
-    }
-    regexp++;
+static void rxEmit16(RegexCompiler *c, int v) {
+  rxEmit(c, (unsigned char)(v&255));
+  rxEmit(c, (unsigned char)((v>>8)&255));
+}
+
+static void rxEmitCode(RegexCompiler *c, const unsigned char *code, size_t len) {
+  if (rxMakeSpace(c, c->len, len))
+    memcpy(&c->code[c->len-len], code, len);
+}
+
+/// Set up an RX_SPLIT to either carry on or skip 'skip' bytes - greedy tries carrying on first
+static void rxSetSplit(unsigned char *op, size_t skip, bool greedy) {
+  rxSet16(&op[1], greedy ? 0 : (int)skip);
+  rxSet16(&op[3], greedy ? (int)skip : 0);
+}
+
+static void rxEndLiteral(RegexCompiler *c) {
+  if (c->runLen > c->literalLen) {
+    memcpy(c->literal, c->run, (size_t)c->runLen);
+    c->literalLen = c->runLen;
   }
-  if (*regexp != '|') return 0;
-  regexp++;
+  c->runLen = 0;
+}
 
-  JsvStringIterator txtIt;
-  jsvStringIteratorNew(&txtIt,  info.sourceStr, info.startIndex);
-  JsVar *rmatch = matchhere(regexp, &txtIt, info);
-  jsvStringIteratorFree(&txtIt);
-  return rmatch;
+/// Parse the character after a backslash
+static char rxParseEscape(RegexCompiler *c) {
+  char ch = *(c->re++);
+  switch (ch) {
+    case 'f': return 0x0C;
+    case 'n': return 0x0A;
+    case 'r': return 0x0D;
+    case 't': return 0x09;
+    case 'v': return 0x0B;
+    case '0': return 0;
+    case 'x':
+      if (isHexadecimal(c->re[0]) && isHexadecimal(c->re[1])) {
+        ch = (char)hexToByte(c->re[0], c->re[1]);
+        c->re += 2;
+      }
+      return ch;
+    case 0: // backslash at the end of the regex
+      c->re--;
+      return '\\';
+    default: // the quoted character (e.g. /,-,? etc.)
+      return ch;
+  }
 }
 
-/* match: search for regexp anywhere in text */
-static JsVar *match(char *regexp, JsVar *str, size_t startIndex, bool ignoreCase) {
-  matchInfo info;
-  info.sourceStr = str;
-  info.startIndex = startIndex;
-  info.ignoreCase = ignoreCase;
-  info.rangeMatch = false;
-  info.rangeFirstChar = NO_RANGE;
-  info.groups = 0;
-
-  JsVar *rmatch;
-  JsvStringIterator txtIt, txtIt2;
-  jsvStringIteratorNew(&txtIt, str, startIndex);
-  /* must look even if string is empty */
-  jsvStringIteratorClone(&txtIt2, &txtIt);
-  rmatch = matchhere(regexp, &txtIt2, info);
-  jsvStringIteratorFree(&txtIt2);
-  jsvStringIteratorNext(&txtIt);
-  while (!rmatch && jsvStringIteratorHasChar(&txtIt)) {
-    info.startIndex++;
-    jsvStringIteratorClone(&txtIt2, &txtIt);
-    rmatch = matchhere(regexp, &txtIt2, info);
-    jsvStringIteratorFree(&txtIt2);
-    jsvStringIteratorNext(&txtIt);
-  }
-  jsvStringIteratorFree(&txtIt);
-  return rmatch;
+/// Return the RXC_ flag for \d\D\s\S\w\W, or 0
+static unsigned char rxClassEscape(char ch) {
+  switch (ch) {
+    case 'd': return RXC_DIGIT;
+    case 'D': return RXC_NOTDIGIT;
+    case 'w': return RXC_WORD;
+    case 'W': return RXC_NOTWORD;
+    case 's': return RXC_SPACE;
+    case 'S': return RXC_NOTSPACE;
+    default: return 0;
+  }
+}
+
+/// Parse a character inside '[]'. If it's \d\s\w/etc, return 0 and set *classFlag
+static char rxParseClassChar(RegexCompiler *c, unsigned char *classFlag) {
+  *classFlag = 0;
+  char ch = *(c->re++);
+  if (ch!='\\') return ch; // note that '.' is just a '.' in a character set
+  *classFlag = rxClassEscape(*c->re);
+  if (*classFlag) {
+    c->re++;
+    return 0;
+  }
+  if (*c->re=='b') { // backspace
+    c->re++;
+    return 0x08;
+  }
+  return rxParseEscape(c);
+}
+
+static void rxAddRange(RegexCompiler *c, size_t op, char lo, char hi) {
+  if ((unsigned char)lo > (unsigned char)hi) return; // empty range
+  if (c->failed) return;
+  if (c->code[op+2]==255) {
+    rxError(c, "RegEx too long");
+    return;
+  }
+  rxEmit(c, (unsigned char)lo);
+  rxEmit(c, (unsigned char)hi);
+  if (!c->failed) c->code[op+2]++;
 }
 
-/* Match one character. Doesn't modify txtIt, returns length of regexp char in *length  */
-bool matchcharacter(char *regexp, JsvStringIterator *txtIt, int *length, matchInfo *info) {
-  *length = 1;
-  char ch = jsvStringIteratorGetChar(txtIt);
-  if (regexp[0]=='.') return true;
-  if (regexp[0]=='[') { // Character set (any char inside '[]')
-    info->rangeMatch = true;
-    bool inverted = regexp[1]=='^';
-    if (inverted) (*length)++;
-    bool matchAny = false;
-    while (regexp[*length] && regexp[*length]!=']') {
-      int matchLen;
-      if (regexp[*length]=='.') { // https://github.com/espruino/Espruino/issues/1948
-        matchAny |= ch=='.';
-        (*length)++;
-      } else {
-        matchAny |= matchcharacter(&regexp[*length], txtIt, &matchLen, info);
-        (*length) += matchLen;
+/// Parse a character set (any char inside '[]')
+static void rxParseClass(RegexCompiler *c) {
+  size_t op = c->len;
+  unsigned char flags = 0;
+  rxEmit(c, RX_CLASS);
+  rxEmit(c, 0);
+  rxEmit(c, 0);
+  if (*c->re=='^') {
+    c->re++;
+    flags |= RXC_INVERT;
+  }
+  while (*c->re && *c->re!=']' && !c->failed) {
+    unsigned char classFlag;
+    char lo = rxParseClassChar(c, &classFlag);
+    flags |= classFlag;
+    if (classFlag) continue;
+    char hi = lo;
+    if (c->re[0]=='-' && c->re[1] && c->re[1]!=']') { // Character set range
+      c->re++;
+      hi = rxParseClassChar(c, &classFlag);
+      if (classFlag) { // eg. [a-\d] - the '-' is just a character
+        flags |= classFlag;
+        rxAddRange(c, op, '-', '-');
+        hi = lo;
       }
     }
-    if (regexp[*length]==']') {
-      (*length)++;
-    } else {
-      jsExceptionHere(JSET_ERROR, "Unfinished character set in RegEx");
-      return false;
+    rxAddRange(c, op, lo, hi);
+  }
+  if (*c->re!=']') {
+    rxError(c, "Unfinished character set in RegEx");
+    return;
+  }
+  c->re++;
+  if (!c->failed) c->code[op+1] = flags;
+}
+
+/// Parse one thing that can be repeated (a character, set or group), and return RXA_*
+static int rxParseAtom(RegexCompiler *c, int depth) {
+  char ch = *(c->re++);
+  switch (ch) {
+    case '^':
+      rxEmit(c, RX_BOL);
+      return RXA_NONE;
+    case '$':
+      rxEmit(c, RX_EOL);
+      return RXA_NONE;
+    case '.':
+      rxEmit(c, RX_ANY);
+      return RXA_CHAR;
+    case '[':
+      rxParseClass(c);
+      return RXA_CHAR;
+    case '(': {
+      int group = 0;
+      if (c->re[0]=='?') {
+        if (c->re[1]!=':') {
+          rxError(c, "Lookahead/lookbehind not supported in RegEx");
+          return RXA_NONE;
+        }
+        c->re += 2; // non-capturing group
+      } else if (c->groups<MAX_GROUPS)
+        group = ++c->groups;
+      if (!jspCheckStackPosition()) {
+        c->failed = true;
+        return RXA_NONE;
+      }
+      if (group) {
+        rxEmit(c, RX_SAVE);
+        rxEmit(c, (unsigned char)(group*2));
+      }
+      rxParseAlternation(c, depth+1);
+      if (c->failed) return RXA_NONE;
+      if (*c->re!=')') {
+        rxError(c, "Unfinished group in RegEx");
+        return RXA_NONE;
+      }
+      c->re++;
+      if (group) {
+        rxEmit(c, RX_SAVE);
+        rxEmit(c, (unsigned char)(group*2+1));
+      }
+      return RXA_GROUP;
+    }
+    case '*':
+    case '+':
+    case '?':
+      rxError(c, "Nothing to repeat in RegEx");
+      return RXA_NONE;
+    case '\\': {
+      unsigned char classFlag = rxClassEscape(*c->re);
+      if (classFlag) {
+        c->re++;
+        rxEmit(c, RX_CLASS);
+        rxEmit(c, classFlag);
+        rxEmit(c, 0);
+        return RXA_CHAR;
+      }
+      if (*c->re=='b' || *c->re=='B') {
+        rxEmit(c, (*c->re=='b') ? RX_WORDB : RX_NWORDB);
+        c->re++;
+        return RXA_NONE;
+      }
+      if (*c->re>='1' && *c->re<='9') {
+        rxEmit(c, RX_BACKREF);
+        rxEmit(c, (unsigned char)(*c->re-'0'));
+        c->re++;
+        return RXA_GROUP;
+      }
+      ch = rxParseEscape(c);
+      break;
     }
-    info->rangeMatch = false;
-    return matchAny != inverted;
-  }
-  char cH = regexp[0];
-  if (cH=='\\') { // escape character
-    *length = 2;
-    // fallback to the quoted character (e.g. /,-,? etc.)
-    cH = regexp[1];
-    // missing quite a few here
-    // https://developer.mozilla.org/en-US/docs/Web/JavaScript/Guide/Regular_Expressions
-    if (cH=='d') return isNumeric(ch);
-    if (cH=='D') return !isNumeric(ch);
-    if (cH=='f') { cH=0x0C; goto haveCode; }
-    if (cH=='b') { cH=0x08; goto haveCode; }
-    if (cH=='n') { cH=0x0A; goto haveCode; }
-    if (cH=='r') { cH=0x0D; goto haveCode; }
-    if (cH=='s') return isWhitespace(ch);
-    if (cH=='S') return !isWhitespace(ch);
-    if (cH=='t') { cH=0x09; goto haveCode; }
-    if (cH=='v') { cH=0x0B; goto haveCode; }
-    if (cH=='w') return isNumeric(ch) || isAlpha(ch) || ch=='_';
-    if (cH=='W') return !(isNumeric(ch) || isAlpha(ch) || ch=='_');
-    if (cH=='0') { cH=0; goto haveCode; }
-    if (cH>='1' && cH<='9') {
-      jsExceptionHere(JSET_ERROR, "Backreferences not supported");
+    default:
+      break;
+  }
+  rxEmit(c, RX_CHAR);
+  rxEmit(c, (unsigned char)(c->ignoreCase ? charToLowerCase(ch) : ch));
+  return RXA_CHAR;
+}
+
+static int rxParseInt(const char **re) {
+  int v = 0;
+  while (isNumeric(**re)) {
+    v = v*10 + (**re-'0');
+    if (v>REPEAT_MAX) v = REPEAT_MAX;
+    (*re)++;
+  }
+  return v;
+}
+
+/// Parse *,+,?,{n},{n,} or {n,m} (and a '?' after for non-greedy). Returns false if there isn't one
+static bool rxParseQuantifier(RegexCompiler *c, int *min, int *max, bool *greedy) {
+  const char *re = c->re;
+  if (*re=='*' || *re=='+' || *re=='?') {
+    *min = (*re=='+') ? 1 : 0;
+    *max = (*re=='?') ? 1 : REPEAT_INFINITE;
+    re++;
+  } else if (*re=='{' && isNumeric(re[1])) {
+    re++;
+    *min = *max = rxParseInt(&re);
+    if (*re==',') {
+      re++;
+      *max = isNumeric(*re) ? rxParseInt(&re) : REPEAT_INFINITE;
+    }
+    if (*re!='}') return false; // not a quantifier, so '{' is just a character
+    re++;
+    if (*min>*max) {
+      rxError(c, "Numbers out of order in RegEx quantifier");
       return false;
-      // we could implement this if needed by matching against info->groupStart/End
     }
-    if (cH=='x' && regexp[2] && regexp[3]) {
-      *length = 4;
-      cH = (char)hexToByte(regexp[2],regexp[3]);
-      goto haveCode;
+  } else
+    return false;
+  *greedy = *re!='?';
+  if (!*greedy) re++;
+  c->re = re;
+  return true;
+}
+
+/// Repeat the code from atomStart to the end
+static void rxQuantify(RegexCompiler *c, size_t atomStart, int kind, int min, int max, bool greedy) {
+  if (kind==RXA_CHAR) { // single characters have their own instruction which doesn't need to backtrack for each character
+    if (!rxMakeSpace(c, atomStart, 6)) return;
+    unsigned char *op = &c->code[atomStart];
+    op[0] = RX_REPEAT;
+    rxSet16(&op[1], min);
+    rxSet16(&op[3], max);
+    op[5] = greedy;
+    return;
+  }
+  // Anything else gets copied: 'min' times, then either in a loop or (max-min) more times, each optional
+  size_t atomLen = c->len - atomStart;
+  unsigned char *atom = (unsigned char *)alloca(atomLen+1);
+  memcpy(atom, &c->code[atomStart], atomLen);
+  atom[atomLen] = RX_MATCH;
+  c->len = atomStart;
+  int i;
+  for (i=0;i<min && !c->failed;i++)
+    rxEmitCode(c, atom, atomLen);
+  if (max==REPEAT_INFINITE) {
+    // L1: SPLIT L2,L3; L2: [MARK] atom [CHECK]; JMP L1; L3:
+    int loop = -1;
+    if (rxFirstSet(atom, 0, 0, false, 0)) { // could match an empty string, so stop looping if it does
+      if (c->loops>=MAX_LOOPS) {
+        rxError(c, "RegEx too complex");
+        return;
+      }
+      loop = c->loops++;
+    }
+    size_t split = c->len;
+    rxEmit(c, RX_SPLIT);
+    rxEmit16(c, 0);
+    rxEmit16(c, 0);
+    if (loop>=0) {
+      rxEmit(c, RX_MARK);
+      rxEmit(c, (unsigned char)loop);
+    }
+    rxEmitCode(c, atom, atomLen);
+    if (loop>=0) {
+      rxEmit(c, RX_CHECK);
+      rxEmit(c, (unsigned char)loop);
+    }
+    rxEmit(c, RX_JMP);
+    rxEmit16(c, (int)split - (int)(c->len+2));
+    if (c->failed) return;
+    rxSetSplit(&c->code[split], c->len-(split+5), greedy);
+  } else {
+    // atom(atom(atom)?)? - every SPLIT skips straight to the end
+    size_t first = c->len;
+    for (i=min;i<max && !c->failed;i++) {
+      rxEmit(c, RX_SPLIT);
+      rxEmit16(c, 0);
+      rxEmit16(c, 0);
+      rxEmitCode(c, atom, atomLen);
+    }
+    if (c->failed) return;
+    for (i=min;i<max;i++) {
+      size_t split = first + (size_t)(i-min)*(5+atomLen);
+      rxSetSplit(&c->code[split], c->len-(split+5), greedy);
+    }
+  }
+}
+
+static void rxParseSequence(RegexCompiler *c, int depth) {
+  while (*c->re && *c->re!='|' && *c->re!=')' && !c->failed) {
+    size_t atomStart = c->len;
+    int kind = rxParseAtom(c, depth);
+    int min = 1, max = 1;
+    bool greedy = true;
+    bool quantified = kind!=RXA_NONE && rxParseQuantifier(c, &min, &max, &greedy);
+    if (c->failed) return;
+    if (depth==0) { // keep track of literal text that has to be in every match
+      bool isChar = c->code[atomStart]==RX_CHAR;
+      if (isChar && min>0 && c->runLen<MAX_LITERAL)
+        c->run[c->runLen++] = (char)c->code[atomStart+1];
+      if (!isChar || min!=1 || max!=1)
+        rxEndLiteral(c);
     }
+    if (quantified)
+      rxQuantify(c, atomStart, kind, min, max, greedy);
+  }
+}
+
+static void rxParseAlternation(RegexCompiler *c, int depth) {
+  size_t altStart = c->len;
+  int jumps = -1; // linked list of the JMPs to the end that need filling in
+  rxParseSequence(c, depth);
+  while (*c->re=='|' && !c->failed) {
+    c->re++;
+    if (depth==0) c->alternation = true;
+    // SPLIT <what we had>, <the next alternative>
+    if (!rxMakeSpace(c, altStart, 5)) return;
+    c->code[altStart] = RX_SPLIT;
+    rxEmit(c, RX_JMP);
+    rxEmit16(c, jumps);
+    if (c->failed) return;
+    jumps = (int)c->len-3;
+    rxSet16(&c->code[altStart+1], 0);
+    rxSet16(&c->code[altStart+3], (int)(c->len-(altStart+5)));
+    altStart = c->len;
+    rxParseSequence(c, depth);
+  }
+  if (c->failed) return;
+  while (jumps>=0) {
+    int next = rxGet16(&c->code[jumps+1]);
+    rxSet16(&c->code[jumps+1], (int)c->len-(jumps+3));
+    jumps = next;
   }
-haveCode:
-  if (info->rangeMatch && regexp[*length] == '-' && regexp[1+*length] != ']') { // Character set range start
-    info->rangeFirstChar = cH;
-    (*length)++;
-    int matchLen;
-    bool match = matchcharacter(&regexp[*length], txtIt, &matchLen, info);
-    (*length)+=matchLen;
-    return match;
-  }
-  if (info->ignoreCase) {
-    ch = charToLowerCase(ch);
-    cH = charToLowerCase(cH);
-  }
-  if (info->rangeFirstChar != NO_RANGE) { // Character set range
-    char cL = (char)info->rangeFirstChar;
-    if (info->ignoreCase) {
-      cL = charToLowerCase(cL);
+}
+
+/// Compile a regex into a program string, or raise an exception and return 0
+static JsVar *rxCompile(const char *source, bool ignoreCase) {
+  unsigned char code[MAX_PROGRAM];
+  RegexCompiler c;
+  memset(&c, 0, sizeof(c));
+  c.re = source;
+  c.code = code;
+  c.ignoreCase = ignoreCase;
+  rxParseAlternation(&c, 0);
+  if (*c.re==')') rxError(&c, "Unmatched ')' in RegEx");
+  rxEmit(&c, RX_MATCH);
+  if (c.failed) return 0;
+  rxEndLiteral(&c);
+  if (c.alternation) c.literalLen = 0;
+  // What characters could a match start with?
+  unsigned char set[RXH_FIRSTSET_LEN];
+  memset(set, 0, sizeof(set));
+  bool canBeEmpty = rxFirstSet(code, 0, set, ignoreCase, 0);
+  int ch, setSize = 0, firstChar = 0;
+  for (ch=0;ch<256;ch++) {
+    if (rxInSet(set, ch)) {
+      setSize++;
+      firstChar = ch;
     }
-    info->rangeFirstChar = NO_RANGE;
-    return (ch >= cL && ch <= cH && cL < cH);
-  }
-  return cH==ch;
-}
-
-/* matchhere: search for regexp at beginning of text. Only handles up to '|' character. Modifies txtIt */
-static JsVar *matchhere(char *regexp, JsvStringIterator *txtIt, matchInfo info) {
-  if (jspIsInterrupted()) return 0;
-  if (regexp[0] == '\0' || // end of regex
-      regexp[0] == '|') // end of this 'or' section of regex
-    return matchfound(txtIt, info);
-  if (regexp[0] == '^') { // must be beginning of String
-    if (jsvStringIteratorGetIndex(txtIt)!=0)
-      return 0; // no match
-    if (!jspCheckStackPosition()) return 0;
-    return matchhere(regexp+1, txtIt, info);
-  }
-  // Marker for end of String
-  if (regexp[0] == '$') {
-    if (!jsvStringIteratorHasChar(txtIt))
-      return matchhere(regexp+1, txtIt, info);
+  }
+  unsigned char flags = ignoreCase ? RXP_IGNORECASE : 0;
+  if (!c.alternation && code[0]==RX_BOL) flags |= RXP_ANCHORED;
+  if (!canBeEmpty && setSize<256) flags |= (setSize==1) ? RXP_FIRSTCHAR : RXP_FIRSTSET;
+  // Header, then code
+  size_t headerLen = RXH_LITERAL + (size_t)c.literalLen + ((flags&RXP_FIRSTSET) ? RXH_FIRSTSET_LEN : 0);
+  size_t len = headerLen + c.len;
+  unsigned char *prog = (unsigned char *)alloca(len);
+  prog[RXH_FLAGS] = flags;
+  prog[RXH_GROUPS] = (unsigned char)c.groups;
+  prog[RXH_FIRSTCHAR] = (unsigned char)firstChar;
+  prog[RXH_LITERAL_LEN] = (unsigned char)c.literalLen;
+  memcpy(&prog[RXH_LITERAL], c.literal, (size_t)c.literalLen);
+  if (flags&RXP_FIRSTSET)
+    memcpy(&prog[RXH_LITERAL+c.literalLen], set, RXH_FIRSTSET_LEN);
+  memcpy(&prog[headerLen], code, c.len);
+  JsVar *progVar = jsvNewFlatStringOfLength((unsigned int)len);
+  if (progVar)
+    memcpy(jsvGetFlatStringPointer(progVar), prog, len);
+  else // not enough contiguous memory - a normal string will do
+    progVar = jsvNewStringOfLength((unsigned int)len, (char*)prog);
+  return progVar;
+}
+
+static size_t rxHeaderLength(const unsigned char *prog) {
+  return (size_t)(RXH_LITERAL + prog[RXH_LITERAL_LEN] + ((prog[RXH_FLAGS]&RXP_FIRSTSET) ? RXH_FIRSTSET_LEN : 0));
+}
+
+// ----------------------------------------------------------------------------
+
+/// The string we're matching against
+typedef struct {
+  JsVar *str;
+  const char *ptr;       ///< Pointer to the data if it's all in one place (flat/native strings)
+  size_t len;
+  JsvStringIterator it;  ///< ...otherwise we read it with an iterator
+  JsvStringIterator base;///< and keep another at the start of the match attempt, which we never backtrack before
+} RegexText;
+
+static void rxTextNew(RegexText *txt, JsVar *str) {
+#ifdef ESPR_UNICODE_SUPPORT
+  if (jsvIsUTF8String(str))
+    txt->str = jsvGetUTF8BackingString(str);
+  else
+#endif
+    txt->str = jsvLockAgain(str);
+  txt->ptr = jsvGetDataPointer(txt->str, &txt->len);
+  if (!txt->ptr) {
+    txt->len = jsvGetStringLength(txt->str);
+    jsvStringIteratorNew(&txt->it, txt->str, 0);
+    jsvStringIteratorClone(&txt->base, &txt->it);
+  }
+}
+
+static void rxTextFree(RegexText *txt) {
+  if (!txt->ptr) {
+    jsvStringIteratorFree(&txt->it);
+    jsvStringIteratorFree(&txt->base);
+  }
+  jsvUnLock(txt->str);
+}
+
+/// We're starting a match attempt at idx, and won't need anything before it
+static void rxTextSetBase(RegexText *txt, size_t idx) {
+  if (!txt->ptr)
+    jsvStringIteratorGoto(&txt->base, txt->str, idx);
+}
+
+/// Get the character at idx, or -1 if we're at the end
+static int rxGetChar(RegexText *txt, size_t idx) {
+  if (idx>=txt->len) return -1;
+  if (txt->ptr) return (unsigned char)txt->ptr[idx];
+  if (idx < txt->it.varIndex || (idx >= txt->base.varIndex && txt->it.varIndex < txt->base.varIndex)) {
+    // going backwards, or we can skip ahead to the start of this match attempt
+    jsvStringIteratorFree(&txt->it);
+    if (idx >= txt->base.varIndex)
+      jsvStringIteratorClone(&txt->it, &txt->base);
     else
-      return nomatchfound(regexp+1, info); // not the end, it's a fail
-  }
-  if (regexp[0] == '(') {
-    info.groupStart[info.groups] = jsvStringIteratorGetIndex(txtIt);
-    info.groupEnd[info.groups] = info.groupStart[info.groups];
-    if (info.groups<MAX_GROUPS) info.groups++;
-    if (!jspCheckStackPosition()) return 0;
-    return matchhere(regexp+1, txtIt, info);
-  }
-  if (regexp[0] == ')') {
-    if (info.groups>0)
-      info.groupEnd[info.groups-1] = jsvStringIteratorGetIndex(txtIt);
-    if (!jspCheckStackPosition()) return 0;
-    return matchhere(regexp+1, txtIt, info);
-  }
-  int charLength;
-  bool charMatched = matchcharacter(regexp, txtIt, &charLength, &info);
-  if (regexp[charLength] == '*' || regexp[charLength] == '+') {
-    char op = regexp[charLength];
-    if (!charMatched && op=='+') {
-      // with '+' operator it has to match at least once
-      return nomatchfound(&regexp[charLength+1], info);
+      jsvStringIteratorNew(&txt->it, txt->str, idx);
+  }
+  jsvStringIteratorGoto(&txt->it, txt->str, idx);
+  return (unsigned char)jsvStringIteratorGetChar(&txt->it);
+}
+
+typedef struct {
+  unsigned char type;  ///< RXB_*
+  unsigned char n;     ///< capture slot/loop register to restore
+  unsigned short pc;
+  uint32_t pos;
+  uint32_t extra;      ///< RXB_GREEDY: minimum position, RXB_LAZY: count so far
+} RegexBacktrack;
+
+#define RXB_BRANCH 0  ///< carry on from pc at pos
+#define RXB_CAPTURE 1 ///< restore capture slot n to pos
+#define RXB_LOOP 2    ///< restore loop register n to pos
+#define RXB_GREEDY 3  ///< RX_REPEAT matched up to pos - try one less
+#define RXB_LAZY 4    ///< RX_REPEAT at pc matched up to pos - try one more
+
+typedef struct {
+  const unsigned char *code;
+  bool ignoreCase;
+  RegexText *txt;
+  size_t caps[(MAX_GROUPS+1)*2]; ///< start/end of the whole match, then each group
+  size_t loops[MAX_LOOPS];
+  RegexBacktrack *stack;
+  size_t stackSize, sp;
+  JsVar *stackVar;     ///< If the stack outgrew stackBuf, the flat string it's in now
+  RegexBacktrack stackBuf[STACK_SIZE];
+} RegexVM;
+
+static bool rxPush(RegexVM *vm, unsigned char type, unsigned char n, size_t pc, size_t pos, size_t extra) {
+  if (vm->sp >= vm->stackSize) { // out of space - move the stack to somewhere bigger
+    size_t newSize = vm->stackSize*2;
+    JsVar *v = jsvNewFlatStringOfLength((unsigned int)(newSize*sizeof(RegexBacktrack)));
+    if (!v) {
+      jsExceptionHere(JSET_ERROR, "RegEx too complex");
+      return false;
+    }
+    RegexBacktrack *stack = (RegexBacktrack*)jsvGetFlatStringPointer(v);
+    memcpy(stack, vm->stack, vm->sp*sizeof(RegexBacktrack));
+    jsvUnLock(vm->stackVar);
+    vm->stackVar = v;
+    vm->stack = stack;
+    vm->stackSize = newSize;
+  }
+  RegexBacktrack *e = &vm->stack[vm->sp++];
+  e->type = type;
+  e->n = n;
+  e->pc = (unsigned short)pc;
+  e->pos = (uint32_t)pos;
+  e->extra = (uint32_t)extra;
+  return true;
+}
+
+/// Try and match at 'start'. Returns 1 on a match (with vm->caps set), 0 if no match, -1 on error
+static int rxRun(RegexVM *vm, size_t start) {
+  const unsigned char *code = vm->code;
+  RegexText *txt = vm->txt;
+  bool ignoreCase = vm->ignoreCase;
+  size_t pc = 0, pos = start, i;
+  size_t steps = 0, checkSteps = 0;
+  size_t maxSteps = (txt->len-start+1)*STEPS_PER_CHAR;
+  for (i=0;i<(MAX_GROUPS+1)*2;i++) vm->caps[i] = NO_POSITION;
+  vm->caps[0] = start;
+  vm->sp = 0;
+  while (true) {
+    if (++steps > checkSteps) {
+      if (steps > maxSteps) {
+        jsExceptionHere(JSET_ERROR, "RegEx too complex");
+        return -1;
+      }
+      if (jspIsInterrupted()) return -1;
+      checkSteps = steps+1024;
+    }
+    const unsigned char *op = &code[pc];
+    switch (op[0]) {
+      case RX_MATCH:
+        vm->caps[1] = pos;
+        return 1;
+      case RX_CHAR:
+      case RX_ANY:
+      case RX_CLASS:
+        if (!rxAtomMatch(op, rxGetChar(txt, pos), ignoreCase)) goto fail;
+        pos++;
+        break;
+      case RX_BOL:
+        if (pos!=0) goto fail;
+        break;
+      case RX_EOL:
+        if (pos<txt->len) goto fail;
+        break;
+      case RX_WORDB:
+      case RX_NWORDB: {
+        bool boundary = (pos>0 && rxIsWordChar(rxGetChar(txt, pos-1))) != rxIsWordChar(rxGetChar(txt, pos));
+        if (boundary != (op[0]==RX_WORDB)) goto fail;
+        break;
+      }
+      case RX_SPLIT:
+        if (!rxPush(vm, RXB_BRANCH, 0, (size_t)((int)pc+5+rxGet16(&op[3])), pos, 0)) return -1;
+        pc = (size_t)((int)pc+5+rxGet16(&op[1]));
+        continue;
+      case RX_JMP:
+        pc = (size_t)((int)pc+3+rxGet16(&op[1]));
+        continue;
+      case RX_SAVE:
+        if (!rxPush(vm, RXB_CAPTURE, op[1], 0, vm->caps[op[1]], 0)) return -1;
+        vm->caps[op[1]] = pos;
+        break;
+      case RX_BACKREF: {
+        size_t s = vm->caps[op[1]*2], e = vm->caps[op[1]*2+1];
+        if (s==NO_POSITION || e==NO_POSITION) break; // group didn't match - this matches an empty string
+        for (i=s;i<e;i++,pos++) {
+          int a = rxGetChar(txt, i), b = rxGetChar(txt, pos);
+          if (b<0) goto fail;
+          if (ignoreCase ? charToLowerCase((char)a)!=charToLowerCase((char)b) : a!=b) goto fail;
+        }
+        break;
+      }
+      case RX_REPEAT: {
+        size_t min = rxGetU16(&op[1]), max = rxGetU16(&op[3]);
+        if (max==REPEAT_INFINITE) max = NO_POSITION;
+        const unsigned char *atom = &op[6];
+        size_t next = pc + rxOpSize(op), count = 0;
+        if (op[5]) { // greedy - match as many as we can, then back off one at a time
+          while (count<max && rxAtomMatch(atom, rxGetChar(txt, pos+count), ignoreCase)) count++;
+          steps += count;
+          if (count<min) goto fail;
+          if (count>min && !rxPush(vm, RXB_GREEDY, 0, next, pos+count, pos+min)) return -1;
+          pos += count;
+        } else { // lazy - match as few as we can, then add one at a time
+          for (;count<min;count++,pos++)
+            if (!rxAtomMatch(atom, rxGetChar(txt, pos), ignoreCase)) goto fail;
+          if (min<max && !rxPush(vm, RXB_LAZY, 0, pc, pos, min)) return -1;
+        }
+        pc = next;
+        continue;
+      }
+      case RX_MARK:
+        if (!rxPush(vm, RXB_LOOP, op[1], 0, vm->loops[op[1]], 0)) return -1;
+        vm->loops[op[1]] = pos;
+        break;
+      case RX_CHECK:
+        if (vm->loops[op[1]]==pos) goto fail;
+        break;
     }
-    char *regexpAfterStar = regexp+charLength+1;
-    JsvStringIterator txtIt2;
-    // Try and match everything after right now
-    jsvStringIteratorClone(&txtIt2, txtIt);
-    JsVar *lastrmatch = matchhere(regexpAfterStar, &txtIt2, info);
-    jsvStringIteratorFree(&txtIt2);
-    // Otherwise try and match more than one
-    while (jsvStringIteratorHasChar(txtIt) && charMatched) {
-      // We had this character matched, so move on and see if we can match with the new one
-      jsvStringIteratorNext(txtIt);
-      charMatched = matchcharacter(regexp, txtIt, &charLength, &info);
-      // See if we can match after the character...
-      jsvStringIteratorClone(&txtIt2, txtIt);
-      JsVar *rmatch = matchhere(regexpAfterStar, &txtIt2, info);
-      jsvStringIteratorFree(&txtIt2);
-      // can't match with this - use the last one
-      if (rmatch) {
-        jsvUnLock(lastrmatch);
-        lastrmatch = rmatch;
+    pc += rxOpSize(op);
+    continue;
+  fail:
+    while (true) {
+      if (!vm->sp) return 0;
+      RegexBacktrack *e = &vm->stack[vm->sp-1];
+      if (e->type==RXB_BRANCH) {
+        pc = e->pc;
+        pos = e->pos;
+        vm->sp--;
+        break;
+      } else if (e->type==RXB_CAPTURE) {
+        vm->caps[e->n] = e->pos;
+        vm->sp--;
+      } else if (e->type==RXB_LOOP) {
+        vm->loops[e->n] = e->pos;
+        vm->sp--;
+      } else if (e->type==RXB_GREEDY) {
+        pos = --e->pos;
+        pc = e->pc;
+        if (e->pos<=e->extra) vm->sp--;
+        break;
+      } else { // RXB_LAZY
+        op = &code[e->pc];
+        size_t max = rxGetU16(&op[3]);
+        if (max==REPEAT_INFINITE) max = NO_POSITION;
+        if (rxAtomMatch(&op[6], rxGetChar(txt, e->pos), ignoreCase)) {
+          pos = ++e->pos;
+          pc = e->pc + rxOpSize(op);
+          if (++e->extra >= max) vm->sp--;
+          break;
+        }
+        vm->sp--;
       }
     }
-    return lastrmatch;
   }
+}
+
+/// Does the text contain 'lit' at or after 'pos'?
+static bool rxContains(RegexText *txt, size_t pos, const unsigned char *lit, size_t litLen, bool ignoreCase) {
+  if (txt->ptr && !ignoreCase) {
+    const char *p = &txt->ptr[pos], *end = &txt->ptr[txt->len];
+    while ((p = memchr(p, lit[0], (size_t)(end-p))) && (size_t)(end-p)>=litLen) {
+      if (!memcmp(p, lit, litLen)) return true;
+      p++;
+    }
+    return false;
+  }
+  // Knuth-Morris-Pratt, so we only ever read forwards through the string
+  unsigned char fail[MAX_LITERAL];
+  size_t i, k = 0;
+  fail[0] = 0;
+  for (i=1;i<litLen;i++) {
+    while (k && lit[i]!=lit[k]) k = fail[k-1];
+    if (lit[i]==lit[k]) k++;
+    fail[i] = (unsigned char)k;
+  }
+  k = 0;
+  int ch;
+  while ((ch = rxGetChar(txt, pos++))>=0) {
+    unsigned char c = (unsigned char)(ignoreCase ? charToLowerCase((char)ch) : ch);
+    while (k && c!=lit[k]) k = fail[k-1];
+    if (c==lit[k]) k++;
+    if (k==litLen) return true;
+  }
+  return false;
+}
+
+/// Skip forward to the first character that a match could start with
+static size_t rxSkip(RegexText *txt, size_t pos, const unsigned char *prog) {
+  const unsigned char *set = (prog[RXH_FLAGS]&RXP_FIRSTSET) ? &prog[RXH_LITERAL+prog[RXH_LITERAL_LEN]] : 0;
+  if (txt->ptr) {
+    if (!set) {
+      const char *p = memchr(&txt->ptr[pos], prog[RXH_FIRSTCHAR], txt->len-pos);
+      return p ? (size_t)(p-txt->ptr) : txt->len;
+    }
+    while (pos<txt->len && !rxInSet(set, (unsigned char)txt->ptr[pos])) pos++;
+    return pos;
+  }
+  int ch;
+  while ((ch = rxGetChar(txt, pos))>=0 && !(set ? rxInSet(set, ch) : ch==prog[RXH_FIRSTCHAR]))
+    pos++;
+  return pos;
+}
+
+/// Search for a match at or after 'start'. Returns 1 on a match (with vm->caps set), 0 if no match, -1 on error
+static int rxSearch(RegexVM *vm, const unsigned char *prog, size_t start) {
+  RegexText *txt = vm->txt;
+  unsigned char flags = prog[RXH_FLAGS];
+  size_t literalLen = prog[RXH_LITERAL_LEN];
+  if (literalLen && !rxContains(txt, start, &prog[RXH_LITERAL], literalLen, vm->ignoreCase))
+    return 0; // every match needs this text, and it's not there
+  size_t pos = start;
+  while (true) {
+    if (flags & (RXP_FIRSTSET|RXP_FIRSTCHAR)) {
+      pos = rxSkip(txt, pos, prog);
+      if (pos>=txt->len) return 0; // can't match an empty string
+    }
+    rxTextSetBase(txt, pos);
+    int r = rxRun(vm, pos);
+    if (r) return r;
+    if ((flags&RXP_ANCHORED) || pos>=txt->len) return 0;
+    pos++;
+  }
+}
+
+static JsVar *rxMatchResult(JsVar *str, size_t *caps, int groups) {
+  JsVar *rmatch = jsvNewEmptyArray();
+  if (!rmatch) return 0;
+  int i;
+  for (i=0;i<=groups;i++) {
+    JsVar *matchStr = 0; // undefined if this group didn't match
+    if (caps[i*2]!=NO_POSITION && caps[i*2+1]!=NO_POSITION)
+      matchStr = jsvNewFromStringVar(str, caps[i*2], caps[i*2+1]-caps[i*2]);
+    jsvSetArrayItem(rmatch, i, matchStr);
+    jsvUnLock(matchStr);
+  }
+  jsvObjectSetChildAndUnLock(rmatch, "index", jsvNewFromInteger((JsVarInt)caps[0]));
+  jsvObjectSetChild(rmatch, "input", str);
+  return rmatch;
+}
 
-  // This character is matched
-  if (jsvStringIteratorHasChar(txtIt) && charMatched) {
-    jsvStringIteratorNext(txtIt);
-    if (!jspCheckStackPosition()) return 0;
-    return matchhere(regexp+charLength, txtIt, info);
+/// Compile the RegExp's source, and store the program on it
+static JsVar *jswrap_regexp_compile(JsVar *parent) {
+  JsVar *source = jsvObjectGetChildIfExists(parent, "source");
+  if (!jsvIsString(source)) {
+    jsvUnLock(source);
+    return 0;
   }
-  // No match
-  return nomatchfound(&regexp[charLength], info);
+  size_t len = jsvGetStringLength(source);
+  char *re = (char *)alloca(len+1);
+  jsvGetString(source, re, len+1);
+  jsvUnLock(source);
+  JsVar *prog = rxCompile(re, jswrap_regexp_hasFlag(parent,'i'));
+  if (prog) jsvObjectSetChild(parent, REGEXP_PROGRAM_NAME, prog);
+  return prog;
 }
 
 /*JSON{
@@ -276,7 +985,12 @@ The built-in class for handling Regular Expressions
 
 **Note:** Espruino's regular expression parser does not contain all the features
 present in a full ES6 JS engine. However it does contain support for the all the
-basics.
+basics: character sets, groups (including `(?:...)`), `|`, `*`, `+`, `?`,
+`{n,m}` (and their non-greedy `*?` forms), `^`, `$`, `\b` and backreferences.
+Lookahead/lookbehind, named groups and the `m`, `s`, `u` and `y` flags are not
+supported.
+
+RegExps are compiled when they are created, so syntax errors are reported then.
 */
 
 /*JSON{
@@ -312,6 +1026,12 @@ JsVar *jswrap_regexp_constructor(JsVar *str, JsVar *flags) {
       jsvObjectSetChild(r, "flags", flags);
   }
   jsvObjectSetChildAndUnLock(r, "lastIndex", jsvNewFromInteger(0));
+  JsVar *prog = jswrap_regexp_compile(r);
+  if (!prog) { // syntax error in the RegEx
+    jsvUnLock(r);
+    return 0;
+  }
+  jsvUnLock(prog);
   return r;
 }
 
@@ -354,32 +1074,50 @@ Or with groups `/W(o)rld/.exec("Hello World")` returns:
 JsVar *jswrap_regexp_exec(JsVar *parent, JsVar *arg) {
   JsVar *str = jsvAsString(arg);
   JsVarInt lastIndex = jsvObjectGetIntegerChild(parent, "lastIndex");
-  JsVar *regex = jsvObjectGetChildIfExists(parent, "source");
-  if (!jsvIsString(regex) || lastIndex>(JsVarInt)jsvGetStringLength(str)) {
-    jsvUnLock2(str,regex);
+  JsVar *prog = jsvObjectGetChildIfExists(parent, REGEXP_PROGRAM_NAME);
+  if (!prog) prog = jswrap_regexp_compile(parent); // eg. a RegExp from before programs were stored
+  if (!prog) {
+    jsvUnLock(str);
     return 0;
   }
-  size_t regexLen = jsvGetStringLength(regex);
-  char *regexPtr = (char *)alloca(regexLen+1);
-  if (!regexPtr) {
-    jsvUnLock2(str,regex);
+  RegexText txt;
+  rxTextNew(&txt, str);
+  if (lastIndex>(JsVarInt)txt.len) {
+    rxTextFree(&txt);
+    jsvUnLock2(str,prog);
     return 0;
   }
-  jsvGetString(regex, regexPtr, regexLen+1);
-  jsvUnLock(regex);
-  JsVar *rmatch = match(regexPtr, str, (size_t)lastIndex, jswrap_regexp_hasFlag(parent,'i'));
-  jsvUnLock(str);
+  if (lastIndex<0) lastIndex = 0;
+  size_t progLen;
+  const unsigned char *progPtr = (const unsigned char *)jsvGetDataPointer(prog, &progLen);
+  if (!progPtr) { // not flat - copy it
+    progLen = jsvGetStringLength(prog);
+    unsigned char *p = (unsigned char *)alloca(progLen);
+    jsvGetStringChars(prog, 0, (char*)p, progLen);
+    progPtr = p;
+  }
+  RegexVM vm;
+  vm.code = &progPtr[rxHeaderLength(progPtr)];
+  vm.ignoreCase = (progPtr[RXH_FLAGS]&RXP_IGNORECASE)!=0;
+  vm.txt = &txt;
+  vm.stack = vm.stackBuf;
+  vm.stackSize = STACK_SIZE;
+  vm.stackVar = 0;
+  int r = rxSearch(&vm, progPtr, (size_t)lastIndex);
+  rxTextFree(&txt);
+  jsvUnLock(vm.stackVar);
+  JsVar *rmatch = 0;
+  if (r>0) rmatch = rxMatchResult(str, vm.caps, progPtr[RXH_GROUPS]);
+  jsvUnLock2(str, prog);
+  if (r<0) return 0; // error, or interrupted
   if (!rmatch) {
     rmatch = jsvNewWithFlags(JSV_NULL);
     lastIndex = 0;
   } else {
     // if it's global, set lastIndex
-    if (jswrap_regexp_hasFlag(parent,'g')) {
-      JsVar *matchStr = jsvGetArrayItem(rmatch,0);
-      lastIndex = jsvObjectGetIntegerChild(rmatch, "index") +
-                  (JsVarInt)jsvGetStringLength(matchStr);
-      jsvUnLock(matchStr);
-    } else
+    if (jswrap_regexp_hasFlag(parent,'g'))
+      lastIndex = (JsVarInt)vm.caps[1];
+    else
       lastIndex = 0;
   }
   jsvObjectSetChildAndUnLock(parent, "lastIndex", jsvNewFromInteger(lastIndex));
@@ -137,15 +137,17 @@ JsVar *jswrap_storage_read(JsVar *name, int offset, int length) {
   "ifndef" : "SAVE_ON_FLASH",
   "class" : "Storage",
   "name" : "readJSON",
-  "generate" : "jswrap_storage_readJSON",
+  "generate_full" : "jswrap_storage_readJSON_ext(name, jsvIsArray(noExceptions) ? false : jsvGetBool(noExceptions), jsvIsArray(noExceptions) ? noExceptions : path)",
   "params" : [
     ["name","JsVar","The filename - max 28 characters (case sensitive)"],
-    ["noExceptions","bool","If true and the JSON is not valid, just return `undefined` - otherwise an `Exception` is thrown"]
+    ["noExceptions","JsVar","If true and the JSON is not valid, just return `undefined` - otherwise an `Exception` is thrown. This can also be the `path` array"],
+    ["path","JsVar","[optional] An array of field names/indices - if supplied only the value at this path is read (see below)"]
   ],
   "return" : ["JsVar","An object containing parsed JSON from the file, or undefined"],
   "typescript" : [
-    "function readJSON(name: string, noExceptions?: false | 0): unknown;",
-    "function readJSON(name: string, noExceptions?: ShortBoolean): unknown | undefined;"
+    "function readJSON(name: string, noExceptions?: false | 0, path?: (string | number)[]): unknown;",
+    "function readJSON(name: string, noExceptions?: ShortBoolean, path?: (string | number)[]): unknown | undefined;",
+    "function readJSON(name: string, path: (string | number)[]): unknown;"
   ]
 }
 Read a file from the flash storage area that has been written with
@@ -154,13 +156,28 @@ Read a file from the flash storage area that has been written with
 This is identical to `JSON.parse(require("Storage").read(...))`. It will throw
 an exception if the data in the file is not valid JSON.
 
+If you only need part of a big file, you can supply a path and only that
+value is read - everything before it is skipped over in flash without being
+loaded into RAM, so you can read files that wouldn't fit in memory:
+
+```
+// same as require("Storage").readJSON("apps.json").apps[3].name
+require("Storage").readJSON("apps.json", ["apps",3,"name"])
+```
+
+`undefined` is returned if there's nothing at the given path. Values that are
+skipped over are only checked loosely (strings must end and brackets must
+balance), and nothing after the value that is read is checked at all.
+
 **Note:** This function should be used with normal files, and not `StorageFile`s
 created with `require("Storage").open(filename, ...)`
 */
-JsVar *jswrap_storage_readJSON(JsVar *name, bool noExceptions) {
+JsVar *jswrap_storage_readJSON_ext(JsVar *name, bool noExceptions, JsVar *path) {
   JsVar *v = jsfReadFile(jsfNameFromVar(name),0,0);
   if (!v) return 0;
-  JsVar *r = jswrap_json_parse_ext(v, JSON_DROP_QUOTES);
+  JsVar *r = jsvIsArray(path) ?
+      jswrap_json_parse_path(v, JSON_DROP_QUOTES, path) :
+      jswrap_json_parse_ext(v, JSON_DROP_QUOTES);
   jsvUnLock(v);
   if (noExceptions) {
     jsvUnLock(jspGetException());
@@ -169,6 +186,10 @@ JsVar *jswrap_storage_readJSON(JsVar *name, bool noExceptions) {
   return r;
 }
 
+JsVar *jswrap_storage_readJSON(JsVar *name, bool noExceptions) {
+  return jswrap_storage_readJSON_ext(name, noExceptions, 0);
+}
+
 /*JSON{
   "type" : "staticmethod",
   "ifndef" : "SAVE_ON_FLASH",
@@ -299,17 +320,99 @@ skipping quotes on fields. This saves space and is faster, but also means that i
 string but contained characters in the UTF8 codepoint range, when saved it won't end up getting reloaded as a UTF8 string.
 It does mean that you cannot parse the file with just `JSON.parse` as it's no longer standard JSON but is JS,
 so you must use `Storage.readJSON`
+
+**Note:** The JSON is written to flash in small chunks as it is generated, so
+the whole JSON string never has to be in RAM. As a result `data` is converted
+to JSON more than once (to find the length, and to check whether the file
+already contains the same data), so it's slower than `Storage.write` of
+a String you already have.
+
+**Note:** On builds with `ESPR_STORAGE_JOURNAL` (eg. Linux) files under 64kB are written as a journal, so
+writing it again only appends the bytes that have changed rather than writing a whole new copy. Using
+`require("Storage").read` on the file then returns a String in RAM rather than a memory-mapped one.
+New files, journals and files under 64kB are converted to JSON just once, in RAM, and are only
+streamed (as above) when the existing file is bigger than that.
 */
+typedef struct {
+  JsfFileName name;
+  uint32_t addr;   ///< When comparing, the address of the existing file's contents
+  uint32_t offset; ///< Offset in the file of the next chunk
+  uint32_t size;   ///< Size of the file
+  bool ok;
+} StorageWriteJSONInfo;
+
+/// jsfGetJSONStreamed callback - is the chunk the same as what's in the existing file?
+static bool jswrap_storage_writeJSON_compare(const char *data, size_t len, void *user_data) {
+  StorageWriteJSONInfo *info = (StorageWriteJSONInfo*)user_data;
+  char buf[64];
+  while (len && info->ok) {
+    uint32_t l = (uint32_t)len;
+    if (l>sizeof(buf)) l=sizeof(buf);
+    if (info->offset+l > info->size) {
+      info->ok = false; // longer than the file
+      break;
+    }
+    jshFlashRead(buf, info->addr+info->offset, l);
+    if (memcmp(buf, data, l)) info->ok = false;
+    data += l;
+    len -= l;
+    info->offset += l;
+  }
+  return info->ok;
+}
+
+/// jsfGetJSONStreamed callback - write the chunk to the file
+static bool jswrap_storage_writeJSON_write(const char *data, size_t len, void *user_data) {
+  StorageWriteJSONInfo *info = (StorageWriteJSONInfo*)user_data;
+  JsVar *chunk = jsvNewNativeString((char*)data, len);
+  if (!chunk || info->offset+len > info->size || // out of memory, or data changed since we counted it
+      !jsfWriteFile(info->name, chunk, JSFF_NONE, (JsVarInt)info->offset, (JsVarInt)info->size))
+    info->ok = false;
+  jsvUnLock(chunk);
+  info->offset += (uint32_t)len;
+  return info->ok;
+}
+
 bool jswrap_storage_writeJSON(JsVar *name, JsVar *data) {
-  JsVar *d = jsvNewFromEmptyString();
-  if (!d) return false;
   /* Don't call jswrap_json_stringify directly because we want to ensure we don't use JSON_JSON_COMPATIBILE, so
   String escapes like `\xFC` stay as `\xFC` and not `\u00FC` to save space and help with unicode compatibility
   */
-  jsfGetJSON(data, d, (JSON_DROP_QUOTES|JSON_IGNORE_FUNCTIONS|JSON_NO_UNDEFINED|JSON_ARRAYBUFFER_AS_ARRAY|JSON_JSON_COMPATIBILE) &~JSON_ALL_UNICODE_ESCAPE);
-  bool r = jsfWriteFile(jsfNameFromVar(name), d, JSFF_NONE, 0, 0);
-  jsvUnLock(d);
-  return r;
+  JSONFlags flags = (JSON_DROP_QUOTES|JSON_IGNORE_FUNCTIONS|JSON_NO_UNDEFINED|JSON_ARRAYBUFFER_AS_ARRAY|JSON_JSON_COMPATIBILE) &~JSON_ALL_UNICODE_ESCAPE;
+  StorageWriteJSONInfo info;
+  info.name = jsfNameFromVar(name);
+  JsfFileHeader header;
+  info.addr = jsfFindFile(info.name, &header);
+  info.size = info.addr ? jsfGetFileSize(&header) : 0;
+  info.offset = 0;
+  info.ok = info.addr && jsfGetFileFlags(&header)==JSFF_NONE; // can we skip writing if the contents are the same?
+#ifdef ESPR_STORAGE_JOURNAL
+  /* Decide whether to journal before we convert to JSON. A journal needs all the data in RAM
+  so it can write just what changed - so if there's no file, or it's a journal or small enough
+  to become one, get the JSON into RAM once and compare it with the file's contents from there
+  (jsfReadFile replays a journal) */
+  bool isJournal = info.addr && jsfGetFileFlags(&header)==JSFF_JOURNAL;
+  if (!info.addr || isJournal || info.size <= JSF_JOURNAL_MAX_SIZE) {
+    JsVar *d = jsvNewFromEmptyString();
+    if (!d) return false;
+    jsfGetJSON(data, d, flags);
+    JsVar *old = (info.ok || isJournal) ? jsfReadFile(info.name, 0, 0) : 0;
+    bool r = old && jsvGetStringLength(old)==jsvGetStringLength(d) && jsvCompareString(old, d, 0, 0, false)==0;
+    jsvUnLock(old);
+    if (!r) r = jsfWriteFile(info.name, d, JSFF_JOURNAL, 0, 0);
+    jsvUnLock(d);
+    return r;
+  }
+#endif
+  /* Count the JSON's length, and at the same time check if the file's already
+  there with the same contents so we don't have to write it (like jsfWriteFile) */
+  uint32_t size = (uint32_t)jsfGetJSONStreamed(data, flags, 0, info.ok ? jswrap_storage_writeJSON_compare : 0, &info);
+  if (info.ok && size==info.size) return true;
+  info.size = size;
+  // Otherwise we never have the whole JSON in RAM - we write it to the file a chunk at a time as it's generated
+  info.offset = 0;
+  info.ok = true;
+  jsfGetJSONStreamed(data, flags, 0, jswrap_storage_writeJSON_write, &info);
+  return info.ok && info.offset==info.size;
 }
 
 /*JSON{
@@ -676,8 +779,13 @@ to detect the end of a file. As such you should not write character code 255
 (`"\xFF"`) to these files.
 */
 
-JsVar *jswrap_storagefile_read_internal(JsVar *f, int len) {
-  bool isReadLine = len<0;
+/* Find the next data in a StorageFile - up to 'len' bytes (or to the end of the line if isReadLine),
+ * all in one chunk - and move the file's position past it. Returns the address of the data in flash
+ * and sets *dataLen, or returns 0 if there's nothing left. *ended is set if we stopped at the end
+ * of the file (or line). */
+uint32_t jswrap_storagefile_readSpan(JsVar *f, int len, bool isReadLine, int *dataLen, bool *ended) {
+  *dataLen = 0;
+  *ended = true;
   char mode = (char)jsvObjectGetIntegerChild(f,"mode");
   if (mode!='r') {
     jsExceptionHere(JSET_ERROR, "Can't read in this mode");
@@ -695,61 +803,74 @@ JsVar *jswrap_storagefile_read_internal(JsVar *f, int len) {
   int fileLen = (int)jsfGetFileSize(&header);
   int offset = jsvObjectGetIntegerChild(f,"offset");
 
-  JsVar *result = 0;
-  char buf[32];
-  if (isReadLine) len = sizeof(buf);
-  while (len) {
-    int remaining = fileLen - offset;
-    if (remaining<=0) { // next page
-      offset = 0;
-      if (chunk==255) {
-        addr=0; // end of file!
-      } else {
-        chunk++;
-        fname.c[fnamei]=(char)chunk;
-        addr = jsfFindFile(fname, &header);
-        fileLen = (int)jsfGetFileSize(&header);
-      }
-      jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
-      jsvObjectSetChildAndUnLock(f,"chunk",jsvNewFromInteger(chunk));
-      remaining = fileLen;
-      if (!addr) {
-        // end of file!
-        return result;
-      }
+  if (offset>=fileLen) { // next page
+    offset = 0;
+    if (chunk==255) {
+      addr=0; // end of file!
+    } else {
+      chunk++;
+      fname.c[fnamei]=(char)chunk;
+      addr = jsfFindFile(fname, &header);
+      fileLen = (int)jsfGetFileSize(&header);
     }
-    int l = len;
-    if (l>(int)sizeof(buf)) l=(int)sizeof(buf);
-    if (l>remaining) l=remaining;
-    jshFlashRead(buf, addr+(uint32_t)offset, (uint32_t)l);
-    for (int i=0;i<l;i++) {
-      if (buf[i]==(char)255) {
-        // end of file!
-        l = i;
-        len = l;
+    jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
+    jsvObjectSetChildAndUnLock(f,"chunk",jsvNewFromInteger(chunk));
+    if (!addr) return 0; // end of file!
+  }
+  int l = fileLen - offset;
+  if (!isReadLine && l>len) l = len;
+  *ended = false;
+  // Look for the end of the file (or line)
+  char buf[32];
+  for (int i=0;i<l && !*ended;i+=(int)sizeof(buf)) {
+    int bl = l-i;
+    if (bl>(int)sizeof(buf)) bl=(int)sizeof(buf);
+    jshFlashRead(buf, addr+(uint32_t)(offset+i), (uint32_t)bl);
+    for (int j=0;j<bl;j++) {
+      if (buf[j]==(char)255) { // end of file!
+        l = i+j;
+        *ended = true;
         break;
       }
-      if (isReadLine && buf[i]=='\n') {
-        l = i+1;
-        len = l;
-        isReadLine = false; // done
+      if (isReadLine && buf[j]=='\n') {
+        l = i+j+1;
+        *ended = true;
         break;
       }
     }
+  }
+  if (l) jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset+l));
+  *dataLen = l;
+  return addr+(uint32_t)offset;
+}
 
-    if (!l) break;
-    if (!result)
-      result = jsvNewFromEmptyString();
-    if (result)
-      jsvAppendStringBuf(result,buf,(size_t)l);
-
+JsVar *jswrap_storagefile_read_internal(JsVar *f, int len) {
+  bool isReadLine = len<0;
+  JsVar *result = 0;
+  while (isReadLine || len>0) {
+    int l;
+    bool ended;
+    uint32_t addr = jswrap_storagefile_readSpan(f, len, isReadLine, &l, &ended);
+    if (!addr || !l) break;
+    // Reference the data in flash if we can rather than copying it
+    JsVar *data = jsvAddressToVar(addr, (uint32_t)l);
+    if (!result) {
+      result = data;
+    } else {
+      if (jsvIsNativeString(result) || jsvIsFlashString(result)) {
+        // the data is in more than one chunk, so we have to make a copy we can append to
+        JsVar *r = jsvNewFromEmptyString();
+        if (r) jsvAppendStringVarComplete(r, result);
+        jsvUnLock(result);
+        result = r;
+      }
+      if (result && data)
+        jsvAppendStringVarComplete(result, data);
+      jsvUnLock(data);
+    }
     len -= l;
-    offset += l;
-    // if we're still reading lines, set the length to buffer size
-    if (isReadLine)
-      len = sizeof(buf);
+    if (ended) break;
   }
-  jsvObjectSetChildAndUnLock(f,"offset",jsvNewFromInteger(offset));
   return result;
 }
 /*JSON{
@@ -769,6 +890,9 @@ bytes.
 
 If the end of the file is reached, the String may be smaller than the amount of
 bytes requested, or if the file is already at the end, `undefined` is returned.
+
+Where the data is all in one of the file's chunks, the String references the
+data in flash memory (like `require("Storage").read`) so doesn't use up RAM.
 */
 JsVar *jswrap_storagefile_read(JsVar *f, int len) {
   if (len<0) len=0;
@@ -995,4 +1119,7 @@ void jswrap_storagefile_erase(JsVar *f) {
   "typescript": "pipe(destination: any, options?: PipeOptions): void"
 }
 Pipe this file to a stream (an object with a 'write' method)
+
+If the destination is a Serial device (e.g. `Serial1` or `USB`), data is sent
+straight from flash memory without creating any Strings.
 */
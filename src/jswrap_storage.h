@@ -20,6 +20,7 @@
 
 void jswrap_storage_eraseAll();
 JsVar *jswrap_storage_read(JsVar *name, int offset, int length);
+JsVar *jswrap_storage_readJSON_ext(JsVar *name, bool noExceptions, JsVar *path);
 JsVar *jswrap_storage_readJSON(JsVar *name, bool noExceptions);
 JsVar *jswrap_storage_readArrayBuffer(JsVar *name);
 bool jswrap_storage_write(JsVar *name, JsVar *data, JsVarInt offset, JsVarInt size);
@@ -34,6 +35,7 @@ JsVar *jswrap_storage_getStats(bool checkInternalFlash);
 void jswrap_storage_optimise();
 
 JsVar *jswrap_storage_open(JsVar *name, JsVar *mode);
+uint32_t jswrap_storagefile_readSpan(JsVar *f, int len, bool isReadLine, int *dataLen, bool *ended);
 JsVar *jswrap_storagefile_read(JsVar *f, int len);
 JsVar *jswrap_storagefile_readLine(JsVar *f);
 int jswrap_storagefile_getLength(JsVar *f);
@@ -225,6 +225,19 @@ int jswrap_string_indexOf(JsVar *parent, JsVar *substring, JsVar *fromIndex, boo
   return -1;
 }
 
+#ifndef SAVE_ON_FLASH
+/* When we're going to run a RegExp on a long string many times, use a flat
+ * copy of it (if there's room) so that each match, and each substring we take,
+ * doesn't have to walk through the string's blocks from the start */
+static JsVar *jswrap_string_flatForRegExp(JsVar *str) {
+  if (jsvIsFlatString(str) || jsvIsNativeString(str) || jsvIsUTF8String(str) ||
+      !jsvGetLastChild(str) || jsvGetStringLength(str)<256)
+    return jsvLockAgain(str);
+  JsVar *flat = jsvAsFlatString(str);
+  return flat ? flat : jsvLockAgain(str);
+}
+#endif
+
 /*JSON{
   "type" : "method",
   "class" : "String",
@@ -277,6 +290,7 @@ JsVar *jswrap_string_match(JsVar *parent, JsVar *subStr) {
     // global
     JsVar *array = jsvNewEmptyArray();
     if (!array) return 0; // out of memory
+    JsVar *str = jswrap_string_flatForRegExp(parent);
     while (match && !jsvIsNull(match)) {
       // get info about match
       JsVar *matchStr = jsvGetArrayItem(match,0);
@@ -287,9 +301,9 @@ JsVar *jswrap_string_match(JsVar *parent, JsVar *subStr) {
       // search again
       jsvUnLock(match);
       jsvObjectSetChildAndUnLock(subStr, "lastIndex", jsvNewFromInteger(last + (len?0:1)));
-      match = jswrap_regexp_exec(subStr, parent);
+      match = jswrap_regexp_exec(subStr, str);
     }
-    jsvUnLock(match);
+    jsvUnLock2(match, str);
     jsvObjectSetChildAndUnLock(subStr, "lastIndex", jsvNewFromInteger(0));
     return array;
   }
@@ -334,6 +348,11 @@ JsVar *jswrap_string_replace(JsVar *parent, JsVar *subStr, JsVar *newSubStr) {
 #ifndef SAVE_ON_FLASH
   // Use RegExp if one is passed in
   if (jsvIsInstanceOf(subStr, "RegExp")) {
+    if (jswrap_regexp_hasFlag(subStr,'g')) {
+      JsVar *flat = jswrap_string_flatForRegExp(str);
+      jsvUnLock(str);
+      str = flat;
+    }
     JsVar *replace;
     if (jsvIsFunction(newSubStr) || jsvIsString(newSubStr))
       replace = jsvLockAgain(newSubStr);
@@ -358,9 +377,11 @@ JsVar *jswrap_string_replace(JsVar *parent, JsVar *subStr, JsVar *newSubStr) {
         unsigned int argCount = 0;
         JsVar *args[13];
         args[argCount++] = jsvLockAgain(matchStr);
-        JsVar *v;
-        while ((v = jsvGetArrayItem(match, (JsVarInt)argCount)))
-          args[argCount++] = v;
+        JsVarInt matchLength = jsvGetArrayLength(match); // groups that didn't match are undefined
+        while ((JsVarInt)argCount < matchLength) {
+          args[argCount] = jsvGetArrayItem(match, (JsVarInt)argCount);
+          argCount++;
+        }
         args[argCount++] = jsvObjectGetChildIfExists(match,"index");
         args[argCount++] = jsvObjectGetChildIfExists(match,"input");
         JsVar *result = jsvAsStringAndUnLock(jspeFunctionCall(replace, 0, 0, false, (JsVarInt)argCount, args));
@@ -374,11 +395,9 @@ JsVar *jswrap_string_replace(JsVar *parent, JsVar *subStr, JsVar *newSubStr) {
           char ch = jsvStringIteratorGetCharAndNext(&src);
           if (ch=='$') {
             ch = jsvStringIteratorGetCharAndNext(&src);
-            JsVar *group = 0;
-            if (ch>'0' && ch<='9')
-              group = jsvGetArrayItem(match, ch-'0');
-            if (group) {
-              jsvStringIteratorAppendString(&dst, group, 0, JSVAPPENDSTRINGVAR_MAXLENGTH);
+            if (ch>'0' && ch<='9' && ch-'0' < jsvGetArrayLength(match)) {
+              JsVar *group = jsvGetArrayItem(match, ch-'0'); // undefined (so nothing) if the group didn't match
+              if (group) jsvStringIteratorAppendString(&dst, group, 0, JSVAPPENDSTRINGVAR_MAXLENGTH);
               jsvUnLock(group);
             } else {
               jsvStringIteratorAppend(&dst, '$');
@@ -522,6 +541,7 @@ JsVar *jswrap_string_split(JsVar *parent, JsVar *split) {
   if (jsvIsInstanceOf(split, "RegExp")) {
     int last = 0;
     JsVar *match;
+    parent = jswrap_string_flatForRegExp(parent);
     jsvObjectSetChildAndUnLock(split, "lastIndex", jsvNewFromInteger(0));
     match = jswrap_regexp_exec(split, parent);
     while (match && !jsvIsNull(match)) {
@@ -543,6 +563,7 @@ JsVar *jswrap_string_split(JsVar *parent, JsVar *split) {
     // add remaining string after last match
     if (last <= (int)jsvGetStringLength(parent))
       jsvArrayPushAndUnLock(array, jsvNewFromStringVar(parent, (size_t)last, JSVAPPENDSTRINGVAR_MAXLENGTH));
+    jsvUnLock(parent);
     return array;
   }
 #endif
@@ -20,6 +20,7 @@
  #include <conio.h>
 #else//!__MINGW32__
  #include <sys/select.h>
+ #include <sys/mman.h>
  #include <termios.h>
  #include <fcntl.h>
 #endif//__MINGW32__
@@ -37,6 +38,9 @@
 #define FAKE_FLASH_FILENAME  "espruino.flash"
 #define FAKE_FLASH_BLOCKSIZE FLASH_PAGE_SIZE
 #define FAKE_FLASH_BLOCKS    (FLASH_TOTAL/FLASH_PAGE_SIZE)
+#define FAKE_FLASH_LENGTH    (FAKE_FLASH_BLOCKSIZE*FAKE_FLASH_BLOCKS)
+static unsigned char *jshFlashMap(bool create);
+static void jshFlashUnmap();
 
 #ifndef FLASH_64BITS_ALIGNMENT
 #define FLASH_UNITARY_WRITE_SIZE 4
@@ -253,6 +257,12 @@ pthread_t inputThread;
 bool isInitialised;
 
 void jshInputThread() {
+  /* SIGPROF (from E.profileStart) samples what JS is doing, so it must
+   * only ever interrupt the main thread */
+  sigset_t sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL);
   while (isInitialised) {
     bool shortSleep = false;
     /* Handle the delayed Ctrl-C -> interrupt behaviour (see description by EXEC_CTRL_C's definition)  */
@@ -357,6 +367,8 @@ void jshInit() {
   }
 #endif
 
+  jshFlashMap(false); // map the fake flash file now if it exists
+
   isInitialised = true;
   int err = pthread_create(&inputThread, NULL, &jshInputThread, NULL);
   if (err != 0)
@@ -388,6 +400,8 @@ void jshKill() {
     if (gpioState[i] != JSHPINSTATE_UNDEFINED)
       sysfs_write_int(SYSFS_GPIO_DIR"/unexport", i);
 #endif
+
+  jshFlashUnmap();
 }
 
 void jshIdle() {
@@ -854,7 +868,7 @@ static FILE *jshFlashOpenFile(bool dontCreate) {
   if (!f && dontCreate) return 0;
   if (!f) f = fopen(FAKE_FLASH_FILENAME, "wb");
   if (!f) return 0;
-  int len = FAKE_FLASH_BLOCKSIZE*FAKE_FLASH_BLOCKS;
+  int len = FAKE_FLASH_LENGTH;
   fseek(f,0,SEEK_END);
   long filelen = ftell(f);
   if (filelen<len) {
@@ -868,11 +882,46 @@ static FILE *jshFlashOpenFile(bool dontCreate) {
   }
   return f;
 }
+
+#ifndef __MINGW32__
+static unsigned char *fakeFlash = 0; ///< The fake flash file, memory-mapped (or 0 if not mapped yet)
+#endif
+
+/* Memory-map the fake flash file so we don't have to open it for each access.
+ * Returns 0 if there's no file (and create==false) or it can't be mapped, in
+ * which case we fall back to reading/writing the file. */
+static unsigned char *jshFlashMap(bool create) {
+#ifndef __MINGW32__
+  if (fakeFlash) return fakeFlash;
+  FILE *f = jshFlashOpenFile(!create);
+  if (!f) return 0;
+  void *m = mmap(NULL, FAKE_FLASH_LENGTH, PROT_READ|PROT_WRITE, MAP_SHARED, fileno(f), 0);
+  fclose(f); // the mapping stays valid after the file is closed
+  if (m != MAP_FAILED) fakeFlash = (unsigned char*)m;
+  return fakeFlash;
+#else
+  return 0;
+#endif
+}
+
+static void jshFlashUnmap() {
+#ifndef __MINGW32__
+  if (fakeFlash) munmap(fakeFlash, FAKE_FLASH_LENGTH);
+  fakeFlash = 0;
+#endif
+}
+
 void jshFlashErasePage(uint32_t addr) {
   //jsDebug(DBG_VERBOSE,"FlashErasePage 0x%08x\n", addr);
+  unsigned char *mem = jshFlashMap(false);
+  uint32_t startAddr, pageSize;
+  if (mem) {
+    if (jshFlashGetPage(addr, &startAddr, &pageSize))
+      memset(&mem[startAddr-FLASH_START], 0xFF, pageSize);
+    return;
+  }
   FILE *f = jshFlashOpenFile(true);
   if (!f) return; // if no file and we're erasing, we don't have to do anything
-  uint32_t startAddr, pageSize;
   if (jshFlashGetPage(addr, &startAddr, &pageSize)) {
     startAddr -= FLASH_START;
     fseek(f, startAddr, SEEK_SET);
@@ -893,6 +942,11 @@ void jshFlashRead(void *buf, uint32_t addr, uint32_t len) {
   }
   addr -= FLASH_START;
 
+  unsigned char *mem = jshFlashMap(false);
+  if (mem) {
+    memcpy(buf, &mem[addr], len);
+    return;
+  }
   FILE *f = jshFlashOpenFile(true);
   if (!f) { // no file, so it's all 0xFF
     memset(buf, 0xFF, len);
@@ -922,6 +976,13 @@ void jshFlashWrite(void *buf, uint32_t addr, uint32_t len) {
   }
   addr -= FLASH_START;
 
+  unsigned char *mem = jshFlashMap(true);
+  if (mem) {
+    // Like real flash, writes can only clear bits
+    for (i=0;i<len;i++)
+      mem[addr+i] &= ((unsigned char*)buf)[i];
+    return;
+  }
   FILE *f = jshFlashOpenFile(false);
   if (!f) return;
 
@@ -942,9 +1003,19 @@ void jshFlashWrite(void *buf, uint32_t addr, uint32_t len) {
   fclose(f);
 }
 
-// No - we can't memory-map the flash memory under Linux (well, we could but for testing it's handy not to)
+// If the fake flash file is memory-mapped, return a pointer into it
 size_t jshFlashGetMemMapAddress(size_t ptr) {
+#ifdef SPIFLASH_BASE
+  /* Builds with SPIFLASH_BASE are testing Flash Strings, so behave like
+   * SPI flash (which can't be memory-mapped) so Storage gives us those */
+  NOT_USED(ptr);
   return 0;
+#else
+  if (ptr<FLASH_START || ptr>=FLASH_START+FAKE_FLASH_LENGTH)
+    return 0;
+  unsigned char *mem = jshFlashMap(false);
+  return mem ? (size_t)&mem[ptr-FLASH_START] : 0;
+#endif
 }
 
 unsigned int jshSetSystemClock(JsVar *options) {
@@ -6,6 +6,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "jslex.h"
 #include "jsparse.h"
@@ -25,6 +27,9 @@
 #endif
 
 #define TEST_DIR "tests/"
+#define BENCH_DIR "benchmark/"
+#define BENCH_RUNS 5 ///< Default number of times --bench runs each benchmark
+#define BENCH_TIMEOUT 120 ///< Seconds before --bench gives up on a benchmark run
 #define CMD_NAME "espruino"
 
 bool isRunning = true;
@@ -60,6 +65,8 @@ void fatal(int errcode, const char *fmt, ...) {
   exit(errcode);
 }
 
+int handleErrors();
+
 void perror_exit(int errcode, const char *s) {
   fflush(stdout);
   fprintf(stderr, "%s: ", CMD_NAME);
@@ -232,6 +239,10 @@ bool run_test(const char *filename) {
   return pass;
 }
 
+static int compare_strings(const void *a, const void *b) {
+  return strcmp(*(const char *const*)a, *(const char *const*)b);
+}
+
 static int has_suffix(const char *str, const char *suffix) {
   size_t len = strlen(str);
   size_t slen = strlen(suffix);
@@ -286,6 +297,136 @@ bool run_all_tests() {
   return rc;
 }
 
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x>y) - (x<y);
+}
+
+/* Run a benchmark 'runs' times, each in a freshly initialised interpreter,
+ * and write the results as a JSON object to 'json' */
+bool run_benchmark(FILE *json, const char *filename, const char *name, int runs) {
+  char *buffer = read_file(filename);
+  if (!buffer) {
+    warning("cannot load %s: %s", filename, strerror(errno));
+    return false;
+  }
+  double *times = malloc(sizeof(double) * (size_t)runs);
+  bool ok = true;
+  int run;
+  fprintf(json, "{\"name\":\"%s\",\"runs\":%d", name, runs);
+  for (run = 0; run < runs; run++) {
+    warning("BENCH %s (%d/%d)", name, run+1, runs);
+    jshInit();
+    jswHWInit();
+    jsvInit(JSVAR_CACHE_SIZE);
+    jsiInit(false /* do not autoload!!! */);
+    addNativeFunction("quit", nativeQuit);
+    jsfSetFlag(JSF_PRETOKENISE, 0);
+#ifdef ESPR_JSVAR_STATS
+    jsvStatsReset();
+#endif
+
+    JsSysTime start = jshGetSystemTime();
+    JsSysTime timeout = start + jshGetTimeFromMilliseconds(BENCH_TIMEOUT*1000);
+    jsvUnLock(jspEvaluate(buffer, false));
+    bool failed = handleErrors()!=0;
+    isRunning = !failed;
+    bool isBusy = true;
+    while (isRunning && (jsiHasTimers() || isBusy) && jshGetSystemTime()<timeout)
+      isBusy = jsiLoop();
+    if (isRunning && (jsiHasTimers() || isBusy)) {
+      warning("%s timed out after %ds", name, BENCH_TIMEOUT);
+      failed = true;
+    }
+    times[run] = jshGetMillisecondsFromTime(jshGetSystemTime() - start);
+    if (failed)
+      ok = false;
+#ifdef ESPR_JSVAR_STATS
+    jsvStatsSample();
+    // Counts don't depend on timing, so we only need them from one run
+    if (run == 0)
+      fprintf(json, ",\"allocs\":%llu,\"locks\":%llu,\"gcRuns\":%u,\"peakVars\":%u,\"peakBytes\":%u",
+             (unsigned long long)jsvStats.allocs, (unsigned long long)jsvStats.locks,
+             jsvStats.gcRuns, jsvStats.peakUsage, jsvStats.peakUsage*(unsigned int)sizeof(JsVar));
+#endif
+    jsiKill();
+    jsvKill();
+    jshKill();
+  }
+  fprintf(json, ",\"ok\":%s,\"time\":[", ok?"true":"false");
+  for (run = 0; run < runs; run++)
+    fprintf(json, "%s%.3f", run?",":"", times[run]);
+  qsort(times, (size_t)runs, sizeof(double), compare_doubles);
+  fprintf(json, "],\"timeMin\":%.3f,\"timeMedian\":%.3f}", times[0], times[runs/2]);
+  free(times);
+  free(buffer);
+  return ok;
+}
+
+/* Run each benchmark in the list (or everything in BENCH_DIR if the list is
+ * empty) and write a JSON object of results to stdout. While benchmarks run,
+ * stdout is pointed at stderr so their console output can't get in the JSON. */
+bool run_benchmarks(struct filelist *fl, int runs) {
+  bool ok = true, first = true;
+  if (fl->count == 0) {
+    ftw(BENCH_DIR, add_test_file, 100);
+    // ftw's order depends on the filesystem - sort so builds can be compared line by line
+    qsort(fl->array, fl->count, sizeof(char*), compare_strings);
+  }
+  fflush(stdout);
+  FILE *json = fdopen(dup(STDOUT_FILENO), "w");
+  if (!json)
+    perror_exit(1, "stdout");
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+  fprintf(json, "{\"runs\":%d,\"sizeofJsVar\":%d,\"benchmarks\":[", runs, (int)sizeof(JsVar));
+  filelist_foreach(fl, fn) {
+    const char *name = strrchr(fn, '/');
+    name = name ? name+1 : fn;
+    /* Each benchmark runs in its own process, so one that fails an assert
+     * (which exits) or crashes is reported rather than stopping the rest */
+    int fds[2];
+    if (pipe(fds) < 0)
+      perror_exit(1, "pipe");
+    fflush(json);
+    pid_t pid = fork();
+    if (pid < 0)
+      perror_exit(1, "fork");
+    if (pid == 0) {
+      close(fds[0]);
+      // only write the results when they're complete
+      char *result = NULL;
+      size_t resultLen = 0;
+      FILE *out = open_memstream(&result, &resultLen);
+      bool benchOk = run_benchmark(out, fn, name, runs);
+      fclose(out);
+      if (write(fds[1], result, resultLen) != (ssize_t)resultLen)
+        _exit(2);
+      _exit(benchOk ? 0 : 1);
+    }
+    close(fds[1]);
+    char buf[1024];
+    ssize_t len, total = 0;
+    fprintf(json, "%s\n  ", first ? "" : ",");
+    while ((len = read(fds[0], buf, sizeof(buf))) > 0) {
+      fwrite(buf, 1, (size_t)len, json);
+      total += len;
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) || !total)
+      ok = false;
+    if (!total) {
+      warning("%s crashed", name);
+      fprintf(json, "{\"name\":\"%s\",\"runs\":%d,\"ok\":false,\"crashed\":true}", name, runs);
+    }
+    first = false;
+  }
+  fprintf(json, "\n]}\n");
+  fclose(json);
+  return ok;
+}
+
 #ifdef ESPR_JIT
 bool run_jit_tests() {
   jshInit();
@@ -296,10 +437,25 @@ bool run_jit_tests() {
   addNativeFunction("quit", nativeQuit);
   addNativeFunction("interrupt", nativeInterrupt);
 
-  JsVar *v = jsjEvaluate("1+2");
+  JsVar *code = jsjEvaluate("1+2");
+  JsVar *v = code ? jsjExecute(code, 0) : 0;
   jsiConsolePrintf("RESULT : %j\n", v);
-  jsvUnLock(v);
-  bool pass = true;
+  bool pass = jsvGetInteger(v)==3;
+  jsvUnLock2(code, v);
+
+  // Time the same function JIT'd and interpreted
+  jsvUnLock(jspEvaluate(
+      "function jitFn() { 'jit'; var s=0; for (var i=0;i<20000;i++) s+=i&7; return s; }\n"
+      "function jsFn() { var s=0; for (var i=0;i<20000;i++) s+=i&7; return s; }", false));
+  const char *fns[2] = { "jitFn()", "jsFn()" };
+  JsVarInt results[2];
+  for (int i=0;i<2;i++) {
+    JsSysTime t = jshGetSystemTime();
+    results[i] = jsvGetIntegerAndUnLock(jspEvaluate(fns[i], false));
+    t = jshGetSystemTime() - t;
+    jsiConsolePrintf("%s = %d in %dms\n", fns[i], results[i], (int)jshGetMillisecondsFromTime(t));
+  }
+  if (results[0] != results[1]) pass = false;
 
   warning("BEFORE: %d Memory Records Used", jsvGetMemoryUsage());
   // jsvTrace(execInfo.root, 0);
@@ -376,6 +532,8 @@ void show_help() {
           "test");
   warning("   --test-mem-n test.js #  Run the supplied Exhaustive Memory crash "
           "test with # vars");
+  warning("   --bench [#] [file.js]   Run each benchmark (default: all in "
+          "'benchmark') # times, writing JSON results to stdout");
 }
 
 void die(const char *txt) {
@@ -476,6 +634,17 @@ int main(int argc, char **argv) {
           die("Expecting an extra 2 arguments\n");
         bool ok = run_memory_test(argv[i + 1], atoi(argv[i + 2]));
         exit(ok ? 0 : 1);
+      } else if (!strcmp(a, "--bench")) {
+        int runs = BENCH_RUNS;
+        i++;
+        if (i < argc && argv[i][0]>='0' && argv[i][0]<='9')
+          runs = atoi(argv[i++]);
+        if (runs < 1)
+          fatal(1, "Expecting at least one run");
+        while (i<argc) filelist_add(&test_files, argv[i++]);
+        bool ok = run_benchmarks(&test_files, runs);
+        filelist_free(&test_files);
+        exit(ok ? 0 : 1);
 #ifdef ESPR_JIT
       } else if (!strcmp(a, "--test-jit")) {
         bool ok = run_jit_tests();
@@ -0,0 +1,50 @@
+// Arrays with lots of elements (these may get a dense index - ESPR_OBJECT_INDEX)
+
+var r = [];
+function check(a, len) {
+  if (a.length != len) return false;
+  for (var i=0;i<len;i++) if (a[i] !== a.slice(i,i+1)[0]) return false;
+  return a[len] === undefined && a[-1] === undefined;
+}
+
+var a = [];
+for (var i=0;i<200;i++) a.push(i);
+r.push(a[0]==0 && a[100]==100 && a[199]==199 && a[200]===undefined);
+// append/pop keep the index up to date
+a[200] = 200;
+a.push(201);
+r.push(a[200]==200 && a[201]==201 && a.length==202);
+r.push(a.pop()==201 && a[201]===undefined && a[200]==200);
+// renumbering
+a.reverse();
+r.push(a[0]==200 && a[200]==0 && check(a, 201));
+a.shift();
+r.push(a[0]==199 && a[198]==1 && check(a, 200));
+a.unshift("x","y");
+r.push(a[0]=="x" && a[2]==199 && check(a, 202));
+a.splice(10,5);
+r.push(a[10]==186 && check(a, 197));
+a.splice(20,0,"p","q");
+r.push(a[20]=="p" && a[22]==176 && check(a, 199));
+a.sort();
+r.push(check(a, 199));
+// holes
+delete a[50];
+r.push(a[50]===undefined && !(50 in a) && a[51]!==undefined);
+a[50] = "z";
+a[300] = "end";
+r.push(a[50]=="z" && a[300]=="end" && a[299]===undefined && a.length==301);
+// string keys on arrays
+a.foo = "bar";
+r.push(a.foo=="bar" && a["foo"]=="bar" && a[0]!==undefined);
+
+// array that is built backwards
+var b = [];
+for (var i=99;i>=0;i--) b[i] = i*2;
+var ok = true;
+for (var i=0;i<100;i++) if (b[i]!=i*2) ok = false;
+r.push(ok);
+
+var pass = 0;
+r.forEach(function(n) { if (n) pass++; });
+result = pass == r.length;
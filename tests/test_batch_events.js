@@ -0,0 +1,49 @@
+// E.batchEvents collects events into one callback per batch
+var o = {}, got = [];
+o.on("acc", function(d) { got.push(d); });
+E.batchEvents(o, "acc", {count:4});
+for (var i=0;i<10;i++) o.emit("acc", {x:i, y:-i, name:"s"+i});
+
+var nums = [];
+var p = {};
+p.on("v", function(d) { nums.push(d); });
+E.batchEvents(p, "v", {count:100, maxDelay:20});
+for (i=0;i<5;i++) p.emit("v", i/2);
+
+var stopped = [];
+var q = {};
+q.on("s", function(d) { stopped.push(d); });
+E.batchEvents(q, "s", {count:10});
+q.emit("s", "a");
+q.emit("s", "b");
+
+var r = {}, single = [];
+r.on("e", function(d) { single.push(d); });
+E.batchEvents(r, "e", {count:2});
+
+var m = {}, mixed = [];
+m.on("m", function(d) { mixed.push(d); });
+E.batchEvents(m, "m", {count:10});
+m.emit("m", 1);
+m.emit("m", 2);
+m.emit("m", {x:3}); // a different type of sample sends the numbers first
+
+setTimeout(function() {
+  E.batchEvents(q, "s"); // flushes "a","b" and stops batching
+  E.batchEvents(r, "e", {count:0});
+  E.batchEvents(m, "m");
+  q.emit("s", "c");
+  r.emit("e", 1);
+}, 1);
+
+setTimeout(function() {
+  result = got.length==2 && // only 2 complete batches, 2 left over
+    got[0].x instanceof Float32Array && got[0].x.length==4 &&
+    got[1].x.join(",")=="4,5,6,7" && got[1].y[3]==-7 &&
+    got[1].name.join(",")=="s4,s5,s6,s7" &&
+    nums.length==1 && nums[0] instanceof Float32Array &&
+    nums[0].join(",")=="0,0.5,1,1.5,2" && // sent by maxDelay, trimmed to 5
+    stopped.length==2 && stopped[0].join(",")=="a,b" && stopped[1]=="c" &&
+    single.length==1 && single[0]==1 &&
+    mixed.length==2 && mixed[0].join(",")=="1,2" && mixed[1].x.join(",")=="3";
+}, 100);
@@ -0,0 +1,22 @@
+// E.defrag should move objects, flat strings and ArrayBuffers without breaking them
+var keep = [], junk = [];
+for (var i=0;i<200;i++) {
+  var a = new Uint8Array(40+i);
+  for (var j=0;j<a.length;j++) a[j] = i+j;
+  keep.push({ n : i, s : "str"+i, a : a, o : { back : i } });
+  junk.push(new Uint8Array(100), { x : i }, "junk"+i);
+}
+var str = E.toString(new Uint8Array(300).fill(65));
+junk = undefined;
+E.defrag();
+E.defrag(); // nothing should move the second time
+
+var ok = true;
+keep.forEach(function(k,i) {
+  if (k.n!=i || k.s!="str"+i || k.o.back!=i || k.a.length!=40+i) ok = false;
+  for (var j=0;j<k.a.length;j++) if (k.a[j]!=((i+j)&255)) ok = false;
+});
+ok = ok && str.length==300 && str.charCodeAt(299)==65 && E.getAddressOf(str,true)!=0;
+// new flat strings must still work
+keep.push(new Uint8Array(2000));
+result = ok && keep[200].length==2000;
@@ -0,0 +1,41 @@
+// Queued events (emit, promises) run in the order they were queued, even when
+// there are more than fit in the native event queue or they can't go in it
+var log = [];
+var a = {}, b = {};
+a.on("ev", function(n) { log.push(n); });
+b.on("ev", function(n) { log.push(n); });
+for (var i=0;i<200;i++) (i%3 ? a : b).emit("ev", i);
+
+// events queued while running events go after everything already queued
+var nested = [];
+var c = {};
+c.on("ev", function(n, again) {
+  nested.push(n);
+  if (again) c.emit("ev", n+100, false);
+});
+for (i=0;i<100;i++) c.emit("ev", i, true);
+
+// too many args for the queue, and undefined args
+var args = [];
+var d = {};
+d.on("ev", function() {
+  var s = [];
+  for (var i=0;i<arguments.length;i++) s.push(arguments[i]);
+  args.push(s.join(","));
+});
+d.emit("ev", 1, 2, 3, 4);
+d.emit("ev", 5, undefined, 7);
+d.emit("ev");
+
+var promised = 0;
+for (i=0;i<100;i++) Promise.resolve(i).then(function(v) { promised += v; });
+
+setTimeout(function() {
+  var inOrder = log.length==200;
+  for (var i=0;i<log.length;i++) if (log[i]!=i) inOrder = false;
+  var nestedOk = nested.length==200;
+  for (i=0;i<nested.length;i++) if (nested[i]!=i) nestedOk = false;
+  result = inOrder && nestedOk &&
+           args.join("|")=="1,2,3,4|5,,7|" &&
+           promised==4950;
+}, 10);
@@ -0,0 +1,15 @@
+// Events that are still queued when save() happens (eg. emitted from E.on('kill')) still run after it
+var log = [];
+var a = {};
+a.on("ev", function(n) { log.push(n); });
+E.on('kill', function() {
+  for (var i=0;i<100;i++) a.emit("ev", i); // more than fit in the native event queue
+});
+save();
+
+setTimeout(function() {
+  require("Storage").erase(".varimg");
+  var ok = log.length==100;
+  for (var i=0;i<log.length;i++) if (log[i]!=i) ok = false;
+  result = ok;
+}, 100);
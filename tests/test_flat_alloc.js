@@ -0,0 +1,23 @@
+// Flat strings allocated from (and freed back into) a fragmented free list must not overlap
+var keep = [], junk = [];
+for (var i=0;i<500;i++) {
+  keep.push({ n : i });
+  junk.push({ x : i }, "junk"+i);
+}
+junk = undefined;
+process.memory(); // GC - lots of small gaps, with big free areas after
+
+var ok = true, bufs = [];
+for (var i=0;i<300;i++) {
+  var a = new Uint8Array(40+((i*37)%400));
+  a.fill(i&255);
+  if (E.getAddressOf(a,true)&3) ok = false; // data must be aligned (small ones aren't flat, so are 0)
+  bufs.push(a);
+  if (i%3==2) bufs.splice((i*7)%bufs.length, 1); // free some, so they can be reused
+}
+bufs.forEach(function(a) {
+  var v = a[0];
+  for (var j=0;j<a.length;j++) if (a[j]!=v) ok = false;
+});
+keep.forEach(function(k,i) { if (k.n!=i) ok = false; });
+result = ok;
@@ -0,0 +1,32 @@
+// Incremental garbage collection (ESPR_GC_INCREMENTAL) - free cyclic garbage a slice at a time from idle
+
+if (E.getFlags().gcSliceTime===undefined) {
+  result = 1; // not built with incremental GC
+} else {
+  E.setFlags({gcSliceTime:0.01}); // tiny slices, so marking takes lots of trips around the idle loop
+  var flagOk = E.getFlags().gcSliceTime==0.01;
+
+  function mk() { var a={}, b={a:a}; a.b=b; } // cyclic garbage - refcounting can't free it
+  var before = process.memory(false).usage;
+  while (process.memory(false).free > 60) mk();
+  var full = process.memory(false).usage;
+
+  // keep changing some live data while the GC is running
+  var live = { list : [] };
+  var n = 0;
+  var iv = setInterval(function() {
+    live.list.push({ n : n, s : "str"+n, self : live });
+    if (live.list.length>5) live.old = live.list.shift();
+    live.list.reverse();
+    n++;
+  }, 1);
+
+  setTimeout(function() {
+    clearInterval(iv);
+    var after = process.memory(false).usage;
+    var liveOk = live.list.length==5 && live.old.self===live &&
+                 live.list.every(function(e) { return e.self===live && e.s=="str"+e.n; });
+    E.setFlags({gcSliceTime:2});
+    result = flagOk && liveOk && n>10 && after < full-(full-before)/2;
+  }, 200);
+}
@@ -0,0 +1,62 @@
+// Member lookups that go via the prototype chain or built-ins may be cached (ESPR_INLINE_CACHE)
+// - check the cache notices when things change
+
+var r = [];
+function A() {}
+A.prototype.get = function() { return 1; };
+var a = new A();
+function getA() { return a.get(); }
+r.push(getA()==1);
+// replace the method on the prototype
+A.prototype.get = function() { return 2; };
+r.push(getA()==2);
+// shadow it on the object
+a.get = function() { return 3; };
+r.push(getA()==3);
+delete a.get;
+r.push(getA()==2);
+// remove from the prototype
+delete A.prototype.get;
+try { getA(); r.push(false); } catch (e) { r.push(true); }
+// replace the whole prototype
+function B() {}
+B.prototype.get = function() { return 4; };
+a.__proto__ = B.prototype;
+r.push(getA()==4);
+A.prototype = { get : function() { return 5; } };
+r.push(getA()==4 && (new A()).get()==5);
+
+// same site, different objects
+function sum(o) { return o.get(); }
+r.push(sum(new A())==5 && sum(new B())==4 && sum({get:function(){return 6;}})==6);
+
+// built-ins
+function sin(x) { return Math.sin(x); }
+r.push(sin(0)==0);
+Math.sin = function() { return 7; };
+r.push(sin(0)==7);
+delete Math.sin;
+r.push(sin(0)==0);
+var s = "Hello";
+r.push(s.charAt(1)=="e" && "World".charAt(1)=="o");
+String.prototype.charAt = function() { return "x"; };
+r.push(s.charAt(1)=="x");
+
+// own members of functions (which can be prototypes too)
+function G() {}
+function getFoo(o) { return o.foo; }
+Function.prototype.foo = 1;
+var g = {}, h = [];
+Object.setPrototypeOf(g, G);
+h.push(getFoo(g)==1, getFoo(g)==1);
+G.foo = 2;
+h.push(getFoo(g)==2);
+function callG() { return G.call(); }
+callG(); callG();
+G.call = function() { return 8; };
+h.push(callG()==8);
+r.push(h.every(function(x) { return x; }));
+
+var pass = 0;
+r.forEach(function(n) { if (n) pass++; });
+result = pass == r.length;
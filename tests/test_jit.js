@@ -0,0 +1,25 @@
+var r=[];
+function t(n,v,e){ var ok = JSON.stringify(v)===JSON.stringify(e); r.push(ok); }
+function add3(a,b,c,d) { return a+b+c+(d===undefined?0:d); }
+t("float", (function(){"jit";return 1.5+2.25;})(), 3.75);
+t("long", (function(){"jit";return 12345678901;})(), 12345678901);
+t("str", (function(){"jit";return "hello"+" world";})(), "hello world");
+t("call0", (function(){"jit";return Math.random()<1;})(), true);
+t("call1", (function(){"jit";return Math.abs(-5);})(), 5);
+t("call3", (function(){"jit";return add3(1,2,3);})(), 6);
+t("call4", (function(){"jit";return add3(1,2,3,4);})(), 10);
+t("member", (function(){"jit";var o={a:{b:42}};return o.a.b;})(), 42);
+t("index", (function(){"jit";var a=[1,2,3];return a[1]+a[2];})(), 5);
+t("assignmember", (function(){"jit";var o={};o.x=5;o["y"]=6;return o;})(), {x:5,y:6});
+t("ternary", (function(){"jit";var a=5;return a>3?"big":"small";})(), "big");
+t("if", (function(){"jit";var a=1;if (a==2) a=10; else a=20; return a;})(), 20);
+t("while", (function(){"jit";var a=0;while(a<100)a++;return a;})(), 100);
+t("do", (function(){"jit";var a=0;do{a+=3;}while(a<10);return a;})(), 12);
+t("andor", (function(){"jit";var a=0,b=2;return [a&&b, a||b, b&&a];})(), [0,2,0]);
+t("unary", (function(){"jit";var a=5;return [-a,~a,!a,+"3"];})(), [-5,-6,false,3]);
+t("prefix", (function(){"jit";var a=5;++a;--a;--a;return a;})(), 4);
+t("method", (function(){"jit";var a=[3,1,2];a.sort();return a.join(",");})(), "1,2,3");
+t("this", (function(){"jit";return this.q;}).call({q:7}), 7);
+t("bigloop", (function(){"jit";var s=0;for(var i=0;i<300;i++){ if (i&1) s+=i; else s-=1; } return s;})(), 22350);
+t("nested", (function(){"jit";var s=0;for(var i=0;i<10;i++)for(var j=0;j<10;j++)s+=Math.max(i,j);return s;})(), 615);
+result = r.every(x=>x);
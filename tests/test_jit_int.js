@@ -0,0 +1,22 @@
+// Local variables that the JIT keeps as native ints - check we drop back to normal JsVars when needed
+var r=[];
+function t(n,v,e){ var ok = JSON.stringify(v)===JSON.stringify(e); if (!ok) console.log(n,v,e); r.push(ok); }
+t("sum", (function(){"jit";var s=0;for(var i=0;i<1000;i++)s+=i;return s;})(), 499500);
+t("overflow", (function(){"jit";var a=2147483000;for(var i=0;i<1000;i++)a+=1;return a;})(), 2147484000);
+t("overflow2", (function(){"jit";var a=1;for(var i=0;i<40;i++)a=a+a;return a;})(), 1099511627776);
+t("underflow", (function(){"jit";var a=-2147483640;for(var i=0;i<20;i++)a--;return a;})(), -2147483660);
+t("float", (function(){"jit";var a=0;for(var i=0;i<4;i++)a=a+0.5;return a;})(), 2);
+t("string", (function(){"jit";var a=0;a=a+"x";a+=1;return a;})(), "0x1");
+t("backtoint", (function(){"jit";var a=2147483647;a++;a=a-10;a=3;a+=1;return a;})(), 4);
+t("while", (function(){"jit";var i=0,n=0;while(i<10){i++;n+=2;}return n;})(), 20);
+t("nested", (function(){"jit";var n=0;for(var i=0;i<10;i++)for(var j=0;j<i;j++)n++;return n;})(), 45);
+t("bits", (function(){"jit";var a=5;var b=~a;var c=(a<<3)|1;var d=c>>1;var e=a^3;return [b,c,d,e];})(), [-6,41,20,6]);
+t("shift", (function(){"jit";var a=1;a=a<<31;var b=a>>31;return [a,b];})(), [-2147483648,-1]);
+t("compare", (function(){"jit";var a=3,b=4,n=0;if(a==3)n+=1;if(a!=b)n+=2;if(a>=b)n+=4;if(a<=b)n+=8;if(a===3)n+=16;return n;})(), 27);
+t("generic", (function(){"jit";var a=5;return [a,a*2,a+0.5,a.toString()];})(), [5,10,5.5,"5"]);
+t("uninit", (function(){"jit";var a;a=5;return a+1;})(), 6);
+t("conddecl", (function(){"jit";if(true){var a=3;}return a;})(), 3);
+t("exprassign", (function(){"jit";var a=1;var b=(a=5)+1;var c=a++;return [a,b,c];})(), [6,6,5]);
+t("return", (function(){"jit";for(var i=0;i<10;i++){if(i==5)return i;}return -1;})(), 5);
+t("bigliteral", (function(){"jit";var a=3000000000;a+=1;return a;})(), 3000000001);
+result = r.every(x=>x);
@@ -0,0 +1,77 @@
+// JSON.parse and Storage.readJSON - values, escapes, numbers, UTF8, errors and non-flat sources
+var tests=0,testsPass=0;
+function test(a,b) {
+  tests++;
+  a = JSON.stringify(a);
+  b = JSON.stringify(b);
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" failed - ",a,"vs",b);
+}
+function testError(json, msg) {
+  tests++;
+  try {
+    JSON.parse(json);
+    console.log("Test "+tests+" failed - no error for "+json);
+  } catch (e) {
+    if (e.message==msg) testsPass++;
+    else console.log("Test "+tests+" failed - "+json+" gave "+e.message);
+  }
+}
+
+// values
+test(JSON.parse(' {"a": 1, "b":[true,false,null], "c":{}} '), {a:1,b:[true,false,null],c:{}});
+test(JSON.parse('[]'), []);
+test(JSON.parse('""'), "");
+// numbers
+test(JSON.parse('[0,5,-5,1.5,-0.25,1e3,2E-2,.5,0x10,010,0b11]'), [0,5,-5,1.5,-0.25,1000,0.02,0.5,16,8,3]);
+test(JSON.parse('2147483648'), 2147483648);
+test(JSON.parse('-2147483649'), -2147483649);
+test(JSON.parse('12345678901234567890') > 1.2e19, true); // too big for an int
+test(typeof JSON.parse('7'), "number");
+// strings and escapes
+test(JSON.parse('"a\\nb\\t\\"c\\\\d\\/"'), 'a\nb\t"c\\d/');
+test(JSON.parse('"\\u0041\\x42\\101"'), "ABA");
+test(JSON.parse("'single'"), "single");
+var long = "0123456789".repeat(30);
+test(JSON.parse(JSON.stringify(long)), long);
+test(JSON.parse(JSON.stringify(long+"\n"+long)), long+"\n"+long);
+// UTF8
+test(JSON.parse('"\\u03A9"'), "Ω");
+test(JSON.parse('"Ω"').length, 1);
+test(JSON.parse('{"Ω":"x°C"}')["Ω"], "x°C");
+test(JSON.parse('["Ω", 1, "\\u00B0"]'), ["Ω",1,"°"]);
+// leniency: trailing commas and comments
+test(JSON.parse('[1,2,]'), [1,2]);
+test(JSON.parse('{"a":1,}'), {a:1});
+test(JSON.parse('/* hi */ [1, // one\n 2]'), [1,2]);
+// keys are added in the order they were written
+test(Object.keys(JSON.parse('{"b":1,"10":2,"a":3}')), ["b","10","a"]);
+// errors
+testError('[1 2]', "Got INT expected ','");
+testError('{"a":1 "b":2}', "Got String:'b' expected ','");
+testError('{"a" 1}', "Got INT expected ':'");
+testError('{a:1}', "Got ID:a expected STRING");
+testError('[1,', "Expecting valid value, got EOF");
+testError('"abc', "Expecting valid value, got UNFINISHED STRING");
+testError('nul', "Expecting valid value, got ID");
+testError('-a', "Got ID:a expected INT");
+testError('', "Expecting valid value, got EOF");
+
+// a big object, from both normal (block) and flat strings
+var big = {};
+for (var i=0;i<50;i++) big["key"+i] = {v:i, s:"str\n"+i, a:[i,-i,i*1000000], n:null, u:"Ω"+i};
+var json = JSON.stringify(big, null, 1);
+var flat = E.toFlatString(json);
+test(E.getAddressOf(flat, true)!=0, true);
+test(JSON.parse(json), big);
+test(JSON.parse(flat), big);
+
+// Storage.readJSON allows unquoted field names
+var s = require("Storage");
+s.write("json_parse.json", "{a:1,'b':[1,2,],c:{d:'x'}}");
+test(s.readJSON("json_parse.json"), {a:1,b:[1,2],c:{d:"x"}});
+s.write("json_parse.json", json);
+test(s.readJSON("json_parse.json"), big);
+s.erase("json_parse.json");
+
+result = tests==testsPass;
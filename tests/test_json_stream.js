@@ -0,0 +1,65 @@
+// Storage.writeJSON and E.writeJSON stream JSON in chunks rather than making one big String
+var tests=0,testsPass=0;
+function test(a,b) {
+  tests++;
+  if (a==b) testsPass++;
+  else console.log("Test "+tests+" failed: "+JSON.stringify(a).substr(0,100)+" != "+JSON.stringify(b).substr(0,100));
+}
+
+var s = require("Storage");
+s.eraseAll();
+var data = { name:"test", list:[1,2.5,"three",null,true,{a:"\xFC"}], str:"x".repeat(300) };
+var big = [];
+for (var i=0;i<1500;i++) big.push({id:i, name:"item number "+i, tags:["a","b"]});
+
+// chunk boundaries
+var chunks = [];
+var n = E.writeJSON({ write : function(d) { chunks.push(d); } }, big);
+test(chunks.join(""), JSON.stringify(big));
+test(n, JSON.stringify(big).length);
+test(chunks.length, Math.ceil(n/256));
+test(chunks.every(function(c,i) { return i==chunks.length-1 || c.length==256; }), true);
+// whitespace and toJSON are as JSON.stringify
+var out = "";
+E.writeJSON({ write : function(d) { out += d; } }, data, 2);
+test(out, JSON.stringify(data, undefined, 2));
+out = "";
+E.writeJSON({ write : function(d) { out += d; } }, {d:new Date(0), u:undefined, f:function(){}}, "\t");
+test(out, JSON.stringify({d:new Date(0), u:undefined, f:function(){}}, undefined, "\t"));
+// errors
+var err;
+try { E.writeJSON({}, 1); } catch (e) { err = e.toString(); }
+test(err, "TypeError: Destination must have a write method");
+var calls = 0;
+try { E.writeJSON({ write : function(d) { calls++; throw "Oops"; } }, big); } catch (e) { err = e; }
+test(err, "Oops");
+test(calls, 1);
+
+// StorageFile
+var f = s.open("big","w");
+E.writeJSON(f, big);
+test(s.open("big","r").read(100000), JSON.stringify(big));
+
+// Storage.writeJSON - small files are journalled on Linux, big ones (>64kB) are streamed
+test(s.writeJSON("small", data), true);
+test(JSON.stringify(s.readJSON("small")), JSON.stringify(data));
+test(s.writeJSON("big.json", big), true);
+test(s.read("big.json").length > 65535, true);
+test(JSON.stringify(s.readJSON("big.json")), JSON.stringify(big));
+var addr = s.getStats().fileBytes;
+test(s.writeJSON("big.json", big), true); // same data - not written again
+test(s.getStats().fileBytes, addr);
+big[1000].name = "changed";
+test(s.writeJSON("big.json", big), true);
+test(JSON.stringify(s.readJSON("big.json")), JSON.stringify(big));
+
+// Serial goes straight to the device
+var serial = "";
+LoopbackB.on('data', function(d) { serial += d; });
+E.writeJSON(LoopbackA, data);
+
+setTimeout(function() {
+  test(serial, JSON.stringify(data));
+  result = tests==testsPass;
+  s.eraseAll();
+}, 100);
@@ -0,0 +1,44 @@
+// Objects with lots of keys (these may get a hash index - ESPR_OBJECT_INDEX)
+
+var r = [];
+
+var o = {};
+for (var i=0;i<300;i++) o["key"+i] = i;
+r.push(o.key0 == 0 && o.key150 == 150 && o.key299 == 299);
+r.push(o.key300 === undefined && !("key300" in o));
+r.push(o["key"+123] == 123);
+
+// delete lots, and check what's left
+for (var i=0;i<300;i+=2) delete o["key"+i];
+r.push(Object.keys(o).length == 150);
+var ok = true;
+for (var i=0;i<300;i++)
+  if (o["key"+i] !== ((i&1)?i:undefined)) ok = false;
+r.push(ok);
+
+// add them back, and some that need the index to grow
+for (var i=0;i<600;i+=2) o["key"+i] = -i;
+r.push(Object.keys(o).length == 450);
+r.push(o.key0 == 0 && o.key2 == -2 && o.key1 == 1 && o.key598 == -598);
+// key order is still insertion order
+r.push(Object.keys(o)[0]=="key1" && Object.keys(o)[150]=="key0");
+
+// short keys, and integer keys
+var p = {};
+for (var i=0;i<100;i++) { p[String.fromCharCode(65+(i%26),65+(i/26|0))] = i; p[i] = -i; }
+ok = true;
+for (var i=0;i<100;i++)
+  if (p[String.fromCharCode(65+(i%26),65+(i/26|0))] != i || p[i] != -i) ok = false;
+r.push(ok);
+
+// lots of globals
+for (var i=0;i<200;i++) global["glob"+i] = i;
+r.push(glob0 + glob199 == 199);
+delete global.glob199;
+r.push(typeof glob199 == "undefined");
+glob199 = 42;
+r.push(glob199 == 42);
+
+var pass = 0;
+r.forEach(function(n) { if (n) pass++; });
+result = pass == r.length;
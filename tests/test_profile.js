@@ -0,0 +1,35 @@
+// E.profileStart/profileStop count samples against the right functions
+function slow(n) {
+  var s = 0;
+  for (var i=0;i<n;i++) s += Math.sqrt(i);
+  return s;
+}
+function fast(n) {
+  var s = 0;
+  for (var i=0;i<n;i++) s += i;
+  return s;
+}
+var obj = { method : function() { return slow(10); } };
+
+E.profileStart();
+var t = getTime();
+while (getTime() < t+0.3) { slow(1000); fast(50); obj.method(); }
+var r = E.profileStop();
+var byName = {};
+r.functions.forEach(function(f) { byName[f.name] = f; });
+var total = 0, lineTotal = 0;
+r.functions.forEach(function(f) {
+  total += f.samples;
+  for (var l in f.lines) lineTotal += f.lines[l];
+});
+
+var threw = false;
+try { E.profileStart(-1); } catch (e) { threw = true; }
+// stopping when not running returns undefined
+var r2 = E.profileStop();
+
+result = r.samples > 20 && r.dropped==0 &&
+  total + r.idle == r.samples && lineTotal == total &&
+  r.functions[0].name=="slow" && byName.slow.samples > byName.fast.samples &&
+  byName.slow.lines[2] > 0 &&
+  threw && r2===undefined;
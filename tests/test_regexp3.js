@@ -0,0 +1,82 @@
+// Compiled RegExps - groups, alternation, quantifiers, backreferences and errors
+var tests=0,testsPass=0;
+function test(a,b) {
+  tests++;
+  a = JSON.stringify(a);
+  b = JSON.stringify(b);
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" failed - ",a,"vs",b);
+}
+function testError(regex, msg) {
+  tests++;
+  try {
+    new RegExp(regex);
+    console.log("Test "+tests+" failed - no error for "+regex);
+  } catch (e) {
+    if (e.message==msg) testsPass++;
+    else console.log("Test "+tests+" failed - "+regex+" gave "+e.message);
+  }
+}
+
+// alternation inside groups
+test(/a(b|c)d/.exec("xacd").slice(), ["acd","c"]);
+test(/(a)|(b)/.exec("b").slice(), ["b",undefined,"b"]);
+test(/(?:ab)+/.exec("ababc")[0], "abab");
+// quantifiers
+test(/colou?r/.test("color") && /colou?r/.test("colour"), true);
+test(/a{2}/.exec("aaaa")[0], "aa");
+test(/a{2,3}/.exec("aaaa")[0], "aaa");
+test(/a{2,}/.exec("aaaaa")[0], "aaaaa");
+test(/(ab){2}/.exec("abababx")[0], "abab");
+test(/(ab){1,2}?/.exec("ababab")[0], "ab");
+test(/a+?/.exec("aaa")[0], "a");
+test(/<.*?>/.exec("<a><b>")[0], "<a>");
+test(/<.*>/.exec("<a><b>")[0], "<a><b>");
+test(/a{x}/.exec("a{x}")[0], "a{x}");
+// loops over things that can match nothing
+test(/(a*)*b/.exec("aaab")[0], "aaab");
+test(/(a|)*b/.exec("aab")[0], "aab");
+// backreferences and word boundaries
+test(/(a)\1/.exec("xaab")[0], "aa");
+test(/(\w+) \1/i.exec("Hello hello world")[1], "Hello");
+test(/\bfoo\b/.test("a foo b"), true);
+test(/\bfoo\b/.test("afoob"), false);
+test(/\Bfoo/.test("afoo"), true);
+// character sets
+test(/[^a-c]+/.exec("abcdefa")[0], "def");
+test(/[\d.]+/.exec("v1.25x")[0], "1.25");
+test(/[\w-]+/.exec("!foo-bar!")[0], "foo-bar");
+test(/[A-Z]+/i.exec("123abC")[0], "abC");
+test(/[^a]/i.exec("Ab")[0], "b");
+// anchors
+test(/$/.exec("abc").index, 3);
+test(/^abc$/.test("abc"), true);
+test(/^abc$/.test("abcd"), false);
+// groups that didn't match are undefined, and replace handles that
+test("x".replace(/(y)?x/, "[$1]"), "[]");
+test("aXbX".replace(/(a)|(b)/g, function(m,a,b,i) { return [m,a,b,i].join(); }), "a,a,,0Xb,,b,2X");
+// syntax errors are thrown when the RegExp is created
+testError("(", "Unfinished group in RegEx");
+testError("a)", "Unmatched ')' in RegEx");
+testError("[abc", "Unfinished character set in RegEx");
+testError("*a", "Nothing to repeat in RegEx");
+testError("a{3,2}", "Numbers out of order in RegEx quantifier");
+// catastrophic backtracking runs out of steps rather than locking up
+tests++;
+try {
+  /^(a|aa)*$/.test("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab");
+  console.log("Test "+tests+" failed - no error");
+} catch (e) {
+  if (e.message=="RegEx too complex") testsPass++;
+}
+// long strings
+var big = "";
+for (var i=0;i<500;i++) big += "word"+i+" ";
+test(big.replace(/\d+/g,"").length, 500*5);
+test(big.split(/ /).length, 501);
+test(big.match(/word\d+/g).length, 500);
+test(/zzz/.test(big), false);
+test(/word499/.exec(big).index, big.indexOf("word499"));
+test(/(\w+\s)*$/.test(big), true);
+
+result = tests==testsPass;
@@ -0,0 +1,73 @@
+// Storage is compacted a slice at a time when idle, and files are all still correct (even if we write or compact while it's in progress)
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" failed: "+msg+" ("+a+" vs "+b+")");
+}
+
+var s = require("Storage");
+s.eraseAll();
+test(E.getFlags().compactSliceTime>0, true, "compactSliceTime flag");
+E.setFlags({compactSliceTime:0.01}); // really short slices, so we stop after almost every file
+var expect = {};
+function check(msg) {
+  var l = s.list();
+  test(l.length, Object.keys(expect).length, msg+" count");
+  var ok = true;
+  Object.keys(expect).forEach(function(f) { if (s.read(f)!==expect[f]) ok = false; });
+  test(ok, true, msg+" contents");
+}
+
+var data = "";
+for (var i=0;i<100;i++) data += "0123456789";
+// fill Storage, then erase most of it so there's more trash than free space
+function fill(prefix) {
+  for (var i=0;i<200;i++) {
+    expect[prefix+i] = i+data;
+    s.write(prefix+i, i+data);
+  }
+  for (var i=0;i<200;i++) if (i%4) {
+    delete expect[prefix+i];
+    s.erase(prefix+i);
+  }
+  var st = s.getStats();
+  test(st.trashBytes > st.freeBytes, true, prefix+" more trash than free");
+}
+
+fill("f");
+var ticks = 0;
+var iv = setInterval(function() {
+  ticks++;
+  // write while compaction is in progress
+  if (ticks==1) {
+    expect.during = "written during compaction";
+    s.write("during", expect.during);
+  }
+  if (ticks==2) {
+    s.writeJSON("during.json", {a:1});
+    s.writeJSON("during.json", {a:2});
+    expect["during.json"] = '{a:2}';
+    s.erase("f0");
+    delete expect.f0;
+  }
+  if (ticks==3) check("during compaction");
+  if (ticks<4) return;
+  var st = s.getStats();
+  // While compaction is paused, what's left to do shows up as one big erased file
+  if (st.trashBytes < st.freeBytes || ticks>2000) {
+    clearInterval(iv);
+    test(st.trashBytes < 2000, true, "compacted"); // f0 may have been erased after it was moved
+    check("after compaction");
+    // now fill again, and compact all at once while compaction is in progress
+    fill("g");
+    setTimeout(function() {
+      s.compact();
+      test(s.getStats().trashBytes, 0, "compacted all at once");
+      check("after compact()");
+      s.eraseAll();
+      E.setFlags({compactSliceTime:5});
+      result = tests==testsPass;
+    }, 1);
+  }
+}, 5);
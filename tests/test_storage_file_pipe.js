@@ -0,0 +1,30 @@
+// StorageFile read/readLine work across chunks, and piping a StorageFile to Serial or a stream sends everything
+var s = require("Storage");
+s.eraseAll();
+var content = "";
+var f = s.open("log","w");
+for (var i=0;i<200;i++) {
+  var l = "line "+i+" of the log file\n";
+  content += l;
+  f.write(l);
+}
+var r = s.open("log","r");
+var str = "", d;
+while ((d = r.read(100))!==undefined) str += d;
+var readOk = str==content;
+r = s.open("log","r");
+var lines = [], line;
+while ((line = r.readLine())!==undefined) lines.push(line);
+var readLineOk = lines.length==200 && lines.join("")==content && lines[150]=="line 150 of the log file\n";
+// big reads across chunks
+var bigReadOk = s.open("log","r").read(100000)==content;
+
+var serial = "", stream = "", done = 0;
+LoopbackB.on('data', function(d) { serial += d; });
+s.open("log","r").pipe(LoopbackA, {chunkSize:100, complete:function() { done++; }});
+s.open("log","r").pipe({ write : function(d) { stream += d; } }, {complete:function() { done++; }});
+
+setTimeout(function() {
+  result = readOk && readLineOk && bigReadOk && done==2 && serial==content && stream==content;
+  s.eraseAll();
+}, 200);
@@ -0,0 +1,69 @@
+// Storage finds and lists files correctly as they're written, erased and moved by compaction
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" failed: "+msg+" ("+a+" vs "+b+")");
+}
+
+var s = require("Storage");
+s.eraseAll();
+var expect = {};
+function check(msg) {
+  var l = s.list();
+  test(l.length, Object.keys(expect).length, msg+" count");
+  var ok = true;
+  l.forEach(function(f) { if (s.read(f)!==expect[f]) ok = false; });
+  Object.keys(expect).forEach(function(f) { if (s.read(f)!==expect[f]) ok = false; });
+  test(ok, true, msg+" contents");
+}
+
+for (var i=0;i<100;i++) {
+  expect["f"+i] = "data"+i;
+  s.write("f"+i, "data"+i);
+}
+check("written");
+// rewrite and erase some, so there's trash to compact
+for (var i=0;i<100;i+=3) {
+  expect["f"+i] = "new"+i+"!";
+  s.write("f"+i, "new"+i+"!");
+}
+for (var i=1;i<100;i+=5) {
+  delete expect["f"+i];
+  s.erase("f"+i);
+}
+test(s.read("f1"), undefined, "erased");
+check("rewritten");
+// list order should be storage order, so a new file goes at the end
+s.write("last", "x");
+expect.last = "x";
+var l = s.list();
+test(l[l.length-1], "last", "order");
+var h = s.hash();
+s.compact();
+check("compacted");
+test(s.hash()!=h, true, "hash changes when files move");
+// StorageFile
+var f = s.open("log","w");
+f.write("hello ");
+f.write("world");
+test(s.open("log","r").read(100), "hello world", "StorageFile");
+test(s.list(undefined,{sf:true}).indexOf("log")>=0, true, "StorageFile listed");
+f.erase();
+// More files than the index can hold - we must fall back to scanning
+for (var i=0;i<400;i++) {
+  expect["g"+i] = ""+i;
+  s.write("g"+i, ""+i);
+}
+check("lots of files");
+for (var i=0;i<400;i++) {
+  delete expect["g"+i];
+  s.erase("g"+i);
+}
+s.compact();
+check("after lots of files");
+s.eraseAll();
+test(s.list().length, 0, "erased all");
+test(s.read("f0"), undefined, "erased all read");
+
+result = tests==testsPass;
@@ -0,0 +1,70 @@
+// Storage.writeJSON only writes what changed, and files read back correctly after changes and compaction
+var tests=0,testsPass=0;
+function test(a,b,msg) {
+  tests++;
+  if (a===b) testsPass++;
+  else console.log("Test "+tests+" failed: "+msg+" ("+a+" vs "+b+")");
+}
+
+var s = require("Storage");
+s.eraseAll();
+var settings = { name : "test", brightness : 5, list : [1,2,3], nested : { a : "hello", b : true } };
+s.writeJSON("settings.json", settings);
+test(JSON.stringify(s.readJSON("settings.json")), JSON.stringify(settings), "first write");
+var used = s.getStats().fileBytes;
+for (var i=0;i<20;i++) {
+  settings.brightness = i;
+  s.writeJSON("settings.json", settings);
+  test(s.readJSON("settings.json").brightness, i, "change "+i);
+}
+// The changes went in the same file
+test(s.getStats().trashCount, 0, "no new files");
+test(s.getStats().fileBytes, used, "no more space used");
+for (var i=0;i<10;i++) {
+  if (i&1) settings.list.push(i); else settings.name += "x";
+  s.writeJSON("settings.json", settings);
+  test(JSON.stringify(s.readJSON("settings.json")), JSON.stringify(settings), "structure change "+i);
+}
+// reading part of the file
+var str = s.read("settings.json");
+test(s.read("settings.json", 3, 10), str.substr(3,10), "read part");
+// writing the same thing again doesn't change it
+var stats = s.getStats();
+s.writeJSON("settings.json", settings);
+test(s.read("settings.json"), str, "same");
+test(s.getStats().freeBytes, stats.freeBytes, "same - nothing written");
+// a small normal file with the same contents isn't rewritten either
+s.write("plain.json", JSON.stringify([1,2,3]));
+stats = s.getStats();
+s.writeJSON("plain.json", [1,2,3]);
+test(s.getStats().freeBytes, stats.freeBytes, "same normal file - nothing written");
+s.erase("plain.json");
+// getting shorter and empty
+s.writeJSON("settings.json", {});
+test(s.read("settings.json"), "{}", "shorter");
+s.writeJSON("settings.json", settings);
+test(JSON.stringify(s.readJSON("settings.json")), JSON.stringify(settings), "longer again");
+// Fill the journal up so we have to write a new file
+for (var i=0;i<50;i++) {
+  settings.brightness = i*1000;
+  s.writeJSON("settings.json", settings);
+}
+test(s.readJSON("settings.json").brightness, 49000, "after journal full");
+test(s.getStats().trashCount>0, true, "journal rewritten");
+// Compaction should keep the contents (while checkpointing the journal)
+s.write("other", "12345");
+settings.brightness = 1;
+s.writeJSON("settings.json", settings);
+s.compact();
+test(JSON.stringify(s.readJSON("settings.json")), JSON.stringify(settings), "after compact");
+test(s.read("other"), "12345", "other file after compact");
+settings.brightness = 2;
+s.writeJSON("settings.json", settings);
+test(JSON.stringify(s.readJSON("settings.json")), JSON.stringify(settings), "change after compact");
+// Writing normally replaces the journal with a normal file
+s.write("settings.json", "normal");
+test(s.read("settings.json"), "normal", "normal file");
+test(s.list().length, 2, "file count");
+
+s.eraseAll();
+result = tests==testsPass;
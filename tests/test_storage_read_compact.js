@@ -0,0 +1,22 @@
+// Strings read from Storage still have the right contents after compaction moves their files
+var s = require("Storage");
+s.eraseAll();
+var strs = [];
+for (var i=0;i<20;i++) {
+  s.write("f"+i, "file "+i+" contents");
+  s.write("x"+i, "erase me");
+}
+for (var i=0;i<20;i++) {
+  strs.push(s.read("f"+i));
+  s.erase("x"+i);
+}
+s.compact();
+var ok = true;
+for (var i=0;i<20;i++) {
+  if (strs[i]!="file "+i+" contents") ok = false;
+  if (s.read("f"+i)!=strs[i]) ok = false;
+}
+// write a file using data read from Storage
+s.write("copy", s.read("f3")+"!");
+result = ok && s.read("copy")=="file 3 contents!";
+s.eraseAll();
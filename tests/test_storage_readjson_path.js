@@ -0,0 +1,69 @@
+// Storage.readJSON with a path only parses the value at that path
+var tests=0,testsPass=0;
+function test(a,b) {
+  tests++;
+  a = JSON.stringify(a);
+  b = JSON.stringify(b);
+  if (a==b) testsPass++;
+  else console.log("Test "+tests+" failed: "+a+" != "+b);
+}
+
+var s = require("Storage");
+s.eraseAll();
+var data = {
+  version : 2,
+  "odd\"key" : "a string with [brackets] and {braces} and \"quotes\" and \\ \n",
+  apps : [],
+  10 : "ten",
+  empty : {}, none : []
+};
+for (var i=0;i<10;i++) data.apps.push({ id:"app"+i, name:"App "+i, files:["a"+i+".js", "b"+i+".js"], size:i*100 });
+s.writeJSON("apps.json", data);
+
+test(s.readJSON("apps.json", ["apps",3,"name"]), "App 3");
+test(s.readJSON("apps.json", ["apps","3","files",1]), "b3.js");
+test(s.readJSON("apps.json", ["apps",9]), data.apps[9]);
+test(s.readJSON("apps.json", ["odd\"key"]), data["odd\"key"]);
+test(s.readJSON("apps.json", [10]), "ten");
+test(s.readJSON("apps.json", ["version"]), 2);
+test(s.readJSON("apps.json", []), data);
+test(s.readJSON("apps.json", false, ["apps",0,"size"]), 0);
+// not there
+test(s.readJSON("apps.json", ["apps",10]), undefined);
+test(s.readJSON("apps.json", ["apps",-1]), undefined);
+test(s.readJSON("apps.json", ["apps","x"]), undefined);
+test(s.readJSON("apps.json", ["nope"]), undefined);
+test(s.readJSON("apps.json", ["version","x"]), undefined);
+test(s.readJSON("apps.json", ["empty","x"]), undefined);
+test(s.readJSON("apps.json", ["none",0]), undefined);
+test(s.readJSON("nofile.json", ["apps"]), undefined);
+
+// standard JSON, comments, single quotes, whitespace
+s.write("std.json", '{ "a" : [ 1, /* c */ 2, "x]\\"y" ] , // comment\n \'b\' : { "c" : [[1,2],[3,4]] } }');
+test(s.readJSON("std.json", ["b","c",1,0]), 3);
+test(s.readJSON("std.json", ["a",2]), "x]\"y");
+
+// errors before the value are reported, errors after it aren't
+s.write("bad.json", '{ "a" : [1,2,, "b" : 2 }');
+var err;
+try { s.readJSON("bad.json", ["b"]); } catch (e) { err = e.toString(); }
+test(err, "SyntaxError: Got EOF expected ','"); // skipped values only have their brackets matched
+test(s.readJSON("bad.json", true, ["b"]), undefined);
+s.write("bad.json", '{ "a" : [1,2], "b" : 2, "c" : }');
+test(s.readJSON("bad.json", ["b"]), 2);
+s.write("bad.json", '{ "a" : "unfinished }');
+err = undefined;
+try { s.readJSON("bad.json", ["b"]); } catch (e) { err = e.toString(); }
+test(err, "SyntaxError: Expecting valid value, got UNFINISHED STRING");
+
+// Only the selected value is loaded
+var big = { list : [], last : "found" };
+for (var i=0;i<500;i++) big.list.push({ i:i, s:"some text to make this bigger" });
+s.writeJSON("big.json", big);
+var m = process.memory().usage;
+var v = s.readJSON("big.json", ["last"]);
+test(process.memory().usage - m < 10, true);
+test(v, "found");
+
+result = tests==testsPass;
+s.eraseAll();
@@ -0,0 +1,94 @@
+// Building strings with +=, template literals and Array.join
+var tests=0,testsPass=0;
+function test(a,b) {
+  tests++;
+  if (a==b) testsPass++;
+  else console.log("Test "+tests+" failed: "+JSON.stringify(a).substr(0,100)+" != "+JSON.stringify(b).substr(0,100));
+}
+
+function expected(n, f) {
+  var r = [];
+  for (var i=0;i<n;i++) r.push(f(i));
+  return r.join("");
+}
+
+// += one char/line at a time
+var s = "";
+for (var i=0;i<500;i++) s += "X";
+test(s, "X".repeat(500));
+s = "";
+for (var i=0;i<300;i++) s += "line "+i+"\n";
+test(s, expected(300, function(i) { return "line "+i+"\n"; }));
+test(s.length, expected(300, function(i) { return "line "+i+"\n"; }).length);
+test(s.substr(s.length-9), "line 299\n");
+
+// appending to two strings in turn, so they keep swapping places as the last one appended to
+var a = "", b = "";
+for (var i=0;i<200;i++) { a += "a"+i; b += "b"+i+","; }
+test(a, expected(200, function(i) { return "a"+i; }));
+test(b, expected(200, function(i) { return "b"+i+","; }));
+
+// reading and changing the string between appends
+s = "";
+for (var i=0;i<100;i++) {
+  s += "abc";
+  if (s[s.length-1]!="c" || s.length!=(i+1)*3) break;
+}
+test(s, "abc".repeat(100));
+s = s.substr(0,10);
+s += "def";
+test(s, "abcabcabcadef");
+
+// free the string while it's in the cache, and make new ones that may reuse its vars
+for (var j=0;j<5;j++) {
+  s = "";
+  for (var i=0;i<100;i++) s += "x"+j;
+  test(s, ("x"+j).repeat(100));
+  s = undefined;
+  E.getSizeOf(global); // allocate/free a bit
+}
+s = "";
+for (var i=0;i<100;i++) {
+  s += "y";
+  if (i==50) process.memory(); // garbage collect
+}
+test(s, "y".repeat(100));
+// vars moving while we append
+if (E.defrag) {
+  var junk = [];
+  for (var i=0;i<200;i++) junk.push("junk"+i);
+  s = "";
+  for (var i=0;i<300;i++) {
+    s += "ab";
+    if (i==100) { junk = undefined; E.defrag(); }
+  }
+  test(s, "ab".repeat(300));
+}
+// string used as an object key (its StringExts get shuffled to make room for the value)
+var k = "";
+for (var i=0;i<40;i++) k += "k";
+var o = {};
+o[k] = 1;
+k += "z";
+test(k, "k".repeat(40)+"z");
+test(Object.keys(o)[0], "k".repeat(40));
+
+// template literals
+var long = "0123456789".repeat(30);
+test(`${long}`, long);
+test(`<a>${long}</a>${1+2}$x{${"y"}}$`, "<a>"+long+"</a>3$x{y}$");
+test(`${"a"}${"b"}`, "ab");
+test(`$`, "$");
+test(`x${ {a:1}.a }y`, "x1y");
+var t = "";
+for (var i=0;i<20;i++) t += `[${i}:${long}]`;
+test(t, expected(20, function(i) { return "["+i+":"+long+"]"; }));
+
+// Array.join
+var arr = [];
+for (var i=0;i<300;i++) arr.push("item "+i);
+test(arr.join(", "), expected(300, function(i) { return (i?", ":"")+"item "+i; }));
+test([long,long,null,1].join(long), long.repeat(5)+"1");
+test([E.toString([65,66,67]), "é".repeat(40)].join("-"), "ABC-"+"é".repeat(40));
+
+result = tests==testsPass;
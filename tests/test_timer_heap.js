@@ -0,0 +1,60 @@
+// Timers fire in time order (same time = order added), and clear/change works
+var order = [];
+setTimeout(function() { order.push("c"); }, 30);
+setTimeout(function() { order.push("a"); }, 10);
+var cleared = setTimeout(function() { order.push("X"); }, 15);
+setTimeout(function() { order.push("b1"); }, 20);
+setTimeout(function() { order.push("b2"); }, 20);
+clearTimeout(cleared);
+
+var ticks = 0;
+var iv = setInterval(function() {
+  ticks++;
+  if (ticks==2) changeInterval(iv, 5);
+  if (ticks==4) clearInterval(iv); // clear while it's executing
+}, 8);
+
+var n = 0;
+var self = setTimeout(function() {
+  n++;
+  clearTimeout(self); // already running, so this should do nothing bad
+}, 12);
+
+// many timers, added in reverse order of when they fire
+var fired = [];
+for (var i=50;i>0;i--) setTimeout(function(i) { fired.push(i); }, 40+i, i);
+
+// cancel every other timer - the rest still fire in order, cancelled ones never do
+// (done from a timer, so the heap has been built)
+var kept = [], memGrowth;
+setTimeout(function() {
+  var ids = [];
+  for (var i=0;i<40;i++) ids.push(setTimeout(function(i) { kept.push(i); }, 60+i, i));
+  for (var i=1;i<40;i+=2) clearTimeout(ids[i]);
+  // cancelling and re-adding the same timer shouldn't keep using memory (cancelled
+  // timers are freed in a sweep once they're half the heap, so some are still around)
+  var churn = setTimeout(function() {}, 1000);
+  var memBefore = process.memory().usage;
+  for (var i=0;i<200;i++) {
+    clearTimeout(churn);
+    churn = setTimeout(function() {}, 1000);
+  }
+  memGrowth = process.memory().usage - memBefore;
+}, 2);
+
+var dumped = "";
+setTimeout(function() {
+  dumped = E.dumpStr();
+}, 1);
+setTimeout(function() {}, 500);
+
+setTimeout(function() {
+  var inOrder = true;
+  for (var i=0;i<fired.length;i++) if (fired[i]!=i+1) inOrder = false;
+  result = order.join(",")=="a,b1,b2,c" && ticks==4 && n==1 &&
+           fired.length==50 && inOrder &&
+           kept.length==20 && kept.every(function(k,i) { return k==i*2; }) &&
+           memGrowth < 400 &&
+           /setTimeout\(function \(\) \{\}, 49\d\.\d+\)/.test(dumped);
+  clearTimeout();
+}, 150);